@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# -----------------------------------------------------------------------------
+# Runs the iad_bench suite against the host build of iad, with the mock IMP
+# backend playing the audio device in real time. The daemon gets a copy of
+# config/iad.json with enough input client slots for the fan-out steps.
+# Results are written as JSON to the file given as the first argument; the
+# daemon's config and log go to build/host/bench/, which git ignores.
+# -----------------------------------------------------------------------------
+
+set -e
+set -o pipefail
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+HOST_DIR="${SCRIPT_DIR}/../build/host"
+BENCH_DIR="${HOST_DIR}/bench"
+OUTPUT="${1:-${BENCH_DIR}/bench.json}"
+CONFIG="${BENCH_DIR}/iad.json"
+LOG="${BENCH_DIR}/iad.log"
+PID_FILE="/tmp/iad.pid"
+
+mkdir -p "$BENCH_DIR"
+sed -e 's/"max_input_clients": *[0-9]*/"max_input_clients": 40/' "${SCRIPT_DIR}/../config/iad.json" > "$CONFIG"
+
+IAD_MOCK_AI=sine IAD_MOCK_AO=null IAD_MOCK_SPEED=1 "${HOST_DIR}/bin/iad" -c "$CONFIG" > "$LOG" 2>&1 &
+IAD_PID=$!
+trap 'kill $IAD_PID 2>/dev/null; wait $IAD_PID 2>/dev/null || true' EXIT
+
+# Wait for the daemon to open its sockets
+for i in $(seq 50); do
+    if [ -f "$PID_FILE" ] && [ "$(cat "$PID_FILE")" = "$IAD_PID" ]; then
+        break
+    fi
+    if ! kill -0 $IAD_PID 2>/dev/null; then
+        echo "iad exited, see $LOG"
+        exit 1
+    fi
+    sleep 0.1
+done
+sleep 0.5
+
+"${HOST_DIR}/bin/iad_bench" -p "$PID_FILE" -o "$OUTPUT"
+echo "Benchmark results written to $OUTPUT"
@@ -0,0 +1,191 @@
+/*
+ * AI FRAME JITTER BENCHMARK
+ *
+ * Measures how regularly the daemon delivers capture frames. Frames are read
+ * from the input socket and the arrival time of each one is compared with the
+ * nominal frame period. Optional CPU hog processes spin at normal priority,
+ * standing in for the video encoder, to show what the audio threads' real-time
+ * scheduling buys: run once with the default SCHED_FIFO settings and once with
+ * "thread_policy": "SCHED_OTHER" to compare.
+ */
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AUDIO_INPUT_SOCKET_PATH "ingenic_audio_input"
+#define DEFAULT_FRAME_BYTES 1280    // 40 ms of 16 kHz mono 16-bit audio
+#define DEFAULT_FRAME_PERIOD_US 40000
+#define DEFAULT_FRAMES 250
+#define MAX_HOGS 16
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connect_socket(const char *name) {
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(&addr.sun_path[1], name, sizeof(addr.sun_path) - 2);
+
+    if (connect(sockfd, (struct sockaddr*)&addr, sizeof(sa_family_t) + strlen(name) + 1) == -1) {
+        perror("connect");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+// Reads exactly one frame. Returns 0 on success.
+static int read_frame(int sockfd, unsigned char *buf, size_t frame_bytes) {
+    size_t received = 0;
+    while (received < frame_bytes) {
+        ssize_t n = read(sockfd, buf + received, frame_bytes - received);
+        if (n <= 0) {
+            return -1;
+        }
+        received += n;
+    }
+    return 0;
+}
+
+static void start_hogs(pid_t *hogs, int count) {
+    for (int i = 0; i < count; i++) {
+        hogs[i] = fork();
+        if (hogs[i] == 0) {
+            volatile unsigned long spin = 0;
+            while (1) {
+                spin++;
+            }
+        }
+    }
+}
+
+static void stop_hogs(pid_t *hogs, int count) {
+    for (int i = 0; i < count; i++) {
+        if (hogs[i] > 0) {
+            kill(hogs[i], SIGKILL);
+            waitpid(hogs[i], NULL, 0);
+        }
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, int pct) {
+    int index = (count * pct) / 100;
+    return sorted[index < count ? index : count - 1];
+}
+
+static void print_stats(const char *name, double *values, int count) {
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    qsort(values, count, sizeof(double), compare_double);
+    printf("%-22s min %8.0f  avg %8.0f  p95 %8.0f  p99 %8.0f  max %8.0f us\n", name,
+           values[0], sum / count, percentile(values, count, 95), percentile(values, count, 99), values[count - 1]);
+}
+
+int main(int argc, char *argv[]) {
+    int frames = DEFAULT_FRAMES;
+    int frame_bytes = DEFAULT_FRAME_BYTES;
+    int period_us = DEFAULT_FRAME_PERIOD_US;
+    int hog_count = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:p:l:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                frames = atoi(optarg);
+                break;
+            case 'f':
+                frame_bytes = atoi(optarg);
+                break;
+            case 'p':
+                period_us = atoi(optarg);
+                break;
+            case 'l':
+                hog_count = atoi(optarg);
+                break;
+            default:
+                printf("Usage: %s [-n frames] [-f frame_bytes] [-p period_us] [-l cpu_hogs]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (frames < 2) {
+        frames = 2;
+    }
+    if (frame_bytes < 1 || period_us < 1) {
+        fprintf(stderr, "Frame size and period must be positive\n");
+        return 1;
+    }
+    if (hog_count < 0 || hog_count > MAX_HOGS) {
+        fprintf(stderr, "Between 0 and %d CPU hogs are supported\n", MAX_HOGS);
+        return 1;
+    }
+
+    int sockfd = connect_socket(AUDIO_INPUT_SOCKET_PATH);
+    if (sockfd < 0) {
+        return 1;
+    }
+
+    unsigned char *buf = malloc(frame_bytes);
+    double *interval_us = calloc(frames - 1, sizeof(double));
+    double *deviation_us = calloc(frames - 1, sizeof(double));
+    pid_t hogs[MAX_HOGS] = {0};
+
+    // Settle on the first frame so the connection setup isn't measured
+    if (read_frame(sockfd, buf, frame_bytes)) {
+        fprintf(stderr, "No audio from the daemon\n");
+        return 1;
+    }
+    start_hogs(hogs, hog_count);
+
+    int received = 0;
+    double previous = now_us();
+    for (int i = 0; i < frames - 1; i++) {
+        if (read_frame(sockfd, buf, frame_bytes)) {
+            fprintf(stderr, "Input stream ended after %d frames\n", i + 1);
+            break;
+        }
+        double now = now_us();
+        interval_us[i] = now - previous;
+        deviation_us[i] = interval_us[i] > period_us ? interval_us[i] - period_us : period_us - interval_us[i];
+        previous = now;
+        received++;
+    }
+
+    stop_hogs(hogs, hog_count);
+    close(sockfd);
+
+    if (received > 0) {
+        printf("AI frame delivery, %d frames of %d bytes, %d CPU hogs\n", received, frame_bytes, hog_count);
+        print_stats("frame interval", interval_us, received);
+        print_stats("deviation from period", deviation_us, received);
+    }
+
+    free(buf);
+    free(interval_us);
+    free(deviation_us);
+    return received > 0 ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+/*
+ * AO STREAM SWITCH BENCHMARK
+ *
+ * Measures how quickly the daemon hands the AO channel from one output client
+ * to the next. A second client is always waiting while the first plays a short
+ * burst; the time from the first client's "drained" acknowledgement to the
+ * second client's "admitted" line and to its first credit grant is recorded.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AUDIO_OUTPUT_SOCKET_PATH "ingenic_audio_output"
+#define AUDIO_CONTROL_SOCKET_PATH "ingenic_audio_control"
+#define AUDIO_CREDIT_HELLO "IADC"
+#define AUDIO_CREDIT_HELLO_LEN 4
+#define BURST_BYTES 1280
+#define DEFAULT_ITERATIONS 20
+
+typedef struct {
+    int sockfd;
+    char line[128];
+    size_t line_len;
+} BenchStream;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connect_socket(const char *name) {
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(&addr.sun_path[1], name, sizeof(addr.sun_path) - 2);
+
+    if (connect(sockfd, (struct sockaddr*)&addr, sizeof(sa_family_t) + strlen(name) + 1) == -1) {
+        perror("connect");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+// Reads status lines until one starts with the given prefix. Returns 0 if found.
+static int wait_for_line(BenchStream *stream, const char *prefix) {
+    size_t prefix_len = strlen(prefix);
+
+    while (1) {
+        char *newline = memchr(stream->line, '\n', stream->line_len);
+        if (!newline) {
+            if (stream->line_len == sizeof(stream->line)) {
+                stream->line_len = 0;
+            }
+            ssize_t n = read(stream->sockfd, stream->line + stream->line_len, sizeof(stream->line) - stream->line_len);
+            if (n <= 0) {
+                return -1;
+            }
+            stream->line_len += n;
+            continue;
+        }
+
+        *newline = '\0';
+        int found = strncmp(stream->line, prefix, prefix_len) == 0;
+        size_t consumed = newline - stream->line + 1;
+        memmove(stream->line, stream->line + consumed, stream->line_len - consumed);
+        stream->line_len -= consumed;
+        if (found) {
+            return 0;
+        }
+    }
+}
+
+static int open_stream(BenchStream *stream) {
+    memset(stream, 0, sizeof(*stream));
+    stream->sockfd = connect_socket(AUDIO_OUTPUT_SOCKET_PATH);
+    if (stream->sockfd < 0) {
+        return -1;
+    }
+    if (write(stream->sockfd, AUDIO_CREDIT_HELLO, AUDIO_CREDIT_HELLO_LEN) != AUDIO_CREDIT_HELLO_LEN) {
+        close(stream->sockfd);
+        return -1;
+    }
+    return 0;
+}
+
+static long query_daemon_switch_us(void) {
+    int sockfd = connect_socket(AUDIO_CONTROL_SOCKET_PATH);
+    if (sockfd < 0) {
+        return -1;
+    }
+    const char *request = "GET ao_switch_latency_us";
+    char reply[32] = {0};
+    long value = -1;
+    if (write(sockfd, request, strlen(request)) > 0 && read(sockfd, reply, sizeof(reply) - 1) > 0) {
+        value = atol(reply);
+    }
+    close(sockfd);
+    return value;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_stats(const char *name, double *values, int count) {
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    qsort(values, count, sizeof(double), compare_double);
+    printf("%-22s min %8.0f  avg %8.0f  p95 %8.0f  max %8.0f us\n", name,
+           values[0], sum / count, values[(count * 95) / 100 < count ? (count * 95) / 100 : count - 1], values[count - 1]);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = DEFAULT_ITERATIONS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            default:
+                printf("Usage: %s [-n iterations]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (iterations < 1) {
+        iterations = 1;
+    }
+
+    double *admit_us = calloc(iterations, sizeof(double));
+    double *ready_us = calloc(iterations, sizeof(double));
+    double *daemon_us = calloc(iterations, sizeof(double));
+    unsigned char burst[BURST_BYTES] = {0};
+
+    BenchStream current, next;
+    if (open_stream(&current) || wait_for_line(&current, "admitted") || wait_for_line(&current, "credit")) {
+        fprintf(stderr, "Failed to start the first stream\n");
+        return 1;
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        if (open_stream(&next)) {
+            return 1;
+        }
+
+        // Play a short burst on the current stream and wait for it to drain
+        if (write(current.sockfd, burst, sizeof(burst)) != sizeof(burst)) {
+            perror("write");
+            return 1;
+        }
+        shutdown(current.sockfd, SHUT_WR);
+        if (wait_for_line(&current, "drained")) {
+            fprintf(stderr, "Stream %d did not drain\n", i);
+            return 1;
+        }
+        double drained = now_us();
+
+        if (wait_for_line(&next, "admitted")) {
+            fprintf(stderr, "Stream %d was not admitted\n", i + 1);
+            return 1;
+        }
+        admit_us[i] = now_us() - drained;
+
+        if (wait_for_line(&next, "credit")) {
+            fprintf(stderr, "Stream %d got no credit\n", i + 1);
+            return 1;
+        }
+        ready_us[i] = now_us() - drained;
+        daemon_us[i] = query_daemon_switch_us();
+
+        close(current.sockfd);
+        current = next;
+    }
+
+    shutdown(current.sockfd, SHUT_WR);
+    wait_for_line(&current, "drained");
+    close(current.sockfd);
+
+    printf("AO stream switch, %d iterations\n", iterations);
+    print_stats("drained -> admitted", admit_us, iterations);
+    print_stats("drained -> first credit", ready_us, iterations);
+    print_stats("daemon switch", daemon_us, iterations);
+
+    free(admit_us);
+    free(ready_us);
+    free(daemon_us);
+    return 0;
+}
@@ -0,0 +1,604 @@
+/*
+ * IAD BENCHMARK SUITE
+ *
+ * Runs a fixed set of load steps against a running daemon and writes the
+ * results as JSON, so runs can be compared to catch regressions:
+ *
+ *   fanout   1 to 32 capture subscribers reading at full speed, plus slow
+ *            subscribers that read at half the stream rate. Reports the
+ *            throughput each client gets and the daemon's CPU use.
+ *   playback 1 to 4 concurrent output writers, each sending a stream and
+ *            waiting for "drained". Reports throughput, admission waits
+ *            and the time from a stream's last byte to its last sample.
+ *   control  GET requests back to back on one connection for a fixed time.
+ *   memory   Resident memory and threads after the run, and the heap
+ *            allocations the daemon made while under load.
+ *
+ * `make host-bench` runs it against the host build with the mock IMP backend.
+ * On a camera, run it on the device while iad is running; the daemon needs
+ * max_input_clients of at least 32 plus the slow subscribers.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AUDIO_INPUT_SOCKET_PATH "ingenic_audio_input"
+#define AUDIO_OUTPUT_SOCKET_PATH "ingenic_audio_output"
+#define AUDIO_CONTROL_SOCKET_PATH "ingenic_audio_control"
+#define DEFAULT_PID_FILE "/var/run/iad.pid"
+#define DEFAULT_STEP_SECONDS 3
+#define DEFAULT_SAMPLE_RATE 16000
+#define DEFAULT_SLOW_CLIENTS 1
+#define MAX_SUBSCRIBERS 40
+#define MAX_WRITERS 4
+#define WRITER_AUDIO_MS 1000
+#define WRITER_SNDBUF 4096
+#define READ_CHUNK 65536
+#define MAX_CONTROL_SAMPLES 100000
+
+static const int fanout_steps[] = {1, 2, 4, 8, 16, 32};
+static const int playback_steps[] = {1, 2, 4};
+
+typedef struct {
+    int sockfd;
+    int slow;
+    unsigned long long received;
+} Subscriber;
+
+typedef struct {
+    int sockfd;
+    size_t sent;
+    int shut;                // Whole stream written and half-closed
+    int done;                // "drained" received, or the stream failed
+    double admitted_us;
+    double shut_us;
+    double drained_us;
+    char line[128];
+    size_t line_len;
+} Writer;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connect_socket(const char *name) {
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(&addr.sun_path[1], name, sizeof(addr.sun_path) - 2);
+
+    if (connect(sockfd, (struct sockaddr*)&addr, sizeof(sa_family_t) + strlen(name) + 1) == -1) {
+        perror("connect");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+// Sends one control request and reads its reply line. Returns the reply length or -1.
+static int control_request(int sockfd, const char *request, char *reply, size_t size) {
+    char line[128];
+    int len = snprintf(line, sizeof(line), "%s\n", request);
+    if (write(sockfd, line, len) != len) {
+        return -1;
+    }
+
+    size_t received = 0;
+    while (received < size - 1) {
+        ssize_t n = read(sockfd, reply + received, size - 1 - received);
+        if (n <= 0) {
+            return -1;
+        }
+        received += n;
+        if (reply[received - 1] == '\n') {
+            break;
+        }
+    }
+    reply[received] = '\0';
+    return (int)received;
+}
+
+// One-shot control request on a fresh connection
+static int control_query(const char *request, char *reply, size_t size) {
+    int sockfd = connect_socket(AUDIO_CONTROL_SOCKET_PATH);
+    if (sockfd < 0) {
+        return -1;
+    }
+    int ret = control_request(sockfd, request, reply, size);
+    close(sockfd);
+    return ret;
+}
+
+static long query_long(const char *request) {
+    char reply[64];
+    return control_query(request, reply, sizeof(reply)) > 0 ? atol(reply) : -1;
+}
+
+// Returns the value following "<key>=" in a reply, or -1
+static long reply_value(const char *reply, const char *key) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "%s=", key);
+    const char *found = strstr(reply, pattern);
+    return found ? atol(found + strlen(pattern)) : -1;
+}
+
+/**
+ * Returns one field of a LATENCY stage, "<stage>=count,avg,p50,p99".
+ * @param field 0 for the count up to 3 for p99.
+ * @return The value, or -1 if the stage is missing or beyond the last bucket.
+ */
+static long reply_percentile(const char *reply, const char *stage, int field) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "%s=", stage);
+    const char *p = strstr(reply, pattern);
+    if (!p) {
+        return -1;
+    }
+    p += strlen(pattern);
+    for (int i = 0; i < field; i++) {
+        p = strchr(p, ',');
+        if (!p) {
+            return -1;
+        }
+        p++;
+    }
+    return strncmp(p, "inf", 3) == 0 ? -1 : atol(p);
+}
+
+// CPU time from /proc/<pid>/stat, which counts in clock ticks
+static double daemon_stat_cpu_seconds(int pid) {
+    char path[64], stat[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t len = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if (len <= 0) {
+        return -1;
+    }
+    stat[len] = '\0';
+
+    // utime and stime are fields 14 and 15; the command name may contain spaces
+    char *p = strrchr(stat, ')');
+    unsigned long utime, stime;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * CPU time the daemon has used so far, in seconds. Sums the nanosecond
+ * counters of every thread's schedstat, since a few seconds at the ticks of
+ * /proc/<pid>/stat can't resolve the daemon's load; falls back to those
+ * where the kernel has no schedstat.
+ */
+static double daemon_cpu_seconds(int pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+
+    double total = 0;
+    int found = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char task_path[300];
+        snprintf(task_path, sizeof(task_path), "/proc/%d/task/%s/schedstat", pid, entry->d_name);
+        FILE *f = fopen(task_path, "r");
+        unsigned long long ns;
+        if (f) {
+            if (fscanf(f, "%llu", &ns) == 1) {
+                total += ns / 1e9;
+                found = 1;
+            }
+            fclose(f);
+        }
+    }
+    closedir(dir);
+    return found ? total : daemon_stat_cpu_seconds(pid);
+}
+
+static int read_pid(const char *pid_file) {
+    FILE *f = fopen(pid_file, "r");
+    int pid = -1;
+    if (f) {
+        if (fscanf(f, "%d", &pid) != 1) {
+            pid = -1;
+        }
+        fclose(f);
+    }
+    return pid;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Connects the subscribers and reads for the step duration. Fast subscribers
+ * read whatever is there; slow ones are limited to half the stream rate.
+ */
+static void run_fanout_step(FILE *out, int fast, int slow, int seconds, int sample_rate, int pid, int last) {
+    Subscriber subs[MAX_SUBSCRIBERS];
+    struct pollfd fds[MAX_SUBSCRIBERS];
+    static unsigned char buf[READ_CHUNK];
+    int count = 0;
+
+    for (int i = 0; i < fast + slow && count < MAX_SUBSCRIBERS; i++) {
+        int sockfd = connect_socket(AUDIO_INPUT_SOCKET_PATH);
+        if (sockfd < 0) {
+            break;
+        }
+        subs[count].sockfd = sockfd;
+        subs[count].slow = i >= fast;
+        subs[count].received = 0;
+        count++;
+    }
+
+    double slow_bytes_per_us = sample_rate * 2 / 2 / 1e6;
+    double cpu_start = daemon_cpu_seconds(pid);
+    double start = now_us();
+    double end = start + seconds * 1e6;
+    double now;
+
+    while ((now = now_us()) < end) {
+        int nfds = 0;
+        for (int i = 0; i < count; i++) {
+            if (subs[i].sockfd < 0) {
+                continue;
+            }
+            if (subs[i].slow && subs[i].received >= (now - start) * slow_bytes_per_us) {
+                continue;
+            }
+            fds[nfds].fd = subs[i].sockfd;
+            fds[nfds].events = POLLIN;
+            nfds++;
+        }
+        if (poll(fds, nfds, 10) <= 0) {
+            continue;
+        }
+
+        for (int i = 0, f = 0; i < count && f < nfds; i++) {
+            if (subs[i].sockfd != fds[f].fd) {
+                continue;
+            }
+            if (fds[f].revents) {
+                size_t want = READ_CHUNK;
+                if (subs[i].slow) {
+                    double allowed = (now - start) * slow_bytes_per_us - subs[i].received;
+                    want = allowed < 1 ? 1 : allowed < READ_CHUNK ? (size_t)allowed : READ_CHUNK;
+                }
+                ssize_t n = read(subs[i].sockfd, buf, want);
+                if (n > 0) {
+                    subs[i].received += n;
+                } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    close(subs[i].sockfd);
+                    subs[i].sockfd = -1;
+                }
+            }
+            f++;
+        }
+    }
+
+    double elapsed = (now_us() - start) / 1e6;
+    double cpu = daemon_cpu_seconds(pid) - cpu_start;
+    double fast_min = -1, fast_max = 0, slow_total = 0, total = 0;
+    int connected = 0;
+    for (int i = 0; i < count; i++) {
+        double bps = subs[i].received / elapsed;
+        total += bps;
+        if (subs[i].slow) {
+            slow_total += bps;
+        } else {
+            fast_min = fast_min < 0 || bps < fast_min ? bps : fast_min;
+            fast_max = bps > fast_max ? bps : fast_max;
+        }
+        if (subs[i].sockfd >= 0) {
+            connected++;
+            close(subs[i].sockfd);
+        }
+    }
+
+    fprintf(out, "    {\"subscribers\": %d, \"slow_subscribers\": %d, \"connected_at_end\": %d, "
+                 "\"client_bps_min\": %.0f, \"client_bps_max\": %.0f, \"slow_client_bps\": %.0f, "
+                 "\"total_bps\": %.0f, \"daemon_cpu_percent\": %.1f}%s\n",
+            fast, slow, connected, fast_min < 0 ? 0 : fast_min, fast_max, slow > 0 ? slow_total / slow : 0,
+            total, pid > 0 && cpu_start >= 0 ? cpu * 100 / elapsed : -1, last ? "" : ",");
+    fflush(out);
+}
+
+// Handles the status lines the daemon sends to an output client
+static void writer_read_status(Writer *writer) {
+    ssize_t n = read(writer->sockfd, writer->line + writer->line_len, sizeof(writer->line) - writer->line_len);
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            writer->done = 1;
+        }
+        return;
+    }
+    writer->line_len += n;
+
+    char *newline;
+    while ((newline = memchr(writer->line, '\n', writer->line_len)) != NULL) {
+        *newline = '\0';
+        if (strcmp(writer->line, "admitted") == 0) {
+            writer->admitted_us = now_us();
+        } else if (strcmp(writer->line, "drained") == 0) {
+            writer->drained_us = now_us();
+            writer->done = 1;
+        } else if (strcmp(writer->line, "timeout") == 0) {
+            writer->done = 1;
+        }
+        size_t consumed = newline - writer->line + 1;
+        memmove(writer->line, writer->line + consumed, writer->line_len - consumed);
+        writer->line_len -= consumed;
+    }
+    if (writer->line_len == sizeof(writer->line)) {
+        writer->line_len = 0;
+    }
+}
+
+/**
+ * Opens the writers at once and streams WRITER_AUDIO_MS of audio through each.
+ * The small send buffer keeps the writer close to the daemon's read position,
+ * so the time from the last byte to "drained" is the playback path's latency.
+ */
+static void run_playback_step(FILE *out, int writer_count, int sample_rate, int last) {
+    Writer writers[MAX_WRITERS];
+    struct pollfd fds[MAX_WRITERS];
+    size_t stream_bytes = (size_t)sample_rate * 2 * WRITER_AUDIO_MS / 1000;
+    unsigned char *audio = calloc(stream_bytes, 1);
+    int sndbuf = WRITER_SNDBUF;
+
+    // A quiet square wave, so the stream isn't mistaken for silence
+    for (size_t i = 0; i + 1 < stream_bytes; i += 2) {
+        short sample = (i / 2) % 40 < 20 ? 1000 : -1000;
+        memcpy(audio + i, &sample, 2);
+    }
+
+    memset(writers, 0, sizeof(writers));
+    double start = now_us();
+    for (int i = 0; i < writer_count; i++) {
+        writers[i].sockfd = connect_socket(AUDIO_OUTPUT_SOCKET_PATH);
+        if (writers[i].sockfd < 0) {
+            writers[i].done = 1;
+            continue;
+        }
+        setsockopt(writers[i].sockfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        fcntl(writers[i].sockfd, F_SETFL, O_NONBLOCK);
+    }
+
+    // Give up once every stream should long have played
+    double deadline = start + (writer_count * WRITER_AUDIO_MS + 10000) * 1e3;
+    while (now_us() < deadline) {
+        int nfds = 0;
+        for (int i = 0; i < writer_count; i++) {
+            if (writers[i].done) {
+                continue;
+            }
+            fds[nfds].fd = writers[i].sockfd;
+            fds[nfds].events = POLLIN | (writers[i].shut ? 0 : POLLOUT);
+            nfds++;
+        }
+        if (nfds == 0) {
+            break;
+        }
+        if (poll(fds, nfds, 100) <= 0) {
+            continue;
+        }
+
+        for (int i = 0, f = 0; i < writer_count && f < nfds; i++) {
+            Writer *writer = &writers[i];
+            if (writer->done || writer->sockfd != fds[f].fd) {
+                continue;
+            }
+            if (fds[f].revents & (POLLIN | POLLHUP | POLLERR)) {
+                writer_read_status(writer);
+            }
+            if (!writer->shut && !writer->done && (fds[f].revents & POLLOUT)) {
+                ssize_t n = send(writer->sockfd, audio + writer->sent, stream_bytes - writer->sent, MSG_NOSIGNAL);
+                if (n > 0) {
+                    writer->sent += n;
+                } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                    writer->done = 1;
+                }
+                if (writer->sent == stream_bytes) {
+                    shutdown(writer->sockfd, SHUT_WR);
+                    writer->shut = 1;
+                    writer->shut_us = now_us();
+                }
+            }
+            f++;
+        }
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    int drained = 0;
+    double bytes = 0, admission_max = 0, drain_sum = 0, drain_max = 0;
+    for (int i = 0; i < writer_count; i++) {
+        Writer *writer = &writers[i];
+        if (writer->sockfd >= 0) {
+            close(writer->sockfd);
+        }
+        bytes += writer->sent;
+        if (writer->admitted_us > 0 && writer->admitted_us - start > admission_max) {
+            admission_max = writer->admitted_us - start;
+        }
+        if (writer->drained_us > 0) {
+            double drain = writer->drained_us - writer->shut_us;
+            drain_sum += drain;
+            drain_max = drain > drain_max ? drain : drain_max;
+            drained++;
+        }
+    }
+
+    char latency[512] = "";
+    control_query("LATENCY", latency, sizeof(latency));
+
+    fprintf(out, "    {\"writers\": %d, \"stream_ms\": %d, \"drained\": %d, \"elapsed_s\": %.3f, "
+                 "\"throughput_bps\": %.0f, \"admission_wait_max_ms\": %.1f, "
+                 "\"drain_latency_avg_ms\": %.1f, \"drain_latency_max_ms\": %.1f, "
+                 "\"daemon_ao_path_p99_us\": %ld}%s\n",
+            writer_count, WRITER_AUDIO_MS, drained, elapsed, bytes / elapsed, admission_max / 1e3,
+            drained ? drain_sum / drained / 1e3 : 0, drain_max / 1e3, reply_percentile(latency, "ao_path", 3),
+            last ? "" : ",");
+    fflush(out);
+    free(audio);
+}
+
+/**
+ * Sends GET requests one after the other for the given time and reports the
+ * request rate and round-trip times.
+ */
+static void run_control_step(FILE *out, int seconds) {
+    static double rtt_us[MAX_CONTROL_SAMPLES];
+    char reply[64];
+    int count = 0, errors = 0;
+
+    int sockfd = connect_socket(AUDIO_CONTROL_SOCKET_PATH);
+    double start = now_us();
+    double end = start + seconds * 1e6;
+    double now = start;
+    while (sockfd >= 0 && now < end && count < MAX_CONTROL_SAMPLES) {
+        double sent = now;
+        if (control_request(sockfd, "GET ai_gain", reply, sizeof(reply)) < 0) {
+            errors++;
+            break;
+        }
+        now = now_us();
+        rtt_us[count++] = now - sent;
+    }
+    double elapsed = (now - start) / 1e6;
+    if (sockfd >= 0) {
+        close(sockfd);
+    }
+
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += rtt_us[i];
+    }
+    qsort(rtt_us, count, sizeof(double), compare_double);
+    fprintf(out, "  \"control\": {\"requests\": %d, \"errors\": %d, \"requests_per_s\": %.0f, "
+                 "\"rtt_avg_us\": %.1f, \"rtt_p99_us\": %.1f},\n",
+            count, errors, elapsed > 0 ? count / elapsed : 0, count ? sum / count : 0,
+            count ? rtt_us[(count * 99) / 100 < count ? (count * 99) / 100 : count - 1] : 0);
+    fflush(out);
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [-d step_seconds] [-s slow_subscribers] [-r sample_rate] [-p pid_file] [-o output.json]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = DEFAULT_STEP_SECONDS;
+    int slow = DEFAULT_SLOW_CLIENTS;
+    int sample_rate = DEFAULT_SAMPLE_RATE;
+    const char *pid_file = DEFAULT_PID_FILE;
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:s:r:p:o:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                seconds = atoi(optarg);
+                break;
+            case 's':
+                slow = atoi(optarg);
+                break;
+            case 'r':
+                sample_rate = atoi(optarg);
+                break;
+            case 'p':
+                pid_file = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (seconds < 1 || sample_rate < 1 || slow < 0 || 32 + slow > MAX_SUBSCRIBERS) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        perror("fopen");
+        return 1;
+    }
+
+    int pid = read_pid(pid_file);
+    long allocations_start = query_long("GET heap_allocations");
+    if (allocations_start < 0) {
+        fprintf(stderr, "The daemon isn't answering on the control socket\n");
+        return 1;
+    }
+
+    time_t started = time(NULL);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&started));
+    fprintf(out, "{\n  \"date\": \"%s\", \"step_seconds\": %d, \"sample_rate\": %d, \"daemon_pid\": %d,\n",
+            date, seconds, sample_rate, pid);
+
+    int steps = sizeof(fanout_steps) / sizeof(fanout_steps[0]);
+    fprintf(out, "  \"fanout\": [\n");
+    for (int i = 0; i < steps; i++) {
+        fprintf(stderr, "fanout: %d subscribers\n", fanout_steps[i]);
+        run_fanout_step(out, fanout_steps[i], slow, seconds, sample_rate, pid, i == steps - 1);
+    }
+    fprintf(out, "  ],\n");
+
+    steps = sizeof(playback_steps) / sizeof(playback_steps[0]);
+    fprintf(out, "  \"playback\": [\n");
+    for (int i = 0; i < steps; i++) {
+        fprintf(stderr, "playback: %d writers\n", playback_steps[i]);
+        run_playback_step(out, playback_steps[i], sample_rate, i == steps - 1);
+    }
+    fprintf(out, "  ],\n");
+
+    fprintf(stderr, "control\n");
+    run_control_step(out, seconds);
+
+    char footprint[512] = "";
+    control_query("FOOTPRINT", footprint, sizeof(footprint));
+    long allocations_end = query_long("GET heap_allocations");
+    fprintf(out, "  \"memory\": {\"rss_kb\": %ld, \"rss_peak_kb\": %ld, \"threads\": %ld, "
+                 "\"heap_allocations_during_run\": %ld}\n}\n",
+            reply_value(footprint, "rss_kb"), reply_value(footprint, "rss_peak_kb"),
+            reply_value(footprint, "threads"), allocations_end - allocations_start);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
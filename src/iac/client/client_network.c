@@ -1,6 +1,8 @@
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "client_network.h"
@@ -56,3 +58,88 @@ int setup_client_connection(int request_type) {
 
     return sockfd;
 }
+
+// Lines received on the output socket but not handled yet, shared by
+// read_credit() and wait_for_drain()
+static char reply[64];
+static size_t reply_len = 0;
+
+// Takes the next line the daemon sent into line, without its newline. Garbage
+// that never ends in a newline is discarded. Each read waits at most
+// timeout_ms, or indefinitely if it is negative. Returns 0, or -1 on timeout,
+// error or end of file.
+static int read_reply_line(int sockfd, char *line, size_t size, int timeout_ms) {
+    for (;;) {
+        char *newline = memchr(reply, '\n', reply_len);
+        if (newline) {
+            size_t len = newline - reply;
+            size_t copy = len < size - 1 ? len : size - 1;
+            memcpy(line, reply, copy);
+            line[copy] = '\0';
+            reply_len -= len + 1;
+            memmove(reply, newline + 1, reply_len);
+            return 0;
+        }
+
+        if (reply_len == sizeof(reply)) {
+            reply_len = 0;
+        }
+        if (timeout_ms >= 0) {
+            struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+            if (poll(&pfd, 1, timeout_ms) <= 0) {
+                return -1;
+            }
+        }
+        ssize_t n = read(sockfd, reply + reply_len, sizeof(reply) - reply_len);
+        if (n <= 0) {
+            return -1;
+        }
+        reply_len += n;
+    }
+}
+
+// Half-closes the output socket to signal end of stream, then waits until the
+// daemon reports that the last sample has actually played.
+int wait_for_drain(int sockfd, int timeout_ms) {
+    if (shutdown(sockfd, SHUT_WR) == -1) {
+        perror("shutdown");
+        return -1;
+    }
+
+    // ticket, queued, admitted and credit lines may still come first
+    char line[64];
+    while (read_reply_line(sockfd, line, sizeof(line), timeout_ms) == 0) {
+        if (strcmp(line, AUDIO_DRAIN_ACK) == 0) {
+            return 0;
+        }
+        if (strcmp(line, "timeout") == 0) {
+            break;
+        }
+    }
+
+    return -1;
+}
+
+// Blocks until the daemon grants more output credit and returns the number of
+// bytes granted, or -1 if the connection was closed or the admission wait timed out.
+long read_credit(int sockfd) {
+    char line[64];
+    long granted = 0;
+
+    while (granted == 0) {
+        if (read_reply_line(sockfd, line, sizeof(line), -1)) {
+            return -1;
+        }
+
+        if (strncmp(line, "credit ", 7) == 0) {
+            granted = atol(line + 7);
+        } else if (strncmp(line, "queued ", 7) == 0) {
+            printf("[INFO] Waiting for the output channel, queue position %s\n", line + 7);
+        } else if (strcmp(line, "timeout") == 0) {
+            fprintf(stderr, "[ERROR] Timed out waiting for the output channel\n");
+            return -1;
+        }
+    }
+
+    return granted;
+}
@@ -8,8 +8,18 @@
 #define AUDIO_INPUT_REQUEST 1
 #define AUDIO_OUTPUT_REQUEST 2
 
+// Sent by the daemon on the output socket once the last sample has been played
+#define AUDIO_DRAIN_ACK "drained"
+#define AUDIO_DRAIN_TIMEOUT_MS 5000
+
+// Opens an output stream with credit-based flow control
+#define AUDIO_CREDIT_HELLO "IADC"
+#define AUDIO_CREDIT_HELLO_LEN 4
+
 // Function declarations
 int setup_client_connection(int request_type);
 int setup_control_client_connection();
+int wait_for_drain(int sockfd, int timeout_ms);
+long read_credit(int sockfd);
 
 #endif // CLIENT_NETWORK_H
@@ -1,33 +1,46 @@
 #include <stdio.h>
-#include <sys/time.h>
 #include <unistd.h>
+#include "client_network.h"
 #include "playback.h"
 
-long long current_time_in_milliseconds() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return (long long)tv.tv_sec * 1000 + (long long)tv.tv_usec / 1000;
-}
-
 void playback_audio(int sockfd, FILE *audio_file) {
     printf("[INFO] Playing back audio to daemon\n");
 
+    // Opt into credit-based flow control: the daemon tells us how much it can take
+    if (write(sockfd, AUDIO_CREDIT_HELLO, AUDIO_CREDIT_HELLO_LEN) != AUDIO_CREDIT_HELLO_LEN) {
+        perror("write");
+        return;
+    }
+
     unsigned char buf[AO_MAX_FRAME_SIZE];
-    ssize_t read_size;
+    size_t read_size;
+    long credit = 0;
 
-    long long start_time, end_time;
-    while ((read_size = fread(buf, 1, sizeof(buf), audio_file)) > 0) {
-        start_time = current_time_in_milliseconds();
-        write(sockfd, buf, read_size);
-        end_time = current_time_in_milliseconds();
+    while (1) {
+        while (credit <= 0) {
+            long granted = read_credit(sockfd);
+            if (granted < 0) {
+                fprintf(stderr, "[ERROR] Daemon closed the connection\n");
+                return;
+            }
+            credit += granted;
+        }
 
-        long long playback_time = end_time - start_time;
-        long long sleep_duration = AO_TEST_SAMPLE_TIME * 1000 - playback_time;
+        size_t want = credit < (long)sizeof(buf) ? (size_t)credit : sizeof(buf);
+        read_size = fread(buf, 1, want, audio_file);
+        if (read_size == 0) {
+            break;
+        }
 
-        if (sleep_duration > 0) {
-            usleep(sleep_duration);
-        } else {
-            usleep(1000);
+        if (write(sockfd, buf, read_size) != (ssize_t)read_size) {
+            perror("write");
+            return;
         }
+        credit -= read_size;
+    }
+
+    // Don't return until the daemon has actually played the tail of the stream
+    if (wait_for_drain(sockfd, AUDIO_DRAIN_TIMEOUT_MS) != 0) {
+        fprintf(stderr, "[WARNING] Daemon did not acknowledge end of playback\n");
     }
 }
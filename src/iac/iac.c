@@ -74,10 +74,6 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
 
-        // Send audio output request to the server
-        int request_type = AUDIO_OUTPUT_REQUEST;
-        write(sockfd, &request_type, sizeof(int));
-
         playback_audio(sockfd, audio_file);
 
         if (!use_stdin) {
@@ -0,0 +1,114 @@
+#include <string.h>
+#include "ao_queue.h"
+#include "pool.h"
+
+// Slot storage is one contiguous allocation of depth * frame_size bytes
+static unsigned char *queue_data = NULL;
+static ssize_t *queue_len = NULL;
+static struct timespec *queue_time = NULL;  // When each frame was read from the client
+static int queue_depth = 0;
+static int queue_frame_size = 0;
+static int queue_head = 0;
+static int queue_count = 0;
+
+/**
+ * Allocates the frame queue.
+ * @param depth Number of frame slots.
+ * @param frame_size Maximum size of a frame in bytes.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int ao_queue_init(int depth, int frame_size) {
+    ao_queue_free();
+
+    queue_data = (unsigned char *) heap_alloc((size_t)depth * frame_size);
+    queue_len = (ssize_t *) heap_calloc(depth, sizeof(ssize_t));
+    queue_time = (struct timespec *) heap_calloc(depth, sizeof(struct timespec));
+    if (!queue_data || !queue_len || !queue_time) {
+        ao_queue_free();
+        return -1;
+    }
+
+    queue_depth = depth;
+    queue_frame_size = frame_size;
+    queue_head = 0;
+    queue_count = 0;
+    return 0;
+}
+
+/**
+ * Releases the memory held by the frame queue.
+ */
+void ao_queue_free() {
+    heap_free(queue_data);
+    heap_free(queue_len);
+    heap_free(queue_time);
+    queue_data = NULL;
+    queue_len = NULL;
+    queue_time = NULL;
+    queue_depth = 0;
+    queue_count = 0;
+}
+
+/**
+ * Drops every queued frame.
+ */
+void ao_queue_clear() {
+    queue_head = 0;
+    queue_count = 0;
+}
+
+int ao_queue_depth() {
+    return queue_depth;
+}
+
+int ao_queue_count() {
+    return queue_count;
+}
+
+int ao_queue_free_slots() {
+    return queue_depth - queue_count;
+}
+
+/**
+ * Copies a frame into the next free slot. Frames larger than the slot size are truncated.
+ * @param data Frame data.
+ * @param len Frame length in bytes.
+ * @param read_time Monotonic time the frame was read from the client.
+ */
+void ao_queue_push(const unsigned char *data, ssize_t len, const struct timespec *read_time) {
+    int slot = (queue_head + queue_count) % queue_depth;
+    if (len > queue_frame_size) {
+        len = queue_frame_size;
+    }
+    memcpy(queue_data + (size_t)slot * queue_frame_size, data, len);
+    queue_len[slot] = len;
+    queue_time[slot] = *read_time;
+    queue_count++;
+}
+
+/**
+ * Returns the oldest queued frame without removing it.
+ * @param len Receives the frame length in bytes.
+ * @param read_time Receives the time the frame was read from the client.
+ * @return Pointer to the frame data, or NULL if the queue is empty.
+ */
+unsigned char *ao_queue_head(ssize_t *len, struct timespec *read_time) {
+    if (queue_count == 0) {
+        *len = 0;
+        return NULL;
+    }
+    *len = queue_len[queue_head];
+    *read_time = queue_time[queue_head];
+    return queue_data + (size_t)queue_head * queue_frame_size;
+}
+
+/**
+ * Releases the oldest queued frame.
+ */
+void ao_queue_pop() {
+    if (queue_count == 0) {
+        return;
+    }
+    queue_head = (queue_head + 1) % queue_depth;
+    queue_count--;
+}
@@ -0,0 +1,28 @@
+#ifndef AO_QUEUE_H
+#define AO_QUEUE_H
+
+#include <sys/types.h>      // For ssize_t
+#include <time.h>           // For struct timespec
+
+#define DEFAULT_AO_QUEUE_DEPTH 4
+
+// Fixed-size ring of frames between the output server and ao_play_thread.
+// All functions except init/free must be called with audio_buffer_lock held.
+
+int ao_queue_init(int depth, int frame_size);
+void ao_queue_free(void);
+void ao_queue_clear(void);
+
+int ao_queue_depth(void);
+int ao_queue_count(void);
+int ao_queue_free_slots(void);
+
+// Producer side: copy a frame into the next free slot (queue must not be full),
+// along with the monotonic time it was read from the client
+void ao_queue_push(const unsigned char *data, ssize_t len, const struct timespec *read_time);
+
+// Consumer side: look at the oldest frame and when it was read, then release it once played
+unsigned char *ao_queue_head(ssize_t *len, struct timespec *read_time);
+void ao_queue_pop(void);
+
+#endif // AO_QUEUE_H
@@ -8,109 +8,25 @@
 #define TAG "AUDIO_COMMON"
 
 /**
- * Helper function to get a specific audio attribute from the configuration.
- * @param type The type of audio (e.g., AUDIO_INPUT or AUDIO_OUTPUT).
- * @param attr The specific attribute name.
- * @return The cJSON item for the requested attribute.
- */
-static cJSON* get_audio_device_attribute(AudioType type, const char *attr) {
-    return get_audio_attribute(type, attr);
-}
-
-/**
- * Helper function to free the memory for a specific audio attribute.
- * @param item The cJSON item to be freed.
- */
-static __attribute__((unused)) void free_audio_device_attribute(cJSON *item) {
-    if (item) {
-        cJSON_Delete(item);
-    }
-}
-
-/**
- * Retrieves the device and channel IDs for audio input or uses defaults.
+ * Retrieves the device and channel IDs for audio input from the configuration snapshot.
  * @param aiDevID Pointer to store the retrieved Device ID.
  * @param aiChnID Pointer to store the retrieved Channel ID.
  */
 void get_audio_input_device_attributes(int *aiDevID, int *aiChnID) {
-    cJSON *aiDevIDItem = get_audio_device_attribute(AUDIO_INPUT, "device_id");
-    cJSON *aiChnIDItem = get_audio_device_attribute(AUDIO_INPUT, "channel_id");
-    *aiDevID = aiDevIDItem ? aiDevIDItem->valueint : DEFAULT_AI_DEV_ID;
-    *aiChnID = aiChnIDItem ? aiChnIDItem->valueint : DEFAULT_AI_CHN_ID;
+    const AudioInputConfig *ai = &config_get()->ai;
+    *aiDevID = ai->device_id;
+    *aiChnID = ai->channel_id;
 }
 
 /**
- * Retrieves the device and channel IDs for audio output or uses defaults.
+ * Retrieves the device and channel IDs for audio output from the configuration snapshot.
  * @param aoDevID Pointer to store the retrieved Device ID.
  * @param aoChnID Pointer to store the retrieved Channel ID.
  */
 void get_audio_output_device_attributes(int *aoDevID, int *aoChnID) {
-    cJSON *aoDevIDItem = get_audio_device_attribute(AUDIO_OUTPUT, "device_id");
-    cJSON *aoChnIDItem = get_audio_device_attribute(AUDIO_OUTPUT, "channel_id");
-    *aoDevID = aoDevIDItem ? aoDevIDItem->valueint : DEFAULT_AO_DEV_ID;
-    *aoChnID = aoChnIDItem ? aoChnIDItem->valueint : DEFAULT_AO_CHN_ID;
-}
-
-/**
- * Fetches the audio input attributes from the configuration.
- * @return A structure containing the audio input attributes.
- */
-AudioInputAttributes get_audio_input_attributes() {
-    AudioInputAttributes attrs;
-    attrs.samplerateItem = get_audio_attribute(AUDIO_INPUT, "sample_rate");
-    attrs.bitwidthItem = get_audio_attribute(AUDIO_INPUT, "bitwidth");
-    attrs.soundmodeItem = get_audio_attribute(AUDIO_INPUT, "soundmode");
-    attrs.frmNumItem = get_audio_attribute(AUDIO_INPUT, "frmNum");
-    attrs.chnCntItem = get_audio_attribute(AUDIO_INPUT, "chnCnt");
-    attrs.SetVolItem = get_audio_attribute(AUDIO_INPUT, "SetVol");
-    attrs.SetGainItem = get_audio_attribute(AUDIO_INPUT, "SetGain");
-    attrs.usrFrmDepthItem = get_audio_attribute(AUDIO_INPUT, "usrFrmDepth");
-    return attrs;
-}
-
-/**
- * Frees the memory allocated for the audio input attributes.
- * @param attrs Pointer to the audio input attributes structure.
- */
-void free_audio_input_attributes(AudioInputAttributes *attrs) {
-    cJSON_Delete(attrs->samplerateItem);
-    cJSON_Delete(attrs->bitwidthItem);
-    cJSON_Delete(attrs->soundmodeItem);
-    cJSON_Delete(attrs->frmNumItem);
-    cJSON_Delete(attrs->chnCntItem);
-    cJSON_Delete(attrs->SetVolItem);
-    cJSON_Delete(attrs->SetGainItem);
-    cJSON_Delete(attrs->usrFrmDepthItem);
-}
-
-/**
- * Fetches the audio output attributes from the configuration.
- * @return A structure containing the audio output attributes.
- */
-AudioOutputAttributes get_audio_attributes() {
-    AudioOutputAttributes attrs;
-    attrs.samplerateItem = get_audio_attribute(AUDIO_OUTPUT, "sample_rate");
-    attrs.bitwidthItem = get_audio_attribute(AUDIO_OUTPUT, "bitwidth");
-    attrs.soundmodeItem = get_audio_attribute(AUDIO_OUTPUT, "soundmode");
-    attrs.frmNumItem = get_audio_attribute(AUDIO_OUTPUT, "frmNum");
-    attrs.chnCntItem = get_audio_attribute(AUDIO_OUTPUT, "chnCnt");
-    attrs.SetVolItem = get_audio_attribute(AUDIO_OUTPUT, "SetVol");
-    attrs.SetGainItem = get_audio_attribute(AUDIO_OUTPUT, "SetGain");
-    return attrs;
-}
-
-/**
- * Frees the memory allocated for the audio output attributes.
- * @param attrs Pointer to the audio output attributes structure.
- */
-void free_audio_output_attributes(AudioOutputAttributes *attrs) {
-    cJSON_Delete(attrs->samplerateItem);
-    cJSON_Delete(attrs->bitwidthItem);
-    cJSON_Delete(attrs->soundmodeItem);
-    cJSON_Delete(attrs->frmNumItem);
-    cJSON_Delete(attrs->chnCntItem);
-    cJSON_Delete(attrs->SetVolItem);
-    cJSON_Delete(attrs->SetGainItem);
+    const AudioOutputConfig *ao = &config_get()->ao;
+    *aoDevID = ao->device_id;
+    *aoChnID = ao->channel_id;
 }
 
 /**
@@ -168,24 +84,3 @@ void mute_audio_output_device(int mute_enable) {
         handle_audio_error("AO: Failed to mute audio output device");
     }
 }
-
-//todo
-void enable_output_channel() {
-    int aoDevID, aoChnID;
-    get_audio_output_device_attributes(&aoDevID, &aoChnID);
-    AudioOutputAttributes attrs = get_audio_attributes();
-
-    if (IMP_AO_EnableChn(aoDevID, aoChnID)) {
-        handle_audio_error("AO: Failed to enable output channel");
-    }
-
-    // Set volume and gain for the audio device
-    int vol = attrs.SetVolItem ? attrs.SetVolItem->valueint : DEFAULT_AO_CHN_VOL;
-    if (vol < -30 || vol > 120) {
-        IMP_LOG_ERR(TAG, "SetVol value out of range: %d. Using default value: %d.\n", vol, DEFAULT_AO_CHN_VOL);
-        vol = DEFAULT_AO_CHN_VOL;
-    }
-    if (IMP_AO_SetVol(aoDevID, aoChnID, vol)) {
-        handle_audio_error("Failed to set volume attribute");
-    }
-}
@@ -6,8 +6,8 @@
 #include <bits/errno.h>     // for EPIPE
 #include "imp/imp_audio.h"  // for IMPAudioIOAttr, IMPAudioFrame, IMP_AI_Dis...
 #include "imp/imp_log.h"    // for IMP_LOG_ERR
-#include "audio_common.h"   // for AudioInputAttributes, PlayInputAttributes
-#include "cJSON.h"          // for cJSON
+#include "audio_common.h"   // for get_audio_input_device_attributes
+#include "audio_imp.h"
 #include "config.h"         // for is_valid_samplerate
 #include "input.h"
 #include "logging.h"        // for handle_audio_error
@@ -16,8 +16,15 @@
 #define TAG "IMP"
 
 int aoDevID, aoChnID, aiDevID, aiChnID;
-//get_audio_output_device_attributes(&aoDevID, &aoChnID);
-//get_audio_input_device_attributes(&aiDevID, &aiChnID);
+
+/**
+ * Resolves the AI and AO device and channel IDs used by the functions below
+ * from the configuration. Must be called once the configuration is loaded.
+ */
+void audio_imp_init(void) {
+    get_audio_output_device_attributes(&aoDevID, &aoChnID);
+    get_audio_input_device_attributes(&aiDevID, &aiChnID);
+}
 
 
 int ai_device(int enable) {
@@ -105,14 +112,13 @@ int ai_set_volume(int aiVol) {
     return 0;
 }
 
-int ai_get_volume(void) {
-    int aiVol;
-    int ret = IMP_AI_GetVol(aiDevID, aiChnID, &aiVol);
+int ai_get_volume(int *aiVol) {
+    int ret = IMP_AI_GetVol(aiDevID, aiChnID, aiVol);
     if (ret != 0) {
         fprintf(stderr, "AI: Failed to get input volume on %d\n", aiChnID);
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    return aiVol;
+    return 0;
 }
 
 
@@ -125,14 +131,13 @@ int ai_set_gain(int aiGain) {
     return 0;
 }
 
-int ai_get_gain(void) {
-    int aiGain;
-    int ret = IMP_AI_GetGain(aiDevID, aiChnID, &aiGain);
+int ai_get_gain(int *aiGain) {
+    int ret = IMP_AI_GetGain(aiDevID, aiChnID, aiGain);
     if (ret != 0) {
         fprintf(stderr, "AI: Failed to get input gain on %d\n", aiChnID);
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    return aiGain;
+    return 0;
 }
 
 int ai_set_mute(int enable) {
@@ -157,16 +162,131 @@ int ai_set_alc_gain(int aiPgaGain) {
     return 0;
 }
 
-int ai_get_alc_gain(void) {
-    int aiPgaGain;
+int ai_get_alc_gain(int *aiPgaGain) {
 #ifdef CONFIG_T31
-    int ret = IMP_AI_GetAlcGain(aiDevID, aiChnID, &aiPgaGain);
+    int ret = IMP_AI_GetAlcGain(aiDevID, aiChnID, aiPgaGain);
 #else
     int ret = 0;
+    *aiPgaGain = 0;
 #endif
     if (ret != 0) {
         fprintf(stderr, "AI: Failed to get input alc gain on %d\n", aiChnID);
-        exit(EXIT_FAILURE);
+        return -1;
+    }
+    return 0;
+}
+
+int ai_ns(int level) {
+    int ret;
+
+    if (level >= 0) {
+        IMPAudioIOAttr attr;
+        ret = IMP_AI_GetPubAttr(aiDevID, &attr);
+        if (ret == 0) {
+            ret = IMP_AI_EnableNs(&attr, level);
+        }
+        if (ret != 0) {
+            fprintf(stderr, "AI: Failed to enable input noise suppression on %d\n", aiChnID);
+            return -1;
+        }
+    } else {
+        ret = IMP_AI_DisableNs();
+        if (ret != 0) {
+            fprintf(stderr, "AI: Failed to disable input noise suppression on %d\n", aiChnID);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ai_hpf(int enable) {
+    int ret;
+
+    if (enable) {
+        IMPAudioIOAttr attr;
+        ret = IMP_AI_GetPubAttr(aiDevID, &attr);
+        if (ret == 0) {
+            ret = IMP_AI_EnableHpf(&attr);
+        }
+        if (ret != 0) {
+            fprintf(stderr, "AI: Failed to enable input high pass filter on %d\n", aiChnID);
+            return -1;
+        }
+    } else {
+        ret = IMP_AI_DisableHpf();
+        if (ret != 0) {
+            fprintf(stderr, "AI: Failed to disable input high pass filter on %d\n", aiChnID);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ai_agc(int enable, int targetLevelDbfs, int compressionGaindB) {
+    int ret;
+
+    if (enable) {
+        IMPAudioIOAttr attr;
+        IMPAudioAgcConfig agcConfig = {.TargetLevelDbfs = targetLevelDbfs, .CompressionGaindB = compressionGaindB};
+        ret = IMP_AI_GetPubAttr(aiDevID, &attr);
+        if (ret == 0) {
+            ret = IMP_AI_EnableAgc(&attr, agcConfig);
+        }
+        if (ret != 0) {
+            fprintf(stderr, "AI: Failed to enable input AGC on %d\n", aiChnID);
+            return -1;
+        }
+    } else {
+        ret = IMP_AI_DisableAgc();
+        if (ret != 0) {
+            fprintf(stderr, "AI: Failed to disable input AGC on %d\n", aiChnID);
+            return -1;
+        }
     }
-    return aiPgaGain;
+    return 0;
+}
+
+int ao_set_volume(int aoVol) {
+    int ret = IMP_AO_SetVol(aoDevID, aoChnID, aoVol);
+    if (ret != 0) {
+        fprintf(stderr, "AO: Failed to set output volume on %d\n", aoChnID);
+        return -1;
+    }
+    return 0;
+}
+
+int ao_get_volume(int *aoVol) {
+    int ret = IMP_AO_GetVol(aoDevID, aoChnID, aoVol);
+    if (ret != 0) {
+        fprintf(stderr, "AO: Failed to get output volume on %d\n", aoChnID);
+        return -1;
+    }
+    return 0;
+}
+
+int ao_set_gain(int aoGain) {
+    int ret = IMP_AO_SetGain(aoDevID, aoChnID, aoGain);
+    if (ret != 0) {
+        fprintf(stderr, "AO: Failed to set output gain on %d\n", aoChnID);
+        return -1;
+    }
+    return 0;
+}
+
+int ao_get_gain(int *aoGain) {
+    int ret = IMP_AO_GetGain(aoDevID, aoChnID, aoGain);
+    if (ret != 0) {
+        fprintf(stderr, "AO: Failed to get output gain on %d\n", aoChnID);
+        return -1;
+    }
+    return 0;
+}
+
+int ao_set_mute(int enable) {
+    int ret = IMP_AO_SetVolMute(aoDevID, aoChnID, enable);
+    if (ret != 0) {
+        fprintf(stderr, "AO: Failed to set output mute on %d\n", aoChnID);
+        return -1;
+    }
+    return 0;
 }
@@ -0,0 +1,33 @@
+#ifndef AUDIO_IMP_H
+#define AUDIO_IMP_H
+
+// Thin wrappers around the IMP audio controls that can change while the
+// devices are running. All return 0 on success and -1 on failure.
+
+// Resolves the device and channel IDs from the configuration
+void audio_imp_init(void);
+
+// Audio input
+int ai_device(int enable);
+int ai_channel(int enable);
+int ai_aec(int enable);
+int ai_ref_frame(int enable);
+int ai_set_volume(int aiVol);
+int ai_get_volume(int *aiVol);
+int ai_set_gain(int aiGain);
+int ai_get_gain(int *aiGain);
+int ai_set_mute(int enable);
+int ai_set_alc_gain(int aiPgaGain);
+int ai_get_alc_gain(int *aiPgaGain);
+int ai_ns(int level);               // level < 0 disables noise suppression
+int ai_hpf(int enable);
+int ai_agc(int enable, int targetLevelDbfs, int compressionGaindB);
+
+// Audio output
+int ao_set_volume(int aoVol);
+int ao_get_volume(int *aoVol);
+int ao_set_gain(int aoGain);
+int ao_get_gain(int *aoGain);
+int ao_set_mute(int enable);
+
+#endif // AUDIO_IMP_H
@@ -0,0 +1,454 @@
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "imp/imp_audio.h"
+#include "audio_common.h"
+#include "calibrate.h"
+#include "lockstat.h"
+#include "logging.h"
+#include "output.h"
+#include "pool.h"
+#include "utils.h"
+
+#define TAG "CALIBRATE"
+
+// Raised-cosine ramps at both ends of the sweep, so it starts and stops without clicks
+#define CALIBRATE_RAMP_MS 5
+
+// Extra time the worker waits for the capture beyond its length
+#define CALIBRATE_CAPTURE_MARGIN_MS 2000
+
+// Capture handshake between the record thread and the worker
+enum {
+    CAPTURE_OFF,            // Nothing is recorded
+    CAPTURE_ARMED,          // The record thread copies the next frame
+    CAPTURE_WRITING,        // The record thread is copying a frame
+    CAPTURE_FULL            // The capture is complete and belongs to the worker
+};
+
+// A captured frame, to date the samples it holds
+typedef struct {
+    size_t start;           // Index of the frame's first sample in the capture
+    size_t count;           // Samples in the frame, including any that didn't fit
+    struct timespec arrival;
+} CalibrateFrame;
+
+// Signal parameters of the running calibration, set by calibrate_start()
+static int cal_ai_rate, cal_ao_rate;
+static int cal_ai_channels, cal_ao_channels;
+static double cal_sweep_high_hz;
+
+// Playback, only touched by the network thread
+static int cal_running = 0;
+static int16_t *cal_playback = NULL;
+static size_t cal_playback_len = 0;         // Samples, all channels
+static size_t cal_playback_pos = 0;
+static size_t cal_sweep_start = 0;          // Index of the sweep's first sample in cal_playback
+static struct timespec cal_sweep_queued;
+static int cal_sweep_queued_set = 0;        // Published to the worker once cal_sweep_queued is written
+
+// Capture, owned by the record thread while armed and by the worker once full
+static int cal_capture_state = CAPTURE_OFF;
+static int16_t *cal_capture = NULL;
+static size_t cal_capture_len = 0;
+static size_t cal_capture_pos = 0;
+static CalibrateFrame *cal_frames = NULL;
+static int cal_frame_capacity = 0;
+static int cal_frame_count = 0;
+
+// Worker thread and its result, read by the network thread once cal_event fires
+static int cal_thread_started = 0;
+static sem_t cal_work;
+static sem_t cal_captured;
+static int cal_event = -1;
+static CalibrateStatus cal_status;
+static CalibrateResult cal_result;
+
+/**
+ * Returns the sweep at the given time since its start, so it can be sampled
+ * at the AO rate for playback and at the AI rate as the reference.
+ * The frequency rises exponentially, which keeps the correlation peak narrow.
+ */
+static double calibrate_sweep(double t) {
+    double duration = CALIBRATE_SWEEP_MS / 1000.0;
+    double ramp = CALIBRATE_RAMP_MS / 1000.0;
+    if (t < 0 || t >= duration) {
+        return 0;
+    }
+
+    double k = duration / log(cal_sweep_high_hz / CALIBRATE_SWEEP_LOW_HZ);
+    double value = CALIBRATE_SWEEP_AMPLITUDE * sin(2 * M_PI * CALIBRATE_SWEEP_LOW_HZ * k * (exp(t / k) - 1));
+    if (t < ramp) {
+        value *= 0.5 - 0.5 * cos(M_PI * t / ramp);
+    } else if (duration - t < ramp) {
+        value *= 0.5 - 0.5 * cos(M_PI * (duration - t) / ramp);
+    }
+    return value;
+}
+
+/**
+ * In-place radix-2 FFT of n complex values stored as interleaved real and
+ * imaginary parts. n must be a power of two. The inverse isn't scaled.
+ */
+static void calibrate_fft(float *x, size_t n, int inverse) {
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            float re = x[2 * i], im = x[2 * i + 1];
+            x[2 * i] = x[2 * j];
+            x[2 * i + 1] = x[2 * j + 1];
+            x[2 * j] = re;
+            x[2 * j + 1] = im;
+        }
+    }
+
+    for (size_t len = 2; len <= n; len <<= 1) {
+        double angle = (inverse ? 2 : -2) * M_PI / len;
+        double step_re = cos(angle), step_im = sin(angle);
+        double w_re = 1, w_im = 0;
+
+        // One twiddle factor per butterfly position, applied across all blocks
+        for (size_t k = 0; k < len / 2; k++) {
+            for (size_t i = k; i < n; i += len) {
+                float *a = &x[2 * i], *b = &x[2 * (i + len / 2)];
+                float t_re = b[0] * w_re - b[1] * w_im;
+                float t_im = b[0] * w_im + b[1] * w_re;
+                b[0] = a[0] - t_re;
+                b[1] = a[1] - t_im;
+                a[0] += t_re;
+                a[1] += t_im;
+            }
+            double next = w_re * step_re - w_im * step_im;
+            w_im = w_re * step_im + w_im * step_re;
+            w_re = next;
+        }
+    }
+}
+
+/**
+ * Cross-correlates the capture with the sweep sampled at the AI rate. Both
+ * are real, so one complex FFT carries the capture in the real parts and the
+ * reference in the imaginary parts, and their spectra are separated by
+ * symmetry: two transforms of the capture length in all.
+ * @param lag Receives the lag of the highest correlation, refined between samples.
+ * @param peak Receives the normalized correlation at that lag.
+ * @return 0 on success, -1 if memory ran out.
+ */
+static int calibrate_correlate(double *lag, double *peak) {
+    size_t ref_len = (size_t)cal_ai_rate * CALIBRATE_SWEEP_MS / 1000;
+    size_t n = 1;
+    while (n < cal_capture_pos) {
+        n <<= 1;
+    }
+
+    float *z = heap_calloc(2 * n, sizeof(float));
+    if (!z) {
+        return -1;
+    }
+    double ref_energy = 0;
+    for (size_t i = 0; i < cal_capture_pos; i++) {
+        z[2 * i] = cal_capture[i];
+    }
+    for (size_t i = 0; i < ref_len; i++) {
+        double r = calibrate_sweep((double)i / cal_ai_rate);
+        z[2 * i + 1] = (float)r;
+        ref_energy += r * r;
+    }
+
+    calibrate_fft(z, n, 0);
+
+    // X = (Z[k] + conj(Z[n-k])) / 2 and R = (Z[k] - conj(Z[n-k])) / 2i; the
+    // correlation's spectrum X * conj(R) is Hermitian, so each pair is done once
+    for (size_t k = 0; k <= n / 2; k++) {
+        size_t m = (n - k) & (n - 1);
+        float a = z[2 * k], b = z[2 * k + 1], c = z[2 * m], d = z[2 * m + 1];
+        float x_re = (a + c) / 2, x_im = (b - d) / 2;
+        float r_re = (b + d) / 2, r_im = (c - a) / 2;
+        float p_re = x_re * r_re + x_im * r_im;
+        float p_im = x_im * r_re - x_re * r_im;
+        z[2 * k] = p_re;
+        z[2 * k + 1] = p_im;
+        z[2 * m] = p_re;
+        z[2 * m + 1] = -p_im;
+    }
+
+    calibrate_fft(z, n, 1);
+
+    // Only lags where the whole sweep fits in the capture are free of wrap-around
+    size_t best = 0;
+    float best_value = 0;
+    for (size_t l = 0; l + ref_len <= cal_capture_pos; l++) {
+        if (fabsf(z[2 * l]) > best_value) {
+            best_value = fabsf(z[2 * l]);
+            best = l;
+        }
+    }
+
+    double capture_energy = 0;
+    for (size_t i = best; i < best + ref_len; i++) {
+        capture_energy += (double)cal_capture[i] * cal_capture[i];
+    }
+    *peak = capture_energy > 0 ? best_value / n / sqrt(ref_energy * capture_energy) : 0;
+
+    // Parabola through the peak and its neighbours
+    *lag = best;
+    if (best > 0 && best + ref_len < cal_capture_pos) {
+        double y0 = fabsf(z[2 * (best - 1)]), y1 = best_value, y2 = fabsf(z[2 * (best + 1)]);
+        double denominator = y0 - 2 * y1 + y2;
+        if (denominator < 0) {
+            *lag += 0.5 * (y0 - y2) / denominator;
+        }
+    }
+
+    heap_free(z);
+    return 0;
+}
+
+static long calibrate_elapsed_us(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000L + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+/**
+ * Finds the sweep in the full capture and dates it against the playback.
+ */
+static CalibrateStatus calibrate_analyze(CalibrateResult *result) {
+    struct timespec stream_start;
+    audio_lock(LOCK_SITE_AO_STATE);
+    int played = ao_stream_start_time(&stream_start);
+    audio_unlock();
+    if (played != 0 || !__atomic_load_n(&cal_sweep_queued_set, __ATOMIC_ACQUIRE)) {
+        return CALIBRATE_NO_PLAYBACK;
+    }
+
+    if (calibrate_correlate(&result->lag_samples, &result->peak)) {
+        return CALIBRATE_NO_MEMORY;
+    }
+    if (result->peak < CALIBRATE_MIN_PEAK) {
+        return CALIBRATE_NO_SIGNAL;
+    }
+
+    // The frame holding the sweep's first sample, which was captured as many
+    // sample periods before the frame arrived as the frame held after it
+    const CalibrateFrame *frame = &cal_frames[0];
+    for (int i = 0; i < cal_frame_count && cal_frames[i].start <= result->lag_samples; i++) {
+        frame = &cal_frames[i];
+    }
+    long captured_us = -(long)((frame->start + frame->count - result->lag_samples) * 1000000 / cal_ai_rate);
+    long sweep_sent_us = (long)((long long)cal_sweep_start / cal_ao_channels * 1000000 / cal_ao_rate);
+
+    result->latency_us = calibrate_elapsed_us(&cal_sweep_queued, &frame->arrival);
+    result->offset_us = calibrate_elapsed_us(&stream_start, &frame->arrival) + captured_us - sweep_sent_us;
+    return CALIBRATE_OK;
+}
+
+/**
+ * Takes the capture back from the record thread.
+ * @return 1 if it was complete, 0 if recording was stopped short.
+ */
+static int calibrate_disarm(void) {
+    while (1) {
+        int expected = CAPTURE_ARMED;
+        if (__atomic_compare_exchange_n(&cal_capture_state, &expected, CAPTURE_OFF, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        if (expected == CAPTURE_FULL) {
+            return 1;
+        }
+        // The record thread is inside calibrate_capture(), for one frame copy at most
+        sched_yield();
+    }
+}
+
+static void calibrate_free_capture(void) {
+    heap_free(cal_capture);
+    heap_free(cal_frames);
+    cal_capture = NULL;
+    cal_frames = NULL;
+}
+
+/**
+ * Waits for each calibration's capture and analyzes it. Runs without
+ * real-time priority, so the FFTs never delay the audio threads.
+ */
+static void *calibrate_thread(void *arg) {
+    while (1) {
+        sem_wait(&cal_work);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        long wait_ms = CALIBRATE_LEAD_MS + CALIBRATE_SWEEP_MS + CALIBRATE_MAX_DELAY_MS + CALIBRATE_CAPTURE_MARGIN_MS;
+        deadline.tv_sec += wait_ms / 1000;
+        deadline.tv_nsec += (wait_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (sem_timedwait(&cal_captured, &deadline) != 0 && errno == EINTR) {
+        }
+
+        int complete = calibrate_disarm();
+        while (sem_trywait(&cal_captured) == 0) {
+        }
+
+        CalibrateResult result = {0};
+        CalibrateStatus status = complete ? calibrate_analyze(&result) : CALIBRATE_NO_CAPTURE;
+        calibrate_free_capture();
+        __atomic_store_n(&cal_capture_state, CAPTURE_OFF, __ATOMIC_RELEASE);
+
+        cal_result = result;
+        cal_status = status;
+        uint64_t one = 1;
+        if (write(cal_event, &one, sizeof(one)) != sizeof(one)) {
+            handle_audio_error(TAG, "Failed to signal the result");
+        }
+    }
+    return NULL;
+}
+
+// Creates the eventfd and the worker on first use
+static int calibrate_setup(void) {
+    if (cal_thread_started) {
+        return 0;
+    }
+
+    cal_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (cal_event < 0) {
+        handle_audio_error(TAG, "eventfd");
+        return -1;
+    }
+    sem_init(&cal_work, 0, 0);
+    sem_init(&cal_captured, 0, 0);
+
+    pthread_t thread;
+    if (create_thread(&thread, "calibrate", calibrate_thread, NULL)) {
+        close(cal_event);
+        cal_event = -1;
+        return -1;
+    }
+    pthread_detach(thread);
+    cal_thread_started = 1;
+    return 0;
+}
+
+int calibrate_event_fd(void) {
+    return calibrate_setup() == 0 ? cal_event : -1;
+}
+
+CalibrateStatus calibrate_start(void) {
+    if (cal_running) {
+        return CALIBRATE_BUSY;
+    }
+    if (calibrate_setup()) {
+        return CALIBRATE_NO_MEMORY;
+    }
+
+    int aiDevID, aiChnID, aoDevID, aoChnID;
+    IMPAudioIOAttr ai_attr, ao_attr;
+    get_audio_input_device_attributes(&aiDevID, &aiChnID);
+    get_audio_output_device_attributes(&aoDevID, &aoChnID);
+    if (IMP_AI_GetPubAttr(aiDevID, &ai_attr) || IMP_AO_GetPubAttr(aoDevID, &ao_attr) ||
+        ai_attr.samplerate <= 0 || ao_attr.samplerate <= 0) {
+        handle_audio_error(TAG, "Failed to read the device attributes");
+        return CALIBRATE_NO_PLAYBACK;
+    }
+    cal_ai_rate = ai_attr.samplerate;
+    cal_ao_rate = ao_attr.samplerate;
+    cal_ai_channels = ai_attr.soundmode == AUDIO_SOUND_MODE_STEREO ? 2 : 1;
+    cal_ao_channels = ao_attr.soundmode == AUDIO_SOUND_MODE_STEREO ? 2 : 1;
+    cal_sweep_high_hz = 0.45 * (cal_ai_rate < cal_ao_rate ? cal_ai_rate : cal_ao_rate);
+
+    size_t lead = (size_t)cal_ao_rate * CALIBRATE_LEAD_MS / 1000;
+    size_t sweep = (size_t)cal_ao_rate * CALIBRATE_SWEEP_MS / 1000;
+    size_t tail = (size_t)cal_ao_rate * CALIBRATE_TAIL_MS / 1000;
+    cal_playback_len = (lead + sweep + tail) * cal_ao_channels;
+    cal_capture_len = (size_t)cal_ai_rate * (CALIBRATE_LEAD_MS + CALIBRATE_SWEEP_MS + CALIBRATE_MAX_DELAY_MS) / 1000;
+    cal_frame_capacity = cal_capture_len / 64 + 2;
+
+    cal_playback = heap_calloc(cal_playback_len, sizeof(int16_t));
+    cal_capture = heap_alloc(cal_capture_len * sizeof(int16_t));
+    cal_frames = heap_alloc(cal_frame_capacity * sizeof(CalibrateFrame));
+    if (!cal_playback || !cal_capture || !cal_frames) {
+        handle_audio_error(TAG, "Failed to allocate the calibration buffers");
+        heap_free(cal_playback);
+        cal_playback = NULL;
+        calibrate_free_capture();
+        return CALIBRATE_NO_MEMORY;
+    }
+
+    for (size_t i = 0; i < sweep; i++) {
+        int16_t value = (int16_t)lrint(calibrate_sweep((double)i / cal_ao_rate));
+        for (int c = 0; c < cal_ao_channels; c++) {
+            cal_playback[(lead + i) * cal_ao_channels + c] = value;
+        }
+    }
+    cal_playback_pos = 0;
+    cal_sweep_start = lead * cal_ao_channels;
+    cal_sweep_queued_set = 0;
+    cal_capture_pos = 0;
+    cal_frame_count = 0;
+    cal_running = 1;
+
+    printf("[INFO] [CALIBRATE] Playing a %d - %.0f Hz sweep, AO at %d Hz, AI at %d Hz\n",
+           CALIBRATE_SWEEP_LOW_HZ, cal_sweep_high_hz, cal_ao_rate, cal_ai_rate);
+    __atomic_store_n(&cal_capture_state, CAPTURE_ARMED, __ATOMIC_RELEASE);
+    sem_post(&cal_work);
+    return CALIBRATE_OK;
+}
+
+size_t calibrate_playback_read(unsigned char *buf, size_t size, const struct timespec *queued) {
+    size_t frame_bytes = cal_ao_channels * sizeof(int16_t);
+    size_t count = (size / frame_bytes) * cal_ao_channels;
+    if (count > cal_playback_len - cal_playback_pos) {
+        count = cal_playback_len - cal_playback_pos;
+    }
+    memcpy(buf, cal_playback + cal_playback_pos, count * sizeof(int16_t));
+
+    if (cal_playback_pos <= cal_sweep_start && cal_sweep_start < cal_playback_pos + count) {
+        cal_sweep_queued = *queued;
+        __atomic_store_n(&cal_sweep_queued_set, 1, __ATOMIC_RELEASE);
+    }
+    cal_playback_pos += count;
+    return count * sizeof(int16_t);
+}
+
+void calibrate_capture(const int16_t *samples, int count, const struct timespec *arrival) {
+    int expected = CAPTURE_ARMED;
+    if (__atomic_load_n(&cal_capture_state, __ATOMIC_RELAXED) != CAPTURE_ARMED ||
+        !__atomic_compare_exchange_n(&cal_capture_state, &expected, CAPTURE_WRITING, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // Only the first channel of a stereo capture is kept
+    size_t frames = count / cal_ai_channels;
+    cal_frames[cal_frame_count++] = (CalibrateFrame){cal_capture_pos, frames, *arrival};
+    for (size_t i = 0; i < frames && cal_capture_pos < cal_capture_len; i++) {
+        cal_capture[cal_capture_pos++] = samples[i * cal_ai_channels];
+    }
+
+    int full = cal_capture_pos == cal_capture_len || cal_frame_count == cal_frame_capacity;
+    __atomic_store_n(&cal_capture_state, full ? CAPTURE_FULL : CAPTURE_ARMED, __ATOMIC_RELEASE);
+    if (full) {
+        sem_post(&cal_captured);
+    }
+}
+
+CalibrateStatus calibrate_result(CalibrateResult *result) {
+    heap_free(cal_playback);
+    cal_playback = NULL;
+    cal_running = 0;
+
+    *result = cal_result;
+    return cal_status;
+}
@@ -0,0 +1,76 @@
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Acoustic loopback calibration. An exponential sine sweep is played through
+ * the AO channel like an output client's stream while the record thread
+ * copies the AI channel aside; a worker thread then finds the sweep in the
+ * capture by FFT cross-correlation and times both paths. The network thread
+ * plays the sweep (see output_server_calibrate()) and collects the result
+ * when calibrate_event_fd() becomes readable.
+ */
+
+#define CALIBRATE_LEAD_MS 200           // Silence before the sweep, covers the stream fade-in
+#define CALIBRATE_SWEEP_MS 500
+#define CALIBRATE_TAIL_MS 100           // Silence after the sweep, covers the stream fade-out
+#define CALIBRATE_MAX_DELAY_MS 1000     // Longest AO to AI path that can be measured
+#define CALIBRATE_SWEEP_LOW_HZ 200      // The sweep ends at 90% of the lower Nyquist frequency
+#define CALIBRATE_SWEEP_AMPLITUDE 16384 // -6 dBFS
+#define CALIBRATE_MIN_PEAK 0.1          // Lowest normalized correlation taken as the sweep
+
+typedef enum {
+    CALIBRATE_OK,
+    CALIBRATE_BUSY,             // The AO channel is in use, or a calibration is running
+    CALIBRATE_NO_MEMORY,
+    CALIBRATE_NO_PLAYBACK,      // The sweep never reached the AO channel
+    CALIBRATE_NO_CAPTURE,       // The AI channel delivered no frames in time
+    CALIBRATE_NO_SIGNAL         // The sweep wasn't heard in the capture
+} CalibrateStatus;
+
+/**
+ * @brief Result of a calibration. Times are from the first sample of the
+ * sweep to the instant it was captured.
+ */
+typedef struct {
+    long latency_us;            // From queueing the sweep for playback, as client audio is queued
+    long offset_us;             // From IMP_AO_SendFrame, the AO to AI path an echo canceller sees
+    double lag_samples;         // Where the sweep starts in the capture, at the AI rate
+    double peak;                // Normalized correlation at the lag, 0 - 1
+} CalibrateResult;
+
+/**
+ * Generates the sweep and arms the capture. Called by the network thread
+ * when it takes the idle AO channel for the calibration.
+ * @return CALIBRATE_OK, CALIBRATE_BUSY or CALIBRATE_NO_MEMORY.
+ */
+CalibrateStatus calibrate_start(void);
+
+/**
+ * Copies the next part of the sweep for the AO queue and notes when the
+ * sweep itself was queued. Called by the network thread.
+ * @param queued Monotonic time the bytes are queued.
+ * @return Bytes copied, 0 once the whole signal has been queued.
+ */
+size_t calibrate_playback_read(unsigned char *buf, size_t size, const struct timespec *queued);
+
+/**
+ * Copies a captured frame while a calibration is recording. Called by the
+ * record thread for every frame; returns at once otherwise.
+ * @param arrival Monotonic time the frame was returned by the driver.
+ */
+void calibrate_capture(const int16_t *samples, int count, const struct timespec *arrival);
+
+// Becomes readable when a calibration result is ready, see calibrate_result().
+int calibrate_event_fd(void);
+
+/**
+ * Takes the finished calibration's result and allows the next one.
+ * @return CALIBRATE_OK with the result filled in, or the reason it failed.
+ */
+CalibrateStatus calibrate_result(CalibrateResult *result);
+
+#endif // CALIBRATE_H
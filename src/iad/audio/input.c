@@ -1,20 +1,46 @@
 #include <errno.h>          // for errno
 #include <stdio.h>          // for NULL, ssize_t
-#include <stdlib.h>         // for exit, free, EXIT_FAILURE
-#include <unistd.h>         // for write
+#include <string.h>         // for memcpy, memmove
+#include <sys/socket.h>     // for send
 #include <pthread.h>        // for pthread_mutex_lock, pthread_mutex_unlock
+#include <time.h>           // for clock_gettime
 #include "imp/imp_audio.h"  // for IMPAudioIOAttr, IMPAudioFrame, IMP_AI_Dis...
 #include "imp/imp_log.h"    // for IMP_LOG_ERR
-#include "audio_common.h"   // for AudioInputAttributes, PlayInputAttributes
-#include "cJSON.h"          // for cJSON
-#include "config.h"         // for is_valid_samplerate
+#include "audio_common.h"   // for get_audio_input_device_attributes
+#include "calibrate.h"      // for calibrate_capture
+#include "config.h"         // for config_get, is_valid_samplerate
 #include "input.h"
+#include "lockstat.h"       // for audio_lock, audio_unlock
 #include "logging.h"        // for handle_audio_error
+#include "parameters.h"     // for parameter_batch_apply_pending, parameters_apply_ai
+#include "realtime.h"       // for realtime_setup_thread
+#include "telemetry.h"      // for telemetry_count, telemetry_level
+#include "trace.h"          // for trace_event
 #include "utils.h"          // for ClientNode, client_list_head, compute_num...
 
 #define TRUE 1
 #define TAG "AI"
 
+// Set by a configuration reload, taken by a record thread between two frames
+static int ai_reinit_requested = 0;
+
+// Duration of the last capture outage, read by the control server
+static long g_ai_last_recovery_ms = 0;
+
+/**
+ * @brief State of the capture supervisor, only touched by the record thread.
+ */
+typedef struct {
+    int faults;                     // Consecutive failed reads, 0 while capturing
+    int backoff_ms;                 // Wait before the next re-initialization
+    struct timespec fault_start;    // First fault of the current outage
+    struct timespec last_frame;     // Last frame delivered to the clients, captured or silence
+    size_t frame_len;               // Size of the last captured frame
+} AiSupervisor;
+
+// Sent in place of frames lost to a capture outage
+static const unsigned char ai_silence[AI_MAX_FRAME_BYTES];
+
 /**
  * Initializes the audio input device with the specified attributes.
  *
@@ -28,14 +54,14 @@
 int initialize_audio_input_device(int aiDevID, int aiChnID) {
     int ret;
     IMPAudioIOAttr attr;
-    AudioInputAttributes attrs = get_audio_input_attributes();
+    const AudioInputConfig *config = &config_get()->ai;
 
-    attr.bitwidth = attrs.bitwidthItem ? string_to_bitwidth(attrs.bitwidthItem->valuestring) : AUDIO_BIT_WIDTH_16;
-    attr.soundmode = attrs.soundmodeItem ? string_to_soundmode(attrs.soundmodeItem->valuestring) : AUDIO_SOUND_MODE_MONO;
-    attr.frmNum = attrs.frmNumItem ? attrs.frmNumItem->valueint : DEFAULT_AI_FRM_NUM;
+    attr.bitwidth = config->bitwidth;
+    attr.soundmode = config->soundmode;
+    attr.frmNum = config->frm_num;
 
     // Validate and set samplerate for the audio device
-    attr.samplerate = attrs.samplerateItem ? attrs.samplerateItem->valueint : DEFAULT_AI_SAMPLE_RATE;
+    attr.samplerate = config->sample_rate;
     if (!is_valid_samplerate(attr.samplerate)) {
         IMP_LOG_ERR(TAG, "Invalid samplerate value: %d. Using default value: %d.\n", attr.samplerate, DEFAULT_AI_SAMPLE_RATE);
         attr.samplerate = DEFAULT_AI_SAMPLE_RATE;
@@ -43,7 +69,7 @@ int initialize_audio_input_device(int aiDevID, int aiChnID) {
 
     attr.numPerFrm = compute_numPerFrm(attr.samplerate);
 
-    int chnCnt = attrs.chnCntItem ? attrs.chnCntItem->valueint : DEFAULT_AI_CHN_CNT;
+    int chnCnt = config->chn_cnt;
     if (chnCnt > 1) {
         IMP_LOG_ERR(TAG, "chnCnt value out of range: %d. Using default value: %d.\n", chnCnt, DEFAULT_AI_CHN_CNT);
         chnCnt = DEFAULT_AI_CHN_CNT;
@@ -54,57 +80,45 @@ int initialize_audio_input_device(int aiDevID, int aiChnID) {
     ret = IMP_AI_SetPubAttr(aiDevID, &attr);
     if (ret != 0) {
         IMP_LOG_ERR(TAG, "IMP_AI_SetPubAttr failed");
-        handle_audio_error(TAG, "Fatal Error: Failed to initialize audio attributes");
-        exit(EXIT_FAILURE);
+        handle_audio_error(TAG, "Failed to initialize audio attributes");
+        return -1;
     }
 
     // Enable AI device
     ret = IMP_AI_Enable(aiDevID);
     if (ret != 0) {
         IMP_LOG_ERR(TAG, "IMP_AI_Enable failed");
-        handle_audio_error(TAG, "Fatal Error: Failed to enable AI device");
-        exit(EXIT_FAILURE);
+        handle_audio_error(TAG, "Failed to enable AI device");
+        return -1;
     }
 
     // Set audio frame depth attribute
     IMPAudioIChnParam chnParam;
-    chnParam.usrFrmDepth = attrs.usrFrmDepthItem ? attrs.usrFrmDepthItem->valueint : DEFAULT_AI_USR_FRM_DEPTH;
+    chnParam.usrFrmDepth = config->usr_frm_depth;
 
     // Set audio channel attributes
     ret = IMP_AI_SetChnParam(aiDevID, aiChnID, &chnParam);
     if (ret != 0) {
         IMP_LOG_ERR(TAG, "IMP_AI_SetChnParam failed");
-        exit(EXIT_FAILURE);
+        return -1;
     }
 
     // Enable AI channel
     ret = IMP_AI_EnableChn(aiDevID, aiChnID);
     if (ret != 0) {
         IMP_LOG_ERR(TAG, "IMP_AI_EnableChn failed");
-        handle_audio_error(TAG, "Fatal Error: Failed to enable AI channel");
-        exit(EXIT_FAILURE);
-    }
-
-    // Set volume and gain for the audio device
-    int vol = attrs.SetVolItem ? attrs.SetVolItem->valueint : DEFAULT_AI_CHN_VOL;
-    if (vol < -30 || vol > 120) {
-        IMP_LOG_ERR(TAG, "SetVol value out of range: %d. Using default value: %d.\n", vol, DEFAULT_AI_CHN_VOL);
-        vol = DEFAULT_AI_CHN_VOL;
-    }
-    if (IMP_AI_SetVol(aiDevID, aiChnID, vol)) {
-        handle_audio_error("Failed to set volume attribute");
+        handle_audio_error(TAG, "Failed to enable AI channel");
+        return -1;
     }
 
-    int gain = attrs.SetGainItem ? attrs.SetGainItem->valueint : DEFAULT_AI_GAIN;
-    if (gain < 0 || gain > 31) {
-        IMP_LOG_ERR(TAG, "SetGain value out of range: %d. Using default value: %d.\n", gain, DEFAULT_AI_GAIN);
-        gain = DEFAULT_AI_GAIN;
-    }
-    if (IMP_AI_SetGain(aiDevID, aiChnID, gain)) {
-        handle_audio_error("Failed to set gain attribute");
-    }
+    // Volume, gain and the audio processing are reset on a new channel; the
+    // parameter registry holds the configured values or the last ones SET
+    parameters_apply_ai();
 
     // Debugging prints
+    int vol = 0, gain = 0;
+    IMP_AI_GetVol(aiDevID, aiChnID, &vol);
+    IMP_AI_GetGain(aiDevID, aiChnID, &gain);
     printf("[INFO] AI samplerate: %d\n", attr.samplerate);
     printf("[INFO] AI Volume: %d\n", vol);
     printf("[INFO] AI Gain: %d\n", gain);
@@ -112,12 +126,205 @@ int initialize_audio_input_device(int aiDevID, int aiChnID) {
     return 0;
 }
 
+/**
+ * Asks the record thread to re-initialize the AI channel with the current
+ * configuration between two frames.
+ */
+void ai_request_reinit() {
+    __atomic_store_n(&ai_reinit_requested, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Re-initializes the AI channel if a configuration reload asked for it.
+ * Connected clients stay connected and receive the new format from the next
+ * frame; volume, gain and the audio processing keep their current values.
+ * @param aiDevID Device ID.
+ * @param aiChnID Channel ID.
+ */
+static void apply_requested_reinit(int aiDevID, int aiChnID) {
+    if (!__atomic_exchange_n(&ai_reinit_requested, 0, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    // Without audio_buffer_lock, so the AO direction keeps playing meanwhile;
+    // only this thread reads frames from the AI channel
+    printf("[INFO] [AI] Reinitializing audio input with the reloaded configuration\n");
+    disable_audio_input();
+    initialize_audio_input_device(aiDevID, aiChnID);
+}
+
+/**
+ * Sends a frame to a client without blocking. A frame that only partly fits in
+ * the socket buffer is completed before the next one, so the client never sees
+ * a torn sample; a frame that finds the previous one still incomplete, or no
+ * room at all, is dropped. Clients that hung up are closed by the network thread.
+ * Must be called with audio_buffer_lock held.
+ */
+static void send_to_client(ClientNode *client, const unsigned char *data, size_t len) {
+    int fd = client->handler.fd;
+
+    if (client->pending_len > 0) {
+        ssize_t sent = send(fd, client->pending, client->pending_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent > 0) {
+            client->bytes_sent += sent;
+            client->pending_len -= sent;
+            memmove(client->pending, client->pending + sent, client->pending_len);
+        }
+        if (client->pending_len > 0) {
+            client->drops++;
+            trace_event(TRACE_QUEUE_FULL, client->id, TRACE_CLIENT_INPUT);
+            return;
+        }
+    }
+
+    ssize_t sent = send(fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent <= 0) {
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EPIPE && errno != ECONNRESET) {
+            handle_audio_error("AI: write to sockfd");
+            trace_event(TRACE_ERROR, TRACE_ERROR_CLIENT_WRITE, errno);
+        }
+        client->drops++;
+        trace_event(TRACE_QUEUE_FULL, client->id, TRACE_CLIENT_INPUT);
+        return;
+    }
+    client->bytes_sent += sent;
+
+    if ((size_t)sent < len) {
+        // The input server sizes pending for the largest frame
+        if (client->pending_size < len - sent) {
+            client->drops++;
+            trace_event(TRACE_QUEUE_FULL, client->id, TRACE_CLIENT_INPUT);
+            return;
+        }
+        memcpy(client->pending, data + sent, len - sent);
+        client->pending_len = len - sent;
+    }
+}
+
+long ai_last_recovery_ms() {
+    return __atomic_load_n(&g_ai_last_recovery_ms, __ATOMIC_RELAXED);
+}
+
+static int ai_should_stop(void) {
+    pthread_mutex_lock(&g_stop_thread_mutex);
+    int should_stop = g_stop_thread;
+    pthread_mutex_unlock(&g_stop_thread_mutex);
+    return should_stop;
+}
+
+static long ai_elapsed_ms(const struct timespec *since, const struct timespec *now) {
+    return (now->tv_sec - since->tv_sec) * 1000 + (now->tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/**
+ * Sends silence for the frame periods that passed without a frame, so clients
+ * stay connected and their stream keeps its timing across a capture outage.
+ * @param upcoming Frames about to be delivered that cover part of the gap.
+ */
+static void ai_fill_gap(AiSupervisor *sup, int upcoming) {
+    if (sup->frame_len == 0 || sup->frame_len > sizeof(ai_silence)) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long missing = ai_elapsed_ms(&sup->last_frame, &now) / (long)(FRAME_DURATION * 1000) - upcoming;
+    if (missing <= 0) {
+        return;
+    }
+
+    audio_lock(LOCK_SITE_AI_RECOVERY);
+    for (long i = 0; i < missing; i++) {
+        for (ClientNode *current = client_list_head; current; current = current->next) {
+            send_to_client(current, ai_silence, sup->frame_len);
+        }
+    }
+    audio_unlock();
+    telemetry_add(TELEMETRY_AI_GAP_FRAMES, missing);
+
+    // Advance by whole periods so the remainder counts toward the next gap
+    long advance_ms = missing * (long)(FRAME_DURATION * 1000);
+    sup->last_frame.tv_sec += advance_ms / 1000;
+    sup->last_frame.tv_nsec += (advance_ms % 1000) * 1000000;
+    if (sup->last_frame.tv_nsec >= 1000000000) {
+        sup->last_frame.tv_sec++;
+        sup->last_frame.tv_nsec -= 1000000000;
+    }
+}
+
+// Waits up to ms, a frame period at a time, so a stop request isn't held up.
+static void ai_backoff_sleep(AiSupervisor *sup, int ms) {
+    int step_ms = (int)(FRAME_DURATION * 1000);
+    for (int waited = 0; waited < ms && !ai_should_stop(); waited += step_ms) {
+        struct timespec step = {0, (long)(ms - waited < step_ms ? ms - waited : step_ms) * 1000000};
+        nanosleep(&step, NULL);
+        ai_fill_gap(sup, 0);
+    }
+}
+
+/**
+ * Handles a failed read. A brief driver hiccup is retried right away; once
+ * AI_FAULT_RETRIES reads in a row failed, the AI channel is re-initialized
+ * after a backoff that doubles with every attempt.
+ * @param counter The fault counter to raise.
+ */
+static void ai_capture_fault(AiSupervisor *sup, TelemetryCounter counter, int aiDevID, int aiChnID) {
+    telemetry_count(counter);
+    telemetry_count(TELEMETRY_DEVICE_ERROR);
+    trace_event(TRACE_ERROR, counter == TELEMETRY_AI_GET_FAULTS ? TRACE_ERROR_AI_GET : TRACE_ERROR_AI_POLL, errno);
+
+    if (sup->faults++ == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &sup->fault_start);
+        sup->backoff_ms = AI_RECOVERY_BACKOFF_MIN_MS;
+        printf("[INFO] [AI] Capture fault, clients stay connected while recovering\n");
+    }
+    ai_fill_gap(sup, 0);
+
+    if (sup->faults <= AI_FAULT_RETRIES) {
+        return;
+    }
+
+    ai_backoff_sleep(sup, sup->backoff_ms);
+    sup->backoff_ms = sup->backoff_ms * 2 > AI_RECOVERY_BACKOFF_MAX_MS ? AI_RECOVERY_BACKOFF_MAX_MS : sup->backoff_ms * 2;
+    if (ai_should_stop()) {
+        return;
+    }
+
+    // No audio_buffer_lock while the device is set up again, so playback
+    // isn't held up; ai_fill_gap() takes it for the silence sent to clients
+    printf("[INFO] [AI] Re-initializing the AI channel after %d failed reads\n", sup->faults);
+    telemetry_count(TELEMETRY_AI_REINITS);
+    disable_audio_input();
+    int ret = initialize_audio_input_device(aiDevID, aiChnID);
+    if (ret != 0) {
+        telemetry_count(TELEMETRY_DEVICE_ERROR);
+        trace_event(TRACE_ERROR, TRACE_ERROR_AI_REINIT, errno);
+    }
+}
+
+/**
+ * Ends an outage once a frame was captured again: fills the rest of the gap
+ * and records how long the outage lasted.
+ */
+static void ai_capture_recovered(AiSupervisor *sup, const struct timespec *now) {
+    long recovery_ms = ai_elapsed_ms(&sup->fault_start, now);
+
+    ai_fill_gap(sup, 1);
+    telemetry_count(TELEMETRY_AI_RECOVERIES);
+    telemetry_observe_us(TELEMETRY_AI_RECOVERY_TIME, recovery_ms * 1000);
+    __atomic_store_n(&g_ai_last_recovery_ms, recovery_ms, __ATOMIC_RELAXED);
+    printf("[INFO] [AI] Capture recovered after %ld ms and %d failed reads\n", recovery_ms, sup->faults);
+    sup->faults = 0;
+}
+
 /**
  * The main thread function for recording audio input.
  *
- * This function continuously records audio from the specified device and
- * channel, and sends the recorded data to connected clients. It handles
- * errors gracefully by releasing any acquired resources.
+ * This function initializes the audio input device, then continuously
+ * records audio and sends every frame to all connected clients without
+ * blocking. Clients are added and removed by the network thread.
+ * Failed reads don't end the thread: the channel is retried and
+ * re-initialized until capture resumes, see ai_capture_fault().
  *
  * @param arg Unused thread argument.
  * @return NULL.
@@ -126,63 +333,76 @@ void *ai_record_thread(void *arg) {
     printf("[INFO] [AI] Entering ai_record_thread\n");
 
     int ret;
+    AiSupervisor sup = {0};
+
+    // Real-time priority so video encoder and ISP load doesn't cause capture overruns
+    realtime_setup_thread("AI", &config_get()->ai.thread);
 
     int aiDevID, aiChnID;
     get_audio_input_device_attributes(&aiDevID, &aiChnID);
 
-    printf("[INFO] Sending audio data to input client\n");
+    clock_gettime(CLOCK_MONOTONIC, &sup.last_frame);
+    if (initialize_audio_input_device(aiDevID, aiChnID) != 0) {
+        fprintf(stderr, "[ERROR] Failed to initialize audio input device, retrying\n");
+        clock_gettime(CLOCK_MONOTONIC, &sup.fault_start);
+        sup.faults = AI_FAULT_RETRIES;
+        sup.backoff_ms = AI_RECOVERY_BACKOFF_MIN_MS;
+    }
 
     while (TRUE) {
+        if (ai_should_stop()) {
+            break;
+        }
+
         // Polling for frame
-        ret = IMP_AI_PollingFrame(aiDevID, aiChnID, 1000);
+        ret = IMP_AI_PollingFrame(aiDevID, aiChnID, AI_POLL_TIMEOUT_MS);
         if (ret != 0) {
             IMP_LOG_ERR(TAG, "IMP_AI_PollingFrame failed");
-            return NULL;
+            ai_capture_fault(&sup, TELEMETRY_AI_POLL_FAULTS, aiDevID, aiChnID);
+            continue;
         }
 
         IMPAudioFrame frm;
-        ret = IMP_AI_GetFrame(aiDevID, aiChnID, &frm, 1000);
+        struct timespec get_start;
+        clock_gettime(CLOCK_MONOTONIC, &get_start);
+        ret = IMP_AI_GetFrame(aiDevID, aiChnID, &frm, AI_POLL_TIMEOUT_MS);
         if (ret != 0) {
             IMP_LOG_ERR(TAG, "IMP_AI_GetFrame failed");
-            return NULL;
+            ai_capture_fault(&sup, TELEMETRY_AI_GET_FAULTS, aiDevID, aiChnID);
+            continue;
         }
 
-        pthread_mutex_lock(&audio_buffer_lock);
+        struct timespec frame_start;
+        clock_gettime(CLOCK_MONOTONIC, &frame_start);
+        telemetry_observe_us(TELEMETRY_AI_GET_TIME, telemetry_elapsed_us(&get_start));
+        sup.frame_len = frm.len;
+        if (sup.faults > 0) {
+            ai_capture_recovered(&sup, &frame_start);
+        }
+        sup.last_frame = frame_start;
+        telemetry_count(TELEMETRY_AI_FRAMES);
+        trace_event(TRACE_AI_FRAME, frm.len, frm.seq);
+        telemetry_level(TELEMETRY_LEVEL_AI, (int16_t *)frm.virAddr, frm.len / sizeof(int16_t));
+        calibrate_capture((int16_t *)frm.virAddr, frm.len / sizeof(int16_t), &frame_start);
+
+        audio_lock(LOCK_SITE_AI_FANOUT);
+        telemetry_observe_us(TELEMETRY_AI_LOCK_WAIT, telemetry_elapsed_us(&frame_start));
 
         // Iterate over all clients and send the audio data
-        ClientNode *current = client_list_head;
-        while (current) {
-            ssize_t wr_sock = write(current->sockfd, frm.virAddr, frm.len);
-
-            if (wr_sock < 0) {
-                if (errno == EPIPE) {
-                    printf("[INFO] Client disconnected\n");
-                } else {
-                    handle_audio_error("AI: write to sockfd");
-                }
-
-                if (current == client_list_head) {
-                    client_list_head = current->next;
-                    free(current);
-                    current = client_list_head;
-                } else {
-                    ClientNode *temp = client_list_head;
-                    while (temp->next != current) {
-                        temp = temp->next;
-                    }
-                    temp->next = current->next;
-                    free(current);
-                    current = temp->next;
-                }
-                continue;
-            }
-            current = current->next;
+        for (ClientNode *current = client_list_head; current; current = current->next) {
+            send_to_client(current, (const unsigned char *)frm.virAddr, frm.len);
+            telemetry_observe_us(TELEMETRY_AI_WRITE_DELAY, telemetry_elapsed_us(&frame_start));
         }
 
-        pthread_mutex_unlock(&audio_buffer_lock);
+        audio_unlock();
+        telemetry_observe_us(TELEMETRY_AI_FRAME_TIME, telemetry_elapsed_us(&frame_start));
 
         // Release audio frame
         IMP_AI_ReleaseFrame(aiDevID, aiChnID, &frm);
+
+        // Frame boundary: apply batched parameter changes between two frames
+        parameter_batch_apply_pending();
+        apply_requested_reinit(aiDevID, aiChnID);
     }
 
     return NULL;
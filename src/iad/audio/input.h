@@ -11,14 +11,28 @@
 #define DEFAULT_AI_DEV_ID 0
 #define DEFAULT_AI_CHN_ID 0
 #define DEFAULT_AI_USR_FRM_DEPTH 40
+#define DEFAULT_AI_THREAD_PRIORITY 98
 
-typedef struct {
-    int sockfd;
-} AiThreadArg;
+// Largest frame the AI channel delivers: 40 ms of 96 kHz mono 16-bit audio
+#define AI_MAX_FRAME_BYTES (AUDIO_SAMPLE_RATE_96000 / 25 * 2)
+
+// A frame is due every 40 ms; this long without one counts as a capture fault
+#define AI_POLL_TIMEOUT_MS 200
+// Failed reads retried before the AI channel is re-initialized
+#define AI_FAULT_RETRIES 3
+// Wait before each re-initialization, doubling up to the maximum
+#define AI_RECOVERY_BACKOFF_MIN_MS 40
+#define AI_RECOVERY_BACKOFF_MAX_MS 5000
 
 // Functions
 int initialize_audio_input_device(int aiDevID, int aiChnID);
-void *ai_record_thread(void *output_file_path);
+void *ai_record_thread(void *arg);
 int disable_audio_input(void);
 
+// Re-initializes the AI channel from the current configuration at the next frame boundary
+void ai_request_reinit(void);
+
+// Milliseconds the last capture outage lasted, from its first fault to the next frame
+long ai_last_recovery_ms(void);
+
 #endif // INPUT_H
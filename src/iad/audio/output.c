@@ -1,15 +1,24 @@
+#include <errno.h>
 #include <pthread.h>
-#include <sched.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
 #include "imp/imp_audio.h"
 #include "imp/imp_log.h"
+#include "ao_queue.h"
 #include "audio_common.h"
 #include "config.h"
-#include "cJSON.h"
 #include "output.h"
+#include "lockstat.h"
 #include "logging.h"
+#include "parameters.h"
+#include "pool.h"
+#include "realtime.h"
+#include "telemetry.h"
+#include "trace.h"
 #include "utils.h"
 
 #define TRUE 1
@@ -18,6 +27,30 @@
 // Global variable to hold the maximum frame size for audio output.
 int g_ao_max_frame_size = DEFAULT_AO_MAX_FRAME_SIZE;
 
+// Stream lifecycle state, protected by audio_buffer_lock
+static int g_ao_fade_samples = 0;      // Length of the fade in/out ramps in samples
+static int g_ao_fade_in_pos = 0;       // Samples of the fade-in ramp already applied
+static int g_ao_stream_ending = 0;     // Set by the output server once the client stopped sending
+static int16_t g_ao_last_sample = 0;   // Last sample handed to the AO channel
+static int16_t *g_ao_tail_buffer = NULL;
+static int g_ao_tail_capacity = 0;     // Samples g_ao_tail_buffer holds; it only ever grows
+static int g_ao_drain_timeout_ms = 0;
+static unsigned int g_ao_generation = 0; // Bumped on every stream switch to invalidate queued frames
+static int g_ao_sending = 0;             // Set while the play thread is inside IMP_AO_SendFrame
+static long g_ao_switch_latency_us = 0;  // Duration of the last stream switch
+static int g_ao_reinit_requested = 0;    // Set by a configuration reload, taken by the play thread
+static int g_ao_reinitializing = 0;      // Set while the play thread re-initializes the AO channel
+static int g_ao_event_fd = -1;           // Signalled whenever the play thread finished sending a frame
+
+// Underrun concealment state, protected by audio_buffer_lock
+static int g_ao_stream_active = 0;       // Set once a stream has played its first frame
+static struct timespec g_ao_stream_start;  // When the stream's first frame was sent, zero before that
+static int g_ao_concealing = 0;          // Set while the play thread is filling a gap in the stream
+static int64_t g_ao_frame_period_ns = 0; // Playback time of one full frame
+static unsigned long g_ao_underruns = 0;
+static unsigned long long g_ao_concealed_samples = 0;
+static int16_t *g_ao_conceal_buffer = NULL;
+
 /**
  * Set the global maximum frame size for audio output.
  * @param frame_size The desired frame size.
@@ -34,6 +67,8 @@ void set_ao_max_frame_size(int frame_size) {
  */
 void handle_and_reinitialize_output(int aoDevID, int aoChnID, const char *errorMsg) {
     handle_audio_error(errorMsg);
+    telemetry_count(TELEMETRY_DEVICE_ERROR);
+    trace_event(TRACE_ERROR, TRACE_ERROR_AO_DEVICE, errno);
     reinitialize_audio_output_device(aoDevID, aoChnID);
 }
 
@@ -44,15 +79,15 @@ void handle_and_reinitialize_output(int aoDevID, int aoChnID, const char *errorM
  */
 void initialize_audio_output_device(int aoDevID, int aoChnID) {
     IMPAudioIOAttr attr;
-    AudioOutputAttributes attrs = get_audio_attributes();
+    const AudioOutputConfig *config = &config_get()->ao;
 
     // Set audio attributes based on the configuration or default values
-    attr.bitwidth = attrs.bitwidthItem ? string_to_bitwidth(attrs.bitwidthItem->valuestring) : AUDIO_BIT_WIDTH_16;
-    attr.soundmode = attrs.soundmodeItem ? string_to_soundmode(attrs.soundmodeItem->valuestring) : AUDIO_SOUND_MODE_MONO;
-    attr.frmNum = attrs.frmNumItem ? attrs.frmNumItem->valueint : DEFAULT_AO_FRM_NUM;
+    attr.bitwidth = config->bitwidth;
+    attr.soundmode = config->soundmode;
+    attr.frmNum = config->frm_num;
 
     // Validate and set samplerate for the audio device
-    attr.samplerate = attrs.samplerateItem ? attrs.samplerateItem->valueint : DEFAULT_AO_SAMPLE_RATE;
+    attr.samplerate = config->sample_rate;
     if (!is_valid_samplerate(attr.samplerate)) {
         IMP_LOG_ERR(TAG, "Invalid samplerate value: %d. Using default value: %d.\n", attr.samplerate, DEFAULT_AO_SAMPLE_RATE);
         attr.samplerate = DEFAULT_AO_SAMPLE_RATE;
@@ -60,7 +95,7 @@ void initialize_audio_output_device(int aoDevID, int aoChnID) {
 
     attr.numPerFrm = compute_numPerFrm(attr.samplerate);
 
-    int chnCnt = attrs.chnCntItem ? attrs.chnCntItem->valueint : DEFAULT_AO_CHN_CNT;
+    int chnCnt = config->chn_cnt;
     if (chnCnt > 1) {
         IMP_LOG_ERR(TAG, "chnCnt value out of range: %d. Using default value: %d.\n", chnCnt, DEFAULT_AO_CHN_CNT);
         chnCnt = DEFAULT_AO_CHN_CNT;
@@ -74,38 +109,58 @@ void initialize_audio_output_device(int aoDevID, int aoChnID) {
         exit(EXIT_FAILURE);
     }
 
-    // Set volume and gain for the audio device
-    int vol = attrs.SetVolItem ? attrs.SetVolItem->valueint : DEFAULT_AO_CHN_VOL;
-    if (vol < -30 || vol > 120) {
-        IMP_LOG_ERR(TAG, "SetVol value out of range: %d. Using default value: %d.\n", vol, DEFAULT_AO_CHN_VOL);
-        vol = DEFAULT_AO_CHN_VOL;
-    }
-    if (IMP_AO_SetVol(aoDevID, aoChnID, vol)) {
-        handle_audio_error("Failed to set volume attribute");
+    // Volume, gain and mute are reset on a new channel; the parameter
+    // registry holds the configured values or the last ones SET
+    parameters_apply_ao();
+
+    // The device is set up without audio_buffer_lock so the AI direction keeps
+    // streaming; only the state shared with the other threads is updated under it
+    audio_lock(LOCK_SITE_AO_STATE);
+
+    // Allocate the frame queue between the output server and the play thread once;
+    // a reinitialization keeps whatever is already queued. The frame size is
+    // fixed along with it, so a reloaded frame_size only applies after a restart.
+    if (ao_queue_depth() == 0) {
+        set_ao_max_frame_size(config->frame_size);
+        if (ao_queue_init(config->queue_depth, g_ao_max_frame_size)) {
+            handle_audio_error("AO: Failed to allocate memory for the frame queue");
+            exit(EXIT_FAILURE);
+        }
     }
 
-    int gain = attrs.SetGainItem ? attrs.SetGainItem->valueint : DEFAULT_AO_GAIN;
-    if (gain < 0 || gain > 31) {
-        IMP_LOG_ERR(TAG, "SetGain value out of range: %d. Using default value: %d.\n", gain, DEFAULT_AO_GAIN);
-        gain = DEFAULT_AO_GAIN;
-    }
-    if (IMP_AO_SetGain(aoDevID, aoChnID, gain)) {
-        handle_audio_error("Failed to set gain attribute");
+    // Fade ramps are applied to 16-bit mono samples, the only format string_to_bitwidth accepts
+    g_ao_fade_samples = attr.samplerate / 1000 * config->fade_ms;
+    g_ao_fade_in_pos = g_ao_fade_samples;
+    if (g_ao_fade_samples > g_ao_tail_capacity || !g_ao_tail_buffer) {
+        int capacity = g_ao_fade_samples > 0 ? g_ao_fade_samples : 1;
+        heap_free(g_ao_tail_buffer);
+        g_ao_tail_buffer = (int16_t *) heap_calloc(capacity, sizeof(int16_t));
+        if (!g_ao_tail_buffer) {
+            handle_audio_error("AO: Failed to allocate memory for fade-out buffer");
+            exit(EXIT_FAILURE);
+        }
+        g_ao_tail_capacity = capacity;
     }
 
-    // Get frame size from config and set it
-    int frame_size_from_config = config_get_ao_frame_size();
-    set_ao_max_frame_size(frame_size_from_config);
-
-    // Allocate memory for audio_buffer based on the frame size
-    audio_buffer = (unsigned char*) malloc(g_ao_max_frame_size);
-    if (!audio_buffer) {
-        // Handle memory allocation failure
-        handle_audio_error("AO: Failed to allocate memory for audio_buffer");
-        exit(EXIT_FAILURE);
+    // Gaps in an active stream are filled with full frames of silence or comfort noise
+    g_ao_frame_period_ns = (int64_t)g_ao_max_frame_size / sizeof(int16_t) * 1000000000LL / attr.samplerate;
+    if (!g_ao_conceal_buffer) {
+        // The frame size is fixed at the first initialization, like the queue
+        g_ao_conceal_buffer = (int16_t *) heap_alloc(g_ao_max_frame_size);
+        if (!g_ao_conceal_buffer) {
+            handle_audio_error("AO: Failed to allocate memory for concealment buffer");
+            exit(EXIT_FAILURE);
+        }
     }
 
+    // Allow the internal and device queues to play out, plus some slack
+    g_ao_drain_timeout_ms = (attr.frmNum + ao_queue_depth() + 2) * (int)(FRAME_DURATION * 1000);
+    audio_unlock();
+
     // Debugging prints
+    int vol = 0, gain = 0;
+    IMP_AO_GetVol(aoDevID, aoChnID, &vol);
+    IMP_AO_GetGain(aoDevID, aoChnID, &gain);
     printf("[INFO] AO samplerate: %d\n", attr.samplerate);
     printf("[INFO] AO Volume: %d\n", vol);
     printf("[INFO] AO Gain: %d\n", gain);
@@ -117,21 +172,354 @@ void initialize_audio_output_device(int aoDevID, int aoChnID) {
  * This primarily involves freeing the memory allocated for the audio buffer.
  */
 void cleanup_audio_output() {
-    if (audio_buffer) {
-        free(audio_buffer);
-        audio_buffer = NULL;
+    ao_queue_free();
+    if (g_ao_tail_buffer) {
+        heap_free(g_ao_tail_buffer);
+        g_ao_tail_buffer = NULL;
+        g_ao_tail_capacity = 0;
+    }
+    if (g_ao_conceal_buffer) {
+        heap_free(g_ao_conceal_buffer);
+        g_ao_conceal_buffer = NULL;
+    }
+}
+
+/**
+ * Marks the start of a new client stream so its first samples are faded in.
+ * Must be called with audio_buffer_lock held.
+ */
+void ao_stream_begin() {
+    g_ao_fade_in_pos = 0;
+    g_ao_stream_ending = 0;
+    g_ao_stream_active = 0;
+    g_ao_concealing = 0;
+    g_ao_stream_start = (struct timespec){0};
+}
+
+/**
+ * Returns an eventfd that becomes readable whenever the play thread has sent
+ * a frame, i.e. a queue slot was freed, a stream finished or the channel
+ * state changed. The output server waits on it instead of blocking.
+ * @return The eventfd, or -1 if it could not be created.
+ */
+int ao_event_fd() {
+    audio_lock(LOCK_SITE_AO_STATE);
+    if (g_ao_event_fd < 0) {
+        g_ao_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (g_ao_event_fd < 0) {
+            handle_audio_error("AO: eventfd");
+        }
+    }
+    int fd = g_ao_event_fd;
+    audio_unlock();
+    return fd;
+}
+
+/**
+ * Wakes the output server. Must be called with audio_buffer_lock held.
+ */
+static void notify_output_server() {
+    if (g_ao_event_fd >= 0) {
+        uint64_t one = 1;
+        ssize_t written = write(g_ao_event_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+/**
+ * Marks the end of the current client stream. The play thread fades out
+ * whatever is still pending, or ramps the last played sample down to zero.
+ * Must be called with audio_buffer_lock held.
+ */
+void ao_stream_end() {
+    g_ao_stream_ending = 1;
+    pthread_cond_broadcast(&audio_data_cond);
+}
+
+/**
+ * Switches the AO channel to a new stream without re-enabling it. Frames of the
+ * previous stream still in the internal queue are invalidated through the queue
+ * generation, and anything left in the channel is discarded with
+ * IMP_AO_ClearChnBuf. The channel keeps running and its volume and gain are
+ * untouched. Waits at most for one in-flight IMP_AO_SendFrame, i.e. one frame period.
+ * Must be called without audio_buffer_lock held.
+ */
+void ao_stream_switch() {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    audio_lock(LOCK_SITE_AO_SWITCH);
+    g_ao_generation++;
+    telemetry_add(TELEMETRY_AO_FRAMES_DROPPED, ao_queue_count());
+    ao_queue_clear();
+    while (g_ao_sending) {
+        audio_cond_wait(&audio_data_cond, NULL);
+    }
+    ao_stream_begin();
+    g_ao_last_sample = 0;
+
+    int aoDevID, aoChnID;
+    get_audio_output_device_attributes(&aoDevID, &aoChnID);
+
+    // A channel being re-initialized starts out empty anyway
+    IMPAudioOChnState state;
+    if (!g_ao_reinitializing &&
+        IMP_AO_QueryChnStat(aoDevID, aoChnID, &state) == 0 && state.chnBusyNum > 0) {
+        if (IMP_AO_ClearChnBuf(aoDevID, aoChnID)) {
+            handle_audio_error("AO: Failed to clear stale audio on stream switch");
+        }
     }
+    audio_unlock();
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    g_ao_switch_latency_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+/**
+ * Returns how long the last stream switch took.
+ * @return The switch duration in microseconds.
+ */
+long ao_last_switch_latency_us() {
+    return g_ao_switch_latency_us;
+}
+
+/**
+ * Reports when the current stream's first frame was handed to
+ * IMP_AO_SendFrame. Must be called with audio_buffer_lock held.
+ * @return 0 on success, -1 if the stream hasn't played yet.
+ */
+int ao_stream_start_time(struct timespec *start) {
+    if (g_ao_stream_start.tv_sec == 0 && g_ao_stream_start.tv_nsec == 0) {
+        return -1;
+    }
+    *start = g_ao_stream_start;
+    return 0;
+}
+
+/**
+ * Returns the number of underruns concealed since startup. An underrun is
+ * counted once per gap, however many frames it takes to fill.
+ * @return The underrun count.
+ */
+unsigned long ao_underrun_count() {
+    audio_lock(LOCK_SITE_AO_STATE);
+    unsigned long count = g_ao_underruns;
+    audio_unlock();
+    return count;
+}
+
+/**
+ * Returns the number of silence or comfort noise samples inserted since startup.
+ * @return The concealed sample count.
+ */
+unsigned long long ao_concealed_samples() {
+    audio_lock(LOCK_SITE_AO_STATE);
+    unsigned long long count = g_ao_concealed_samples;
+    audio_unlock();
+    return count;
+}
+
+/**
+ * Applies the fade-in ramp to the head of a stream.
+ * @param samples Sample buffer.
+ * @param count Number of samples in the buffer.
+ */
+static void apply_fade_in(int16_t *samples, int count) {
+    for (int i = 0; i < count && g_ao_fade_in_pos < g_ao_fade_samples; i++, g_ao_fade_in_pos++) {
+        samples[i] = (int16_t)((int32_t)samples[i] * g_ao_fade_in_pos / g_ao_fade_samples);
+    }
+}
+
+/**
+ * Applies the fade-out ramp to the tail of the final frame of a stream.
+ * @param samples Sample buffer.
+ * @param count Number of samples in the buffer.
+ */
+static void apply_fade_out(int16_t *samples, int count) {
+    int ramp = count < g_ao_fade_samples ? count : g_ao_fade_samples;
+    for (int i = 0; i < ramp; i++) {
+        int16_t *s = &samples[count - ramp + i];
+        *s = (int16_t)((int32_t)*s * (ramp - 1 - i) / ramp);
+    }
+}
+
+/**
+ * Fills the tail buffer with a short frame ramping the last played sample down
+ * to silence, so a stream that ended on a non-zero sample doesn't leave a step
+ * in the output. Must be called with audio_buffer_lock held; the frame is sent
+ * once the lock is released.
+ * @return The number of samples in the frame, 0 if no ramp is needed.
+ */
+static int fill_fade_out_tail() {
+    if (g_ao_fade_samples <= 0 || g_ao_last_sample == 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < g_ao_fade_samples; i++) {
+        g_ao_tail_buffer[i] = (int16_t)((int32_t)g_ao_last_sample * (g_ao_fade_samples - 1 - i) / g_ao_fade_samples);
+    }
+    g_ao_last_sample = 0;
+
+    return g_ao_fade_samples;
+}
+
+/**
+ * Fills the concealment buffer with one frame of silence or low-level comfort
+ * noise. The first frame of a gap starts with a ramp from the last played
+ * sample, so the transition doesn't click.
+ * @return The number of samples in the frame.
+ */
+static int fill_concealment_frame() {
+    static uint32_t seed = 1;
+    int count = g_ao_max_frame_size / sizeof(int16_t);
+    int level = config_get()->ao.comfort_noise_level;
+
+    for (int i = 0; i < count; i++) {
+        int32_t sample = 0;
+        if (i < g_ao_fade_samples) {
+            sample = (int32_t)g_ao_last_sample * (g_ao_fade_samples - 1 - i) / g_ao_fade_samples;
+        }
+        if (level > 0) {
+            seed = seed * 1103515245 + 12345;
+            sample += (int32_t)((seed >> 16) % (2 * level + 1)) - level;
+        }
+        g_ao_conceal_buffer[i] = (int16_t)(sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample);
+    }
+    g_ao_last_sample = 0;
+
+    return count;
+}
+
+/**
+ * Computes when the AO channel will be half way through its last queued block,
+ * which leaves half a frame period to send the next frame before the hardware
+ * underruns.
+ * @param aoDevID Device ID.
+ * @param aoChnID Channel ID.
+ * @param due Set to the deadline on the monotonic clock.
+ */
+static void schedule_next_frame(int aoDevID, int aoChnID, struct timespec *due) {
+    IMPAudioOChnState state;
+    int busy = 1;
+    if (IMP_AO_QueryChnStat(aoDevID, aoChnID, &state) == 0 && state.chnBusyNum > 1) {
+        busy = state.chnBusyNum;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, due);
+    int64_t nsec = due->tv_nsec + (2 * busy - 1) * g_ao_frame_period_ns / 2;
+    due->tv_sec += nsec / 1000000000;
+    due->tv_nsec = nsec % 1000000000;
+}
+
+/**
+ * Waits on audio_data_cond until signalled or until the given monotonic time.
+ * Must be called with audio_buffer_lock held.
+ * @param due Deadline on the monotonic clock.
+ * @return 0 when signalled, ETIMEDOUT once the deadline has passed.
+ */
+static int wait_for_data_until(const struct timespec *due) {
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t remaining = (int64_t)(due->tv_sec - now.tv_sec) * 1000000000 + (due->tv_nsec - now.tv_nsec);
+    if (remaining <= 0) {
+        return ETIMEDOUT;
+    }
+
+    // audio_data_cond uses the default realtime clock
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    int64_t nsec = deadline.tv_nsec + remaining;
+    deadline.tv_sec += nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
+    return audio_cond_wait(&audio_data_cond, &deadline);
+}
+
+/**
+ * Returns the number of milliseconds elapsed since the given start time.
+ * @param start Start time on the monotonic clock.
+ */
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/**
+ * Checks whether the stream ended with ao_stream_end() has been handed to the
+ * AO channel and the channel has no more busy blocks queued. Never blocks.
+ * @param since When the stream was ended.
+ * @return 1 once drained, 0 while still playing, -1 on timeout or query failure.
+ */
+int ao_drain_state(const struct timespec *since) {
+    audio_lock(LOCK_SITE_AO_STATE);
+    int pending = g_ao_stream_ending || ao_queue_count() > 0 || g_ao_reinitializing;
+    audio_unlock();
+
+    if (!pending) {
+        int aoDevID, aoChnID;
+        get_audio_output_device_attributes(&aoDevID, &aoChnID);
+
+        IMPAudioOChnState state;
+        if (IMP_AO_QueryChnStat(aoDevID, aoChnID, &state)) {
+            handle_audio_error("AO: Failed to query channel state");
+            return -1;
+        }
+        if (state.chnBusyNum == 0) {
+            return 1;
+        }
+    }
+
+    return elapsed_ms(since) > g_ao_drain_timeout_ms ? -1 : 0;
 }
 
 /**
  * Reinitialize the audio device by first disabling it and then initializing.
+ * Runs without audio_buffer_lock; g_ao_reinitializing keeps the network
+ * thread from querying or clearing the channel meanwhile.
+ * Must be called by the play thread without audio_buffer_lock held.
  * @param aoDevID Device ID.
  * @param aoChnID Channel ID.
  */
 void reinitialize_audio_output_device(int aoDevID, int aoChnID) {
+    audio_lock(LOCK_SITE_AO_STATE);
+    g_ao_reinitializing = 1;
+    audio_unlock();
+
     IMP_AO_DisableChn(aoDevID, aoChnID);
     IMP_AO_Disable(aoDevID);
     initialize_audio_output_device(aoDevID, aoChnID);
+
+    audio_lock(LOCK_SITE_AO_STATE);
+    g_ao_reinitializing = 0;
+    audio_unlock();
+}
+
+/**
+ * Asks the play thread to re-initialize the AO channel with the current
+ * configuration at its next frame boundary.
+ */
+void ao_request_reinit() {
+    __atomic_store_n(&g_ao_reinit_requested, 1, __ATOMIC_RELEASE);
+
+    // Wake the play thread if it is idle
+    audio_lock(LOCK_SITE_AO_STATE);
+    pthread_cond_broadcast(&audio_data_cond);
+    audio_unlock();
+}
+
+/**
+ * Re-initializes the AO channel if a configuration reload asked for it.
+ * Queued client audio is kept and plays on with the new format; volume, gain
+ * and mute keep their current values, see parameters_apply_ao().
+ * @param aoDevID Device ID.
+ * @param aoChnID Channel ID.
+ */
+static void apply_requested_reinit(int aoDevID, int aoChnID) {
+    if (!__atomic_exchange_n(&g_ao_reinit_requested, 0, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    printf("[INFO] [AO] Reinitializing audio output with the reloaded configuration\n");
+    reinitialize_audio_output_device(aoDevID, aoChnID);
 }
 
 /**
@@ -142,10 +530,8 @@ void reinitialize_audio_output_device(int aoDevID, int aoChnID) {
 void *ao_play_thread(void *arg) {
     printf("[INFO] [AO] Entering ao_play_thread\n");
 
-    // Boost the thread priority for real-time audio playback
-    struct sched_param param;
-    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
-    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    // Real-time priority for playback, SCHED_FIFO at the highest priority by default
+    realtime_setup_thread("AO", &config_get()->ao.thread);
 
     int aoDevID, aoChnID;
     get_audio_output_device_attributes(&aoDevID, &aoChnID);
@@ -153,35 +539,182 @@ void *ao_play_thread(void *arg) {
     // Initialize the audio device for playback
     initialize_audio_output_device(aoDevID, aoChnID);
 
+    // Deadline for the next frame while a stream is active
+    struct timespec next_frame_due;
+
     // Continuous loop to play audio
     while (TRUE) {
-        pthread_mutex_lock(&audio_buffer_lock);
-
-        // Wait until there's audio data in the buffer
-        while (audio_buffer_size == 0) {
+        // Frame boundary: apply batched parameter changes between two frames
+        parameter_batch_apply_pending();
+        apply_requested_reinit(aoDevID, aoChnID);
+
+        struct timespec lock_start;
+        clock_gettime(CLOCK_MONOTONIC, &lock_start);
+        audio_lock(LOCK_SITE_AO_PLAY);
+        telemetry_observe_us(TELEMETRY_AO_LOCK_WAIT, telemetry_elapsed_us(&lock_start));
+
+        // Wait until there's a queued frame or the stream has ended. While a
+        // stream is active, give up once the channel is about to run dry.
+        int conceal = 0;
+        int reinit = 0;
+        while (ao_queue_count() == 0 && !g_ao_stream_ending) {
             // Add thread termination check here
             pthread_mutex_lock(&g_stop_thread_mutex);
             if (g_stop_thread) {
-                pthread_mutex_unlock(&audio_buffer_lock);
+                audio_unlock();
                 pthread_mutex_unlock(&g_stop_thread_mutex);
                 return NULL;
             }
             pthread_mutex_unlock(&g_stop_thread_mutex);
 
-            pthread_cond_wait(&audio_data_cond, &audio_buffer_lock);
+            if (!g_ao_stream_active) {
+                if (__atomic_load_n(&g_ao_reinit_requested, __ATOMIC_ACQUIRE)) {
+                    reinit = 1;
+                    break;
+                }
+                audio_cond_wait(&audio_data_cond, NULL);
+            } else if (wait_for_data_until(&next_frame_due) == ETIMEDOUT &&
+                       ao_queue_count() == 0 && !g_ao_stream_ending) {
+                conceal = 1;
+                break;
+            }
         }
 
-        IMPAudioFrame frm = {.virAddr = (uint32_t *)audio_buffer, .len = audio_buffer_size};
+        if (reinit) {
+            audio_unlock();
+            continue;
+        }
 
-        // Send the audio frame for playback
-        if (IMP_AO_SendFrame(aoDevID, aoChnID, &frm, BLOCK)) {
-            pthread_mutex_unlock(&audio_buffer_lock);
-            handle_and_reinitialize_output(aoDevID, aoChnID, "IMP_AO_SendFrame data error");
+        if (conceal) {
+            // Keep the channel fed on schedule so the stream resumes without
+            // a pop and with the same latency once data arrives again
+            if (!g_ao_concealing) {
+                g_ao_concealing = 1;
+                g_ao_underruns++;
+                telemetry_count(TELEMETRY_UNDERRUN);
+                trace_event(TRACE_AO_UNDERRUN, 0, g_ao_underruns);
+            }
+            int sample_count = fill_concealment_frame();
+            g_ao_concealed_samples += sample_count;
+            g_ao_sending = 1;
+            audio_unlock();
+
+            IMPAudioFrame frm = {.virAddr = (uint32_t *)g_ao_conceal_buffer, .len = sample_count * sizeof(int16_t)};
+            int send_failed = IMP_AO_SendFrame(aoDevID, aoChnID, &frm, BLOCK);
+            schedule_next_frame(aoDevID, aoChnID, &next_frame_due);
+
+            audio_lock(LOCK_SITE_AO_PLAY);
+            g_ao_sending = 0;
+            pthread_cond_broadcast(&audio_data_cond);
+            notify_output_server();
+            audio_unlock();
+
+            if (send_failed) {
+                handle_and_reinitialize_output(aoDevID, aoChnID, "IMP_AO_SendFrame concealment error");
+            }
             continue;
         }
 
-        audio_buffer_size = 0;
-        pthread_mutex_unlock(&audio_buffer_lock);
+        if (ao_queue_count() == 0) {
+            // Stream ended after its last frame was already played. The ramp
+            // to silence blocks for a while in IMP_AO_SendFrame, so it is sent
+            // without the lock, like any other frame.
+            int tail_count = fill_fade_out_tail();
+            unsigned int generation = g_ao_generation;
+            g_ao_sending = 1;
+            audio_unlock();
+
+            int send_failed = 0;
+            if (tail_count > 0) {
+                IMPAudioFrame frm = {.virAddr = (uint32_t *)g_ao_tail_buffer, .len = tail_count * sizeof(int16_t)};
+                send_failed = IMP_AO_SendFrame(aoDevID, aoChnID, &frm, BLOCK);
+            }
+
+            audio_lock(LOCK_SITE_AO_PLAY);
+            g_ao_sending = 0;
+            // A stream switch while sending already reset the stream state
+            if (generation == g_ao_generation) {
+                g_ao_stream_ending = 0;
+                g_ao_stream_active = 0;
+                g_ao_concealing = 0;
+            }
+            pthread_cond_broadcast(&audio_data_cond);
+            notify_output_server();
+            audio_unlock();
+
+            if (send_failed) {
+                handle_audio_error("AO: Failed to send fade-out frame");
+            }
+            continue;
+        }
+
+        // Data after a gap fades in again from the concealment frames
+        if (g_ao_concealing) {
+            g_ao_concealing = 0;
+            g_ao_fade_in_pos = 0;
+        }
+
+        // The head slot is only touched by this thread until it is popped,
+        // so the lock can be dropped while the frame is processed and sent
+        ssize_t frame_len;
+        struct timespec read_time;
+        unsigned char *frame = ao_queue_head(&frame_len, &read_time);
+        int last_frame = g_ao_stream_ending && ao_queue_count() == 1;
+        int first_frame = !g_ao_stream_active;
+        unsigned int generation = g_ao_generation;
+        g_ao_sending = 1;
+        audio_unlock();
+
+        struct timespec frame_start;
+        clock_gettime(CLOCK_MONOTONIC, &frame_start);
+        telemetry_observe_us(TELEMETRY_AO_QUEUE_WAIT, telemetry_elapsed_us(&read_time));
+        int16_t *samples = (int16_t *)frame;
+        int sample_count = frame_len / sizeof(int16_t);
+        apply_fade_in(samples, sample_count);
+        if (last_frame) {
+            apply_fade_out(samples, sample_count);
+        }
+        if (sample_count > 0) {
+            g_ao_last_sample = samples[sample_count - 1];
+        }
+        telemetry_level(TELEMETRY_LEVEL_AO, samples, sample_count);
+
+        IMPAudioFrame frm = {.virAddr = (uint32_t *)frame, .len = frame_len};
+        telemetry_observe_us(TELEMETRY_AO_FRAME_TIME, telemetry_elapsed_us(&frame_start));
+
+        // Send the audio frame for playback
+        struct timespec send_start;
+        clock_gettime(CLOCK_MONOTONIC, &send_start);
+        int send_failed = IMP_AO_SendFrame(aoDevID, aoChnID, &frm, BLOCK);
+        if (!send_failed) {
+            long send_us = telemetry_elapsed_us(&send_start);
+            telemetry_count(TELEMETRY_AO_FRAMES);
+            telemetry_observe_us(TELEMETRY_AO_SEND_TIME, send_us);
+            trace_event(TRACE_AO_FRAME, frame_len, send_us);
+            telemetry_observe_us(TELEMETRY_AO_PATH_TIME, telemetry_elapsed_us(&read_time));
+        }
+        schedule_next_frame(aoDevID, aoChnID, &next_frame_due);
+
+        audio_lock(LOCK_SITE_AO_PLAY);
+        g_ao_sending = 0;
+        // A stream switch while sending already emptied the queue
+        if (generation == g_ao_generation) {
+            if (first_frame && !send_failed) {
+                g_ao_stream_start = send_start;
+            }
+            ao_queue_pop();
+            g_ao_stream_active = !last_frame;
+            if (last_frame) {
+                g_ao_stream_ending = 0;
+            }
+        }
+        pthread_cond_broadcast(&audio_data_cond);
+        notify_output_server();
+        audio_unlock();
+
+        if (send_failed) {
+            handle_and_reinitialize_output(aoDevID, aoChnID, "IMP_AO_SendFrame data error");
+        }
     }
 
     return NULL;
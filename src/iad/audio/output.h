@@ -2,6 +2,7 @@
 #define OUTPUT_H
 
 #include <pthread.h>
+#include <time.h>
 #include "imp/imp_audio.h"  // for AUDIO_SAMPLE_RATE_48000
 
 #define DEFAULT_AO_SAMPLE_RATE AUDIO_SAMPLE_RATE_48000
@@ -12,6 +13,10 @@
 #define DEFAULT_AO_FRM_NUM 20
 #define DEFAULT_AO_DEV_ID 0
 #define DEFAULT_AO_CHN_ID 0
+#define DEFAULT_AO_FADE_MS 10
+#define DEFAULT_AO_CREDIT_FRAMES 4
+#define DEFAULT_AO_COMFORT_NOISE_LEVEL 0
+#define DEFAULT_AO_THREAD_PRIORITY 99
 
 // Functions
 void reinitialize_audio_output_device(int aoDevID, int aoChnID);
@@ -22,6 +27,31 @@ void set_ao_max_frame_size(int frame_size);
 void cleanup_audio_output();
 int disable_audio_output(void);
 
+// Stream lifecycle, called by the output server with audio_buffer_lock held
+void ao_stream_begin(void);
+void ao_stream_end(void);
+
+// Returns 1 once the ended stream has fully played out of the AO channel, 0 while it
+// is still playing, -1 if it did not drain within the drain timeout since it ended
+int ao_drain_state(const struct timespec *since);
+
+// Becomes readable whenever the play thread has sent a frame
+int ao_event_fd(void);
+
+// Discards stale audio and starts a new stream on the running channel
+void ao_stream_switch(void);
+long ao_last_switch_latency_us(void);
+
+// When the current stream's first frame was sent; called with audio_buffer_lock held
+int ao_stream_start_time(struct timespec *start);
+
+// Re-initializes the AO channel from the current configuration at the next frame boundary
+void ao_request_reinit(void);
+
+// Underrun concealment counters
+unsigned long ao_underrun_count(void);
+unsigned long long ao_concealed_samples(void);
+
 // Global variable declaration for the maximum frame size for audio output.
 extern int g_ao_max_frame_size;
 
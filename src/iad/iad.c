@@ -4,22 +4,24 @@
  * This daemon manages audio input and output for the Ingenic Tomahawk class devices.
  */
 
-#if !defined(__UCLIBC__) && !defined(__GLIBC__)
-#include <bits/signal.h>             // Signal definitions
-#endif
 #include <signal.h>                  // Signal handling functions
 #include <stdio.h>                   // Standard I/O functions
 #include <stdlib.h>
 #include <pthread.h>                 // Multithreading functions
 #include "iad.h"
-#include "network/input_server.h"    // Audio input server functions
-#include "network/output_server.h"   // Audio output server functions
-#include "network/control_server.h"  // Audio control server functions
+#include "network/network.h"         // Network thread serving all sockets
+#include "network/handover.h"        // Socket handover from a running daemon
+#include "network/parameters.h"      // Runtime parameter registry
+#include "network/reload.h"          // Configuration reload on SIGHUP
+#include "audio/input.h"             // Audio input functions
 #include "audio/output.h"            // Audio output functions
 #include "utils/cmdline.h"           // Command-line argument parsing
 #include "utils/config.h"            // Configuration file handling
 #include "utils/utils.h"             // Utility functions
 #include "utils/logging.h"           // Logging functions
+#include "utils/footprint.h"         // Thread stack tracking
+#include "utils/trace.h"             // Event trace ring
+#include "utils/realtime.h"          // Memory locking
 #include "version.h"                 // Version information
 
 #define TAG "IAD"
@@ -43,6 +45,11 @@ int main(int argc, char *argv[]) {
         return 1; // Exit on command line parsing error
     }
 
+    // Take the sockets of the running daemon and wait for it to release the devices
+    if (options.takeover && handover_take_over()) {
+        return 1;
+    }
+
     // Check to see if daemonize was requested
     if (options.daemonize) {
         daemonize();
@@ -65,20 +72,14 @@ int main(int argc, char *argv[]) {
     int disable_ai = options.disable_ai;
     int disable_ao = options.disable_ao;
 
-    // Load and validate the audio configuration from the specified file
-    if (config_load_from_file(config_file_path) == 0) {
-        if (!validate_json(get_audio_config())) {
-            handle_audio_error("Invalid configuration format. Continuing with default settings.", config_file_path);
-        }
-    } else {
+    // Load, validate and compile the audio configuration from the specified file
+    int config_result = config_load_from_file(config_file_path);
+    if (config_result == CONFIG_INVALID) {
+        handle_audio_error("Invalid configuration format. Continuing with default settings.", config_file_path);
+    } else if (config_result != CONFIG_OK) {
         handle_audio_error("Failed to load configuration. Continuing with default settings. File", config_file_path);
     }
 
-    /* Debug only
-    cJSON *loaded_config = get_audio_config();
-    printf("Loaded JSON: %s\n", cJSON_Print(loaded_config));
-    */
-
     // Determine whether to enable audio input/output based on configuration
     if (!disable_ai) {
         disable_ai = !config_get_ai_enabled();
@@ -88,45 +89,57 @@ int main(int argc, char *argv[]) {
         disable_ao = !config_get_ao_enabled();
     }
 
-    pthread_t control_server_thread, input_server_thread, output_server_thread, play_thread_id;
+    // Lock memory before any thread is started so their stacks are locked too
+    realtime_lock_memory();
+    footprint_register_thread("main");
 
-    // Launch the control server thread
-    if (create_thread(&control_server_thread, audio_control_server_thread, NULL)) {
-        return 1;
-    }
+    pthread_t network_thread_id, record_thread_id, play_thread_id;
+
+    // Build the runtime parameter registry served by the control socket
+    parameters_init();
+
+    // Reload iad.json on SIGHUP; the network thread applies the changes
+    reload_init();
 
-    // Launch the audio input server thread (if audio input is enabled)
+    // Record events for post-mortem analysis, written out on TRACE, SIGUSR1 or a crash
+    trace_init();
+
+    // Launch the audio capture thread (if audio input is enabled)
     if (!disable_ai) {
-        if (create_thread(&input_server_thread, audio_input_server_thread, NULL)) {
+        if (create_thread(&record_thread_id, "ai", ai_record_thread, NULL)) {
             return 1;
         }
     }
 
-    // Launch the audio output server thread (if audio output is enabled)
+    // Launch the audio playback thread (if audio output is enabled)
     if (!disable_ao) {
-        if (create_thread(&output_server_thread, audio_output_server_thread, NULL)) {
+        if (create_thread(&play_thread_id, "ao", ao_play_thread, NULL)) {
             return 1;
         }
     }
 
-    // Launch the audio playback thread (if audio output is enabled)
-    if (!disable_ao) {
-        if (create_thread(&play_thread_id, ao_play_thread, NULL)) {
-            return 1;
-        }
+    // Launch the network thread serving the control, input and output sockets
+    NetworkServers servers = {.ai_enabled = !disable_ai, .ao_enabled = !disable_ao};
+    if (create_thread(&network_thread_id, "network", network_thread, &servers)) {
+        return 1;
     }
 
-    // Wait for all launched threads to complete their execution
-    pthread_join(control_server_thread, NULL);
+    // The network thread returns once a termination signal arrived
+    pthread_join(network_thread_id, NULL);
+
+    // Stop the audio threads, then release the devices
+    stop_audio_threads();
 
     if (!disable_ai) {
-        pthread_join(input_server_thread, NULL);
+        pthread_join(record_thread_id, NULL);
     }
 
     if (!disable_ao) {
-        pthread_join(output_server_thread, NULL);
         pthread_join(play_thread_id, NULL);
     }
 
+    perform_cleanup();
+    printf("[INFO] Audio daemon stopped\n");
+
     return 0; // Successful termination
 }
@@ -0,0 +1,632 @@
+/*
+ * MOCK IMP AUDIO BACKEND
+ *
+ * Implements the IMP_AI_* and IMP_AO_* calls iad makes, so `make host` can
+ * link the daemon natively on a PC without libimp. The AI channel delivers
+ * frames on the frame clock, the AO channel plays into a buffer of frmNum
+ * frames that drains at the sample rate, so IMP_AO_SendFrame and
+ * IMP_AO_QueryChnStat block and report like the real driver does.
+ *
+ * Configured from the environment:
+ *   IAD_MOCK_AI     Capture source: "sine" (440 Hz), "sine:<hz>", "noise",
+ *                   "silence", a 16-bit PCM WAV file that is looped, or
+ *                   "loopback[:<ms>]": what the AO channel plays, heard by
+ *                   the AI channel <ms> (default 40) after it left the buffer.
+ *   IAD_MOCK_AO     File receiving the played PCM; unset or "null" discards it.
+ *   IAD_MOCK_SPEED  Clock multiplier, e.g. 4 runs four times faster than
+ *                   real time; 0 doesn't pace at all. Defaults to 1.
+ *   IAD_MOCK_AI_FAULT "<frames>:<reads>" makes <reads> polls fail after
+ *                   <frames> good frames, to exercise capture recovery.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "imp/imp_audio.h"
+#include "imp/imp_log.h"
+
+#define MOCK_MAX_FRAME_SAMPLES 4096
+#define MOCK_SINE_AMPLITUDE 8000
+#define MOCK_DEFAULT_SINE_HZ 440
+#define MOCK_DEFAULT_LOOPBACK_MS 40
+#define MOCK_MAX_LOOPBACK_MS 2000
+#define MOCK_LOOPBACK_SAMPLES (1 << 18)   // Capture samples in flight from AO to AI, a power of two
+
+typedef enum {
+    MOCK_SOURCE_SINE,
+    MOCK_SOURCE_NOISE,
+    MOCK_SOURCE_SILENCE,
+    MOCK_SOURCE_WAV,
+    MOCK_SOURCE_LOOPBACK
+} MockSource;
+
+static pthread_once_t mock_once = PTHREAD_ONCE_INIT;
+static double mock_speed = 1.0;
+
+// Capture side, only touched by the record thread
+static IMPAudioIOAttr ai_attr = {.samplerate = AUDIO_SAMPLE_RATE_16000, .bitwidth = AUDIO_BIT_WIDTH_16,
+                                 .soundmode = AUDIO_SOUND_MODE_MONO, .frmNum = 20, .numPerFrm = 640, .chnCnt = 1};
+static MockSource ai_source = MOCK_SOURCE_SINE;
+static double ai_sine_hz = MOCK_DEFAULT_SINE_HZ;
+static int16_t *ai_wav = NULL;
+static size_t ai_wav_samples = 0;
+static size_t ai_wav_pos = 0;
+static unsigned long long ai_position = 0;     // Samples generated so far
+static int16_t ai_frame[MOCK_MAX_FRAME_SAMPLES];
+static double ai_next_frame = 0;               // Mock time the next frame is due
+static int ai_seq = 0;
+static int ai_fault_after = -1;                // Good frames before injected faults, -1 for none
+static int ai_fault_reads = 0;
+static int ai_vol = 60, ai_gain = 20, ai_alc_gain = 0;
+static double ai_loopback_delay = MOCK_DEFAULT_LOOPBACK_MS / 1000.0;
+
+// Playback side, shared by the play thread and the network thread
+static pthread_mutex_t ao_lock = PTHREAD_MUTEX_INITIALIZER;
+static IMPAudioIOAttr ao_attr = {.samplerate = AUDIO_SAMPLE_RATE_16000, .bitwidth = AUDIO_BIT_WIDTH_16,
+                                 .soundmode = AUDIO_SOUND_MODE_MONO, .frmNum = 20, .numPerFrm = 640, .chnCnt = 1};
+static double ao_buffered = 0;                 // Samples waiting in the device buffer
+static double ao_drained_at = 0;               // Mock time ao_buffered was last updated
+static int ao_paused = 0;
+static FILE *ao_sink = NULL;
+static int ao_vol = 60, ao_gain = 20;
+
+/*
+ * Loopback path, protected by ao_lock. Slot k % MOCK_LOOPBACK_SAMPLES holds
+ * the capture sample due at mock time k / AI rate; the play side writes
+ * ahead as frames are sent and the capture side clears what it has read.
+ */
+static int16_t *loopback_ring = NULL;
+
+// Real time since startup, stretched by IAD_MOCK_SPEED
+static double mock_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9) * (mock_speed > 0 ? mock_speed : 1.0);
+}
+
+// Sleeps for the given mock time
+static void mock_sleep(double seconds) {
+    if (mock_speed > 0 && seconds > 0) {
+        usleep((useconds_t)(seconds / mock_speed * 1e6));
+    }
+}
+
+/**
+ * Loads a 16-bit PCM WAV file for the capture source. Only the first channel
+ * of a multi-channel file is used.
+ * @return 0 on success, -1 if the file can't be read, is empty or truncated,
+ *         or has another format.
+ */
+static int mock_load_wav(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("[MOCK] Failed to open the capture WAV file");
+        return -1;
+    }
+
+    unsigned char header[12];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+        memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "[MOCK] %s is not a WAV file\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    int channels = 0, bits = 0, rate = 0;
+    unsigned char chunk[8];
+    while (fread(chunk, 1, sizeof(chunk), f) == sizeof(chunk)) {
+        uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            unsigned char fmt[16];
+            if (fread(fmt, 1, sizeof(fmt), f) != sizeof(fmt)) {
+                break;
+            }
+            channels = fmt[2] | fmt[3] << 8;
+            rate = fmt[4] | fmt[5] << 8 | fmt[6] << 16 | fmt[7] << 24;
+            bits = fmt[14] | fmt[15] << 8;
+            fseek(f, size - sizeof(fmt) + (size & 1), SEEK_CUR);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (channels <= 0 || bits != 16) {
+                break;
+            }
+            size_t frames = size / (2 * channels);
+            if (frames == 0) {
+                fprintf(stderr, "[MOCK] %s has no samples\n", path);
+                fclose(f);
+                return -1;
+            }
+            ai_wav = malloc(frames * sizeof(int16_t));
+            int16_t *all = malloc(size);
+            if (!ai_wav || !all) {
+                free(all);
+                break;
+            }
+            if (fread(all, 1, size, f) != size) {
+                fprintf(stderr, "[MOCK] %s is truncated\n", path);
+                free(all);
+                free(ai_wav);
+                ai_wav = NULL;
+                fclose(f);
+                return -1;
+            }
+            for (size_t i = 0; i < frames; i++) {
+                ai_wav[i] = all[i * channels];
+            }
+            free(all);
+            ai_wav_samples = frames;
+            fclose(f);
+            printf("[INFO] [MOCK] Capturing %s: %zu samples at %d Hz, looped\n", path, frames, rate);
+            return 0;
+        } else {
+            fseek(f, size + (size & 1), SEEK_CUR);
+        }
+    }
+
+    fprintf(stderr, "[MOCK] %s is not 16-bit PCM\n", path);
+    free(ai_wav);
+    ai_wav = NULL;
+    fclose(f);
+    return -1;
+}
+
+// Reads the IAD_MOCK_* settings once
+static void mock_setup(void) {
+    const char *speed = getenv("IAD_MOCK_SPEED");
+    if (speed) {
+        mock_speed = atof(speed);
+    }
+
+    const char *source = getenv("IAD_MOCK_AI");
+    if (!source || strcmp(source, "sine") == 0) {
+        ai_source = MOCK_SOURCE_SINE;
+    } else if (strncmp(source, "sine:", 5) == 0) {
+        ai_source = MOCK_SOURCE_SINE;
+        ai_sine_hz = atof(source + 5);
+    } else if (strcmp(source, "noise") == 0) {
+        ai_source = MOCK_SOURCE_NOISE;
+    } else if (strcmp(source, "silence") == 0) {
+        ai_source = MOCK_SOURCE_SILENCE;
+    } else if (strncmp(source, "loopback", 8) == 0 && (source[8] == '\0' || source[8] == ':')) {
+        loopback_ring = calloc(MOCK_LOOPBACK_SAMPLES, sizeof(int16_t));
+        ai_source = loopback_ring ? MOCK_SOURCE_LOOPBACK : MOCK_SOURCE_SILENCE;
+        if (source[8] == ':') {
+            double ms = atof(source + 9);
+            ai_loopback_delay = (ms < 0 ? 0 : ms > MOCK_MAX_LOOPBACK_MS ? MOCK_MAX_LOOPBACK_MS : ms) / 1000.0;
+        }
+        printf("[INFO] [MOCK] Capturing the AO channel with a %g ms delay\n", ai_loopback_delay * 1000);
+    } else if (mock_load_wav(source) == 0) {
+        ai_source = MOCK_SOURCE_WAV;
+    } else {
+        fprintf(stderr, "[MOCK] Unusable IAD_MOCK_AI source %s, capturing a sine tone\n", source);
+        ai_source = MOCK_SOURCE_SINE;
+    }
+
+    const char *sink = getenv("IAD_MOCK_AO");
+    if (sink && strcmp(sink, "null") != 0) {
+        ao_sink = fopen(sink, "wb");
+        if (!ao_sink) {
+            perror("[MOCK] Failed to open the playback file, discarding playback");
+        }
+    }
+
+    const char *fault = getenv("IAD_MOCK_AI_FAULT");
+    if (fault && sscanf(fault, "%d:%d", &ai_fault_after, &ai_fault_reads) != 2) {
+        ai_fault_after = -1;
+    }
+
+    printf("[INFO] [MOCK] IMP mock backend, speed %gx\n", mock_speed);
+}
+
+static void mock_init(void) {
+    pthread_once(&mock_once, mock_setup);
+}
+
+void imp_log_fun(int le, int op, int out, const char *tag, const char *file, int line, const char *func,
+                 const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "[IMP] [%s] ", tag);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+int IMP_Log_Get_Option(void) {
+    return 0;
+}
+
+/*
+ * Audio input
+ */
+
+int IMP_AI_SetPubAttr(int audioDevId, IMPAudioIOAttr *attr) {
+    mock_init();
+    if (attr->numPerFrm <= 0 || attr->numPerFrm > MOCK_MAX_FRAME_SAMPLES || attr->samplerate <= 0) {
+        return -1;
+    }
+    ai_attr = *attr;
+    return 0;
+}
+
+int IMP_AI_GetPubAttr(int audioDevId, IMPAudioIOAttr *attr) {
+    *attr = ai_attr;
+    return 0;
+}
+
+int IMP_AI_Enable(int audioDevId) {
+    mock_init();
+    return 0;
+}
+
+int IMP_AI_Disable(int audioDevId) {
+    return 0;
+}
+
+int IMP_AI_EnableChn(int audioDevId, int aiChn) {
+    ai_next_frame = 0;
+    return 0;
+}
+
+int IMP_AI_DisableChn(int audioDevId, int aiChn) {
+    return 0;
+}
+
+int IMP_AI_SetChnParam(int audioDevId, int aiChn, IMPAudioIChnParam *chnParam) {
+    return 0;
+}
+
+int IMP_AI_PollingFrame(int audioDevId, int aiChn, unsigned int timeout_ms) {
+    if (ai_fault_after == 0 && ai_fault_reads > 0) {
+        ai_fault_reads--;
+        usleep(timeout_ms * 1000);
+        ai_next_frame = 0;
+        return -1;
+    }
+    if (ai_fault_after > 0) {
+        ai_fault_after--;
+    }
+
+    // Frames come out on the frame clock, like the codec's DMA delivers them
+    double period = (double)ai_attr.numPerFrm / ai_attr.samplerate;
+    double now = mock_now();
+    if (ai_next_frame == 0) {
+        ai_next_frame = now + period;
+    }
+    mock_sleep(ai_next_frame - now);
+    ai_next_frame += period;
+    return 0;
+}
+
+int IMP_AI_GetFrame(int audioDevId, int aiChn, IMPAudioFrame *frm, IMPBlock block) {
+    if (ai_source == MOCK_SOURCE_LOOPBACK) {
+        // The frame PollingFrame just waited for ended one period before the next one is due
+        double period = (double)ai_attr.numPerFrm / ai_attr.samplerate;
+        long long first = llround((ai_next_frame - 2 * period) * ai_attr.samplerate);
+
+        pthread_mutex_lock(&ao_lock);
+        for (int i = 0; i < ai_attr.numPerFrm; i++) {
+            int16_t *slot = &loopback_ring[(first + i) & (MOCK_LOOPBACK_SAMPLES - 1)];
+            ai_frame[i] = *slot;
+            *slot = 0;
+        }
+        pthread_mutex_unlock(&ao_lock);
+        ai_position += ai_attr.numPerFrm;
+    }
+
+    for (int i = 0; i < ai_attr.numPerFrm && ai_source != MOCK_SOURCE_LOOPBACK; i++, ai_position++) {
+        switch (ai_source) {
+            case MOCK_SOURCE_SINE:
+                ai_frame[i] = (int16_t)(MOCK_SINE_AMPLITUDE * sin(2 * M_PI * ai_sine_hz * ai_position / ai_attr.samplerate));
+                break;
+            case MOCK_SOURCE_NOISE:
+                ai_frame[i] = (int16_t)(rand() % (2 * MOCK_SINE_AMPLITUDE + 1) - MOCK_SINE_AMPLITUDE);
+                break;
+            case MOCK_SOURCE_WAV:
+                ai_frame[i] = ai_wav[ai_wav_pos];
+                ai_wav_pos = (ai_wav_pos + 1) % ai_wav_samples;
+                break;
+            default:
+                ai_frame[i] = 0;
+                break;
+        }
+    }
+
+    frm->bitwidth = ai_attr.bitwidth;
+    frm->soundmode = ai_attr.soundmode;
+    frm->virAddr = (uint32_t *)ai_frame;
+    frm->phyAddr = 0;
+    frm->timeStamp = (int64_t)(mock_now() * 1e6);
+    frm->seq = ai_seq++;
+    frm->len = ai_attr.numPerFrm * sizeof(int16_t);
+    return 0;
+}
+
+int IMP_AI_ReleaseFrame(int audioDevId, int aiChn, IMPAudioFrame *frm) {
+    return 0;
+}
+
+int IMP_AI_SetVol(int audioDevId, int aiChn, int aiVol) {
+    ai_vol = aiVol;
+    return 0;
+}
+
+int IMP_AI_GetVol(int audioDevId, int aiChn, int *vol) {
+    *vol = ai_vol;
+    return 0;
+}
+
+int IMP_AI_SetVolMute(int audioDevId, int aiChn, int mute) {
+    return 0;
+}
+
+int IMP_AI_SetGain(int audioDevId, int aiChn, int aiGain) {
+    ai_gain = aiGain;
+    return 0;
+}
+
+int IMP_AI_GetGain(int audioDevId, int aiChn, int *aiGain) {
+    *aiGain = ai_gain;
+    return 0;
+}
+
+int IMP_AI_SetAlcGain(int audioDevId, int aiChn, int aiPgaGain) {
+    ai_alc_gain = aiPgaGain;
+    return 0;
+}
+
+int IMP_AI_GetAlcGain(int audioDevId, int aiChn, int *aiPgaGain) {
+    *aiPgaGain = ai_alc_gain;
+    return 0;
+}
+
+int IMP_AI_EnableAec(int aiDevId, int aiChn, int aoDevId, int aoChn) {
+    return 0;
+}
+
+int IMP_AI_DisableAec(int aiDevId, int aiChn) {
+    return 0;
+}
+
+int IMP_AI_EnableAecRefFrame(int audioDevId, int aiChn, int audioAoDevId, int aoChn) {
+    return 0;
+}
+
+int IMP_AI_DisableAecRefFrame(int audioDevId, int aiChn, int audioAoDevId, int aoChn) {
+    return 0;
+}
+
+int IMP_AI_EnableNs(IMPAudioIOAttr *attr, int mode) {
+    return 0;
+}
+
+int IMP_AI_DisableNs(void) {
+    return 0;
+}
+
+int IMP_AI_EnableHpf(IMPAudioIOAttr *attr) {
+    return 0;
+}
+
+int IMP_AI_DisableHpf(void) {
+    return 0;
+}
+
+int IMP_AI_SetHpfCoFrequency(int cofrequency) {
+    return 0;
+}
+
+int IMP_AI_EnableAgc(IMPAudioIOAttr *attr, IMPAudioAgcConfig agcConfig) {
+    return 0;
+}
+
+int IMP_AI_DisableAgc(void) {
+    return 0;
+}
+
+/*
+ * Audio output
+ */
+
+/**
+ * Schedules a frame for the capture side, resampled to the AI rate by taking
+ * the nearest played sample. Must be called with ao_lock held.
+ * @param play_at Mock time the frame's first sample leaves the device buffer.
+ */
+static void loopback_write(const int16_t *samples, int count, double play_at) {
+    int ai_rate = ai_attr.samplerate;
+    double start = play_at + ai_loopback_delay;
+    double end = start + (double)count / ao_attr.samplerate;
+
+    for (long long k = (long long)ceil(start * ai_rate); k < end * ai_rate; k++) {
+        int j = (int)((k / (double)ai_rate - start) * ao_attr.samplerate);
+        loopback_ring[k & (MOCK_LOOPBACK_SAMPLES - 1)] = samples[j < count ? j : count - 1];
+    }
+}
+
+// Plays out what the elapsed time allows. Must be called with ao_lock held.
+static void ao_drain(void) {
+    double now = mock_now();
+    if (mock_speed <= 0) {
+        ao_buffered = 0;
+    } else if (!ao_paused && ao_drained_at > 0) {
+        ao_buffered -= (now - ao_drained_at) * ao_attr.samplerate;
+        if (ao_buffered < 0) {
+            ao_buffered = 0;
+        }
+    }
+    ao_drained_at = now;
+}
+
+int IMP_AO_SetPubAttr(int audioDevId, IMPAudioIOAttr *attr) {
+    mock_init();
+    if (attr->numPerFrm <= 0 || attr->frmNum <= 0 || attr->samplerate <= 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&ao_lock);
+    ao_attr = *attr;
+    pthread_mutex_unlock(&ao_lock);
+    return 0;
+}
+
+int IMP_AO_GetPubAttr(int audioDevId, IMPAudioIOAttr *attr) {
+    pthread_mutex_lock(&ao_lock);
+    *attr = ao_attr;
+    pthread_mutex_unlock(&ao_lock);
+    return 0;
+}
+
+int IMP_AO_Enable(int audioDevId) {
+    mock_init();
+    return 0;
+}
+
+int IMP_AO_Disable(int audioDevId) {
+    return 0;
+}
+
+int IMP_AO_EnableChn(int audioDevId, int aoChn) {
+    pthread_mutex_lock(&ao_lock);
+    ao_buffered = 0;
+    ao_drained_at = 0;
+    ao_paused = 0;
+    pthread_mutex_unlock(&ao_lock);
+    return 0;
+}
+
+int IMP_AO_DisableChn(int audioDevId, int aoChn) {
+    return 0;
+}
+
+int IMP_AO_SendFrame(int audioDevId, int aoChn, IMPAudioFrame *data, IMPBlock block) {
+    int samples = data->len / sizeof(int16_t);
+
+    // Wait for room in the device buffer, as the DMA frees it
+    while (1) {
+        pthread_mutex_lock(&ao_lock);
+        ao_drain();
+        double capacity = (double)ao_attr.frmNum * ao_attr.numPerFrm;
+        double excess = ao_buffered + samples - capacity;
+        if (excess <= 0 || mock_speed <= 0) {
+            if (loopback_ring) {
+                loopback_write((const int16_t *)data->virAddr, samples, ao_drained_at + ao_buffered / ao_attr.samplerate);
+            }
+            ao_buffered += samples;
+            pthread_mutex_unlock(&ao_lock);
+            break;
+        }
+        int paused = ao_paused;
+        double wait = excess / ao_attr.samplerate;
+        pthread_mutex_unlock(&ao_lock);
+
+        if (block == NOBLOCK) {
+            return -1;
+        }
+        mock_sleep(paused ? (double)ao_attr.numPerFrm / ao_attr.samplerate : wait);
+    }
+
+    if (ao_sink) {
+        fwrite(data->virAddr, 1, data->len, ao_sink);
+        fflush(ao_sink);
+    }
+    return 0;
+}
+
+int IMP_AO_PauseChn(int audioDevId, int aoChn) {
+    pthread_mutex_lock(&ao_lock);
+    ao_drain();
+    ao_paused = 1;
+    pthread_mutex_unlock(&ao_lock);
+    return 0;
+}
+
+int IMP_AO_ResumeChn(int audioDevId, int aoChn) {
+    pthread_mutex_lock(&ao_lock);
+    ao_drain();
+    ao_paused = 0;
+    pthread_mutex_unlock(&ao_lock);
+    return 0;
+}
+
+int IMP_AO_ClearChnBuf(int audioDevId, int aoChn) {
+    pthread_mutex_lock(&ao_lock);
+    ao_buffered = 0;
+    ao_drained_at = mock_now();
+    pthread_mutex_unlock(&ao_lock);
+    return 0;
+}
+
+int IMP_AO_FlushChnBuf(int audioDevId, int aoChn) {
+    // Blocks until everything buffered has played
+    while (1) {
+        pthread_mutex_lock(&ao_lock);
+        ao_drain();
+        double remaining = ao_paused ? 0 : ao_buffered / ao_attr.samplerate;
+        pthread_mutex_unlock(&ao_lock);
+        if (remaining <= 0) {
+            return 0;
+        }
+        mock_sleep(remaining);
+    }
+}
+
+int IMP_AO_QueryChnStat(int audioDevId, int aoChn, IMPAudioOChnState *status) {
+    pthread_mutex_lock(&ao_lock);
+    ao_drain();
+    int busy = (int)((ao_buffered + ao_attr.numPerFrm - 1) / ao_attr.numPerFrm);
+    status->chnTotalNum = ao_attr.frmNum;
+    status->chnBusyNum = busy;
+    status->chnFreeNum = ao_attr.frmNum - busy;
+    pthread_mutex_unlock(&ao_lock);
+    return 0;
+}
+
+int IMP_AO_SetVol(int audioDevId, int aoChn, int aoVol) {
+    ao_vol = aoVol;
+    return 0;
+}
+
+int IMP_AO_GetVol(int audioDevId, int aoChn, int *aoVol) {
+    *aoVol = ao_vol;
+    return 0;
+}
+
+int IMP_AO_SetGain(int audioDevId, int aoChn, int aoGain) {
+    ao_gain = aoGain;
+    return 0;
+}
+
+int IMP_AO_GetGain(int audioDevId, int aoChn, int *aoGain) {
+    *aoGain = ao_gain;
+    return 0;
+}
+
+int IMP_AO_SetVolMute(int audioDevId, int aoChn, int mute) {
+    return 0;
+}
+
+int IMP_AO_EnableAgc(IMPAudioIOAttr *attr, IMPAudioAgcConfig agcConfig) {
+    return 0;
+}
+
+int IMP_AO_DisableAgc(void) {
+    return 0;
+}
+
+int IMP_AO_EnableHpf(IMPAudioIOAttr *attr) {
+    return 0;
+}
+
+int IMP_AO_DisableHpf(void) {
+    return 0;
+}
+
+int IMP_AO_SetHpfCoFrequency(int cofrequency) {
+    return 0;
+}
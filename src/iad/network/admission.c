@@ -0,0 +1,236 @@
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "admission.h"
+#include "logging.h"
+#include "output_server.h"
+#include "pool.h"
+
+#define TAG "NET_ADMISSION"
+
+// FIFO of waiting output clients plus the client currently holding the AO channel
+static pthread_mutex_t admission_lock = PTHREAD_MUTEX_INITIALIZER;
+static AdmissionTicket *waiting_head = NULL;
+static AdmissionTicket *waiting_tail = NULL;
+static unsigned int next_ticket = 1;
+static unsigned int active_ticket = 0;
+static Pool tickets;    // Storage for waiting tickets, guarded by admission_lock
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Sends a short status line to a client without blocking the caller.
+ * Legacy clients never read these, so a full socket buffer is ignored.
+ */
+static void notify_client(int sockfd, const char *msg) {
+    send(sockfd, msg, strlen(msg), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+/**
+ * Tells every waiting client its current position. Must be called with admission_lock held.
+ */
+static void notify_positions(void) {
+    char msg[32];
+    int position = 1;
+    for (AdmissionTicket *t = waiting_head; t; t = t->next, position++) {
+        snprintf(msg, sizeof(msg), AO_QUEUED_FORMAT, position);
+        notify_client(t->sockfd, msg);
+    }
+}
+
+/**
+ * Unlinks a waiting ticket. Must be called with admission_lock held.
+ */
+static void remove_waiting(AdmissionTicket *prev, AdmissionTicket *t) {
+    if (prev) {
+        prev->next = t->next;
+    } else {
+        waiting_head = t->next;
+    }
+    if (waiting_tail == t) {
+        waiting_tail = prev;
+    }
+}
+
+int admission_init(int capacity) {
+    pthread_mutex_lock(&admission_lock);
+    int ret = pool_init(&tickets, "waiting output clients", sizeof(AdmissionTicket), capacity);
+    pthread_mutex_unlock(&admission_lock);
+
+    if (ret) {
+        handle_audio_error(TAG, "Failed to allocate admission tickets");
+    }
+    return ret;
+}
+
+void admission_shutdown() {
+    pthread_mutex_lock(&admission_lock);
+    while (waiting_head) {
+        AdmissionTicket *t = waiting_head;
+        remove_waiting(NULL, t);
+        close(t->sockfd);
+        pool_put(&tickets, t);
+    }
+    pool_destroy(&tickets);
+    pthread_mutex_unlock(&admission_lock);
+}
+
+unsigned int admission_enqueue(int sockfd, int timeout_ms) {
+    pthread_mutex_lock(&admission_lock);
+
+    AdmissionTicket *t = (AdmissionTicket *)pool_get(&tickets);
+    if (!t) {
+        pthread_mutex_unlock(&admission_lock);
+        printf("[INFO] [AO] Too many waiting output clients, rejecting connection\n");
+        return 0;
+    }
+
+    t->sockfd = sockfd;
+    t->ticket = next_ticket++;
+    t->deadline_ms = timeout_ms > 0 ? monotonic_ms() + timeout_ms : 0;
+    t->next = NULL;
+
+    int position = 1;
+    if (waiting_tail) {
+        waiting_tail->next = t;
+        for (AdmissionTicket *w = waiting_head; w != t; w = w->next) {
+            position++;
+        }
+    } else {
+        waiting_head = t;
+    }
+    waiting_tail = t;
+
+    // An idle channel admits the client right away; position 0 means "next up"
+    if (active_ticket == 0 && waiting_head == t) {
+        position = 0;
+    }
+
+    char msg[48];
+    snprintf(msg, sizeof(msg), AO_TICKET_FORMAT, t->ticket, position);
+    notify_client(sockfd, msg);
+
+    unsigned int ticket = t->ticket;
+    pthread_mutex_unlock(&admission_lock);
+
+    return ticket;
+}
+
+int admission_next(AdmissionTicket *admitted) {
+    pthread_mutex_lock(&admission_lock);
+    if (!waiting_head || active_ticket != 0) {
+        pthread_mutex_unlock(&admission_lock);
+        return -1;
+    }
+
+    AdmissionTicket *t = waiting_head;
+    remove_waiting(NULL, t);
+    active_ticket = t->ticket;
+    *admitted = *t;
+    admitted->next = NULL;
+    pool_put(&tickets, t);
+
+    notify_client(admitted->sockfd, AO_ADMITTED);
+    notify_positions();
+
+    pthread_mutex_unlock(&admission_lock);
+    return 0;
+}
+
+void admission_release() {
+    pthread_mutex_lock(&admission_lock);
+    active_ticket = 0;
+    pthread_mutex_unlock(&admission_lock);
+}
+
+int admission_expire() {
+    long long now = monotonic_ms();
+    long long next_deadline = -1;
+    int changed = 0;
+
+    pthread_mutex_lock(&admission_lock);
+
+    AdmissionTicket *prev = NULL;
+    AdmissionTicket *t = waiting_head;
+    while (t) {
+        // A client that hung up without sending anything is dropped; one that
+        // sent audio and closed keeps its place so its audio still plays
+        struct pollfd pfd = {.fd = t->sockfd, .events = POLLIN};
+        char peek;
+        int hung_up = poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLIN | POLLHUP)) &&
+                      recv(t->sockfd, &peek, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+        int timed_out = t->deadline_ms && now >= t->deadline_ms;
+
+        if (hung_up || timed_out) {
+            if (timed_out) {
+                printf("[INFO] [AO] Ticket %u timed out waiting for the output channel\n", t->ticket);
+                notify_client(t->sockfd, AO_TIMEOUT);
+            }
+            AdmissionTicket *next = t->next;
+            remove_waiting(prev, t);
+            close(t->sockfd);
+            pool_put(&tickets, t);
+            t = next;
+            changed = 1;
+            continue;
+        }
+
+        if (t->deadline_ms && (next_deadline < 0 || t->deadline_ms - now < next_deadline)) {
+            next_deadline = t->deadline_ms - now;
+        }
+        prev = t;
+        t = t->next;
+    }
+
+    if (changed) {
+        notify_positions();
+    }
+
+    pthread_mutex_unlock(&admission_lock);
+    return (int)next_deadline;
+}
+
+int admission_position(unsigned int ticket) {
+    int position = -1;
+
+    pthread_mutex_lock(&admission_lock);
+    if (ticket != 0 && ticket == active_ticket) {
+        position = 0;
+    } else {
+        int p = 1;
+        for (AdmissionTicket *t = waiting_head; t; t = t->next, p++) {
+            if (t->ticket == ticket) {
+                position = p;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&admission_lock);
+
+    return position;
+}
+
+int admission_busy() {
+    pthread_mutex_lock(&admission_lock);
+    int busy = active_ticket != 0 || waiting_head != NULL;
+    pthread_mutex_unlock(&admission_lock);
+    return busy;
+}
+
+int admission_waiting() {
+    pthread_mutex_lock(&admission_lock);
+    int count = 0;
+    for (AdmissionTicket *t = waiting_head; t; t = t->next) {
+        count++;
+    }
+    pthread_mutex_unlock(&admission_lock);
+    return count;
+}
@@ -0,0 +1,46 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#define DEFAULT_AO_ADMISSION_TIMEOUT_MS 60000
+
+/**
+ * @brief An output client waiting for, or holding, the AO channel.
+ */
+typedef struct AdmissionTicket {
+    int sockfd;                     // Client socket
+    unsigned int ticket;            // Monotonic ticket number, defines FIFO order
+    long long deadline_ms;          // Monotonic time after which the wait is abandoned, 0 for none
+    struct AdmissionTicket *next;   // Next waiting client
+} AdmissionTicket;
+
+// Allocates room for capacity waiting clients. Returns 0 on success, -1 if memory ran out.
+int admission_init(int capacity);
+
+// Closes the waiting clients and releases the room allocated by admission_init().
+void admission_shutdown(void);
+
+// Queues a newly accepted output client and tells it its ticket and position.
+// Returns the ticket number, or 0 if the client could not be queued because too many are waiting.
+unsigned int admission_enqueue(int sockfd, int timeout_ms);
+
+// Makes the first waiting client the active client if the AO channel is free and
+// fills in its ticket. Returns 0 on success, -1 if no client can be admitted.
+int admission_next(AdmissionTicket *admitted);
+
+// Releases the AO channel held by the active client.
+void admission_release(void);
+
+// Closes waiting clients whose deadline passed or who hung up.
+// Returns the number of milliseconds until the next deadline, or -1 if there is none.
+int admission_expire(void);
+
+// Returns 0 for the active client, the 1-based position of a waiting client, or -1 if unknown.
+int admission_position(unsigned int ticket);
+
+// Returns 1 if a client is playing or waiting, 0 otherwise.
+int admission_busy(void);
+
+// Returns the number of clients waiting for the AO channel.
+int admission_waiting(void);
+
+#endif // ADMISSION_H
@@ -1,141 +1,1019 @@
-#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <pthread.h>
 #include <stdio.h>
-#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
+#include "admission.h"
+#include "calibrate.h"
+#include "config.h"
+#include "event_loop.h"
+#include "footprint.h"
+#include "lockstat.h"
 #include "logging.h"
+#include "metrics.h"
 #include "utils.h"
 #include "network.h"
+#include "output_server.h"
+#include "parameters.h"
+#include "persist.h"
+#include "pool.h"
+#include "reload.h"
+#include "telemetry.h"
+#include "trace.h"
 #include "control_server.h"
 
 #define TAG "NET_CONTROL"
 
-// Global flag and mutex to control thread termination
-extern volatile int g_stop_thread;
-extern pthread_mutex_t g_stop_thread_mutex;
+/**
+ * @brief A connection on the control socket.
+ *
+ * A client whose first message contains no newline is a legacy one-shot
+ * client: the message is answered without a trailing newline and the
+ * connection is closed. Otherwise every newline-terminated line is a request
+ * and every reply is a line, in order, for as long as the client stays connected.
+ */
+typedef struct ControlClient {
+    EventHandler handler;                   // Must be first, see event_loop.h
+    int state;                              // One of the CONTROL_CLIENT_* states
+    char in[CONTROL_MAX_REQUEST + 1];       // Received, not yet handled requests
+    size_t in_len;
+    char out[CONTROL_OUTPUT_BUFFER];        // Replies not yet written to the socket
+    size_t out_len;
+    char *bulk;                             // Reply too large for out, written after it (METRICS)
+    size_t bulk_len;
+    size_t bulk_off;
 
-void handle_control_client(int client_sock) {
-    char buffer[256];
-    ssize_t bytes_received = recv(client_sock, buffer, sizeof(buffer) - 1, 0);
+    // Telemetry subscription, see control_client_subscribe()
+    int topics;                                     // CONTROL_TOPIC_* bits, 0 when not subscribed
+    int interval_ms;
+    long long next_report_ms;
+    unsigned int reported[TELEMETRY_COUNTER_COUNT]; // Counter values already reported
+    int peaks[TELEMETRY_LEVEL_COUNT];               // Highest levels since the last report
+    int reported_queue;                             // Waiting output clients last reported
 
-    if (bytes_received <= 0) {
-        handle_audio_error(TAG, "recv");
-        close(client_sock);
-        return;
-    }
+    int awaiting_batch;                             // Set while this client's BATCH is in flight
+    int awaiting_calibration;                       // Set while this client's CALIBRATE is running
 
-    buffer[bytes_received] = '\0';  // Null-terminate the received string
+    struct ControlClient *next;
+} ControlClient;
 
-    // Try interpreting buffer as an integer for legacy clients
-    int client_request_type = *(int *)buffer;
+enum {
+    CONTROL_CLIENT_NEW,         // Nothing received yet
+    CONTROL_CLIENT_PIPELINED,   // Newline-delimited requests on a persistent connection
+    CONTROL_CLIENT_CLOSING      // Close once the pending replies are written
+};
 
-    if (client_request_type == AUDIO_OUTPUT_REQUEST) {
-        pthread_mutex_lock(&audio_buffer_lock);
+// Telemetry topics a client can subscribe to
+#define CONTROL_TOPIC_STREAM    0x01
+#define CONTROL_TOPIC_QUEUE     0x02
+#define CONTROL_TOPIC_LEVELS    0x04
+#define CONTROL_TOPIC_UNDERRUNS 0x08
+#define CONTROL_TOPIC_ERRORS    0x10
+#define CONTROL_TOPIC_ALL       0x1f
 
-        if (active_client_sock != -1) {
-            if (write(client_sock, "queued", strlen("queued")) == -1) {
-                handle_audio_error(TAG, "write");
-            }
-        } else {
-            if (write(client_sock, "not_queued", strlen("not_queued")) == -1) {
-                handle_audio_error(TAG, "write");
-            }
+static const struct {
+    const char *name;
+    int topic;
+} control_topics[] = {
+    {"stream", CONTROL_TOPIC_STREAM},
+    {"queue", CONTROL_TOPIC_QUEUE},
+    {"levels", CONTROL_TOPIC_LEVELS},
+    {"underruns", CONTROL_TOPIC_UNDERRUNS},
+    {"errors", CONTROL_TOPIC_ERRORS},
+    {"all", CONTROL_TOPIC_ALL},
+};
+
+// Stages reported by LATENCY, in path order
+static const struct {
+    const char *name;
+    TelemetryHistogram histogram;
+} control_latency_stages[] = {
+    {"ao_queue", TELEMETRY_AO_QUEUE_WAIT},
+    {"ao_send", TELEMETRY_AO_SEND_TIME},
+    {"ao_path", TELEMETRY_AO_PATH_TIME},
+    {"ai_get", TELEMETRY_AI_GET_TIME},
+    {"ai_write", TELEMETRY_AI_WRITE_DELAY},
+};
+
+// Event names of the telemetry counters, in TelemetryCounter order
+static const struct {
+    const char *event;
+    int topic;
+} control_counter_events[TELEMETRY_COUNTER_COUNT] = {
+    {"stream_start", CONTROL_TOPIC_STREAM},
+    {"stream_stop", CONTROL_TOPIC_STREAM},
+    {"underrun", CONTROL_TOPIC_UNDERRUNS},
+    {"device_error", CONTROL_TOPIC_ERRORS},
+    {"ai_frames", 0},           // Counters without a topic are only exposed through METRICS
+    {"ao_frames", 0},
+    {"ao_frames_dropped", 0},
+    {"ai_connects", 0},
+    {"ao_connects", 0},
+    {"ai_poll_fault", CONTROL_TOPIC_ERRORS},
+    {"ai_get_fault", CONTROL_TOPIC_ERRORS},
+    {"ai_reinit", CONTROL_TOPIC_ERRORS},
+    {"ai_recovered", CONTROL_TOPIC_ERRORS},
+    {"ai_gap_frames", CONTROL_TOPIC_ERRORS},
+};
+
+static int control_loop = -1;
+static ControlClient *batch_owner = NULL;   // Client waiting for the batch in flight
+static ControlClient *calibrate_owner = NULL;   // Client waiting for the calibration result
+static long long batch_deadline_ms = 0;
+static int reload_pending = 0;              // SIGHUP or legacy RELOAD waiting for the batch in flight
+static ParameterChange batch_changes[PARAM_BATCH_MAX];  // Client batch in flight, saved once applied
+static int batch_change_count = 0;
+static ControlClient *control_clients = NULL;
+static int control_client_count = 0;
+static Pool control_client_pool;
+static Pool control_metrics_buffers;        // Expositions being written, see control_client_metrics()
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Formats the per-stage latency histograms as one line of
+ * "<stage>=<count>,<avg_us>,<p50_us>,<p99_us>" fields. Percentiles are bucket
+ * bounds; "inf" means beyond the last one.
+ * @return Length of the line.
+ */
+static int control_latency(char *reply, size_t reply_size) {
+    size_t len = 0;
+    for (size_t i = 0; i < sizeof(control_latency_stages) / sizeof(control_latency_stages[0]) && len < reply_size; i++) {
+        TelemetryHistogramSnapshot snapshot;
+        telemetry_histogram(control_latency_stages[i].histogram, &snapshot);
+
+        char p50[24] = "inf", p99[24] = "inf";
+        long p50_us = telemetry_percentile_us(&snapshot, 50);
+        long p99_us = telemetry_percentile_us(&snapshot, 99);
+        if (p50_us >= 0) {
+            snprintf(p50, sizeof(p50), "%ld", p50_us);
+        }
+        if (p99_us >= 0) {
+            snprintf(p99, sizeof(p99), "%ld", p99_us);
         }
 
-        pthread_mutex_unlock(&audio_buffer_lock);
+        len += snprintf(reply + len, reply_size - len, "%s%s=%llu,%llu,%s,%s", i ? " " : "",
+                        control_latency_stages[i].name, snapshot.count,
+                        snapshot.count ? snapshot.sum_us / snapshot.count : 0, p50, p99);
+    }
+    return len < reply_size ? (int)len : (int)reply_size - 1;
+}
+
+/**
+ * Executes a single control request.
+ * @param request NUL-terminated request, without the line terminator.
+ * @param len Length of the request in bytes; legacy binary requests may contain NUL bytes.
+ * @param reply Buffer for the reply.
+ * @param reply_size Size of the reply buffer.
+ * @return Length of the reply.
+ */
+static int control_execute(const char *request, size_t len, char *reply, size_t reply_size) {
+    // Try interpreting the request as an integer for legacy clients
+    int client_request_type = 0;
+    if (len >= sizeof(int)) {
+        memcpy(&client_request_type, request, sizeof(int));
+    }
+
+    if (client_request_type == AUDIO_OUTPUT_REQUEST) {
+        return snprintf(reply, reply_size, "%s", admission_busy() ? "queued" : "not_queued");
+    }
+    // Report where an output client's ticket stands: 0 means it holds the channel
+    else if (strncmp(request, "QUEUE ", 6) == 0) {
+        unsigned int ticket = 0;
+        sscanf(request + 6, "%u", &ticket);
+
+        int position = admission_position(ticket);
+        if (position >= 0) {
+            return snprintf(reply, reply_size, "%d", position);
+        }
+        return snprintf(reply, reply_size, "RESPONSE_ERROR");
     }
     // Check for the new protocol
-    else if (strncmp(buffer, "GET ", 4) == 0) {
+    else if (strncmp(request, "GET ", 4) == 0) {
         char variable_name[100];
-        sscanf(buffer + 4, "%s", variable_name);
-
-        char* value = get_variable_value(variable_name);
+        if (sscanf(request + 4, "%99s", variable_name) != 1) {
+            return snprintf(reply, reply_size, "RESPONSE_ERROR");
+        }
 
-        if (value) {
-            write(client_sock, value, strlen(value));
-            free(value);
-        } else {
-            write(client_sock, "RESPONSE_UNKNOWN_VARIABLE", strlen("RESPONSE_UNKNOWN_VARIABLE"));
+        char value[24];
+        if (get_variable_value(variable_name, value, sizeof(value)) == 0) {
+            return snprintf(reply, reply_size, "%s", value);
         }
+        return snprintf(reply, reply_size, "RESPONSE_UNKNOWN_VARIABLE");
     }
-    else if (strncmp(buffer, "SET ", 4) == 0) {
+    else if (strncmp(request, "SET ", 4) == 0) {
         char variable_name[100];
         char value[100];
-        sscanf(buffer + 4, "%s %s", variable_name, value);
+        if (sscanf(request + 4, "%99s %99s", variable_name, value) != 2) {
+            return snprintf(reply, reply_size, "RESPONSE_ERROR");
+        }
 
         int result = set_variable_value(variable_name, value);
+        if (result == PARAM_OK) {
+            long long parsed;
+            if (parameter_parse(parameter_find(variable_name), value, &parsed) == PARAM_OK) {
+                persist_note(variable_name, parsed, monotonic_ms());
+            }
+            return snprintf(reply, reply_size, "RESPONSE_OK");
+        }
+        if (result == PARAM_UNKNOWN) {
+            return snprintf(reply, reply_size, "RESPONSE_UNKNOWN_VARIABLE");
+        }
+        return snprintf(reply, reply_size, "RESPONSE_ERROR");
+    }
+    // Resident memory, thread count and stack high-water marks in KiB
+    else if (strcmp(request, "FOOTPRINT") == 0) {
+        return footprint_report(reply, reply_size);
+    }
+    // Where the time goes on the playback and capture paths
+    else if (strcmp(request, "LATENCY") == 0) {
+        return control_latency(reply, reply_size);
+    }
+    // Write the event trace ring to TRACE_FILE
+    else if (strcmp(request, "TRACE") == 0) {
+        return snprintf(reply, reply_size, "%s", trace_dump(TRACE_DUMP_COMMAND, 0) == 0 ? "RESPONSE_OK" : "RESPONSE_ERROR");
+    }
+    // Contention on audio_buffer_lock per call site; RESET clears the figures once reported
+    else if (strcmp(request, "LOCKSTAT") == 0 || strcmp(request, "LOCKSTAT RESET") == 0) {
+        int lockstat_len = lockstat_report(reply, reply_size, request[8] != '\0');
+        if (lockstat_len >= 0) {
+            return lockstat_len;
+        }
+    }
+    else if (strncmp(request, "LOCKSTAT ", 9) == 0) {
+        int lockstat_len = lockstat_site_report(request + 9, reply, reply_size);
+        if (lockstat_len >= 0) {
+            return lockstat_len;
+        }
+    }
 
-        if (result == 0) {
-            write(client_sock, "RESPONSE_OK", strlen("RESPONSE_OK"));
-        } else {
-            write(client_sock, "RESPONSE_ERROR", strlen("RESPONSE_ERROR"));
+    return snprintf(reply, reply_size, "RESPONSE_ERROR");
+}
+
+/**
+ * Appends a request's reply to the client's output buffer.
+ * The caller makes sure CONTROL_MAX_REPLY + 1 bytes are free.
+ */
+static void control_client_reply(ControlClient *client, const char *request, size_t len, int newline) {
+    int reply_len = control_execute(request, len, client->out + client->out_len, CONTROL_MAX_REPLY);
+    if (reply_len >= CONTROL_MAX_REPLY) {
+        reply_len = CONTROL_MAX_REPLY - 1;
+    }
+    client->out_len += reply_len;
+    if (newline) {
+        client->out[client->out_len++] = '\n';
+    }
+}
+
+static void control_client_close(ControlClient *client) {
+    if (batch_owner == client) {
+        // The batch still gets applied; nobody is left to hear the result
+        batch_owner = NULL;
+    }
+    if (calibrate_owner == client) {
+        // The calibration finishes anyway and then frees the AO channel
+        calibrate_owner = NULL;
+    }
+    event_loop_remove(control_loop, &client->handler);
+    trace_event(TRACE_CLIENT_DISCONNECT, client->handler.fd, TRACE_CLIENT_CONTROL);
+    close(client->handler.fd);
+
+    for (ControlClient **link = &control_clients; *link; link = &(*link)->next) {
+        if (*link == client) {
+            *link = client->next;
+            break;
         }
     }
-    else {
-        write(client_sock, "RESPONSE_ERROR", strlen("RESPONSE_ERROR"));
+    control_client_count--;
+    pool_put(&control_metrics_buffers, client->bulk);
+    pool_put(&control_client_pool, client);
+}
+
+/**
+ * Appends a fixed line to the client's output buffer.
+ * The caller makes sure CONTROL_MAX_REPLY + 1 bytes are free.
+ */
+static void control_client_append(ControlClient *client, const char *line) {
+    size_t len = strlen(line);
+    memcpy(client->out + client->out_len, line, len);
+    client->out_len += len;
+}
+
+/**
+ * Handles "SUBSCRIBE <interval_ms> [topic[,topic...]]". Events of the chosen
+ * topics are pushed as "EVENT <name> <value>" lines at most once per interval.
+ * Counter events carry the number of occurrences since the previous report,
+ * so nothing is lost when a report is skipped for a slow reader.
+ * @param args Arguments following the command.
+ */
+static void control_client_subscribe(ControlClient *client, const char *args) {
+    int interval_ms = 0;
+    char topic_list[64] = "all";
+    if (sscanf(args, "%d %63s", &interval_ms, topic_list) < 1 ||
+        interval_ms < CONTROL_MIN_REPORT_MS || interval_ms > CONTROL_MAX_REPORT_MS) {
+        control_client_append(client, "RESPONSE_ERROR\n");
+        return;
     }
 
-    close(client_sock);
+    int topics = 0;
+    for (char *name = strtok(topic_list, ","); name; name = strtok(NULL, ",")) {
+        size_t i;
+        for (i = 0; i < sizeof(control_topics) / sizeof(control_topics[0]); i++) {
+            if (strcmp(name, control_topics[i].name) == 0) {
+                topics |= control_topics[i].topic;
+                break;
+            }
+        }
+        if (i == sizeof(control_topics) / sizeof(control_topics[0])) {
+            control_client_append(client, "RESPONSE_ERROR\n");
+            return;
+        }
+    }
+
+    client->topics = topics;
+    client->interval_ms = interval_ms;
+    client->next_report_ms = monotonic_ms();
+    for (int i = 0; i < TELEMETRY_COUNTER_COUNT; i++) {
+        client->reported[i] = telemetry_counter(i);
+    }
+    memset(client->peaks, 0, sizeof(client->peaks));
+    client->reported_queue = -1;
+    control_client_append(client, "RESPONSE_OK\n");
 }
 
-void *audio_control_server_thread(void *arg) {
-    printf("[INFO] [CTRL] Entering audio_control_server_thread\n");
+/**
+ * Handles "METRICS": renders the daemon's counters, gauges and histograms in
+ * the Prometheus text format, terminated by a "# EOF" line. The exposition is
+ * written after any replies already queued, and no further request is handled
+ * until it has been written in full.
+ */
+static void control_client_metrics(ControlClient *client) {
+    client->bulk = pool_get(&control_metrics_buffers);
+    client->bulk_off = 0;
+    if (!client->bulk) {
+        printf("[INFO] [CTRL] Too many METRICS requests in flight, try again later\n");
+        control_client_append(client, "RESPONSE_ERROR\n");
+        return;
+    }
+    client->bulk_len = metrics_render(client->bulk, METRICS_BUFFER_SIZE);
+}
+
+/**
+ * Reloads the configuration file and submits its live changes as a batch.
+ * @param owner Client to answer once the batch is applied, or NULL.
+ * @return -1 if the file was rejected, 0 if there is nothing to wait for,
+ *         1 if the owner gets its reply when the batch has been applied.
+ */
+static int control_reload(ControlClient *owner) {
+    ParameterChange changes[PARAM_BATCH_MAX];
+    int count = 0;
 
-    update_socket_paths_from_config();
+    // Save runtime changes still waiting for the debounce first, so the
+    // reload compares the file against them instead of reverting them
+    persist_flush(monotonic_ms() + PERSIST_MAX_DELAY_MS);
 
-    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        handle_audio_error(TAG, "socket");
-        return NULL;
+    if (reload_config(changes, &count)) {
+        return -1;
     }
+    if (count == 0 || parameter_batch_submit(changes, count) != PARAM_OK) {
+        return 0;
+    }
+
+    // Reloaded values already match the file
+    batch_change_count = 0;
+    batch_owner = owner;
+    batch_deadline_ms = monotonic_ms() + CONTROL_BATCH_FALLBACK_MS;
+    if (owner) {
+        owner->awaiting_batch = 1;
+    }
+    return 1;
+}
 
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    strncpy(&addr.sun_path[1], AUDIO_CONTROL_SOCKET_PATH, sizeof(addr.sun_path) - 2);
-    addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
+/**
+ * Handles "BATCH <name>=<value> [<name>=<value> ...]". Every change is
+ * validated before any is applied; the batch is then applied as a whole by an
+ * audio thread at its next frame boundary, and the client gets one reply once
+ * that has happened: RESPONSE_OK, or RESPONSE_UNKNOWN_VARIABLE / RESPONSE_ERROR
+ * followed by the offending parameter name.
+ * @param args Arguments following the command; modified while parsing.
+ */
+static void control_client_batch(ControlClient *client, char *args) {
+    ParameterChange changes[PARAM_BATCH_MAX];
+    int count = 0;
+    char reply[CONTROL_MAX_REPLY];
+
+    for (char *change = strtok(args, " "); change; change = strtok(NULL, " ")) {
+        char *value = strchr(change, '=');
+        if (value) {
+            *value++ = '\0';
+        }
+
+        const Parameter *param = parameter_find(change);
+        if (!param) {
+            snprintf(reply, sizeof(reply), "RESPONSE_UNKNOWN_VARIABLE %s\n", change);
+            control_client_append(client, reply);
+            return;
+        }
+        if (!value || !param->set || count == PARAM_BATCH_MAX ||
+            parameter_parse(param, value, &changes[count].value) != PARAM_OK) {
+            snprintf(reply, sizeof(reply), "RESPONSE_ERROR %s\n", change);
+            control_client_append(client, reply);
+            return;
+        }
+        changes[count++].param = param;
+    }
 
-    printf("[INFO] [CTRL] Attempting to bind control socket\n");
-    if (bind(sockfd, (struct sockaddr*)&addr, sizeof(sa_family_t) + strlen(AUDIO_CONTROL_SOCKET_PATH) + 1) == -1) {
-        handle_audio_error(TAG, "bind failed");
-        close(sockfd);
-        return NULL;
+    if (count == 0 || parameter_batch_submit(changes, count) != PARAM_OK) {
+        control_client_append(client, "RESPONSE_ERROR\n");
+        return;
     }
-    else {
-        printf("[INFO] [CTRL] Bind to control socket succeeded\n");
+
+    memcpy(batch_changes, changes, count * sizeof(changes[0]));
+    batch_change_count = count;
+
+    // Replies stay in order: nothing else from this client is handled until the batch is applied
+    client->awaiting_batch = 1;
+    batch_owner = client;
+    batch_deadline_ms = monotonic_ms() + CONTROL_BATCH_FALLBACK_MS;
+}
+
+static void control_calibrate_event(EventHandler *handler, uint32_t events);
+
+// Registered with the event loop by the first CALIBRATE
+static EventHandler control_calibrate_done = {.fd = -1, .callback = control_calibrate_event};
+
+// Reply reasons of a failed calibration, in CalibrateStatus order
+static const char *control_calibrate_errors[] = {
+    "", "busy", "no_memory", "no_playback", "no_capture", "no_signal",
+};
+
+/**
+ * Handles "CALIBRATE": plays a sweep through the idle AO channel and measures
+ * when the AI channel hears it. The client gets one reply once the capture
+ * has been analyzed, see control_calibrate_event(); nothing else from it is
+ * handled until then.
+ */
+static void control_client_calibrate(ControlClient *client) {
+    char reply[CONTROL_MAX_REPLY];
+    int status = output_server_calibrate();
+    if (status != CALIBRATE_OK) {
+        snprintf(reply, sizeof(reply), "RESPONSE_ERROR %s\n", control_calibrate_errors[status]);
+        control_client_append(client, reply);
+        return;
     }
 
-    printf("[INFO] [CTRL] Attempting to listen on control socket\n");
-    if (listen(sockfd, 5) == -1) {
-        handle_audio_error(TAG, "listen");
-        close(sockfd);
-        return NULL;
+    if (control_calibrate_done.fd < 0) {
+        control_calibrate_done.fd = calibrate_event_fd();
+        event_loop_add(control_loop, &control_calibrate_done, EPOLLIN);
     }
-    else {
-        printf("[INFO] [CTRL] Listening on control socket\n");
+    client->awaiting_calibration = 1;
+    calibrate_owner = client;
+}
+
+/**
+ * Appends the events a subscriber hasn't seen yet. A client whose output is
+ * backed up is skipped; its pending events are coalesced into the next report.
+ * @param now Current monotonic time in milliseconds.
+ */
+static void control_client_report(ControlClient *client, long long now) {
+    client->next_report_ms = now + client->interval_ms;
+    if (client->bulk || sizeof(client->out) - client->out_len <= CONTROL_MAX_REPLY) {
+        return;
     }
 
-    while (1) {
-        int should_stop = 0;
-        pthread_mutex_lock(&g_stop_thread_mutex);
-        should_stop = g_stop_thread;
-        pthread_mutex_unlock(&g_stop_thread_mutex);
+    char *report = client->out + client->out_len;
+    int len = 0;
+
+    for (int i = 0; i < TELEMETRY_COUNTER_COUNT; i++) {
+        if (!(client->topics & control_counter_events[i].topic)) {
+            continue;
+        }
+        unsigned int count = telemetry_counter(i);
+        if (count != client->reported[i]) {
+            len += snprintf(report + len, CONTROL_MAX_REPLY - len, "EVENT %s %u\n",
+                            control_counter_events[i].event, count - client->reported[i]);
+            client->reported[i] = count;
+        }
+    }
+
+    if (client->topics & CONTROL_TOPIC_QUEUE) {
+        int waiting = admission_waiting();
+        if (waiting != client->reported_queue) {
+            len += snprintf(report + len, CONTROL_MAX_REPLY - len, "EVENT queue %d\n", waiting);
+            client->reported_queue = waiting;
+        }
+    }
+
+    if (client->topics & CONTROL_TOPIC_LEVELS) {
+        len += snprintf(report + len, CONTROL_MAX_REPLY - len, "EVENT level_ai %d\nEVENT level_ao %d\n",
+                        client->peaks[TELEMETRY_LEVEL_AI], client->peaks[TELEMETRY_LEVEL_AO]);
+        memset(client->peaks, 0, sizeof(client->peaks));
+    }
 
-        if (should_stop) {
+    client->out_len += len;
+}
+
+/**
+ * Handles the complete request lines of a pipelined client, stopping early
+ * while the output buffer is too full to take another reply.
+ */
+static void control_client_process(ControlClient *client) {
+    char *line = client->in;
+    char *end = client->in + client->in_len;
+
+    while (client->state == CONTROL_CLIENT_PIPELINED && !client->awaiting_batch && !client->awaiting_calibration && !client->bulk &&
+           sizeof(client->out) - client->out_len > CONTROL_MAX_REPLY) {
+        char *newline = memchr(line, '\n', end - line);
+        if (!newline) {
             break;
         }
+        // Another client's batch is in flight; this one waits its turn
+        if ((strncmp(line, "BATCH ", 6) == 0 || strncmp(line, "RELOAD", 6) == 0) && parameter_batch_busy()) {
+            break;
+        }
+        *newline = '\0';
+        if (newline > line && newline[-1] == '\r') {
+            newline[-1] = '\0';
+        }
+        if (strncmp(line, "BATCH ", 6) == 0) {
+            control_client_batch(client, line + 6);
+        } else if (strncmp(line, "SUBSCRIBE ", 10) == 0) {
+            control_client_subscribe(client, line + 10);
+        } else if (strcmp(line, "METRICS") == 0) {
+            control_client_metrics(client);
+        } else if (strcmp(line, "RELOAD") == 0) {
+            int result = control_reload(client);
+            if (result < 0) {
+                control_client_append(client, "RESPONSE_ERROR\n");
+            } else if (result == 0) {
+                control_client_append(client, "RESPONSE_OK\n");
+            }
+        } else if (strcmp(line, "CALIBRATE") == 0) {
+            control_client_calibrate(client);
+        } else if (strcmp(line, "UNSUBSCRIBE") == 0) {
+            client->topics = 0;
+            control_client_append(client, "RESPONSE_OK\n");
+        } else if (*line) {
+            control_client_reply(client, line, strlen(line), 1);
+        }
+        line = newline + 1;
+    }
+
+    client->in_len = end - line;
+    memmove(client->in, line, client->in_len);
+
+    // A request that doesn't fit the buffer can't be answered
+    if (client->state == CONTROL_CLIENT_PIPELINED && !client->awaiting_batch && !client->awaiting_calibration && !client->bulk &&
+        client->in_len == CONTROL_MAX_REQUEST &&
+        !memchr(client->in, '\n', client->in_len)) {
+        memcpy(client->out + client->out_len, "RESPONSE_ERROR\n", 15);
+        client->out_len += 15;
+        client->state = CONTROL_CLIENT_CLOSING;
+    }
+}
 
-        printf("[INFO] [CTRL] Waiting for a control client connection\n");
-        int client_sock = accept(sockfd, NULL, NULL);
+/**
+ * Writes as much pending output as the socket takes without blocking.
+ * @return 0 if the client is still usable, -1 if the connection failed.
+ */
+static int control_client_flush(ControlClient *client) {
+    while (client->out_len > 0) {
+        ssize_t n = send(client->handler.fd, client->out, client->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        }
+        client->out_len -= n;
+        memmove(client->out, client->out + n, client->out_len);
+    }
+    while (client->bulk) {
+        ssize_t n = send(client->handler.fd, client->bulk + client->bulk_off, client->bulk_len - client->bulk_off,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        }
+        client->bulk_off += n;
+        if (client->bulk_off == client->bulk_len) {
+            pool_put(&control_metrics_buffers, client->bulk);
+            client->bulk = NULL;
+        }
+    }
+    return 0;
+}
+
+static void control_client_update(ControlClient *client);
+
+/**
+ * Whether more requests are read from the client. Reading stops while the
+ * input buffer is full or a reply is pending, so that a full buffer is never
+ * mistaken for EOF, and while replies back up, so a slow reader can't grow
+ * the output buffer.
+ */
+static int control_client_reading(const ControlClient *client) {
+    return client->state != CONTROL_CLIENT_CLOSING &&
+           client->in_len < CONTROL_MAX_REQUEST &&
+           !client->awaiting_batch && !client->awaiting_calibration && !client->bulk &&
+           sizeof(client->out) - client->out_len > CONTROL_MAX_REPLY;
+}
+
+static void control_client_event(EventHandler *handler, uint32_t events) {
+    ControlClient *client = (ControlClient *)handler;
+
+    if (events & EPOLLERR) {
+        control_client_close(client);
+        return;
+    }
+
+    if ((events & EPOLLHUP) && !control_client_reading(client)) {
+        // Hung up while its requests wait; nothing can be read or answered anymore
+        control_client_close(client);
+        return;
+    }
+
+    if ((events & (EPOLLIN | EPOLLHUP)) && control_client_reading(client)) {
+        ssize_t n = recv(handler->fd, client->in + client->in_len, CONTROL_MAX_REQUEST - client->in_len, MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            // Client went away; whatever it still had queued is dropped
+            control_client_close(client);
+            return;
+        }
+        if (n > 0) {
+            client->in_len += n;
+            client->in[client->in_len] = '\0';
+
+            if (client->state == CONTROL_CLIENT_NEW) {
+                if (memchr(client->in, '\n', client->in_len)) {
+                    client->state = CONTROL_CLIENT_PIPELINED;
+                } else if (strcmp(client->in, "METRICS") == 0) {
+                    control_client_metrics(client);
+                    client->in_len = 0;
+                    client->state = CONTROL_CLIENT_CLOSING;
+                } else if (strcmp(client->in, "RELOAD") == 0) {
+                    // Legacy clients can't wait for the batch; the reply only says the file was accepted
+                    int result = 0;
+                    if (parameter_batch_busy()) {
+                        reload_pending = 1;
+                    } else {
+                        result = control_reload(NULL);
+                    }
+                    control_client_append(client, result < 0 ? "RESPONSE_ERROR" : "RESPONSE_OK");
+                    client->in_len = 0;
+                    client->state = CONTROL_CLIENT_CLOSING;
+                } else {
+                    // Legacy client: one request per connection, reply without newline
+                    control_client_reply(client, client->in, client->in_len, 0);
+                    client->in_len = 0;
+                    client->state = CONTROL_CLIENT_CLOSING;
+                }
+            }
+        }
+    }
+
+    control_client_update(client);
+}
+
+/**
+ * Handles pending requests, writes pending output and updates the events
+ * watched for the client. Closes the client if writing failed or it is done;
+ * the client must not be used afterwards.
+ */
+static void control_client_update(ControlClient *client) {
+    // Requests held back by a full buffer or a bulk reply resume as soon as
+    // the output drains, even if the client has nothing more to send
+    size_t pending;
+    do {
+        if (control_client_flush(client)) {
+            control_client_close(client);
+            return;
+        }
+        pending = client->in_len;
+        control_client_process(client);
+    } while (client->in_len != pending);
+
+    if (control_client_flush(client) ||
+        (client->state == CONTROL_CLIENT_CLOSING && client->out_len == 0 && !client->bulk)) {
+        control_client_close(client);
+        return;
+    }
+
+    uint32_t watch = 0;
+    if (control_client_reading(client)) {
+        watch |= EPOLLIN;
+    }
+    if (client->out_len > 0 || client->bulk) {
+        watch |= EPOLLOUT;
+    }
+    event_loop_modify(control_loop, &client->handler, watch);
+}
+
+/**
+ * Samples the telemetry meters and pushes reports to subscribers that are due.
+ * @return Milliseconds until the next report is due, or -1 without subscribers.
+ */
+static int control_report_telemetry(void) {
+    int timeout_ms = -1;
+    long long now = monotonic_ms();
+
+    // The meters are shared, so fold them into every subscriber's own peak
+    int peaks[TELEMETRY_LEVEL_COUNT] = {0};
+    for (ControlClient *client = control_clients; client; client = client->next) {
+        if (client->topics & CONTROL_TOPIC_LEVELS) {
+            for (int i = 0; i < TELEMETRY_LEVEL_COUNT; i++) {
+                peaks[i] = telemetry_take_peak(i);
+            }
+            break;
+        }
+    }
+
+    ControlClient *next;
+    for (ControlClient *client = control_clients; client; client = next) {
+        next = client->next;
+        if (!client->topics) {
+            continue;
+        }
+        for (int i = 0; i < TELEMETRY_LEVEL_COUNT; i++) {
+            if (peaks[i] > client->peaks[i]) {
+                client->peaks[i] = peaks[i];
+            }
+        }
+        int due = now >= client->next_report_ms;
+        if (due) {
+            control_client_report(client, now);
+        }
+        timeout_ms = event_loop_timeout(timeout_ms, (int)(client->next_report_ms - now));
+        if (due) {
+            control_client_update(client);
+        }
+    }
+
+    return timeout_ms;
+}
+
+/**
+ * Delivers the result of an applied batch, then resumes clients that were
+ * held back while it was in flight.
+ */
+static void control_batch_event(EventHandler *handler, uint32_t events) {
+    uint64_t done;
+    if (read(handler->fd, &done, sizeof(done)) < 0) {
+        return;
+    }
+
+    const char *failed_name = NULL;
+    int result = parameter_batch_collect(&failed_name);
+    if (result == PARAM_BUSY) {
+        return;
+    }
+
+    if (result == PARAM_OK) {
+        long long now = monotonic_ms();
+        for (int i = 0; i < batch_change_count; i++) {
+            persist_note(batch_changes[i].param->name, batch_changes[i].value, now);
+        }
+    }
+    batch_change_count = 0;
+
+    ControlClient *owner = batch_owner;
+    batch_owner = NULL;
+    batch_deadline_ms = 0;
+    if (owner) {
+        char reply[CONTROL_MAX_REPLY];
+        if (result == PARAM_OK) {
+            snprintf(reply, sizeof(reply), "RESPONSE_OK\n");
+        } else {
+            snprintf(reply, sizeof(reply), "RESPONSE_ERROR %s\n", failed_name ? failed_name : "");
+        }
+        control_client_append(owner, reply);
+        owner->awaiting_batch = 0;
+    }
+
+    ControlClient *next;
+    for (ControlClient *client = control_clients; client; client = next) {
+        next = client->next;
+        if (client == owner || client->in_len > 0) {
+            control_client_update(client);
+        }
+    }
+}
+
+/**
+ * Delivers the calibration result and hands the AO channel back to the
+ * output clients.
+ */
+static void control_calibrate_event(EventHandler *handler, uint32_t events) {
+    uint64_t done;
+    if (read(handler->fd, &done, sizeof(done)) < 0) {
+        return;
+    }
+
+    CalibrateResult result;
+    CalibrateStatus status = calibrate_result(&result);
+    output_server_calibrate_done();
+
+    char reply[CONTROL_MAX_REPLY];
+    if (status == CALIBRATE_OK) {
+        // delay_ms is the offset rounded for the AEC profile
+        snprintf(reply, sizeof(reply), "latency_us=%ld offset_us=%ld delay_ms=%ld lag=%.2f peak=%.2f\n",
+                 result.latency_us, result.offset_us, (result.offset_us + 500) / 1000, result.lag_samples,
+                 result.peak);
+    } else {
+        snprintf(reply, sizeof(reply), "RESPONSE_ERROR %s\n", control_calibrate_errors[status]);
+    }
+    printf("[INFO] [CTRL] Calibration: %s", reply);
+
+    ControlClient *owner = calibrate_owner;
+    calibrate_owner = NULL;
+    if (owner) {
+        control_client_append(owner, reply);
+        owner->awaiting_calibration = 0;
+        control_client_update(owner);
+    }
+}
+
+/**
+ * Applies a batch from the control thread if no audio thread reached a frame
+ * boundary in time, e.g. because neither stream is running.
+ * @param timeout_ms Current dispatch timeout.
+ * @return The dispatch timeout, shortened to the batch deadline.
+ */
+static int control_batch_fallback(int timeout_ms) {
+    if (!batch_deadline_ms) {
+        return timeout_ms;
+    }
+
+    long long remaining = batch_deadline_ms - monotonic_ms();
+    if (remaining <= 0) {
+        batch_deadline_ms = 0;
+        parameter_batch_apply_pending();
+        return timeout_ms;
+    }
+    return event_loop_timeout(timeout_ms, (int)remaining);
+}
+
+/**
+ * Notes a SIGHUP; the reload runs from the main loop once no batch is in flight.
+ */
+static void control_reload_event(EventHandler *handler, uint32_t events) {
+    uint64_t count;
+    if (read(handler->fd, &count, sizeof(count)) == sizeof(count)) {
+        printf("[INFO] [CTRL] SIGHUP received, reloading configuration\n");
+        reload_pending = 1;
+    }
+}
+
+static void control_listener_event(EventHandler *handler, uint32_t events) {
+    while (1) {
+        int client_sock = accept(handler->fd, NULL, NULL);
         if (client_sock == -1) {
-            handle_audio_error(TAG, "accept");
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                handle_audio_error(TAG, "accept");
+            }
+            return;
+        }
+
+        fcntl(client_sock, F_SETFL, fcntl(client_sock, F_GETFL) | O_NONBLOCK);
+
+        ControlClient *client = pool_get(&control_client_pool);
+        if (!client) {
+            printf("[INFO] [CTRL] Too many control clients, rejecting connection\n");
+            close(client_sock);
+            continue;
+        }
+        client->handler.fd = client_sock;
+        client->handler.callback = control_client_event;
+        client->state = CONTROL_CLIENT_NEW;
+
+        if (event_loop_add(control_loop, &client->handler, EPOLLIN)) {
+            close(client_sock);
+            pool_put(&control_client_pool, client);
             continue;
         }
-        handle_control_client(client_sock);
+        client->next = control_clients;
+        control_clients = client;
+        control_client_count++;
+        trace_event(TRACE_CLIENT_CONNECT, client_sock, TRACE_CLIENT_CONTROL);
+    }
+}
+
+// Registered with the network thread's event loop while the server runs
+static EventHandler control_listener = {.fd = -1};
+static EventHandler control_batch_done = {.fd = -1};
+/**
+ * Writes the trace ring on SIGUSR1, from the network thread rather than the
+ * signal handler so a real-time audio thread is never held up by the file write.
+ */
+static void control_trace_event(EventHandler *handler, uint32_t events) {
+    uint64_t count;
+    if (read(handler->fd, &count, sizeof(count)) == sizeof(count)) {
+        if (trace_dump(TRACE_DUMP_SIGNAL, SIGUSR1) == 0) {
+            printf("[INFO] [CTRL] SIGUSR1 received, trace written to %s\n", TRACE_FILE);
+        } else {
+            handle_audio_error(TAG, "Failed to write the trace");
+        }
+    }
+}
+
+static EventHandler control_reload_signal = {.fd = -1};
+static EventHandler control_trace_signal = {.fd = -1};
+
+int control_server_init(int loop) {
+    if (pool_init(&control_client_pool, "control clients", sizeof(ControlClient),
+                  config_get()->network.max_control_clients)) {
+        handle_audio_error(TAG, "Failed to allocate control clients");
+        return -1;
+    }
+    if (pool_init(&control_metrics_buffers, "metrics buffers", METRICS_BUFFER_SIZE, CONTROL_METRICS_BUFFERS)) {
+        handle_audio_error(TAG, "Failed to allocate metrics buffers");
+        pool_destroy(&control_client_pool);
+        return -1;
+    }
+
+    control_listener.fd = network_listen(AUDIO_CONTROL_SOCKET_PATH, "CTRL");
+    if (control_listener.fd < 0) {
+        pool_destroy(&control_metrics_buffers);
+        pool_destroy(&control_client_pool);
+        return -1;
+    }
+    control_listener.callback = control_listener_event;
+
+    if (event_loop_add(loop, &control_listener, EPOLLIN)) {
+        close(control_listener.fd);
+        control_listener.fd = -1;
+        pool_destroy(&control_metrics_buffers);
+        pool_destroy(&control_client_pool);
+        return -1;
+    }
+    control_loop = loop;
+
+    control_batch_done.fd = parameter_batch_fd();
+    control_batch_done.callback = control_batch_event;
+    if (control_batch_done.fd >= 0) {
+        event_loop_add(loop, &control_batch_done, EPOLLIN);
+    }
+
+    control_reload_signal.fd = reload_signal_fd();
+    control_reload_signal.callback = control_reload_event;
+    if (control_reload_signal.fd >= 0) {
+        event_loop_add(loop, &control_reload_signal, EPOLLIN);
+    }
+
+    control_trace_signal.fd = trace_signal_fd();
+    control_trace_signal.callback = control_trace_event;
+    if (control_trace_signal.fd >= 0) {
+        event_loop_add(loop, &control_trace_signal, EPOLLIN);
+    }
+
+    printf("[INFO] [CTRL] Waiting for control client connections\n");
+    return 0;
+}
+
+int control_server_poll() {
+    if (control_listener.fd < 0) {
+        return -1;
+    }
+
+    if (reload_pending && !parameter_batch_busy()) {
+        reload_pending = 0;
+        control_reload(NULL);
     }
 
-    close(sockfd);
-    return NULL;
+    int timeout_ms = control_batch_fallback(control_report_telemetry());
+    return event_loop_timeout(timeout_ms, persist_flush(monotonic_ms()));
+}
+
+void control_server_shutdown() {
+    if (control_listener.fd < 0) {
+        return;
+    }
+
+    // Don't lose settings changed just before shutdown
+    persist_flush(monotonic_ms() + PERSIST_MAX_DELAY_MS);
+
+    while (control_clients) {
+        control_client_close(control_clients);
+    }
+    if (control_batch_done.fd >= 0) {
+        event_loop_remove(control_loop, &control_batch_done);
+    }
+    if (control_reload_signal.fd >= 0) {
+        event_loop_remove(control_loop, &control_reload_signal);
+    }
+    if (control_trace_signal.fd >= 0) {
+        event_loop_remove(control_loop, &control_trace_signal);
+    }
+    if (control_calibrate_done.fd >= 0) {
+        event_loop_remove(control_loop, &control_calibrate_done);
+    }
+    event_loop_remove(control_loop, &control_listener);
+    close(control_listener.fd);
+    control_listener.fd = -1;
+    control_loop = -1;
+    pool_destroy(&control_metrics_buffers);
+    pool_destroy(&control_client_pool);
 }
@@ -18,8 +18,30 @@ extern char AUDIO_CONTROL_SOCKET_PATH[];
 #define RESPONSE_ERROR 400
 #define RESPONSE_UNKNOWN_VARIABLE 404
 
-// Functions
-void *audio_control_server_thread(void *arg);
-void handle_control_client(int client_sock);
+// Connection limits
+#define CONTROL_MAX_REQUEST 256
+#define CONTROL_MAX_REPLY 1024
+#define CONTROL_OUTPUT_BUFFER 4096
+#ifdef CONFIG_TINY_BUILD
+#define CONTROL_METRICS_BUFFERS 1     // METRICS expositions written at the same time
+#else
+#define CONTROL_METRICS_BUFFERS 2
+#endif
+
+// Accepted SUBSCRIBE report intervals
+#define CONTROL_MIN_REPORT_MS 20
+#define CONTROL_MAX_REPORT_MS 60000
+
+// A BATCH not applied by an audio thread within two frames is applied by the control thread
+#define CONTROL_BATCH_FALLBACK_MS 80
+
+// Starts serving control clients on the network thread's event loop. Returns 0 on success.
+int control_server_init(int loop);
+
+// Runs reloads, reports and writes that are due. Returns milliseconds until the next one, or -1.
+int control_server_poll(void);
+
+// Disconnects all control clients, saves pending settings and closes the listening socket.
+void control_server_shutdown(void);
 
 #endif // CONTROL_SERVER_H
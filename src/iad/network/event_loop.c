@@ -0,0 +1,72 @@
+#include <errno.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include "event_loop.h"
+#include "logging.h"
+
+#define TAG "NET_EVENT"
+
+// Ready events handled per epoll_wait call
+#define EVENT_LOOP_BATCH 16
+
+int event_loop_create() {
+    int loop = epoll_create1(EPOLL_CLOEXEC);
+    if (loop < 0) {
+        handle_audio_error(TAG, "epoll_create1");
+    }
+    return loop;
+}
+
+int event_loop_add(int loop, EventHandler *handler, uint32_t events) {
+    struct epoll_event ev = {.events = events, .data.ptr = handler};
+    if (epoll_ctl(loop, EPOLL_CTL_ADD, handler->fd, &ev) == -1) {
+        handle_audio_error(TAG, "epoll_ctl add");
+        return -1;
+    }
+    return 0;
+}
+
+int event_loop_modify(int loop, EventHandler *handler, uint32_t events) {
+    struct epoll_event ev = {.events = events, .data.ptr = handler};
+    if (epoll_ctl(loop, EPOLL_CTL_MOD, handler->fd, &ev) == -1) {
+        handle_audio_error(TAG, "epoll_ctl modify");
+        return -1;
+    }
+    return 0;
+}
+
+void event_loop_remove(int loop, EventHandler *handler) {
+    // Older kernels require a non-NULL event even though it is ignored
+    struct epoll_event ev = {0};
+    epoll_ctl(loop, EPOLL_CTL_DEL, handler->fd, &ev);
+}
+
+int event_loop_timeout(int timeout_ms, int other_ms) {
+    if (timeout_ms < 0) {
+        return other_ms;
+    }
+    return other_ms >= 0 && other_ms < timeout_ms ? other_ms : timeout_ms;
+}
+
+/**
+ * Waits for ready handlers and runs their callbacks. A callback may remove and
+ * free its own handler, but must not free other handlers of the same batch.
+ */
+int event_loop_dispatch(int loop, int timeout_ms) {
+    struct epoll_event events[EVENT_LOOP_BATCH];
+
+    int count = epoll_wait(loop, events, EVENT_LOOP_BATCH, timeout_ms);
+    if (count < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        handle_audio_error(TAG, "epoll_wait");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        EventHandler *handler = events[i].data.ptr;
+        handler->callback(handler, events[i].events);
+    }
+    return count;
+}
@@ -0,0 +1,42 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+typedef struct EventHandler EventHandler;
+
+// Called with the ready epoll events (EPOLLIN, EPOLLOUT, EPOLLHUP, ...) of the handler's fd
+typedef void (*event_callback)(EventHandler *handler, uint32_t events);
+
+/**
+ * @brief A file descriptor watched by an event loop.
+ *
+ * Embed this as the first member of a per-connection struct; the callback can
+ * cast the handler back to the containing struct.
+ */
+struct EventHandler {
+    int fd;                     // Watched file descriptor
+    event_callback callback;    // Invoked when the fd is ready
+};
+
+// Creates an event loop. Returns its descriptor, or -1 on failure.
+int event_loop_create(void);
+
+// Starts watching a handler's fd for the given events. Returns 0 on success, -1 on failure.
+int event_loop_add(int loop, EventHandler *handler, uint32_t events);
+
+// Changes the events watched for a handler. Returns 0 on success, -1 on failure.
+int event_loop_modify(int loop, EventHandler *handler, uint32_t events);
+
+// Stops watching a handler. Must be called before its fd is closed.
+void event_loop_remove(int loop, EventHandler *handler);
+
+// Returns the shorter of two dispatch timeouts, where -1 means no limit.
+int event_loop_timeout(int timeout_ms, int other_ms);
+
+// Waits up to timeout_ms (-1 for no limit) and runs the callbacks of ready handlers.
+// Returns the number of handlers run, or -1 on failure other than EINTR.
+int event_loop_dispatch(int loop, int timeout_ms);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,360 @@
+#define _GNU_SOURCE         // for struct ucred
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "event_loop.h"
+#include "handover.h"
+#include "input_server.h"
+#include "logging.h"
+#include "network.h"
+
+#define TAG "NET_HANDOVER"
+
+#define HANDOVER_REQUEST "HANDOVER"
+#define HANDOVER_REQUEST_LEN 8
+
+// The new daemon sends its request right after connecting
+#define HANDOVER_REQUEST_TIMEOUT_MS 100
+
+#define HANDOVER_MAX_FDS (HANDOVER_MAX_LISTENERS + HANDOVER_MAX_CLIENTS)
+
+typedef struct {
+    char name[HANDOVER_NAME_LEN];
+    int fd;
+} HandoverListener;
+
+// Sockets received from the old daemon, handed out once by the servers
+static HandoverListener inherited_listeners[HANDOVER_MAX_LISTENERS];
+static int inherited_listener_count = 0;
+static int inherited_clients[HANDOVER_MAX_CLIENTS];
+static int inherited_client_count = 0;
+
+// Listening sockets of this daemon, only touched by the network thread
+static HandoverListener own_listeners[HANDOVER_MAX_LISTENERS];
+static int own_listener_count = 0;
+
+static int handover_loop = -1;
+static EventHandler handover_listener = {.fd = -1};
+static int handed_over = 0;
+
+static long long handover_monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int handover_connect(void) {
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        handle_audio_error(TAG, "socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(&addr.sun_path[1], HANDOVER_SOCKET_PATH, sizeof(addr.sun_path) - 2);
+
+    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(sa_family_t) + strlen(HANDOVER_SOCKET_PATH) + 1) == -1) {
+        handle_audio_error(TAG, "No running daemon to take over from");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/**
+ * Receives the handover message and its descriptors into the inherited tables.
+ */
+static int handover_receive(int sockfd) {
+    struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+    if (poll(&pfd, 1, HANDOVER_RECEIVE_TIMEOUT_MS) <= 0) {
+        fprintf(stderr, "[ERROR] [HANDOVER] The running daemon did not hand over its sockets\n");
+        return -1;
+    }
+
+    HandoverMessage message;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOVER_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {.iov_base = &message, .iov_len = sizeof(message)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t received = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+    if (received < 0) {
+        handle_audio_error(TAG, "recvmsg");
+        return -1;
+    }
+
+    int fds[HANDOVER_MAX_FDS];
+    int fd_count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), fd_count * sizeof(int));
+        }
+    }
+
+    if (received != sizeof(message) || message.magic != HANDOVER_MAGIC ||
+        message.listener_count > HANDOVER_MAX_LISTENERS || message.client_count > HANDOVER_MAX_CLIENTS ||
+        (msg.msg_flags & MSG_CTRUNC) || fd_count != (int)(message.listener_count + message.client_count)) {
+        fprintf(stderr, "[ERROR] [HANDOVER] Invalid handover message\n");
+        for (int i = 0; i < fd_count; i++) {
+            close(fds[i]);
+        }
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < message.listener_count; i++) {
+        HandoverListener *listener = &inherited_listeners[inherited_listener_count++];
+        memcpy(listener->name, message.names[i], HANDOVER_NAME_LEN);
+        listener->name[HANDOVER_NAME_LEN - 1] = '\0';
+        listener->fd = fds[i];
+    }
+    for (unsigned int i = 0; i < message.client_count; i++) {
+        inherited_clients[inherited_client_count++] = fds[message.listener_count + i];
+    }
+    return 0;
+}
+
+/**
+ * The old daemon keeps its end open until it exits, so end of file means the
+ * audio devices are free.
+ */
+static int handover_wait_released(int sockfd) {
+    long long deadline = handover_monotonic_ms() + HANDOVER_RELEASE_TIMEOUT_MS;
+
+    while (1) {
+        long long remaining = deadline - handover_monotonic_ms();
+        if (remaining <= 0) {
+            fprintf(stderr, "[ERROR] [HANDOVER] The old daemon did not exit\n");
+            return -1;
+        }
+
+        struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+        int ret = poll(&pfd, 1, (int)remaining);
+        if (ret < 0 && errno != EINTR) {
+            handle_audio_error(TAG, "poll");
+            return -1;
+        }
+        if (ret <= 0) {
+            continue;
+        }
+
+        char discard[16];
+        ssize_t n = read(sockfd, discard, sizeof(discard));
+        if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+            return 0;
+        }
+    }
+}
+
+int handover_take_over() {
+    long long start_ms = handover_monotonic_ms();
+
+    int sockfd = handover_connect();
+    if (sockfd < 0) {
+        return -1;
+    }
+
+    if (send(sockfd, HANDOVER_REQUEST, HANDOVER_REQUEST_LEN, MSG_NOSIGNAL) != HANDOVER_REQUEST_LEN ||
+        handover_receive(sockfd)) {
+        close(sockfd);
+        return -1;
+    }
+    printf("[INFO] [HANDOVER] Received %d listening sockets and %d input clients, waiting for the old daemon to exit\n",
+           inherited_listener_count, inherited_client_count);
+
+    int ret = handover_wait_released(sockfd);
+    close(sockfd);
+    if (ret) {
+        return -1;
+    }
+
+    printf("[INFO] [HANDOVER] Old daemon exited %lld ms after the request\n", handover_monotonic_ms() - start_ms);
+    return 0;
+}
+
+int handover_take_listener(const char *name) {
+    for (int i = 0; i < inherited_listener_count; i++) {
+        HandoverListener *listener = &inherited_listeners[i];
+        if (listener->fd >= 0 && strcmp(listener->name, name) == 0) {
+            int fd = listener->fd;
+            listener->fd = -1;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+int handover_take_clients(int *fds, int max) {
+    int count = inherited_client_count < max ? inherited_client_count : max;
+    memcpy(fds, inherited_clients, count * sizeof(int));
+    for (int i = count; i < inherited_client_count; i++) {
+        close(inherited_clients[i]);
+    }
+    inherited_client_count = 0;
+    return count;
+}
+
+void handover_release_unused() {
+    for (int i = 0; i < inherited_listener_count; i++) {
+        if (inherited_listeners[i].fd >= 0) {
+            printf("[INFO] [HANDOVER] Closing unused socket %s\n", inherited_listeners[i].name);
+            close(inherited_listeners[i].fd);
+            inherited_listeners[i].fd = -1;
+        }
+    }
+    for (int i = 0; i < inherited_client_count; i++) {
+        close(inherited_clients[i]);
+    }
+    inherited_client_count = 0;
+}
+
+void handover_add_listener(const char *name, int fd) {
+    if (own_listener_count == HANDOVER_MAX_LISTENERS) {
+        return;
+    }
+    HandoverListener *listener = &own_listeners[own_listener_count++];
+    strncpy(listener->name, name, HANDOVER_NAME_LEN - 1);
+    listener->name[HANDOVER_NAME_LEN - 1] = '\0';
+    listener->fd = fd;
+}
+
+/**
+ * Sends the listening sockets and the input clients to the new daemon. The
+ * connection stays open until this process exits, which tells the new daemon
+ * the audio devices are free.
+ */
+static int handover_send(int sockfd) {
+    HandoverMessage message;
+    memset(&message, 0, sizeof(message));
+    message.magic = HANDOVER_MAGIC;
+
+    int fds[HANDOVER_MAX_FDS];
+    for (int i = 0; i < own_listener_count; i++) {
+        memcpy(message.names[i], own_listeners[i].name, HANDOVER_NAME_LEN);
+        fds[i] = own_listeners[i].fd;
+    }
+    message.listener_count = own_listener_count;
+
+    // The record thread stops sending to these before they leave
+    int client_count = input_server_detach_clients(&fds[own_listener_count], HANDOVER_MAX_CLIENTS);
+    message.client_count = client_count;
+    int fd_count = own_listener_count + client_count;
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOVER_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {.iov_base = &message, .iov_len = sizeof(message)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = CMSG_SPACE(sizeof(int) * fd_count),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+
+    int ret = sendmsg(sockfd, &msg, MSG_NOSIGNAL) == sizeof(message) ? 0 : -1;
+    if (ret) {
+        handle_audio_error(TAG, "sendmsg");
+    }
+
+    // The new daemon holds its own references now; detached clients that
+    // could not be sent have to reconnect
+    for (int i = own_listener_count; i < fd_count; i++) {
+        close(fds[i]);
+    }
+    if (ret == 0) {
+        printf("[INFO] [HANDOVER] Handed %d listening sockets and %d input clients to the new daemon\n",
+               own_listener_count, client_count);
+    }
+    return ret;
+}
+
+static void handover_listener_event(EventHandler *handler, uint32_t events) {
+    int sockfd = accept(handler->fd, NULL, NULL);
+    if (sockfd == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            handle_audio_error(TAG, "accept");
+        }
+        return;
+    }
+
+    // Only a daemon started by the same user may take the sockets
+    struct ucred peer;
+    socklen_t peer_len = sizeof(peer);
+    if (handed_over || getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) == -1 ||
+        (peer.uid != geteuid() && peer.uid != 0)) {
+        close(sockfd);
+        return;
+    }
+
+    struct timeval timeout = {0, HANDOVER_REQUEST_TIMEOUT_MS * 1000};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char request[HANDOVER_REQUEST_LEN];
+    if (recv(sockfd, request, sizeof(request), MSG_WAITALL) != HANDOVER_REQUEST_LEN ||
+        memcmp(request, HANDOVER_REQUEST, HANDOVER_REQUEST_LEN) != 0) {
+        close(sockfd);
+        return;
+    }
+
+    printf("[INFO] [HANDOVER] New daemon (pid %d) is taking over\n", (int)peer.pid);
+    if (handover_send(sockfd)) {
+        close(sockfd);
+        return;
+    }
+
+    // Left open on purpose, it closes when this process exits
+    handed_over = 1;
+}
+
+int handover_server_init(int loop) {
+    handover_listener.fd = network_listen(HANDOVER_SOCKET_PATH, "HANDOVER");
+    if (handover_listener.fd < 0) {
+        return -1;
+    }
+    handover_listener.callback = handover_listener_event;
+
+    if (event_loop_add(loop, &handover_listener, EPOLLIN)) {
+        close(handover_listener.fd);
+        handover_listener.fd = -1;
+        return -1;
+    }
+    handover_loop = loop;
+    return 0;
+}
+
+int handover_done() {
+    return handed_over;
+}
+
+void handover_server_shutdown() {
+    if (handover_listener.fd < 0) {
+        return;
+    }
+
+    event_loop_remove(handover_loop, &handover_listener);
+    close(handover_listener.fd);
+    handover_listener.fd = -1;
+}
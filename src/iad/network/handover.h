@@ -0,0 +1,65 @@
+#ifndef HANDOVER_H
+#define HANDOVER_H
+
+// Socket a new daemon started with -t connects to, to take over from the running one
+#define HANDOVER_SOCKET_PATH "ingenic_audio_handover"
+
+// Listening sockets and input clients passed in one handover
+#define HANDOVER_MAX_LISTENERS 4
+#define HANDOVER_MAX_CLIENTS 32
+
+#define HANDOVER_MAGIC 0x49414448   // "IADH"
+#define HANDOVER_NAME_LEN 32
+
+// How long the new daemon waits for the sockets, and for the old one to exit
+#define HANDOVER_RECEIVE_TIMEOUT_MS 2000
+#define HANDOVER_RELEASE_TIMEOUT_MS 5000
+
+/**
+ * @brief Sent by the old daemon along with the descriptors: the listening
+ * sockets first, in the order of their names, then the input clients.
+ */
+typedef struct {
+    unsigned int magic;
+    unsigned int listener_count;
+    unsigned int client_count;
+    char names[HANDOVER_MAX_LISTENERS][HANDOVER_NAME_LEN];
+} HandoverMessage;
+
+/**
+ * Takes over the listening sockets and input clients of the running daemon and
+ * waits until it has released the audio devices and exited. Called by a daemon
+ * started with -t before anything else is set up.
+ * @return 0 on success, -1 if no daemon handed over in time.
+ */
+int handover_take_over(void);
+
+/**
+ * Returns the inherited listening socket with the given name, once.
+ * @return The socket, or -1 if none was handed over.
+ */
+int handover_take_listener(const char *name);
+
+/**
+ * Returns the inherited input clients. They are handed out once.
+ * @param fds Receives up to max client sockets.
+ * @return The number of sockets stored.
+ */
+int handover_take_clients(int *fds, int max);
+
+// Closes inherited sockets nobody took, e.g. after a socket was renamed.
+void handover_release_unused(void);
+
+// Records a listening socket of this daemon so it can be handed over later.
+void handover_add_listener(const char *name, int fd);
+
+// Starts accepting handover requests on the network thread's event loop. Returns 0 on success.
+int handover_server_init(int loop);
+
+// Returns 1 once the sockets were handed to a new daemon, which then owns them.
+int handover_done(void);
+
+// Stops accepting handover requests.
+void handover_server_shutdown(void);
+
+#endif // HANDOVER_H
@@ -1,119 +1,191 @@
-#include <stdlib.h>
-#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <pthread.h>
 #include <stdio.h>
-#include <sys/un.h>
 #include <unistd.h>
+#include "config.h"
 #include "input.h"
+#include "lockstat.h"
 #include "logging.h"
+#include "pool.h"
 #include "utils.h"
 #include "network.h"
 #include "input_server.h"
+#include "handover.h"
 #include "audio_common.h"
+#include "telemetry.h"
+#include "trace.h"
 
 #define TAG "NET_INPUT"
 
-// Global flag and mutex to control thread termination
-extern volatile int g_stop_thread;
-extern pthread_mutex_t g_stop_thread_mutex;
+static int input_loop = -1;
+static EventHandler input_listener = {.fd = -1};
 
-void handle_audio_input_client(int client_sock) {
-    pthread_mutex_lock(&audio_buffer_lock);
+// ClientNodes, each followed by room for the rest of a frame, only touched by the network thread
+static Pool input_clients;
 
-    ClientNode *new_client = (ClientNode *)malloc(sizeof(ClientNode));
-    if (!new_client) {
-        handle_audio_error(TAG, "malloc");
-        close(client_sock);
-        pthread_mutex_unlock(&audio_buffer_lock);
-        return;
-    }
-    new_client->sockfd = client_sock;
-    new_client->next = client_list_head;
-    client_list_head = new_client;
+// Connection numbers for input clients, protected by audio_buffer_lock
+static unsigned int next_client_id = 1;
 
-    pthread_mutex_unlock(&audio_buffer_lock);
+static void input_client_close(ClientNode *client) {
+    audio_lock(LOCK_SITE_INPUT_CLIENTS);
+    for (ClientNode **link = &client_list_head; *link; link = &(*link)->next) {
+        if (*link == client) {
+            *link = client->next;
+            break;
+        }
+    }
+    audio_unlock();
+    trace_event(TRACE_CLIENT_DISCONNECT, client->id, TRACE_CLIENT_INPUT);
 
-    printf("[INFO] [AI] Input client connected\n");
+    event_loop_remove(input_loop, &client->handler);
+    close(client->handler.fd);
+    pool_put(&input_clients, client);
+    printf("[INFO] [AI] Input client disconnected\n");
+}
 
-    AiThreadArg thread_arg;
-    thread_arg.sockfd = client_sock;
+/**
+ * Input clients only receive audio. Anything they send is discarded; a client
+ * that half-closes its end keeps receiving until it hangs up.
+ */
+static void input_client_event(EventHandler *handler, uint32_t events) {
+    ClientNode *client = (ClientNode *)handler;
+
+    if (events & EPOLLIN) {
+        char discard[256];
+        ssize_t n;
+        while ((n = recv(handler->fd, discard, sizeof(discard), MSG_DONTWAIT)) > 0) {
+        }
+        if (n == 0) {
+            event_loop_modify(input_loop, handler, 0);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            events |= EPOLLERR;
+        }
+    }
 
-    pthread_t ai_thread;
-    if (pthread_create(&ai_thread, NULL, ai_record_thread, &thread_arg) != 0) {
-        handle_audio_error(TAG, "pthread_create");
-        close(client_sock);
-        free(new_client);
-    } else {
-        pthread_detach(ai_thread);
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        input_client_close(client);
     }
 }
 
-void *audio_input_server_thread(void *arg) {
-    printf("[INFO] [AI] Entering audio_input_server_thread\n");
+/**
+ * Adds a connected client to the list the record thread sends to.
+ * @return 0 on success, -1 if the socket was closed.
+ */
+static int input_client_add(int client_sock) {
+    fcntl(client_sock, F_SETFL, fcntl(client_sock, F_GETFL) | O_NONBLOCK);
 
-    // Fetch audio play attributes
-    int aiDevID, aiChnID;
-    get_audio_input_device_attributes(&aiDevID, &aiChnID);
+    ClientNode *new_client = pool_get(&input_clients);
+    if (!new_client) {
+        printf("[INFO] [AI] Too many input clients, rejecting connection\n");
+        close(client_sock);
+        return -1;
+    }
+    new_client->handler.fd = client_sock;
+    new_client->handler.callback = input_client_event;
+    new_client->pending = (unsigned char *)(new_client + 1);
+    new_client->pending_size = AI_MAX_FRAME_BYTES;
 
-    if (initialize_audio_input_device(aiDevID, aiChnID) != 0) {
-        fprintf(stderr, "[ERROR] Failed to initialize audio input device\n");
-        return NULL;
+    if (event_loop_add(input_loop, &new_client->handler, EPOLLIN)) {
+        close(client_sock);
+        pool_put(&input_clients, new_client);
+        return -1;
     }
 
-    update_socket_paths_from_config();
+    // The record thread sends to the client from its next frame on
+    audio_lock(LOCK_SITE_INPUT_CLIENTS);
+    new_client->id = next_client_id++;
+    new_client->next = client_list_head;
+    client_list_head = new_client;
+    audio_unlock();
+    trace_event(TRACE_CLIENT_CONNECT, new_client->id, TRACE_CLIENT_INPUT);
+    return 0;
+}
+
+static void input_listener_event(EventHandler *handler, uint32_t events) {
+    while (1) {
+        int client_sock = accept(handler->fd, NULL, NULL);
+        if (client_sock == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                handle_audio_error(TAG, "accept");
+            }
+            return;
+        }
 
-    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        handle_audio_error(TAG, "socket");
-        return NULL;
+        if (input_client_add(client_sock) == 0) {
+            telemetry_count(TELEMETRY_AI_CONNECTS);
+            printf("[INFO] [AI] Input client connected\n");
+        }
     }
+}
 
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    strncpy(&addr.sun_path[1], AUDIO_INPUT_SOCKET_PATH, sizeof(addr.sun_path) - 2);
-    addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
-
-    printf("[INFO] [AI] Attempting to bind socket\n");
-    if (bind(sockfd, (struct sockaddr*)&addr, sizeof(sa_family_t) + strlen(AUDIO_INPUT_SOCKET_PATH) + 1) == -1) {
-        handle_audio_error(TAG, "bind failed");
-        close(sockfd);
-        return NULL;
-    }
-    else {
-        printf("[INFO] [AI] Bind to input socket succeeded\n");
+int input_server_init(int loop) {
+    if (pool_init(&input_clients, "input clients", sizeof(ClientNode) + AI_MAX_FRAME_BYTES,
+                  config_get()->network.max_input_clients)) {
+        handle_audio_error(TAG, "Failed to allocate the input client pool");
+        return -1;
     }
 
-    printf("[INFO] [AI] Attempting to listen on socket\n");
-    if (listen(sockfd, 5) == -1) {
-        handle_audio_error(TAG, "listen");
-        close(sockfd);
-        return NULL;
+    input_listener.fd = network_listen(AUDIO_INPUT_SOCKET_PATH, "AI");
+    if (input_listener.fd < 0) {
+        pool_destroy(&input_clients);
+        return -1;
     }
-    else {
-        printf("[INFO] [AI] Listening on input socket\n");
+    input_listener.callback = input_listener_event;
+
+    if (event_loop_add(loop, &input_listener, EPOLLIN)) {
+        close(input_listener.fd);
+        input_listener.fd = -1;
+        pool_destroy(&input_clients);
+        return -1;
     }
+    input_loop = loop;
 
-    while (1) {
-        int should_stop = 0;
-        pthread_mutex_lock(&g_stop_thread_mutex);
-        should_stop = g_stop_thread;
-        pthread_mutex_unlock(&g_stop_thread_mutex);
+    // Clients of the daemon this one took over from keep their stream
+    int inherited[HANDOVER_MAX_CLIENTS];
+    int count = handover_take_clients(inherited, HANDOVER_MAX_CLIENTS);
+    for (int i = 0; i < count; i++) {
+        input_client_add(inherited[i]);
+    }
+    if (count > 0) {
+        printf("[INFO] [AI] Took over %d input clients\n", count);
+    }
+    return 0;
+}
 
-        if (should_stop) {
-            break;
-        }
+int input_server_detach_clients(int *fds, int max) {
+    int count = 0;
 
-        printf("[INFO] [AI] Waiting for input client connection\n");
-        int client_sock = accept(sockfd, NULL, NULL);
-        if (client_sock == -1) {
-            handle_audio_error(TAG, "accept");
+    audio_lock(LOCK_SITE_INPUT_CLIENTS);
+    ClientNode **link = &client_list_head;
+    while (*link) {
+        ClientNode *client = *link;
+        // A client in the middle of a frame would see the rest of it missing
+        if (client->pending_len > 0 || count == max) {
+            link = &client->next;
             continue;
         }
-        handle_audio_input_client(client_sock);
+        *link = client->next;
+        event_loop_remove(input_loop, &client->handler);
+        fds[count++] = client->handler.fd;
+        pool_put(&input_clients, client);
+    }
+    audio_unlock();
+
+    return count;
+}
+
+void input_server_shutdown() {
+    if (input_listener.fd < 0) {
+        return;
     }
 
-    close(sockfd);
-    return NULL;
+    while (client_list_head) {
+        input_client_close(client_list_head);
+    }
+    event_loop_remove(input_loop, &input_listener);
+    close(input_listener.fd);
+    input_listener.fd = -1;
+    pool_destroy(&input_clients);
 }
@@ -18,7 +18,18 @@ extern char AUDIO_INPUT_SOCKET_PATH[];
 #define RESPONSE_ERROR 400
 #define RESPONSE_UNKNOWN_VARIABLE 404
 
-// Functions
-void *audio_input_server_thread(void *arg);
+// Starts serving input clients on the network thread's event loop. Returns 0 on success.
+int input_server_init(int loop);
+
+/**
+ * Removes the input clients that are between two frames from the client list
+ * without closing them, so they can be handed to a new daemon.
+ * @param fds Receives up to max client sockets, now owned by the caller.
+ * @return The number of sockets stored.
+ */
+int input_server_detach_clients(int *fds, int max);
+
+// Disconnects all input clients and closes the listening socket.
+void input_server_shutdown(void);
 
 #endif // INPUT_SERVER_H
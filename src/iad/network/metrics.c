@@ -0,0 +1,189 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "admission.h"
+#include "ao_queue.h"
+#include "footprint.h"
+#include "lockstat.h"
+#include "metrics.h"
+#include "output.h"
+#include "output_server.h"
+#include "pool.h"
+#include "telemetry.h"
+#include "utils.h"
+
+#define TAG "NET_METRICS"
+
+#define METRICS_EOF "# EOF\n"
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;         // Excludes the room kept for METRICS_EOF
+    int truncated;
+} MetricsBuffer;
+
+/**
+ * Appends formatted text. Text that doesn't fit in the buffer is dropped,
+ * and so is everything after it, so the output only ever has whole lines.
+ */
+static void metrics_printf(MetricsBuffer *out, const char *fmt, ...) {
+    if (out->truncated) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out->buf + out->len, out->cap - out->len, fmt, args);
+    va_end(args);
+
+    if (n < 0 || (size_t)n >= out->cap - out->len) {
+        out->buf[out->len] = '\0';
+        out->truncated = 1;
+        return;
+    }
+    out->len += n;
+}
+
+static void metrics_header(MetricsBuffer *out, const char *name, const char *type, const char *help) {
+    metrics_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics_counter(MetricsBuffer *out, const char *name, const char *help, unsigned long long value) {
+    metrics_header(out, name, "counter", help);
+    metrics_printf(out, "%s %llu\n", name, value);
+}
+
+static void metrics_gauge(MetricsBuffer *out, const char *name, const char *help, long long value) {
+    metrics_header(out, name, "gauge", help);
+    metrics_printf(out, "%s %lld\n", name, value);
+}
+
+static void metrics_histogram(MetricsBuffer *out, const char *name, const char *help, TelemetryHistogram histogram) {
+    static const long bounds_us[TELEMETRY_BUCKET_COUNT - 1] = TELEMETRY_BUCKET_BOUNDS_US;
+    TelemetryHistogramSnapshot snapshot;
+    telemetry_histogram(histogram, &snapshot);
+
+    metrics_header(out, name, "histogram", help);
+    unsigned long long cumulative = 0;
+    for (int i = 0; i < TELEMETRY_BUCKET_COUNT - 1; i++) {
+        cumulative += snapshot.buckets[i];
+        metrics_printf(out, "%s_bucket{le=\"%g\"} %llu\n", name, bounds_us[i] / 1e6, cumulative);
+    }
+    metrics_printf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, snapshot.count);
+    metrics_printf(out, "%s_sum %g\n", name, snapshot.sum_us / 1e6);
+    metrics_printf(out, "%s_count %llu\n", name, snapshot.count);
+}
+
+size_t metrics_render(char *buf, size_t size) {
+    MetricsBuffer out = {.buf = buf, .len = 0, .cap = size - sizeof(METRICS_EOF) + 1};
+
+    metrics_counter(&out, "iad_ai_frames_captured_total", "Frames read from the AI channel.",
+                    telemetry_counter(TELEMETRY_AI_FRAMES));
+    metrics_counter(&out, "iad_ao_frames_played_total", "Client frames sent to the AO channel.",
+                    telemetry_counter(TELEMETRY_AO_FRAMES));
+    metrics_counter(&out, "iad_ao_frames_dropped_total", "Queued client frames discarded by a stream switch.",
+                    telemetry_counter(TELEMETRY_AO_FRAMES_DROPPED));
+    metrics_counter(&out, "iad_ao_underruns_total", "Gaps in an output stream filled by concealment.",
+                    ao_underrun_count());
+    metrics_counter(&out, "iad_ao_concealed_samples_total", "Silence or comfort noise samples inserted on underrun.",
+                    ao_concealed_samples());
+    metrics_counter(&out, "iad_device_errors_total", "Failed IMP calls on the audio path.",
+                    telemetry_counter(TELEMETRY_DEVICE_ERROR));
+    metrics_counter(&out, "iad_ai_client_connects_total", "Input clients accepted.",
+                    telemetry_counter(TELEMETRY_AI_CONNECTS));
+    metrics_counter(&out, "iad_ao_client_connects_total", "Output clients accepted.",
+                    telemetry_counter(TELEMETRY_AO_CONNECTS));
+    metrics_counter(&out, "iad_ao_streams_total", "Output clients admitted to the AO channel.",
+                    telemetry_counter(TELEMETRY_STREAM_START));
+    metrics_counter(&out, "iad_heap_allocations_total", "Heap allocations since startup; constant while streaming.",
+                    heap_allocation_count());
+    metrics_counter(&out, "iad_ai_poll_faults_total", "IMP_AI_PollingFrame calls that failed or timed out.",
+                    telemetry_counter(TELEMETRY_AI_POLL_FAULTS));
+    metrics_counter(&out, "iad_ai_get_faults_total", "IMP_AI_GetFrame calls that failed.",
+                    telemetry_counter(TELEMETRY_AI_GET_FAULTS));
+    metrics_counter(&out, "iad_ai_reinits_total", "AI channel re-initializations to recover from capture faults.",
+                    telemetry_counter(TELEMETRY_AI_REINITS));
+    metrics_counter(&out, "iad_ai_recoveries_total", "Capture outages recovered from.",
+                    telemetry_counter(TELEMETRY_AI_RECOVERIES));
+    metrics_counter(&out, "iad_ai_gap_frames_total", "Silence frames sent to input clients in place of lost capture.",
+                    telemetry_counter(TELEMETRY_AI_GAP_FRAMES));
+
+    // Queue depths and per-client totals are read under audio_buffer_lock, like their writers
+    audio_lock(LOCK_SITE_METRICS);
+    int ao_queued = ao_queue_count();
+    int ao_depth = ao_queue_depth();
+    int ai_clients = 0;
+    for (ClientNode *client = client_list_head; client; client = client->next) {
+        ai_clients++;
+    }
+    audio_unlock();
+
+    metrics_gauge(&out, "iad_ao_queue_frames", "Frames waiting in the internal AO queue.", ao_queued);
+    metrics_gauge(&out, "iad_ao_queue_depth", "Capacity of the internal AO queue in frames.", ao_depth);
+    metrics_gauge(&out, "iad_ao_waiting_clients", "Output clients waiting for admission.", admission_waiting());
+    metrics_gauge(&out, "iad_ai_clients", "Connected input clients.", ai_clients);
+
+    metrics_header(&out, "iad_ai_client_bytes_total", "counter", "Audio bytes delivered to an input client.");
+    audio_lock(LOCK_SITE_METRICS);
+    for (ClientNode *client = client_list_head; client; client = client->next) {
+        metrics_printf(&out, "iad_ai_client_bytes_total{client=\"%u\"} %llu\n", client->id, client->bytes_sent);
+    }
+    audio_unlock();
+
+    metrics_header(&out, "iad_ai_client_drops_total", "counter", "Frames not delivered in full to an input client.");
+    audio_lock(LOCK_SITE_METRICS);
+    for (ClientNode *client = client_list_head; client; client = client->next) {
+        metrics_printf(&out, "iad_ai_client_drops_total{client=\"%u\"} %u\n", client->id, client->drops);
+    }
+    audio_unlock();
+
+    unsigned int ao_ticket;
+    unsigned long long ao_bytes;
+    ao_client_stats(&ao_ticket, &ao_bytes);
+    metrics_header(&out, "iad_ao_client_bytes_total", "counter", "Audio bytes received from the output client holding the channel.");
+    if (ao_ticket) {
+        metrics_printf(&out, "iad_ao_client_bytes_total{ticket=\"%u\"} %llu\n", ao_ticket, ao_bytes);
+    }
+
+    FootprintProcess process;
+    if (footprint_process(&process) == 0) {
+        metrics_gauge(&out, "iad_resident_memory_bytes", "Resident set size of the daemon.", process.rss_kb * 1024LL);
+        metrics_gauge(&out, "iad_threads", "Threads of the daemon.", process.threads);
+    }
+
+    metrics_header(&out, "iad_thread_stack_resident_bytes", "gauge", "Stack pages a thread has touched, its high-water mark.");
+    const char *thread_name;
+    size_t stack_used_kb, stack_size_kb;
+    for (int i = 0; footprint_stack(i, &thread_name, &stack_used_kb, &stack_size_kb) == 0; i++) {
+        metrics_printf(&out, "iad_thread_stack_resident_bytes{thread=\"%s\"} %zu\n", thread_name, stack_used_kb * 1024);
+    }
+
+    metrics_histogram(&out, "iad_ao_lock_wait_seconds", "Time the play thread waited for the audio buffer lock.",
+                      TELEMETRY_AO_LOCK_WAIT);
+    metrics_histogram(&out, "iad_ai_lock_wait_seconds", "Time the record thread waited for the audio buffer lock.",
+                      TELEMETRY_AI_LOCK_WAIT);
+    metrics_histogram(&out, "iad_ao_frame_processing_seconds", "Time spent preparing an output frame before sending it.",
+                      TELEMETRY_AO_FRAME_TIME);
+    metrics_histogram(&out, "iad_ai_frame_processing_seconds", "Time spent delivering a captured frame to the clients.",
+                      TELEMETRY_AI_FRAME_TIME);
+    metrics_histogram(&out, "iad_ai_recovery_seconds", "Time from the first capture fault to the next captured frame.",
+                      TELEMETRY_AI_RECOVERY_TIME);
+    metrics_histogram(&out, "iad_ao_queue_wait_seconds", "Time from reading client audio to the play thread taking it.",
+                      TELEMETRY_AO_QUEUE_WAIT);
+    metrics_histogram(&out, "iad_ao_send_seconds", "Time spent in IMP_AO_SendFrame.", TELEMETRY_AO_SEND_TIME);
+    metrics_histogram(&out, "iad_ao_path_seconds", "Time from reading client audio to IMP_AO_SendFrame returning.",
+                      TELEMETRY_AO_PATH_TIME);
+    metrics_histogram(&out, "iad_ai_get_seconds", "Time spent in IMP_AI_GetFrame.", TELEMETRY_AI_GET_TIME);
+    metrics_histogram(&out, "iad_ai_write_delay_seconds", "Time from IMP_AI_GetFrame returning to a client's send() returning.",
+                      TELEMETRY_AI_WRITE_DELAY);
+
+    if (out.truncated) {
+        fprintf(stderr, "[WARNING] [METRICS] Exposition exceeds %zu bytes, truncated\n", size);
+    }
+
+    // Marks the end of the exposition on a pipelined connection; scrapers read it as a comment
+    memcpy(out.buf + out.len, METRICS_EOF, sizeof(METRICS_EOF));
+    return out.len + sizeof(METRICS_EOF) - 1;
+}
@@ -0,0 +1,14 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+// Size of a rendered exposition, enough for every input client the daemon accepts
+#define METRICS_BUFFER_SIZE 16384
+
+// Renders the daemon's counters, gauges and histograms in the Prometheus text
+// exposition format into buf. Lines that don't fit are left out; the "# EOF"
+// line always ends the output. Returns the length of the output.
+size_t metrics_render(char *buf, size_t size);
+
+#endif // METRICS_H
@@ -1,8 +1,20 @@
-#include <stdlib.h>            // for free, malloc
+#include <fcntl.h>             // for fcntl, O_NONBLOCK
+#include <stdint.h>            // for uint64_t
 #include <string.h>            // for NULL, strncpy, memset, strcmp, strncmp
 #include <stdio.h>             // for printf, snprintf, sscanf
-#include "config.h"   // for config_get_ai_socket, config_get_ao_so...
+#include <sys/socket.h>        // for socket, bind, listen
+#include <sys/un.h>            // for sockaddr_un
+#include <unistd.h>            // for close, read
+#include "config.h"   // for config_get, NetworkConfig
+#include "control_server.h"  // for control_server_init, control_server_poll
+#include "event_loop.h"  // for event_loop_create, event_loop_dispatch
+#include "handover.h"  // for handover_take_listener, handover_server_init
+#include "input_server.h"  // for input_server_init
+#include "logging.h"  // for handle_audio_error
 #include "network.h"
+#include "output_server.h"  // for output_server_init, output_server_poll
+#include "parameters.h"  // for parameter_get, parameter_set
+#include "utils.h"  // for stop_signal_fd
 
 #define TAG "NET"
 
@@ -10,55 +22,140 @@ char AUDIO_INPUT_SOCKET_PATH[32] = "ingenic_audio_input";
 char AUDIO_OUTPUT_SOCKET_PATH[32] = "ingenic_audio_output";
 char AUDIO_CONTROL_SOCKET_PATH[32] = "ingenic_audio_control";
 
-// Sample variables for testing
-int sampleVariableA = 0;
-int sampleVariableB = 1;
-
-char* get_variable_value(const char* variable_name) {
-    if (strcmp(variable_name, "sampleVariableA") == 0) {
-        char* value = (char*) malloc(10 * sizeof(char));
-        snprintf(value, 10, "%d", sampleVariableA);
-        return value;
-    } else if (strcmp(variable_name, "sampleVariableB") == 0) {
-        char* value = (char*) malloc(10 * sizeof(char));
-        snprintf(value, 10, "%d", sampleVariableB);
-        return value;
-    } else {
-        return NULL;
+/**
+ * Reads a runtime parameter for a GET request.
+ * @param variable_name Name of the parameter.
+ * @param value Buffer for the value as text.
+ * @param size Size of the buffer.
+ * @return 0 on success, -1 if the parameter is unknown or can't be read.
+ */
+int get_variable_value(const char* variable_name, char* value, size_t size) {
+    long long parameter;
+    if (parameter_get(variable_name, &parameter) != PARAM_OK) {
+        return -1;
     }
+
+    snprintf(value, size, "%lld", parameter);
+    return 0;
 }
 
+/**
+ * Validates and applies a runtime parameter for a SET request.
+ * @param variable_name Name of the parameter.
+ * @param value New value as text.
+ * @return PARAM_OK on success, or one of the PARAM_* error codes.
+ */
 int set_variable_value(const char* variable_name, const char* value) {
-    if (strcmp(variable_name, "sampleVariableA") == 0) {
-        sampleVariableA = atoi(value);
-        return 0;
-    } else if (strcmp(variable_name, "sampleVariableB") == 0) {
-        sampleVariableB = atoi(value);
-        return 0;
-    } else {
-        return -1;
-    }
+    return parameter_set(variable_name, value);
 }
 
 void update_socket_paths_from_config() {
-    char *ao_socket_from_config = config_get_ao_socket();
-    if (ao_socket_from_config) {
-        strncpy(AUDIO_OUTPUT_SOCKET_PATH, ao_socket_from_config, sizeof(AUDIO_OUTPUT_SOCKET_PATH) - 1);
+    const NetworkConfig *network = &config_get()->network;
+
+    if (network->ao_socket[0]) {
+        strncpy(AUDIO_OUTPUT_SOCKET_PATH, network->ao_socket, sizeof(AUDIO_OUTPUT_SOCKET_PATH) - 1);
         AUDIO_OUTPUT_SOCKET_PATH[sizeof(AUDIO_OUTPUT_SOCKET_PATH) - 1] = '\0';
-        free(ao_socket_from_config);
     }
 
-    char *ai_socket_from_config = config_get_ai_socket();
-    if (ai_socket_from_config) {
-        strncpy(AUDIO_INPUT_SOCKET_PATH, ai_socket_from_config, sizeof(AUDIO_INPUT_SOCKET_PATH) - 1);
+    if (network->ai_socket[0]) {
+        strncpy(AUDIO_INPUT_SOCKET_PATH, network->ai_socket, sizeof(AUDIO_INPUT_SOCKET_PATH) - 1);
         AUDIO_INPUT_SOCKET_PATH[sizeof(AUDIO_INPUT_SOCKET_PATH) - 1] = '\0';
-        free(ai_socket_from_config);
     }
 
-    char *ctrl_socket_from_config = config_get_ctrl_socket();
-    if (ctrl_socket_from_config) {
-        strncpy(AUDIO_CONTROL_SOCKET_PATH, ctrl_socket_from_config, sizeof(AUDIO_CONTROL_SOCKET_PATH) - 1);
+    if (network->ctrl_socket[0]) {
+        strncpy(AUDIO_CONTROL_SOCKET_PATH, network->ctrl_socket, sizeof(AUDIO_CONTROL_SOCKET_PATH) - 1);
         AUDIO_CONTROL_SOCKET_PATH[sizeof(AUDIO_CONTROL_SOCKET_PATH) - 1] = '\0';
-        free(ctrl_socket_from_config);
     }
 }
+
+int network_listen(const char *name, const char *log_tag) {
+    // A daemon started with -t keeps serving on its predecessor's socket
+    int sockfd = handover_take_listener(name);
+    if (sockfd >= 0) {
+        handover_add_listener(name, sockfd);
+        printf("[INFO] [%s] Took over socket %s\n", log_tag, name);
+        return sockfd;
+    }
+
+    sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        handle_audio_error(TAG, "socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(&addr.sun_path[1], name, sizeof(addr.sun_path) - 2);
+    addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
+
+    if (bind(sockfd, (struct sockaddr*)&addr, sizeof(sa_family_t) + strlen(name) + 1) == -1) {
+        handle_audio_error(TAG, "bind failed");
+        close(sockfd);
+        return -1;
+    }
+
+    if (listen(sockfd, 5) == -1) {
+        handle_audio_error(TAG, "listen");
+        close(sockfd);
+        return -1;
+    }
+
+    handover_add_listener(name, sockfd);
+    printf("[INFO] [%s] Listening on socket %s\n", log_tag, name);
+    return sockfd;
+}
+
+static int network_running = 1;
+
+static void network_stop_event(EventHandler *handler, uint32_t events) {
+    uint64_t count;
+    if (read(handler->fd, &count, sizeof(count)) == sizeof(count)) {
+        printf("[INFO] [NET] Termination signal received, shutting down\n");
+        network_running = 0;
+    }
+}
+
+void *network_thread(void *arg) {
+    const NetworkServers *servers = (const NetworkServers *)arg;
+    printf("[INFO] [NET] Entering network_thread\n");
+
+    update_socket_paths_from_config();
+
+    int loop = event_loop_create();
+    if (loop < 0) {
+        return NULL;
+    }
+
+    EventHandler stop = {.fd = stop_signal_fd(), .callback = network_stop_event};
+    if (stop.fd >= 0) {
+        event_loop_add(loop, &stop, EPOLLIN);
+    }
+
+    // A server that fails to start is logged and the others keep running
+    control_server_init(loop);
+    if (servers->ai_enabled) {
+        input_server_init(loop);
+    }
+    if (servers->ao_enabled) {
+        output_server_init(loop);
+    }
+    handover_server_init(loop);
+    handover_release_unused();
+
+    // After a handover the new daemon serves the sockets, this one just exits
+    while (network_running && !handover_done()) {
+        int timeout_ms = event_loop_timeout(control_server_poll(), output_server_poll());
+        if (event_loop_dispatch(loop, timeout_ms) < 0) {
+            break;
+        }
+    }
+
+    handover_server_shutdown();
+    output_server_shutdown();
+    input_server_shutdown();
+    control_server_shutdown();
+
+    close(loop);
+    return NULL;
+}
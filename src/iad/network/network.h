@@ -16,9 +16,32 @@
 #define RESPONSE_ERROR 400
 #define RESPONSE_UNKNOWN_VARIABLE 404
 
+// Servers run by the network thread
+typedef struct {
+    int ai_enabled;
+    int ao_enabled;
+} NetworkServers;
+
 // Functions
 void update_socket_paths_from_config();
-char* get_variable_value(const char* variable_name);
+int get_variable_value(const char* variable_name, char* value, size_t size);
 int set_variable_value(const char* variable_name, const char* value);
 
+/**
+ * Creates a non-blocking listening socket in the abstract namespace.
+ * @param name Socket name, without the leading NUL byte.
+ * @param log_tag Tag used in the log line, e.g. "AI".
+ * @return The socket, or -1 on failure.
+ */
+int network_listen(const char *name, const char *log_tag);
+
+/**
+ * Serves the control, input and output sockets from one event loop until a
+ * termination signal arrives. All socket I/O happens on this thread; the audio
+ * threads only capture and play.
+ * @param arg The NetworkServers to run.
+ * @return NULL.
+ */
+void *network_thread(void *arg);
+
 #endif // NETWORK_H
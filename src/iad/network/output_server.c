@@ -1,118 +1,463 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <pthread.h>
 #include <stdio.h>
-#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
+#include "admission.h"
+#include "ao_queue.h"
 #include "audio_common.h"
+#include "calibrate.h"
+#include "config.h"
+#include "event_loop.h"
+#include "lockstat.h"
 #include "logging.h"
 #include "utils.h"
 #include "network.h"
 #include "output.h"
 #include "output_server.h"
+#include "pool.h"
+#include "telemetry.h"
+#include "trace.h"
 
 #define TAG "NET_OUTPUT"
 
-void *audio_output_server_thread(void *arg) {
-    printf("[INFO] [AO] Entering audio_output_server_thread\n");
+// How often a credit-based client's window, or a draining stream, is re-evaluated
+#define AO_CREDIT_POLL_MS (int)(FRAME_DURATION * 1000 / 4)
 
-    update_socket_paths_from_config();
+// The client holding the AO channel, protected by audio_buffer_lock
+static unsigned int ao_client_ticket = 0;
+static unsigned long long ao_client_bytes = 0;
 
-    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        handle_audio_error(TAG, "socket");
-        return NULL;
+void ao_client_stats(unsigned int *ticket, unsigned long long *bytes) {
+    audio_lock(LOCK_SITE_METRICS);
+    *ticket = ao_client_ticket;
+    *bytes = ao_client_bytes;
+    audio_unlock();
+}
+
+// Progress of the admitted client holding the AO channel
+typedef enum {
+    AO_SESSION_IDLE,        // No client is admitted
+    AO_SESSION_STREAMING,   // Reading audio from the client
+    AO_SESSION_DRAINING,    // Client stopped sending, its audio is still playing
+    AO_SESSION_CALIBRATING  // The calibration sweep played out, its capture is being analyzed
+} AoSessionState;
+
+/**
+ * @brief The admitted output client, only touched by the network thread.
+ * A calibration takes the channel the same way, without a socket.
+ */
+typedef struct {
+    EventHandler handler;   // Client socket, watched while there is room in the queue
+    AoSessionState state;
+    int calibrating;        // Set while the session plays the calibration sweep
+    int calibrated;         // Set once the calibration result has been collected
+    int watched;            // Set while the socket is in the event loop
+    int first_read;
+    int credit_mode;
+    long outstanding;       // Bytes granted but not yet received
+    int window_frames;
+    struct timespec drain_start;
+} AoSession;
+
+static int output_loop = -1;
+static EventHandler output_listener = {.fd = -1};
+static EventHandler output_play_event = {.fd = -1};
+static AoSession session = {.handler = {.fd = -1}};
+
+// Holds one frame read from the client, allocated once by output_server_init()
+static unsigned char *read_buffer = NULL;
+static size_t read_buffer_size = 0;
+
+/**
+ * Grants a credit-based client as many bytes as fit in its window. The window
+ * covers frames still in the internal queue and blocks busy in the AO channel,
+ * so a client sending as fast as credits allow has a bounded, known latency.
+ */
+static void grant_credits(void) {
+    int aoDevID, aoChnID;
+    get_audio_output_device_attributes(&aoDevID, &aoChnID);
+
+    IMPAudioOChnState state;
+    int busy = 0;
+    if (IMP_AO_QueryChnStat(aoDevID, aoChnID, &state) == 0) {
+        busy = state.chnBusyNum;
+    }
+
+    audio_lock(LOCK_SITE_OUTPUT_SESSION);
+    int queued = ao_queue_count();
+    audio_unlock();
+
+    long available = (long)(session.window_frames - busy - queued) * g_ao_max_frame_size - session.outstanding;
+    if (available < g_ao_max_frame_size) {
+        return;
     }
 
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    strncpy(&addr.sun_path[1], AUDIO_OUTPUT_SOCKET_PATH, sizeof(addr.sun_path) - 2);
-    addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
+    char msg[32];
+    int len = snprintf(msg, sizeof(msg), AO_CREDIT_FORMAT, available);
+    if (send(session.handler.fd, msg, len, MSG_NOSIGNAL | MSG_DONTWAIT) == len) {
+        session.outstanding += available;
+    }
+}
 
-    printf("[INFO] [AO] Attempting to bind socket\n");
-    if (bind(sockfd, (struct sockaddr*)&addr, sizeof(sa_family_t) + strlen(AUDIO_OUTPUT_SOCKET_PATH) + 1) == -1) {
-        handle_audio_error(TAG, "bind failed");
-        close(sockfd);
-        return NULL;
+static void output_session_watch(int watch) {
+    if (watch && !session.watched) {
+        session.watched = event_loop_add(output_loop, &session.handler, EPOLLIN) == 0;
+    } else if (!watch && session.watched) {
+        event_loop_remove(output_loop, &session.handler);
+        session.watched = 0;
     }
-    else {
-        printf("[INFO] [AO] Bind to output socket succeeded\n");
+}
+
+static void output_session_admit(void);
+
+/**
+ * Frees the channel after a calibration once its sweep has played out and
+ * its result was collected, whichever comes last, and admits the next client.
+ */
+static void output_calibration_release(void) {
+    if (session.state != AO_SESSION_CALIBRATING || !session.calibrated) {
+        return;
     }
+    session.state = AO_SESSION_IDLE;
+    session.calibrating = 0;
+    printf("[INFO] [AO] Calibration finished\n");
 
-    printf("[INFO] [AO] Attempting to listen on socket\n");
-    if (listen(sockfd, 5) == -1) {
-        handle_audio_error(TAG, "listen");
-        close(sockfd);
-        return NULL;
+    output_session_admit();
+}
+
+/**
+ * Finishes the drained or timed-out session and admits the next waiting client.
+ * @param drained 1 if the client's audio has fully played out.
+ */
+static void output_session_finish(int drained) {
+    if (session.calibrating) {
+        // Clients keep waiting until the capture of the sweep's echo is complete
+        session.state = AO_SESSION_CALIBRATING;
+        output_calibration_release();
+        return;
     }
-    else {
-        printf("[INFO] [AO] Listening on output socket\n");
+
+    if (drained) {
+        // Clients that half-closed the socket wait for this before closing
+        send(session.handler.fd, AO_DRAIN_ACK, strlen(AO_DRAIN_ACK), MSG_NOSIGNAL | MSG_DONTWAIT);
+    } else {
+        printf("[INFO] [AO] Timed out waiting for output to drain\n");
     }
 
-    while (1) {
-        int should_stop = 0;
-        pthread_mutex_lock(&g_stop_thread_mutex);
-        should_stop = g_stop_thread;
-        pthread_mutex_unlock(&g_stop_thread_mutex);
+    output_session_watch(0);
+    close(session.handler.fd);
+    session.handler.fd = -1;
+    session.state = AO_SESSION_IDLE;
+    admission_release();
+    telemetry_count(TELEMETRY_STREAM_STOP);
+
+    audio_lock(LOCK_SITE_OUTPUT_SESSION);
+    trace_event(TRACE_CLIENT_DISCONNECT, ao_client_ticket, TRACE_CLIENT_OUTPUT);
+    ao_client_ticket = 0;
+    audio_unlock();
+    printf("[INFO] [AO] Client Disconnected\n");
+
+    output_session_admit();
+}
 
-        if (should_stop) {
+static void output_session_check_drained(void) {
+    int drained = ao_drain_state(&session.drain_start);
+    if (drained != 0) {
+        output_session_finish(drained > 0);
+    }
+}
+
+/**
+ * The client closed or half-closed its end: fades out whatever is still
+ * pending and lets it play before the next client is admitted.
+ */
+static void output_session_end(void) {
+    output_session_watch(0);
+
+    audio_lock(LOCK_SITE_OUTPUT_SESSION);
+    ao_stream_end();
+    audio_unlock();
+
+    session.state = AO_SESSION_DRAINING;
+    clock_gettime(CLOCK_MONOTONIC, &session.drain_start);
+    output_session_check_drained();
+}
+
+/**
+ * Reads client audio into the queue for as long as the queue has free slots.
+ * With the queue full the socket is left unread, so a raw PCM client is paced
+ * by socket backpressure; reading resumes when the play thread frees a slot.
+ * A client that opens with AO_CREDIT_HELLO is paced with credit grants instead.
+ */
+static void output_session_read(void) {
+    unsigned char *buf = read_buffer;
+    // The queue takes at most one frame per slot
+    size_t size = read_buffer_size < (size_t)g_ao_max_frame_size ? read_buffer_size : (size_t)g_ao_max_frame_size;
+
+    while (session.state == AO_SESSION_STREAMING) {
+        audio_lock(LOCK_SITE_OUTPUT_READ);
+        int free_slots = ao_queue_free_slots();
+        audio_unlock();
+
+        if (free_slots == 0) {
+            trace_event(TRACE_QUEUE_FULL, ao_client_ticket, TRACE_CLIENT_OUTPUT);
+            output_session_watch(0);
             break;
         }
 
-        printf("[INFO] [AO] Waiting for output client connection\n");
-        int client_sock = accept(sockfd, NULL, NULL);
-        if (client_sock == -1) {
-            handle_audio_error(TAG, "accept");
-            continue;
+        struct timespec read_time;
+        ssize_t read_size;
+        if (session.calibrating) {
+            clock_gettime(CLOCK_MONOTONIC, &read_time);
+            read_size = calibrate_playback_read(buf, size, &read_time);
+        } else {
+            read_size = read(session.handler.fd, buf, size);
+            clock_gettime(CLOCK_MONOTONIC, &read_time);
+        }
+        if (read_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            output_session_watch(1);
+            break;
+        }
+        if (read_size <= 0) {
+            output_session_end();
+            return;
         }
 
-        pthread_mutex_lock(&audio_buffer_lock);
-        while (active_client_sock != -1) {
-            pthread_cond_wait(&audio_data_cond, &audio_buffer_lock);
+        unsigned char *data = buf;
+        if (session.first_read) {
+            session.first_read = 0;
+            if (read_size >= AO_CREDIT_HELLO_LEN && memcmp(buf, AO_CREDIT_HELLO, AO_CREDIT_HELLO_LEN) == 0) {
+                printf("[INFO] [AO] Client uses credit-based flow control\n");
+                session.credit_mode = 1;
+                data += AO_CREDIT_HELLO_LEN;
+                read_size -= AO_CREDIT_HELLO_LEN;
+            }
         }
 
-        active_client_sock = client_sock;
+        if (session.credit_mode) {
+            session.outstanding = session.outstanding > read_size ? session.outstanding - read_size : 0;
+        }
 
-        // Enabling the channel, after its already enabled, clears all buffers for some reason... otherwise
-        // old audio will play on each subsequent client connect... unknown why.
-        enable_output_channel();
-        //There has to be a better way than to do this.
+        // Only this thread pushes, so the free slot is still there
+        if (read_size > 0) {
+            audio_lock(LOCK_SITE_OUTPUT_READ);
+            ao_queue_push(data, read_size, &read_time);
+            ao_client_bytes += read_size;
+            pthread_cond_broadcast(&audio_data_cond);
+            audio_unlock();
+        }
+    }
 
-        printf("[INFO] [AO] Client connected\n");
+    if (session.state == AO_SESSION_STREAMING && session.credit_mode) {
+        grant_credits();
+    }
+}
 
-        memset(audio_buffer, 0, g_ao_max_frame_size);
-        audio_buffer_size = 0;
-        pthread_mutex_unlock(&audio_buffer_lock);
+static void output_session_event(EventHandler *handler, uint32_t events) {
+    output_session_read();
+}
 
-        unsigned char buf[g_ao_max_frame_size];
-        ssize_t read_size;
+/**
+ * Admits the next waiting client if the AO channel is free.
+ */
+static void output_session_admit(void) {
+    AdmissionTicket client;
+    if (session.state != AO_SESSION_IDLE || admission_next(&client)) {
+        return;
+    }
+
+    // Drop anything left from the previous stream while the channel keeps running
+    ao_stream_switch();
+    telemetry_count(TELEMETRY_STREAM_START);
+
+    audio_lock(LOCK_SITE_OUTPUT_SESSION);
+    ao_client_ticket = client.ticket;
+    ao_client_bytes = 0;
+    audio_unlock();
 
-        printf("[INFO] [AO] Receiving audio data from client\n");
-        while ((read_size = read(client_sock, buf, sizeof(buf))) > 0) {
-            pthread_mutex_lock(&audio_buffer_lock);
-            memcpy(audio_buffer, buf, read_size);
-            audio_buffer_size = read_size;
-            pthread_cond_signal(&audio_data_cond);
-            pthread_mutex_unlock(&audio_buffer_lock);
+    printf("[INFO] [AO] Client with ticket %u connected (switch took %ld us)\n",
+           client.ticket, ao_last_switch_latency_us());
+
+    session.handler.fd = client.sockfd;
+    session.handler.callback = output_session_event;
+    session.state = AO_SESSION_STREAMING;
+    session.watched = 0;
+    session.first_read = 1;
+    session.credit_mode = 0;
+    session.outstanding = 0;
+    session.window_frames = config_get_ao_credit_frames();
+
+    printf("[INFO] [AO] Receiving audio data from client\n");
+    output_session_read();
+}
+
+int output_server_calibrate(void) {
+    if (output_listener.fd < 0 || session.state != AO_SESSION_IDLE || admission_busy()) {
+        return CALIBRATE_BUSY;
+    }
+
+    CalibrateStatus status = calibrate_start();
+    if (status != CALIBRATE_OK) {
+        return status;
+    }
+
+    // The sweep is a stream of its own, starting on a cleared channel
+    ao_stream_switch();
+    printf("[INFO] [AO] Calibrating (switch took %ld us)\n", ao_last_switch_latency_us());
+
+    session.handler.fd = -1;
+    session.state = AO_SESSION_STREAMING;
+    session.calibrating = 1;
+    session.calibrated = 0;
+    session.watched = 0;
+    session.first_read = 0;
+    session.credit_mode = 0;
+    session.outstanding = 0;
+    output_session_read();
+    return CALIBRATE_OK;
+}
+
+void output_server_calibrate_done(void) {
+    session.calibrated = 1;
+    output_calibration_release();
+}
+
+/**
+ * The play thread sent a frame: resume reading, grant credits or finish draining.
+ */
+static void output_play_event_cb(EventHandler *handler, uint32_t events) {
+    uint64_t count;
+    if (read(handler->fd, &count, sizeof(count)) != sizeof(count)) {
+        return;
+    }
+
+    if (session.state == AO_SESSION_STREAMING && !session.watched) {
+        output_session_read();
+    } else if (session.state == AO_SESSION_STREAMING && session.credit_mode) {
+        grant_credits();
+    } else if (session.state == AO_SESSION_DRAINING) {
+        output_session_check_drained();
+    }
+}
+
+static void output_listener_event(EventHandler *handler, uint32_t events) {
+    while (1) {
+        int client_sock = accept(handler->fd, NULL, NULL);
+        if (client_sock == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                handle_audio_error(TAG, "accept");
+            }
+            return;
         }
 
-        // Clear audio buffer after reading ends
-        memset(audio_buffer, 0, g_ao_max_frame_size);
-        audio_buffer_size = 0;
+        fcntl(client_sock, F_SETFL, fcntl(client_sock, F_GETFL) | O_NONBLOCK);
 
-        pthread_mutex_lock(&audio_buffer_lock);
-        active_client_sock = -1;
-        pthread_cond_broadcast(&audio_data_cond);
-        pthread_mutex_unlock(&audio_buffer_lock);
+        // Read per client so a reloaded timeout applies to the next one
+        unsigned int ticket = admission_enqueue(client_sock, config_get_ao_admission_timeout_ms());
+        if (ticket == 0) {
+            close(client_sock);
+            continue;
+        }
+        telemetry_count(TELEMETRY_AO_CONNECTS);
+        trace_event(TRACE_CLIENT_CONNECT, ticket, TRACE_CLIENT_OUTPUT);
+        printf("[INFO] [AO] Client queued with ticket %u\n", ticket);
 
-        close(client_sock);
-        printf("[INFO] [AO] Client Disconnected\n");
+        output_session_admit();
+    }
+}
+
+static void output_read_buffer_free(void) {
+    heap_free(read_buffer);
+    read_buffer = NULL;
+    read_buffer_size = 0;
+}
+
+int output_server_init(int loop) {
+    output_play_event.fd = ao_event_fd();
+    if (output_play_event.fd < 0) {
+        return -1;
+    }
+    output_play_event.callback = output_play_event_cb;
+
+    // frame_size only changes on a restart, so the play thread sizes its queue slots the same
+    read_buffer_size = config_get()->ao.frame_size;
+    read_buffer = heap_alloc(read_buffer_size);
+    if (!read_buffer) {
+        handle_audio_error(TAG, "Failed to allocate the read buffer");
+        return -1;
+    }
+
+    if (admission_init(config_get()->network.max_waiting_clients)) {
+        output_read_buffer_free();
+        return -1;
+    }
+
+    output_listener.fd = network_listen(AUDIO_OUTPUT_SOCKET_PATH, "AO");
+    if (output_listener.fd < 0) {
+        admission_shutdown();
+        output_read_buffer_free();
+        return -1;
+    }
+    output_listener.callback = output_listener_event;
+
+    if (event_loop_add(loop, &output_listener, EPOLLIN) ||
+        event_loop_add(loop, &output_play_event, EPOLLIN)) {
+        event_loop_remove(loop, &output_listener);
+        close(output_listener.fd);
+        output_listener.fd = -1;
+        admission_shutdown();
+        output_read_buffer_free();
+        return -1;
+    }
+    output_loop = loop;
+
+    printf("[INFO] [AO] Waiting for output client connections\n");
+    return 0;
+}
+
+int output_server_poll() {
+    if (output_listener.fd < 0) {
+        return -1;
+    }
+
+    // Wake up in time to expire the next waiting client
+    int timeout_ms = admission_expire();
+
+    // The channel's busy count changes as blocks play, so credits and the
+    // drain are re-evaluated a few times per frame
+    if (session.state == AO_SESSION_STREAMING && session.credit_mode) {
+        grant_credits();
+        timeout_ms = event_loop_timeout(timeout_ms, AO_CREDIT_POLL_MS);
+    } else if (session.state == AO_SESSION_DRAINING) {
+        output_session_check_drained();
+        if (session.state == AO_SESSION_DRAINING) {
+            timeout_ms = event_loop_timeout(timeout_ms, AO_CREDIT_POLL_MS);
+        }
+    }
+    return timeout_ms;
+}
+
+void output_server_shutdown() {
+    if (output_listener.fd < 0) {
+        return;
+    }
 
-        // Causes small files to cut off too soon, disable for now.
-	//clear_audio_output_buffer();
+    if (session.state != AO_SESSION_IDLE && !session.calibrating) {
+        output_session_watch(0);
+        close(session.handler.fd);
+        session.handler.fd = -1;
+        session.state = AO_SESSION_IDLE;
+        admission_release();
     }
 
-    close(sockfd);
-    return NULL;
+    event_loop_remove(output_loop, &output_play_event);
+    event_loop_remove(output_loop, &output_listener);
+    close(output_listener.fd);
+    output_listener.fd = -1;
+    admission_shutdown();
+    output_read_buffer_free();
 }
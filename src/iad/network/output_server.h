@@ -1,6 +1,8 @@
 #ifndef OUTPUT_SERVER_H
 #define OUTPUT_SERVER_H
 
+#include "calibrate.h"      // For CalibrateStatus
+
 extern char AUDIO_OUTPUT_SOCKET_PATH[];
 
 #define CLIENT_QUEUED 1
@@ -18,7 +20,41 @@ extern char AUDIO_OUTPUT_SOCKET_PATH[];
 #define RESPONSE_ERROR 400
 #define RESPONSE_UNKNOWN_VARIABLE 404
 
-// Functions
-void *audio_output_server_thread(void *arg);
+// Sent on the output socket once a client's last sample has been played
+#define AO_DRAIN_ACK "drained\n"
+
+// Sent by a client as the first bytes on the output socket to opt into credit-based
+// flow control. The daemon then sends "credit <bytes>\n" lines and the client never
+// has more than the granted number of bytes in flight.
+#define AO_CREDIT_HELLO "IADC"
+#define AO_CREDIT_HELLO_LEN 4
+#define AO_CREDIT_FORMAT "credit %ld\n"
+
+// Admission status lines sent on the output socket. A new client gets its ticket
+// and position (0 = admitted immediately), then position updates while it waits.
+#define AO_TICKET_FORMAT "ticket %u %d\n"
+#define AO_QUEUED_FORMAT "queued %d\n"
+#define AO_ADMITTED "admitted\n"
+#define AO_TIMEOUT "timeout\n"
+
+// Starts serving output clients on the network thread's event loop. Returns 0 on success.
+int output_server_init(int loop);
+
+// Expires waiting clients and re-evaluates credits and draining.
+// Returns milliseconds until this is due again, or -1.
+int output_server_poll(void);
+
+// Disconnects the playing client and closes the listening socket.
+void output_server_shutdown(void);
+
+// Takes the idle AO channel to play the calibration sweep, see calibrate.h.
+// Returns CALIBRATE_OK, or CALIBRATE_BUSY while a client plays or waits.
+int output_server_calibrate(void);
+
+// Hands the channel back once the calibration result was collected.
+void output_server_calibrate_done(void);
+
+// Reports the ticket of the client holding the AO channel (0 if none) and the bytes it sent
+void ao_client_stats(unsigned int *ticket, unsigned long long *bytes);
 
 #endif // OUTPUT_SERVER_H
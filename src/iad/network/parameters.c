@@ -0,0 +1,543 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "audio_imp.h"
+#include "config.h"
+#include "input.h"
+#include "logging.h"
+#include "output.h"
+#include "parameters.h"
+#include "pool.h"
+
+#define TAG "NET_PARAM"
+
+// Lookup table size, a power of two comfortably above the number of parameters
+#define PARAM_TABLE_SIZE 64
+
+// Batch lifecycle
+enum {
+    BATCH_IDLE,
+    BATCH_PENDING,      // Submitted, waiting for a frame boundary
+    BATCH_DONE          // Applied, result not collected yet
+};
+
+// The batch in flight, protected by batch_lock. batch_state is also read
+// without the lock so the audio threads can skip the trylock when idle.
+// batch_lock also serializes SET and parameters_apply_ai/ao(), so the
+// cached controls below always match what was last sent to the device.
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static ParameterChange batch_changes[PARAM_BATCH_MAX];
+static int batch_count = 0;
+static int batch_state = BATCH_IDLE;
+static int batch_result = PARAM_OK;
+static const char *batch_failed_name = NULL;
+static int batch_event_fd = -1;
+
+// Controls the IMP SDK can set but not read back are cached here. They start
+// from the configuration in parameters_init() and are sent to the device
+// whenever its channel is initialized.
+static long long ai_mute_state = 0;
+static long long ai_aec_state = 0;
+static long long ai_ns_level = -1;
+static long long ai_hpf_state = 0;
+static long long ai_agc_state = 0;
+static long long ai_agc_target_dbfs = 10;
+static long long ai_agc_compression_db = 0;
+static long long ao_mute_state = 0;
+
+// Controls that can be read back but are lost when a channel is initialized;
+// the last value set is kept here to be sent again
+static long long ai_volume_value = DEFAULT_AI_CHN_VOL;
+static long long ai_gain_value = DEFAULT_AI_GAIN;
+static long long ai_alc_gain_value = 0;
+static long long ao_volume_value = DEFAULT_AO_CHN_VOL;
+static long long ao_gain_value = DEFAULT_AO_GAIN;
+
+static int get_int_with(int (*getter)(int *), long long *value) {
+    int v;
+    if (getter(&v)) {
+        return -1;
+    }
+    *value = v;
+    return 0;
+}
+
+static int get_ai_volume(long long *value) {
+    return get_int_with(ai_get_volume, value);
+}
+
+static int set_ai_volume(long long value) {
+    if (ai_set_volume((int)value)) {
+        return -1;
+    }
+    ai_volume_value = value;
+    return 0;
+}
+
+static int get_ai_gain(long long *value) {
+    return get_int_with(ai_get_gain, value);
+}
+
+static int set_ai_gain(long long value) {
+    if (ai_set_gain((int)value)) {
+        return -1;
+    }
+    ai_gain_value = value;
+    return 0;
+}
+
+static int get_ai_alc_gain(long long *value) {
+    return get_int_with(ai_get_alc_gain, value);
+}
+
+static int set_ai_alc_gain(long long value) {
+    if (ai_set_alc_gain((int)value)) {
+        return -1;
+    }
+    ai_alc_gain_value = value;
+    return 0;
+}
+
+static int get_ao_volume(long long *value) {
+    return get_int_with(ao_get_volume, value);
+}
+
+static int set_ao_volume(long long value) {
+    if (ao_set_volume((int)value)) {
+        return -1;
+    }
+    ao_volume_value = value;
+    return 0;
+}
+
+static int get_ao_gain(long long *value) {
+    return get_int_with(ao_get_gain, value);
+}
+
+static int set_ao_gain(long long value) {
+    if (ao_set_gain((int)value)) {
+        return -1;
+    }
+    ao_gain_value = value;
+    return 0;
+}
+
+static int get_ai_mute(long long *value) {
+    *value = ai_mute_state;
+    return 0;
+}
+
+static int set_ai_mute(long long value) {
+    if (ai_set_mute((int)value)) {
+        return -1;
+    }
+    ai_mute_state = value;
+    return 0;
+}
+
+static int get_ai_aec(long long *value) {
+    *value = ai_aec_state;
+    return 0;
+}
+
+static int set_ai_aec(long long value) {
+    if (ai_aec((int)value)) {
+        return -1;
+    }
+    ai_aec_state = value;
+    return 0;
+}
+
+static int get_ai_ns_level(long long *value) {
+    *value = ai_ns_level;
+    return 0;
+}
+
+static int set_ai_ns_level(long long value) {
+    if (ai_ns((int)value)) {
+        return -1;
+    }
+    ai_ns_level = value;
+    return 0;
+}
+
+static int get_ai_hpf(long long *value) {
+    *value = ai_hpf_state;
+    return 0;
+}
+
+static int set_ai_hpf(long long value) {
+    if (ai_hpf((int)value)) {
+        return -1;
+    }
+    ai_hpf_state = value;
+    return 0;
+}
+
+// AGC settings only take effect through IMP_AI_EnableAgc, so changing them re-enables it
+static int apply_ai_agc(long long enable, long long target, long long compression) {
+    if (ai_agc((int)enable, (int)target, (int)compression)) {
+        return -1;
+    }
+    ai_agc_state = enable;
+    ai_agc_target_dbfs = target;
+    ai_agc_compression_db = compression;
+    return 0;
+}
+
+static int get_ai_agc(long long *value) {
+    *value = ai_agc_state;
+    return 0;
+}
+
+static int set_ai_agc(long long value) {
+    return apply_ai_agc(value, ai_agc_target_dbfs, ai_agc_compression_db);
+}
+
+static int get_ai_agc_target_dbfs(long long *value) {
+    *value = ai_agc_target_dbfs;
+    return 0;
+}
+
+static int set_ai_agc_target_dbfs(long long value) {
+    if (!ai_agc_state) {
+        ai_agc_target_dbfs = value;
+        return 0;
+    }
+    return apply_ai_agc(1, value, ai_agc_compression_db);
+}
+
+static int get_ai_agc_compression_db(long long *value) {
+    *value = ai_agc_compression_db;
+    return 0;
+}
+
+static int set_ai_agc_compression_db(long long value) {
+    if (!ai_agc_state) {
+        ai_agc_compression_db = value;
+        return 0;
+    }
+    return apply_ai_agc(1, ai_agc_target_dbfs, value);
+}
+
+static int get_ao_mute(long long *value) {
+    *value = ao_mute_state;
+    return 0;
+}
+
+static int set_ao_mute(long long value) {
+    if (ao_set_mute((int)value)) {
+        return -1;
+    }
+    ao_mute_state = value;
+    return 0;
+}
+
+static int get_ao_switch_latency_us(long long *value) {
+    *value = ao_last_switch_latency_us();
+    return 0;
+}
+
+static int get_ao_underruns(long long *value) {
+    *value = ao_underrun_count();
+    return 0;
+}
+
+static int get_ai_last_recovery_ms(long long *value) {
+    *value = ai_last_recovery_ms();
+    return 0;
+}
+
+static int get_heap_allocations(long long *value) {
+    *value = (long long)heap_allocation_count();
+    return 0;
+}
+
+static int get_ao_concealed_samples(long long *value) {
+    *value = (long long)ao_concealed_samples();
+    return 0;
+}
+
+static const Parameter parameters[] = {
+    {"ai_volume", PARAM_INT, -30, 120, get_ai_volume, set_ai_volume},
+    {"ai_gain", PARAM_INT, 0, 31, get_ai_gain, set_ai_gain},
+    {"ai_alc_gain", PARAM_INT, 0, 7, get_ai_alc_gain, set_ai_alc_gain},
+    {"ai_mute", PARAM_BOOL, 0, 1, get_ai_mute, set_ai_mute},
+    {"ai_aec", PARAM_BOOL, 0, 1, get_ai_aec, set_ai_aec},
+    {"ai_ns_level", PARAM_INT, -1, 3, get_ai_ns_level, set_ai_ns_level},
+    {"ai_hpf", PARAM_BOOL, 0, 1, get_ai_hpf, set_ai_hpf},
+    {"ai_agc", PARAM_BOOL, 0, 1, get_ai_agc, set_ai_agc},
+    {"ai_agc_target_dbfs", PARAM_INT, 0, 31, get_ai_agc_target_dbfs, set_ai_agc_target_dbfs},
+    {"ai_agc_compression_db", PARAM_INT, 0, 90, get_ai_agc_compression_db, set_ai_agc_compression_db},
+    {"ai_last_recovery_ms", PARAM_INT, 0, 0, get_ai_last_recovery_ms, NULL},
+    {"ao_volume", PARAM_INT, -30, 120, get_ao_volume, set_ao_volume},
+    {"ao_gain", PARAM_INT, 0, 31, get_ao_gain, set_ao_gain},
+    {"ao_mute", PARAM_BOOL, 0, 1, get_ao_mute, set_ao_mute},
+    {"ao_switch_latency_us", PARAM_INT, 0, 0, get_ao_switch_latency_us, NULL},
+    {"ao_underruns", PARAM_INT, 0, 0, get_ao_underruns, NULL},
+    {"ao_concealed_samples", PARAM_INT, 0, 0, get_ao_concealed_samples, NULL},
+    {"heap_allocations", PARAM_INT, 0, 0, get_heap_allocations, NULL},
+};
+
+#define PARAM_COUNT (sizeof(parameters) / sizeof(parameters[0]))
+
+// Open-addressed hash table of pointers into parameters[], filled once at startup
+static const Parameter *parameter_table[PARAM_TABLE_SIZE];
+
+// FNV-1a
+static uint32_t parameter_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Takes the starting value of a cached control from the configuration, or the
+ * fallback if the configured value is outside the parameter's range.
+ */
+static long long parameter_initial(const char *name, long long value, long long fallback) {
+    const Parameter *param = parameter_find(name);
+    if (value < param->min || value > param->max) {
+        fprintf(stderr, "[ERROR] [%s] %s value out of range: %lld. Using default value: %lld.\n",
+                TAG, name, value, fallback);
+        return fallback;
+    }
+    return value;
+}
+
+void parameters_init() {
+    audio_imp_init();
+
+    batch_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (batch_event_fd < 0) {
+        handle_audio_error(TAG, "eventfd");
+    }
+
+    memset(parameter_table, 0, sizeof(parameter_table));
+    for (size_t i = 0; i < PARAM_COUNT; i++) {
+        uint32_t slot = parameter_hash(parameters[i].name) & (PARAM_TABLE_SIZE - 1);
+        while (parameter_table[slot]) {
+            slot = (slot + 1) & (PARAM_TABLE_SIZE - 1);
+        }
+        parameter_table[slot] = &parameters[i];
+    }
+
+    const AudioInputConfig *ai = &config_get()->ai;
+    const AudioOutputConfig *ao = &config_get()->ao;
+    ai_volume_value = parameter_initial("ai_volume", ai->volume, DEFAULT_AI_CHN_VOL);
+    ai_gain_value = parameter_initial("ai_gain", ai->gain, DEFAULT_AI_GAIN);
+    ai_alc_gain_value = parameter_initial("ai_alc_gain", ai->alc_gain, 0);
+    ai_aec_state = ai->aec_enabled;
+    ai_ns_level = ai->ns_enabled ? parameter_initial("ai_ns_level", ai->ns_level, -1) : -1;
+    ai_hpf_state = ai->hpf_enabled;
+    ai_agc_state = ai->agc_enabled;
+    ai_agc_target_dbfs = parameter_initial("ai_agc_target_dbfs", ai->agc_target_dbfs, 10);
+    ai_agc_compression_db = parameter_initial("ai_agc_compression_db", ai->agc_compression_db, 0);
+    ao_volume_value = parameter_initial("ao_volume", ao->volume, DEFAULT_AO_CHN_VOL);
+    ao_gain_value = parameter_initial("ao_gain", ao->gain, DEFAULT_AO_GAIN);
+}
+
+/**
+ * Sends one cached control to a freshly initialized channel. A control the
+ * device rejects is reported and cached as off, so GET reports what the
+ * device is actually doing.
+ */
+static void parameter_reapply(const char *name, long long *state, int (*set)(long long value), long long off) {
+    if (*state == off) {
+        return;
+    }
+    long long value = *state;
+    if (set(value)) {
+        fprintf(stderr, "[ERROR] [%s] Failed to apply %s = %lld\n", TAG, name, value);
+        *state = off;
+    }
+}
+
+/**
+ * Sends a control that has no off state to a freshly initialized channel.
+ */
+static void parameter_restore(const char *name, long long value, int (*set)(long long value)) {
+    if (set(value)) {
+        fprintf(stderr, "[ERROR] [%s] Failed to apply %s = %lld\n", TAG, name, value);
+    }
+}
+
+void parameters_apply_ai() {
+    pthread_mutex_lock(&batch_lock);
+    parameter_restore("ai_volume", ai_volume_value, set_ai_volume);
+    parameter_restore("ai_gain", ai_gain_value, set_ai_gain);
+    parameter_restore("ai_alc_gain", ai_alc_gain_value, set_ai_alc_gain);
+    parameter_reapply("ai_mute", &ai_mute_state, set_ai_mute, 0);
+    parameter_reapply("ai_aec", &ai_aec_state, set_ai_aec, 0);
+    parameter_reapply("ai_ns_level", &ai_ns_level, set_ai_ns_level, -1);
+    parameter_reapply("ai_hpf", &ai_hpf_state, set_ai_hpf, 0);
+    parameter_reapply("ai_agc", &ai_agc_state, set_ai_agc, 0);
+    pthread_mutex_unlock(&batch_lock);
+}
+
+void parameters_apply_ao() {
+    pthread_mutex_lock(&batch_lock);
+    parameter_restore("ao_volume", ao_volume_value, set_ao_volume);
+    parameter_restore("ao_gain", ao_gain_value, set_ao_gain);
+    parameter_reapply("ao_mute", &ao_mute_state, set_ao_mute, 0);
+    pthread_mutex_unlock(&batch_lock);
+}
+
+const Parameter *parameter_find(const char *name) {
+    uint32_t slot = parameter_hash(name) & (PARAM_TABLE_SIZE - 1);
+    while (parameter_table[slot]) {
+        if (strcmp(parameter_table[slot]->name, name) == 0) {
+            return parameter_table[slot];
+        }
+        slot = (slot + 1) & (PARAM_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+int parameter_parse(const Parameter *param, const char *text, long long *value) {
+    if (param->type == PARAM_BOOL) {
+        if (strcasecmp(text, "true") == 0 || strcasecmp(text, "on") == 0) {
+            *value = 1;
+            return PARAM_OK;
+        }
+        if (strcasecmp(text, "false") == 0 || strcasecmp(text, "off") == 0) {
+            *value = 0;
+            return PARAM_OK;
+        }
+    }
+
+    char *end;
+    long long parsed = strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || parsed < param->min || parsed > param->max) {
+        return PARAM_INVALID;
+    }
+    *value = parsed;
+    return PARAM_OK;
+}
+
+int parameter_get(const char *name, long long *value) {
+    const Parameter *param = parameter_find(name);
+    if (!param) {
+        return PARAM_UNKNOWN;
+    }
+    return param->get(value) == 0 ? PARAM_OK : PARAM_FAILED;
+}
+
+int parameter_set(const char *name, const char *text) {
+    const Parameter *param = parameter_find(name);
+    if (!param) {
+        return PARAM_UNKNOWN;
+    }
+    if (!param->set) {
+        return PARAM_READ_ONLY;
+    }
+
+    long long value;
+    if (parameter_parse(param, text, &value) != PARAM_OK) {
+        return PARAM_INVALID;
+    }
+    pthread_mutex_lock(&batch_lock);
+    int failed = param->set(value);
+    pthread_mutex_unlock(&batch_lock);
+    if (failed) {
+        return PARAM_FAILED;
+    }
+    printf("[INFO] [CTRL] Set %s to %lld\n", name, value);
+    return PARAM_OK;
+}
+
+int parameter_batch_submit(const ParameterChange *changes, int count) {
+    if (count < 1 || count > PARAM_BATCH_MAX) {
+        return PARAM_INVALID;
+    }
+
+    pthread_mutex_lock(&batch_lock);
+    if (batch_state != BATCH_IDLE) {
+        pthread_mutex_unlock(&batch_lock);
+        return PARAM_BUSY;
+    }
+    memcpy(batch_changes, changes, count * sizeof(ParameterChange));
+    batch_count = count;
+    __atomic_store_n(&batch_state, BATCH_PENDING, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&batch_lock);
+
+    return PARAM_OK;
+}
+
+int parameter_batch_busy() {
+    return __atomic_load_n(&batch_state, __ATOMIC_ACQUIRE) != BATCH_IDLE;
+}
+
+int parameter_batch_apply_pending() {
+    if (__atomic_load_n(&batch_state, __ATOMIC_ACQUIRE) != BATCH_PENDING) {
+        return 0;
+    }
+    // The control thread only holds the lock briefly; try again next frame
+    if (pthread_mutex_trylock(&batch_lock)) {
+        return 0;
+    }
+    if (batch_state != BATCH_PENDING) {
+        pthread_mutex_unlock(&batch_lock);
+        return 0;
+    }
+
+    // Remember the current values so a failure part way through can be undone
+    long long previous[PARAM_BATCH_MAX];
+    batch_result = PARAM_OK;
+    batch_failed_name = NULL;
+    for (int i = 0; i < batch_count; i++) {
+        if (batch_changes[i].param->get(&previous[i])) {
+            batch_result = PARAM_FAILED;
+            batch_failed_name = batch_changes[i].param->name;
+            break;
+        }
+    }
+
+    for (int i = 0; batch_result == PARAM_OK && i < batch_count; i++) {
+        if (batch_changes[i].param->set(batch_changes[i].value)) {
+            batch_result = PARAM_FAILED;
+            batch_failed_name = batch_changes[i].param->name;
+            while (--i >= 0) {
+                batch_changes[i].param->set(previous[i]);
+            }
+        }
+    }
+
+    __atomic_store_n(&batch_state, BATCH_DONE, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&batch_lock);
+
+    uint64_t done = 1;
+    if (write(batch_event_fd, &done, sizeof(done)) < 0) {
+        handle_audio_error(TAG, "eventfd write");
+    }
+    return 1;
+}
+
+int parameter_batch_fd() {
+    return batch_event_fd;
+}
+
+int parameter_batch_collect(const char **failed_name) {
+    pthread_mutex_lock(&batch_lock);
+    if (batch_state != BATCH_DONE) {
+        pthread_mutex_unlock(&batch_lock);
+        return PARAM_BUSY;
+    }
+    int result = batch_result;
+    *failed_name = batch_failed_name;
+    if (result == PARAM_OK) {
+        for (int i = 0; i < batch_count; i++) {
+            printf("[INFO] [CTRL] Set %s to %lld\n", batch_changes[i].param->name, batch_changes[i].value);
+        }
+    }
+    batch_state = BATCH_IDLE;
+    pthread_mutex_unlock(&batch_lock);
+    return result;
+}
@@ -0,0 +1,85 @@
+#ifndef PARAMETERS_H
+#define PARAMETERS_H
+
+// Result codes of parameter operations
+#define PARAM_OK 0
+#define PARAM_UNKNOWN -1        // No parameter with that name
+#define PARAM_INVALID -2        // Value not a number or out of range
+#define PARAM_READ_ONLY -3      // Parameter can't be set
+#define PARAM_FAILED -4         // The device rejected the operation
+#define PARAM_BUSY -5           // Another batch is still in flight
+
+// Most changes accepted in one batch
+#define PARAM_BATCH_MAX 16
+
+typedef enum {
+    PARAM_INT,      // Integer within [min, max]
+    PARAM_BOOL      // 0/1, also accepts true/false and on/off
+} ParameterType;
+
+/**
+ * @brief A runtime parameter reachable through GET and SET on the control socket.
+ */
+typedef struct {
+    const char *name;
+    ParameterType type;
+    long long min;
+    long long max;
+    int (*get)(long long *value);   // Returns 0 on success
+    int (*set)(long long value);    // Returns 0 on success, NULL for read-only parameters
+} Parameter;
+
+/**
+ * @brief One change of a batch, validated before submission.
+ */
+typedef struct {
+    const Parameter *param;
+    long long value;
+} ParameterChange;
+
+// Builds the lookup table and takes the starting values of the cached
+// controls from the configuration. Must be called once it is loaded.
+void parameters_init(void);
+
+// Sends the current value of every control (volume, gain, ALC gain, mute,
+// AEC, noise suppression, high pass filter, AGC) to a channel that was just
+// initialized, which resets them. Runtime changes survive a re-initialization.
+void parameters_apply_ai(void);
+
+// The same for the AO channel: volume, gain and mute.
+void parameters_apply_ao(void);
+
+// Looks up a parameter by name in constant time. Returns NULL if unknown.
+const Parameter *parameter_find(const char *name);
+
+// Converts and range-checks a textual value. Returns PARAM_OK or PARAM_INVALID.
+int parameter_parse(const Parameter *param, const char *text, long long *value);
+
+// Reads a parameter. Returns one of the PARAM_* result codes.
+int parameter_get(const char *name, long long *value);
+
+// Validates and applies a textual value. Returns one of the PARAM_* result codes.
+int parameter_set(const char *name, const char *text);
+
+// Batches are applied all-or-nothing by an audio thread between two frames.
+// Only one batch is in flight at a time.
+
+// Queues validated changes for the next frame boundary. Returns PARAM_OK or PARAM_BUSY.
+int parameter_batch_submit(const ParameterChange *changes, int count);
+
+// Returns 1 while a submitted batch hasn't been collected yet.
+int parameter_batch_busy(void);
+
+// Applies the pending batch, if any. Called by the audio threads at every frame
+// boundary; never blocks. Returns 1 if a batch was applied.
+int parameter_batch_apply_pending(void);
+
+// Returns an eventfd that becomes readable once the batch has been applied.
+int parameter_batch_fd(void);
+
+// Takes the result of an applied batch: PARAM_OK, or PARAM_FAILED with the
+// name of the rejected parameter after all earlier changes were rolled back.
+// Returns PARAM_BUSY if the batch hasn't been applied yet.
+int parameter_batch_collect(const char **failed_name);
+
+#endif // PARAMETERS_H
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "logging.h"
+#include "persist.h"
+
+#define TAG "NET_PERSIST"
+
+// Where each persistent parameter lives in iad.json
+static const struct {
+    const char *name;
+    ConfigUpdate update;
+} persist_keys[] = {
+    {"ai_volume", {"AI_attributes", NULL, "SetVol", 0}},
+    {"ai_gain", {"AI_attributes", NULL, "SetGain", 0}},
+    {"ai_alc_gain", {"AI_attributes", NULL, "SetAlcGain", 0}},
+    {"ai_aec", {"AI_attributes", NULL, "EnableAec", 1}},
+    {"ai_ns_level", {"AI_attributes", NULL, "Level_Ns", 0}},
+    {"ai_ns_level", {"AI_attributes", NULL, "Enable_Ns", 1}},
+    {"ai_hpf", {"AI_attributes", NULL, "Enable_Hpf", 1}},
+    {"ai_agc", {"AI_attributes", NULL, "Enable_Agc", 1}},
+    {"ai_agc_target_dbfs", {"AI_attributes", "AGC_attributes", "TargetLevelDbfs", 0}},
+    {"ai_agc_compression_db", {"AI_attributes", "AGC_attributes", "CompressionGaindB", 0}},
+    {"ao_volume", {"AO_attributes", NULL, "SetVol", 0}},
+    {"ao_gain", {"AO_attributes", NULL, "SetGain", 0}},
+};
+
+#define PERSIST_KEY_COUNT (sizeof(persist_keys) / sizeof(persist_keys[0]))
+
+// Pending changes, only touched by the control thread
+static ConfigUpdate pending[PERSIST_KEY_COUNT];
+static int pending_dirty[PERSIST_KEY_COUNT];
+static long long first_change_ms = 0;   // 0 while nothing is pending
+static long long last_change_ms = 0;
+
+void persist_note(const char *name, long long value, long long now_ms) {
+    int noted = 0;
+    for (size_t i = 0; i < PERSIST_KEY_COUNT; i++) {
+        if (strcmp(persist_keys[i].name, name) != 0) {
+            continue;
+        }
+        pending[i] = persist_keys[i].update;
+        pending[i].value = (int)value;
+
+        // A noise suppression level of -1 is stored as Enable_Ns = false
+        if (strcmp(pending[i].key, "Enable_Ns") == 0) {
+            pending[i].value = value >= 0;
+        } else if (strcmp(pending[i].key, "Level_Ns") == 0 && value < 0) {
+            continue;
+        }
+        pending_dirty[i] = 1;
+        noted = 1;
+    }
+
+    if (noted) {
+        if (!first_change_ms) {
+            first_change_ms = now_ms;
+        }
+        last_change_ms = now_ms;
+    }
+}
+
+int persist_flush(long long now_ms) {
+    if (!first_change_ms) {
+        return -1;
+    }
+
+    long long due = last_change_ms + PERSIST_DEBOUNCE_MS;
+    if (due > first_change_ms + PERSIST_MAX_DELAY_MS) {
+        due = first_change_ms + PERSIST_MAX_DELAY_MS;
+    }
+    if (now_ms < due) {
+        return (int)(due - now_ms);
+    }
+
+    ConfigUpdate updates[PERSIST_KEY_COUNT];
+    int count = 0;
+    for (size_t i = 0; i < PERSIST_KEY_COUNT; i++) {
+        if (pending_dirty[i]) {
+            updates[count++] = pending[i];
+        }
+    }
+
+    // Keep the changes of a failed write pending and try again after the debounce
+    if (config_save(updates, count)) {
+        handle_audio_error(TAG, "Failed to save settings to the configuration file");
+        first_change_ms = now_ms;
+        last_change_ms = now_ms;
+        return PERSIST_DEBOUNCE_MS;
+    }
+
+    memset(pending_dirty, 0, sizeof(pending_dirty));
+    first_change_ms = 0;
+    printf("[INFO] [CTRL] Saved %d setting(s) to the configuration file\n", count);
+    return -1;
+}
@@ -0,0 +1,21 @@
+#ifndef PERSIST_H
+#define PERSIST_H
+
+// A change is written once no other change followed for this long...
+#define PERSIST_DEBOUNCE_MS 2000
+// ...but never later than this after the first unsaved change
+#define PERSIST_MAX_DELAY_MS 10000
+
+// Notes a parameter changed through the control socket. Parameters without a
+// configuration key (mutes, read-only values) are ignored.
+void persist_note(const char *name, long long value, long long now_ms);
+
+/**
+ * Writes the noted changes to the configuration file once they are due.
+ * Only called from the control thread.
+ * @param now_ms Current monotonic time in milliseconds.
+ * @return Milliseconds until the next write is due, or -1 if nothing is pending.
+ */
+int persist_flush(long long now_ms);
+
+#endif // PERSIST_H
@@ -0,0 +1,135 @@
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "config.h"
+#include "input.h"
+#include "logging.h"
+#include "output.h"
+#include "reload.h"
+
+#define TAG "NET_RELOAD"
+
+static int reload_event_fd = -1;
+
+// Only async-signal-safe calls here; the control thread does the actual reload
+static void handle_sighup(int sig) {
+    uint64_t one = 1;
+    ssize_t written = write(reload_event_fd, &one, sizeof(one));
+    (void)written;
+}
+
+int reload_init() {
+    reload_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reload_event_fd < 0) {
+        handle_audio_error(TAG, "eventfd");
+        return -1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sighup;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGHUP, &sa, NULL) == -1) {
+        handle_audio_error(TAG, "sigaction");
+        return -1;
+    }
+    return 0;
+}
+
+int reload_signal_fd() {
+    return reload_event_fd;
+}
+
+/**
+ * Adds a live change to the batch if the file's value differs from the running
+ * one and is in range for the parameter. Comparing with the running value
+ * rather than the previous file also applies a file edited back to its
+ * startup value after the parameter was changed at runtime.
+ */
+static void reload_live(ParameterChange *changes, int *count, const char *name, int new_value) {
+    const Parameter *param = parameter_find(name);
+    long long live;
+    if (!param || param->get(&live)) {
+        printf("[INFO] [CFG] Ignoring %s = %d, its current value can't be read\n", name, new_value);
+        return;
+    }
+    if (live == new_value) {
+        return;
+    }
+
+    if (new_value < param->min || new_value > param->max || *count == PARAM_BATCH_MAX) {
+        printf("[INFO] [CFG] Ignoring %s = %d, keeping %lld\n", name, new_value, live);
+        return;
+    }
+    changes[*count].param = param;
+    changes[*count].value = new_value;
+    (*count)++;
+    printf("[INFO] [CFG] %s: %lld -> %d\n", name, live, new_value);
+}
+
+static void reload_restart_needed(const char *name, int changed) {
+    if (changed) {
+        printf("[INFO] [CFG] %s changed; takes effect after a restart\n", name);
+    }
+}
+
+int reload_config(ParameterChange *changes, int *count) {
+    const AudioConfig *old;
+    if (config_reload(&old) != CONFIG_OK) {
+        printf("[INFO] [CFG] Configuration rejected, keeping the running one\n");
+        return -1;
+    }
+    const AudioConfig *current = config_get();
+    const AudioInputConfig *old_ai = &old->ai, *ai = &current->ai;
+    const AudioOutputConfig *old_ao = &old->ao, *ao = &current->ao;
+
+    *count = 0;
+
+    // Settings fixed by resources allocated at startup
+    reload_restart_needed("AI enabled/device/channel", old_ai->enabled != ai->enabled ||
+                          old_ai->device_id != ai->device_id || old_ai->channel_id != ai->channel_id);
+    reload_restart_needed("AO enabled/device/channel", old_ao->enabled != ao->enabled ||
+                          old_ao->device_id != ao->device_id || old_ao->channel_id != ao->channel_id);
+    reload_restart_needed("AO frame_size/queue_depth", old_ao->frame_size != ao->frame_size ||
+                          old_ao->queue_depth != ao->queue_depth);
+    reload_restart_needed("Socket paths/client limits", memcmp(&old->network, &current->network, sizeof(NetworkConfig)) != 0);
+    reload_restart_needed("Thread scheduling", memcmp(&old_ai->thread, &ai->thread, sizeof(ThreadConfig)) != 0 ||
+                          memcmp(&old_ao->thread, &ao->thread, sizeof(ThreadConfig)) != 0);
+    reload_restart_needed("Memory locking/thread stacks", memcmp(&old->daemon, &current->daemon, sizeof(DaemonConfig)) != 0);
+
+    // Stream format changes re-initialize one direction; the other keeps streaming
+    if (old_ai->sample_rate != ai->sample_rate || old_ai->frm_num != ai->frm_num ||
+        old_ai->bitwidth != ai->bitwidth || old_ai->soundmode != ai->soundmode ||
+        old_ai->chn_cnt != ai->chn_cnt || old_ai->usr_frm_depth != ai->usr_frm_depth) {
+        printf("[INFO] [CFG] AI format changed; reinitializing audio input\n");
+        ai_request_reinit();
+    }
+    if (old_ao->sample_rate != ao->sample_rate || old_ao->frm_num != ao->frm_num ||
+        old_ao->bitwidth != ao->bitwidth || old_ao->soundmode != ao->soundmode ||
+        old_ao->chn_cnt != ao->chn_cnt || old_ao->fade_ms != ao->fade_ms) {
+        printf("[INFO] [CFG] AO format changed; reinitializing audio output\n");
+        ao_request_reinit();
+    }
+
+    // Everything else is applied live as one batch; AGC levels go before the switch
+    reload_live(changes, count, "ai_volume", ai->volume);
+    reload_live(changes, count, "ai_gain", ai->gain);
+    reload_live(changes, count, "ai_alc_gain", ai->alc_gain);
+    reload_live(changes, count, "ai_aec", ai->aec_enabled);
+    reload_live(changes, count, "ai_ns_level", ai->ns_enabled ? ai->ns_level : -1);
+    reload_live(changes, count, "ai_hpf", ai->hpf_enabled);
+    reload_live(changes, count, "ai_agc_target_dbfs", ai->agc_target_dbfs);
+    reload_live(changes, count, "ai_agc_compression_db", ai->agc_compression_db);
+    reload_live(changes, count, "ai_agc", ai->agc_enabled);
+    reload_live(changes, count, "ao_volume", ao->volume);
+    reload_live(changes, count, "ao_gain", ao->gain);
+
+    // credit_frames, admission_timeout_ms and comfort_noise_level are read
+    // from the snapshot as they are used, so they need nothing here
+    printf("[INFO] [CFG] Configuration reloaded\n");
+    return 0;
+}
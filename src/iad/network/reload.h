@@ -0,0 +1,22 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "parameters.h"
+
+// Creates the reload eventfd and installs the SIGHUP handler. Returns 0 on success.
+int reload_init(void);
+
+// Returns an eventfd that becomes readable when SIGHUP was received.
+int reload_signal_fd(void);
+
+/**
+ * Loads iad.json again and applies what changed against the running configuration.
+ * Changes that need a re-initialization re-initialize only the affected direction;
+ * settings that can change live are returned as a batch for the caller to submit.
+ * @param changes Receives up to PARAM_BATCH_MAX live parameter changes.
+ * @param count Receives the number of changes.
+ * @return 0 on success, -1 if the file was rejected and the running configuration kept.
+ */
+int reload_config(ParameterChange *changes, int *count);
+
+#endif // RELOAD_H
@@ -14,6 +14,7 @@ void print_usage(const char *prog_name) {
     printf("  -c <path>   Path to configuration file (default: ./iad.json)\n");
     printf("  -d <AI|AO>  Disable AI (Audio Input) or AO (Audio Output)\n");
     printf("  -r          Start the program as a daemon\n");
+    printf("  -t          Take over from the running daemon without dropping clients\n");
     printf("  -h          Display this help message\n");
 }
 
@@ -42,9 +43,10 @@ int parse_cmdline(int argc, char *argv[], CmdOptions *options) {
     options->disable_ai = 0;
     options->disable_ao = 0;
     options->daemonize = 0;
+    options->takeover = 0;
 
     // Use getopt to parse the command line arguments
-    while ((opt = getopt(argc, argv, "d:c:rh")) != -1) {
+    while ((opt = getopt(argc, argv, "d:c:rth")) != -1) {
         switch (opt) {
             case 'c':
                 if (optarg) {  // Check if optarg is not NULL before assigning
@@ -69,6 +71,9 @@ int parse_cmdline(int argc, char *argv[], CmdOptions *options) {
             case 'r':
                 options->daemonize = 1;
 		break;
+            case 't':
+                options->takeover = 1;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 exit(0);
@@ -7,6 +7,7 @@ typedef struct {
     int disable_ai;
     int disable_ao;
     int daemonize;
+    int takeover;
 } CmdOptions;
 
 // Function to parse command line arguments
@@ -1,35 +1,274 @@
-#include <pthread.h>        // for pthread_mutex_unlock, pthread_mutex_lock
+#include <fcntl.h>          // for open, O_CREAT, O_WRONLY
+#include <sched.h>          // for SCHED_FIFO, SCHED_RR, SCHED_OTHER
+#include <libgen.h>         // for dirname
 #include <stdio.h>          // for fprintf, stderr, fclose, NULL, fseek, fopen
-#include <stdlib.h>         // for free, calloc
-#include <string.h>         // for strcmp, strdup
+#include <string.h>         // for strcmp, strncpy
+#include <sys/stat.h>       // for stat
+#include <unistd.h>         // for fsync, rename, unlink
 #include "imp/imp_audio.h"  // for AUDIO_SAMPLE_RATE_16000, AUDIO_SAMPLE_RAT...
 #include "config.h"
 #include "cJSON.h"          // for cJSON_IsNumber, cJSON_IsBool, cJSON_GetOb...
-#include "output.h"         // for DEFAULT_AO_MAX_FRAME_SIZE
+#include "admission.h"      // for DEFAULT_AO_ADMISSION_TIMEOUT_MS
+#include "ao_queue.h"       // for DEFAULT_AO_QUEUE_DEPTH
+#include "input.h"          // for DEFAULT_AI_SAMPLE_RATE, DEFAULT_AI_GAIN
+#include "output.h"         // for DEFAULT_AO_MAX_FRAME_SIZE, DEFAULT_AO_FADE_MS
+#include "pool.h"           // for heap_alloc, heap_free
+#include "realtime.h"       // for DEFAULT_LOCKED_THREAD_STACK_KB, DEFAULT_THREAD_STACK_KB
+#include "utils.h"          // for string_to_bitwidth, string_to_soundmode
+
+// Built-in settings, used until a file is loaded and for anything it leaves out
+static const AudioConfig config_defaults = {
+    .ai = {
+        .enabled = 1,
+        .device_id = DEFAULT_AI_DEV_ID,
+        .channel_id = DEFAULT_AI_CHN_ID,
+        .sample_rate = DEFAULT_AI_SAMPLE_RATE,
+        .frm_num = DEFAULT_AI_FRM_NUM,
+        .bitwidth = AUDIO_BIT_WIDTH_16,
+        .soundmode = AUDIO_SOUND_MODE_MONO,
+        .chn_cnt = DEFAULT_AI_CHN_CNT,
+        .usr_frm_depth = DEFAULT_AI_USR_FRM_DEPTH,
+        .volume = DEFAULT_AI_CHN_VOL,
+        .gain = DEFAULT_AI_GAIN,
+        .agc_compression_db = 6,
+        .thread = {SCHED_FIFO, DEFAULT_AI_THREAD_PRIORITY, 0},
+    },
+    .ao = {
+        .enabled = 1,
+        .device_id = DEFAULT_AO_DEV_ID,
+        .channel_id = DEFAULT_AO_CHN_ID,
+        .sample_rate = DEFAULT_AO_SAMPLE_RATE,
+        .frm_num = DEFAULT_AO_FRM_NUM,
+        .bitwidth = AUDIO_BIT_WIDTH_16,
+        .soundmode = AUDIO_SOUND_MODE_MONO,
+        .chn_cnt = DEFAULT_AO_CHN_CNT,
+        .volume = DEFAULT_AO_CHN_VOL,
+        .gain = DEFAULT_AO_GAIN,
+        .frame_size = DEFAULT_AO_MAX_FRAME_SIZE,
+        .fade_ms = DEFAULT_AO_FADE_MS,
+        .queue_depth = DEFAULT_AO_QUEUE_DEPTH,
+        .credit_frames = DEFAULT_AO_CREDIT_FRAMES,
+        .admission_timeout_ms = DEFAULT_AO_ADMISSION_TIMEOUT_MS,
+        .comfort_noise_level = DEFAULT_AO_COMFORT_NOISE_LEVEL,
+        .agc_compression_db = 6,
+        .hpf_cofrequency = 100,
+        .thread = {SCHED_FIFO, DEFAULT_AO_THREAD_PRIORITY, 0},
+    },
+    .network = {
+        .max_input_clients = DEFAULT_MAX_INPUT_CLIENTS,
+        .max_control_clients = DEFAULT_MAX_CONTROL_CLIENTS,
+        .max_waiting_clients = DEFAULT_MAX_WAITING_CLIENTS,
+    },
+    .daemon = {
+        .thread_stack_kb = DEFAULT_THREAD_STACK_KB,
+    },
+};
 
-// Global pointer for the root of the configuration JSON object
-static cJSON *config_root = NULL;
+/**
+ * @brief A loaded snapshot. Snapshots replaced by a reload stay allocated
+ * for CONFIG_RETIRED_KEEP more reloads, so a reader never sees one freed under it.
+ */
+typedef struct ConfigSnapshot {
+    AudioConfig config;                 // Must be first, readers only see this
+    struct ConfigSnapshot *retired;     // Older snapshots, newest first
+} ConfigSnapshot;
+
+// The published snapshot. Readers load it without locking; it is replaced
+// as a whole and never modified once published.
+static const AudioConfig *config_current = &config_defaults;
+
+// Readers only hold a snapshot for the duration of a call, so one replaced
+// this many reloads ago is no longer in use and can be freed
+#define CONFIG_RETIRED_KEEP 2
+
+// The published snapshot and the retired ones still kept, newest first.
+// Only touched by the thread loading the file.
+static ConfigSnapshot *config_retired = NULL;
+
+// File to read again on reload
+static char config_path[256];
+
+static int validate_json(cJSON *root);
+
+/**
+ * Reads an integer, keeping the current value if the key is missing or not a number.
+ */
+static void config_read_int(cJSON *section, const char *key, int *value) {
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(section, key);
+    if (cJSON_IsNumber(item)) {
+        *value = item->valueint;
+    }
+}
+
+/**
+ * Reads an optional integer, keeping the current value if the key is missing or out of range.
+ */
+static void config_read_int_range(cJSON *section, const char *key, int *value, int min, int max) {
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(section, key);
+    if (cJSON_IsNumber(item) && item->valueint >= min && item->valueint <= max) {
+        *value = item->valueint;
+    }
+}
+
+/**
+ * Reads a boolean, keeping the current value if the key is missing or not a boolean.
+ */
+static void config_read_bool(cJSON *section, const char *key, int *value) {
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(section, key);
+    if (cJSON_IsBool(item)) {
+        *value = cJSON_IsTrue(item);
+    }
+}
+
+static void config_read_socket(cJSON *section, const char *key, char *path) {
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(section, key);
+    if (cJSON_IsString(item)) {
+        strncpy(path, item->valuestring, CONFIG_SOCKET_PATH_MAX - 1);
+        path[CONFIG_SOCKET_PATH_MAX - 1] = '\0';
+    }
+}
+
+/**
+ * Reads the scheduling of an audio thread, keeping the defaults for missing or invalid keys.
+ */
+static void config_read_thread(cJSON *section, ThreadConfig *thread) {
+    static const struct {
+        const char *name;
+        int policy;
+    } policies[] = {
+        {"SCHED_FIFO", SCHED_FIFO},
+        {"SCHED_RR", SCHED_RR},
+        {"SCHED_OTHER", SCHED_OTHER},
+    };
+
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(section, "thread_policy");
+    if (cJSON_IsString(item)) {
+        size_t i;
+        for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+            if (strcmp(item->valuestring, policies[i].name) == 0) {
+                thread->policy = policies[i].policy;
+                break;
+            }
+        }
+        if (i == sizeof(policies) / sizeof(policies[0])) {
+            fprintf(stderr, "[WARNING] Unexpected thread_policy string: %s. Keeping the default.\n", item->valuestring);
+        }
+    }
+    config_read_int_range(section, "thread_priority", &thread->priority, 1, 99);
+    config_read_int_range(section, "cpu_affinity", &thread->cpu_affinity, 0, 0xffff);
+}
+
+/**
+ * Copies the settings of one direction that AI and AO have in common.
+ */
+static void config_read_common(cJSON *section, int *enabled, int *device_id, int *channel_id, int *sample_rate,
+                               int *frm_num, IMPAudioBitWidth *bitwidth, IMPAudioSoundMode *soundmode, int *chn_cnt,
+                               int *volume, int *gain) {
+    config_read_bool(section, "enabled", enabled);
+    config_read_int(section, "device_id", device_id);
+    config_read_int(section, "channel_id", channel_id);
+    config_read_int(section, "sample_rate", sample_rate);
+    config_read_int(section, "frmNum", frm_num);
+    config_read_int(section, "chnCnt", chn_cnt);
+    config_read_int(section, "SetVol", volume);
+    config_read_int(section, "SetGain", gain);
+
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(section, "bitwidth");
+    if (cJSON_IsString(item)) {
+        *bitwidth = string_to_bitwidth(item->valuestring);
+    }
+    item = cJSON_GetObjectItemCaseSensitive(section, "soundmode");
+    if (cJSON_IsString(item)) {
+        *soundmode = string_to_soundmode(item->valuestring);
+    }
+}
+
+/**
+ * Compiles the parsed configuration into a typed snapshot, starting from the defaults.
+ * @param audio The 'audio' object of the configuration, may be NULL.
+ * @param config Snapshot to fill.
+ */
+static void config_compile(cJSON *audio, AudioConfig *config) {
+    *config = config_defaults;
+
+    cJSON *section = cJSON_GetObjectItemCaseSensitive(audio, "AI_attributes");
+    if (cJSON_IsObject(section)) {
+        AudioInputConfig *ai = &config->ai;
+        config_read_common(section, &ai->enabled, &ai->device_id, &ai->channel_id, &ai->sample_rate, &ai->frm_num,
+                           &ai->bitwidth, &ai->soundmode, &ai->chn_cnt, &ai->volume, &ai->gain);
+        config_read_int(section, "usrFrmDepth", &ai->usr_frm_depth);
+        config_read_int(section, "SetAlcGain", &ai->alc_gain);
+        config_read_bool(section, "Enable_Ns", &ai->ns_enabled);
+        config_read_int(section, "Level_Ns", &ai->ns_level);
+        config_read_bool(section, "Enable_Hpf", &ai->hpf_enabled);
+        config_read_bool(section, "EnableAec", &ai->aec_enabled);
+        config_read_bool(section, "Enable_Agc", &ai->agc_enabled);
+
+        cJSON *agc = cJSON_GetObjectItemCaseSensitive(section, "AGC_attributes");
+        config_read_int(agc, "TargetLevelDbfs", &ai->agc_target_dbfs);
+        config_read_int(agc, "CompressionGaindB", &ai->agc_compression_db);
+        config_read_thread(section, &ai->thread);
+    }
+
+    section = cJSON_GetObjectItemCaseSensitive(audio, "AO_attributes");
+    if (cJSON_IsObject(section)) {
+        AudioOutputConfig *ao = &config->ao;
+        config_read_common(section, &ao->enabled, &ao->device_id, &ao->channel_id, &ao->sample_rate, &ao->frm_num,
+                           &ao->bitwidth, &ao->soundmode, &ao->chn_cnt, &ao->volume, &ao->gain);
+        config_read_int(section, "frame_size", &ao->frame_size);
+        config_read_int_range(section, "fade_ms", &ao->fade_ms, 0, 100);
+        config_read_int_range(section, "queue_depth", &ao->queue_depth, 2, 64);
+        config_read_int_range(section, "credit_frames", &ao->credit_frames, 1, 64);
+        config_read_int_range(section, "admission_timeout_ms", &ao->admission_timeout_ms, 0, 3600000);
+        config_read_int_range(section, "comfort_noise_level", &ao->comfort_noise_level, 0, 1024);
+        config_read_bool(section, "Enable_Agc", &ao->agc_enabled);
+        config_read_bool(section, "Enable_Hpf", &ao->hpf_enabled);
+
+        cJSON *agc = cJSON_GetObjectItemCaseSensitive(section, "AGC_attributes");
+        config_read_int(agc, "TargetLevelDbfs", &ao->agc_target_dbfs);
+        config_read_int(agc, "CompressionGaindB", &ao->agc_compression_db);
+
+        cJSON *hpf = cJSON_GetObjectItemCaseSensitive(section, "HPF_attributes");
+        config_read_int(hpf, "SetHpfCoFrequency", &ao->hpf_cofrequency);
+        config_read_thread(section, &ao->thread);
+    }
+
+    section = cJSON_GetObjectItemCaseSensitive(audio, "network");
+    if (cJSON_IsObject(section)) {
+        config_read_socket(section, "audio_input_socket_path", config->network.ai_socket);
+        config_read_socket(section, "audio_output_socket_path", config->network.ao_socket);
+        config_read_socket(section, "audio_control_socket_path", config->network.ctrl_socket);
+        config_read_int_range(section, "max_input_clients", &config->network.max_input_clients, 1, 64);
+        config_read_int_range(section, "max_control_clients", &config->network.max_control_clients, 1, 64);
+        config_read_int_range(section, "max_waiting_clients", &config->network.max_waiting_clients, 1, 64);
+    }
 
-// Mutex to ensure thread-safe access to the configuration
-static pthread_mutex_t config_mutex;
-static pthread_mutexattr_t config_mutex_attr;  // Attributes for the recursive mutex
+    section = cJSON_GetObjectItemCaseSensitive(audio, "daemon");
+    if (cJSON_IsObject(section)) {
+        config_read_bool(section, "lock_memory", &config->daemon.lock_memory);
+        config_read_int_range(section, "thread_stack_kb", &config->daemon.thread_stack_kb, 64, 8192);
+    }
+
+    // Locked default stacks would keep megabytes per thread resident
+    if (config->daemon.lock_memory && !config->daemon.thread_stack_kb) {
+        config->daemon.thread_stack_kb = DEFAULT_LOCKED_THREAD_STACK_KB;
+    }
+}
 
 /**
- * Load configuration from the specified file into the global config_root cJSON object.
- * This function will initialize the mutex, read the file, and parse its contents as JSON.
+ * Reads and parses a configuration file.
  * @param config_file_path Path to the configuration file.
- * @return 0 on success, -1 on failure.
+ * @return The parse tree, to be freed with cJSON_Delete(), or NULL on error.
  */
-int config_load_from_file(const char *config_file_path) {
-    // Initialize the recursive mutex attribute and the mutex
-    pthread_mutexattr_init(&config_mutex_attr);
-    pthread_mutexattr_settype(&config_mutex_attr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&config_mutex, &config_mutex_attr);
+static cJSON *config_read_json(const char *config_file_path) {
+    // cJSON allocates through the counted heap functions too
+    static cJSON_Hooks hooks = {heap_alloc, heap_free};
+    cJSON_InitHooks(&hooks);
 
     FILE *file = fopen(config_file_path, "r");
     if (!file) {
         fprintf(stderr, "[ERROR] Configuration file '%s' not found.\n", config_file_path);
-        return -1;
+        return NULL;
     }
 
     fseek(file, 0, SEEK_END);
@@ -40,38 +279,124 @@ int config_load_from_file(const char *config_file_path) {
     if (length == 0) {
         fprintf(stderr, "[ERROR] Configuration file '%s' is empty.\n", config_file_path);
         fclose(file);
-        return -1;
+        return NULL;
     }
 
-    char *content = calloc(1, length + 1);  // +1 for the null terminator
+    char *content = heap_calloc(1, length + 1);  // +1 for the null terminator
     if (!content) {
         fclose(file);
-        return -1;
+        return NULL;
     }
 
     if (fread(content, 1, length, file) != length) {
         fclose(file);
-        free(content);
-        return -1;
+        heap_free(content);
+        return NULL;
     }
 
     fclose(file);
-    config_root = cJSON_Parse(content);
+    cJSON *root = cJSON_ParseWithOpts(content, NULL, 1);  // Trailing garbage is an error too
+    heap_free(content);
 
     // Check if parsing was successful and log an error if it wasn't
-    if (!config_root) {
+    if (!root) {
         fprintf(stderr, "Failed to parse JSON config. Error near: %s\n", cJSON_GetErrorPtr());
+    }
+    return root;
+}
+
+/**
+ * Reads, parses, validates and compiles a configuration file.
+ * @param config_file_path Path to the configuration file.
+ * @param config Snapshot to fill.
+ * @return CONFIG_OK, CONFIG_ERROR or CONFIG_INVALID; config is complete unless CONFIG_ERROR is returned.
+ */
+static int config_parse_file(const char *config_file_path, AudioConfig *config) {
+    cJSON *root = config_read_json(config_file_path);
+    if (!root) {
+        return CONFIG_ERROR;
+    }
 
-	//Debug: Print loaded json config
-	//cJSON *loaded_config = get_audio_config();
-	//printf("Loaded JSON: %s\n", cJSON_Print(loaded_config));
+    cJSON *audio = cJSON_GetObjectItemCaseSensitive(root, "audio");
+    int result = validate_json(audio) ? CONFIG_OK : CONFIG_INVALID;
+    config_compile(audio, config);
+    cJSON_Delete(root);
+    return result;
+}
 
-        free(content);
-        return -1;
+/**
+ * Publishes a new snapshot. The snapshot it replaces is retired, not freed:
+ * readers take no lock, so one may still be looking at it. Only snapshots
+ * retired more than CONFIG_RETIRED_KEEP reloads ago are freed.
+ */
+static const AudioConfig *config_publish(ConfigSnapshot *snapshot) {
+    const AudioConfig *previous = __atomic_exchange_n(&config_current, &snapshot->config, __ATOMIC_ACQ_REL);
+    snapshot->retired = config_retired;
+    config_retired = snapshot;
+
+    ConfigSnapshot *last = snapshot;
+    for (int kept = 0; last && kept < CONFIG_RETIRED_KEEP; kept++) {
+        last = last->retired;
     }
+    if (last) {
+        while (last->retired) {
+            ConfigSnapshot *expired = last->retired;
+            last->retired = expired->retired;
+            heap_free(expired);
+        }
+    }
+    return previous;
+}
 
-    free(content);
-    return 0;
+/**
+ * Load configuration from the specified file and publish it as the current snapshot.
+ * The file is read, parsed and validated once; the parse tree is freed afterwards.
+ * @param config_file_path Path to the configuration file.
+ * @return CONFIG_OK on success, CONFIG_ERROR if the file could not be loaded,
+ *         CONFIG_INVALID if it was loaded but failed validation.
+ */
+int config_load_from_file(const char *config_file_path) {
+    strncpy(config_path, config_file_path, sizeof(config_path) - 1);
+
+    ConfigSnapshot *snapshot = heap_alloc(sizeof(ConfigSnapshot));
+    if (!snapshot) {
+        return CONFIG_ERROR;
+    }
+
+    int result = config_parse_file(config_file_path, &snapshot->config);
+    if (result == CONFIG_ERROR) {
+        heap_free(snapshot);
+        return result;
+    }
+
+    config_publish(snapshot);
+    return result;
+}
+
+/**
+ * Reloads the file given to config_load_from_file(). A file that fails to
+ * load or validate is rejected as a whole and the running configuration is kept.
+ * @param previous Receives the snapshot that was replaced, for diffing.
+ * @return CONFIG_OK if a new snapshot was published, CONFIG_ERROR or CONFIG_INVALID otherwise.
+ */
+int config_reload(const AudioConfig **previous) {
+    if (!config_path[0]) {
+        return CONFIG_ERROR;
+    }
+
+    ConfigSnapshot *snapshot = heap_alloc(sizeof(ConfigSnapshot));
+    if (!snapshot) {
+        return CONFIG_ERROR;
+    }
+
+    int result = config_parse_file(config_path, &snapshot->config);
+    if (result != CONFIG_OK) {
+        heap_free(snapshot);
+        return result;
+    }
+
+    *previous = config_publish(snapshot);
+    return CONFIG_OK;
 }
 
 /**
@@ -84,7 +409,7 @@ int config_load_from_file(const char *config_file_path) {
  * @param root The root cJSON object of the loaded configuration.
  * @return int 1 if the configuration is valid, 0 otherwise.
  */
-int validate_json(cJSON *root) {
+static int validate_json(cJSON *root) {
     // Check if the root object exists and is of the correct type
     if (!root || !cJSON_IsObject(root)) {
         fprintf(stderr, "Invalid configuration format. Root should be an object.\n");
@@ -157,33 +482,28 @@ int validate_json(cJSON *root) {
     };
 
     // Validate the 'AO_attributes' and 'AI_attributes' objects
-    const char *sections[] = {"AO_attributes", "AI_attributes"};
-    struct Attribute *current_attributes;
+    const struct {
+        const char *name;
+        struct Attribute *attributes;
+        int count;
+    } sections[] = {
+        {"AO_attributes", ao_attributes, sizeof(ao_attributes) / sizeof(ao_attributes[0])},
+        {"AI_attributes", ai_attributes, sizeof(ai_attributes) / sizeof(ai_attributes[0])},
+    };
 
     for (int s = 0; s < 2; s++) {
-        if (strcmp(sections[s], "AO_attributes") == 0) {
-            current_attributes = ao_attributes;
-        } else if (strcmp(sections[s], "AI_attributes") == 0) {
-            current_attributes = ai_attributes;
-        }
+        struct Attribute *current_attributes = sections[s].attributes;
 
-        cJSON *section = cJSON_GetObjectItemCaseSensitive(audio, sections[s]);
+        cJSON *section = cJSON_GetObjectItemCaseSensitive(audio, sections[s].name);
         if (!section || !cJSON_IsObject(section)) {
-            fprintf(stderr, "Invalid configuration format. '%s' key is missing or not an object.\n", sections[s]);
+            fprintf(stderr, "Invalid configuration format. '%s' key is missing or not an object.\n", sections[s].name);
             return 0;
         }
 
-        int attributes_len;
-        if (strcmp(sections[s], "AO_attributes") == 0) {
-            attributes_len = sizeof(ao_attributes) / sizeof(ao_attributes[0]);
-        } else {
-            attributes_len = sizeof(ai_attributes) / sizeof(ai_attributes[0]);
-        }
-
-        for (int i = 0; i < attributes_len; i++) {
+        for (int i = 0; i < sections[s].count; i++) {
             cJSON *item = cJSON_GetObjectItemCaseSensitive(section, current_attributes[i].key);
             if (!item || !current_attributes[i].validator(item)) {
-                fprintf(stderr, "Invalid configuration format. '%s' key in '%s' is missing or of incorrect type.\n", current_attributes[i].key, sections[s]);
+                fprintf(stderr, "Invalid configuration format. '%s' key in '%s' is missing or of incorrect type.\n", current_attributes[i].key, sections[s].name);
                 return 0;
             }
 
@@ -191,17 +511,18 @@ int validate_json(cJSON *root) {
                 for (int j = 0; j < sizeof(agc_attributes) / sizeof(agc_attributes[0]); j++) {
                     cJSON *agc_item = cJSON_GetObjectItemCaseSensitive(item, agc_attributes[j].key);
                     if (!agc_item || !agc_attributes[j].validator(agc_item)) {
-                        fprintf(stderr, "Invalid configuration format. '%s' key in 'AGC_attributes' of '%s' is missing or of incorrect type.\n", agc_attributes[j].key, sections[s]);
+                        fprintf(stderr, "Invalid configuration format. '%s' key in 'AGC_attributes' of '%s' is missing or of incorrect type.\n", agc_attributes[j].key, sections[s].name);
                         return 0;
                     }
                 }
             }
 
-            if (strcmp(ao_attributes[i].key, "HPF_attributes") == 0 && strcmp(sections[s], "AO_attributes") == 0) {
+            // Only AO has HPF_attributes; indexing ao_attributes here used to read past the shorter AI list
+            if (strcmp(current_attributes[i].key, "HPF_attributes") == 0) {
                 for (int j = 0; j < sizeof(hpf_attributes) / sizeof(hpf_attributes[0]); j++) {
                     cJSON *hpf_item = cJSON_GetObjectItemCaseSensitive(item, hpf_attributes[j].key);
                     if (!hpf_item || !hpf_attributes[j].validator(hpf_item)) {
-                        fprintf(stderr, "Invalid configuration format. '%s' key in 'HPF_attributes' of '%s' is missing or of incorrect type.\n", hpf_attributes[j].key, sections[s]);
+                        fprintf(stderr, "Invalid configuration format. '%s' key in 'HPF_attributes' of '%s' is missing or of incorrect type.\n", hpf_attributes[j].key, sections[s].name);
                         return 0;
                     }
                 }
@@ -233,181 +554,248 @@ int validate_json(cJSON *root) {
 }
 
 /**
- * Cleanup the loaded configuration. This function will free the memory associated
- * with the global cJSON object and destroy the mutex.
+ * Sets a number or boolean in the parse tree, adding the key if it is missing.
+ * @return 1 if the tree changed, 0 if it already held the value.
  */
-void config_cleanup(void) {
-    pthread_mutex_lock(&config_mutex);
-    if (config_root) {
-        cJSON_Delete(config_root);
-        config_root = NULL;
+static int config_update_item(cJSON *object, const ConfigUpdate *update) {
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(object, update->key);
+    if (update->is_bool) {
+        if (cJSON_IsBool(item) && cJSON_IsTrue(item) == !!update->value) {
+            return 0;
+        }
+        cJSON *value = cJSON_CreateBool(update->value);
+        if (item) {
+            cJSON_ReplaceItemInObjectCaseSensitive(object, update->key, value);
+        } else {
+            cJSON_AddItemToObject(object, update->key, value);
+        }
+        return 1;
     }
-    pthread_mutex_unlock(&config_mutex);
-
-    // Destroy the mutex
-    pthread_mutex_destroy(&config_mutex);
-    pthread_mutexattr_destroy(&config_mutex_attr);
-}
-
-/**
- * Retrieve the 'audio' configuration object.
- * @return Pointer to the cJSON 'audio' object, or NULL if not found.
- */
-cJSON *get_audio_config(void) {
-    pthread_mutex_lock(&config_mutex);
-    cJSON *item = cJSON_GetObjectItemCaseSensitive(config_root, "audio");
-    pthread_mutex_unlock(&config_mutex);
-    return item;
-}
 
-/**
- * Retrieve the 'network' configuration object.
- * @return Pointer to the cJSON 'network' object, or NULL if not found.
- */
-cJSON *get_network_config(void) {
-    pthread_mutex_lock(&config_mutex);
-    cJSON *item = cJSON_GetObjectItemCaseSensitive(config_root, "network");
-    pthread_mutex_unlock(&config_mutex);
-    return item;
+    if (cJSON_IsNumber(item)) {
+        if (item->valueint == update->value) {
+            return 0;
+        }
+        cJSON_SetNumberValue(item, update->value);
+        return 1;
+    }
+    if (item) {
+        cJSON_ReplaceItemInObjectCaseSensitive(object, update->key, cJSON_CreateNumber(update->value));
+    } else {
+        cJSON_AddNumberToObject(object, update->key, update->value);
+    }
+    return 1;
 }
 
 /**
- * Check if AI (Audio Input) is enabled in the configuration.
- * @return 1 if enabled, 0 otherwise.
+ * Re-indents cJSON output the way iad.json is written by hand: two spaces
+ * per level and a single space after a colon. cJSON escapes tabs inside
+ * strings, so every raw tab is formatting.
+ * @return A newly allocated, newline-terminated string, or NULL on allocation failure.
  */
-int config_get_ai_enabled() {
-    cJSON *audio = get_audio_config();
-    if (!audio) {
-        fprintf(stderr, "Warning: Using default AI enabled value.\n");
-        return 1; // Default to enabled if no audio config
+static char *config_format(const char *printed) {
+    size_t tabs = 0;
+    for (const char *p = printed; *p; p++) {
+        tabs += *p == '\t';
     }
 
-    cJSON *AI_attributes = cJSON_GetObjectItemCaseSensitive(audio, "AI_attributes");
-    if (!AI_attributes) {
-        fprintf(stderr, "Warning: Using default AI enabled value.\n");
-        return 1; // Default to enabled if no AI_attributes
+    char *formatted = heap_alloc(strlen(printed) + tabs + 2);
+    if (!formatted) {
+        return NULL;
     }
 
-    cJSON *enabled = cJSON_GetObjectItemCaseSensitive(AI_attributes, "enabled");
-    return cJSON_IsTrue(enabled);
+    char *out = formatted;
+    int line_start = 1;
+    for (const char *p = printed; *p; p++) {
+        if (*p == '\t') {
+            int indent = line_start ? 2 : 1;
+            memset(out, ' ', indent);
+            out += indent;
+            continue;
+        }
+        line_start = *p == '\n';
+        *out++ = *p;
+    }
+    *out++ = '\n';
+    *out = '\0';
+    return formatted;
 }
 
 /**
- * Check if AO (Audio Output) is enabled in the configuration.
- * @return 1 if enabled, 0 otherwise.
+ * Replaces the configuration file with new contents so that a crash or power
+ * loss leaves either the old or the new file: the contents go to a temporary
+ * file that is synced before it is renamed over the original.
  */
-int config_get_ao_enabled() {
-    cJSON *audio = get_audio_config();
-    if (!audio) {
-        fprintf(stderr, "Warning: Using default AO enabled value.\n");
-        return 1;
+static int config_write_atomic(const char *config_file_path, const char *contents) {
+    char tmp_path[sizeof(config_path) + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", config_file_path);
+
+    struct stat st;
+    mode_t mode = stat(config_file_path, &st) == 0 ? (st.st_mode & 0777) : 0644;
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd < 0) {
+        fprintf(stderr, "[ERROR] Failed to create '%s'.\n", tmp_path);
+        return -1;
     }
 
-    cJSON *AO_attributes = cJSON_GetObjectItemCaseSensitive(audio, "AO_attributes");
-    if (!AO_attributes) {
-        fprintf(stderr, "Warning: Using default AO enabled value.\n");
-        return 1;
+    size_t len = strlen(contents);
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, contents + written, len - written);
+        if (n < 0) {
+            close(fd);
+            unlink(tmp_path);
+            fprintf(stderr, "[ERROR] Failed to write '%s'.\n", tmp_path);
+            return -1;
+        }
+        written += n;
     }
 
-    cJSON *enabled = cJSON_GetObjectItemCaseSensitive(AO_attributes, "enabled");
-    return cJSON_IsTrue(enabled);
+    if (fsync(fd) || close(fd) || rename(tmp_path, config_file_path)) {
+        unlink(tmp_path);
+        fprintf(stderr, "[ERROR] Failed to replace '%s'.\n", config_file_path);
+        return -1;
+    }
+
+    // Make the rename itself durable
+    char dir_path[sizeof(config_path)];
+    strncpy(dir_path, config_file_path, sizeof(dir_path) - 1);
+    dir_path[sizeof(dir_path) - 1] = '\0';
+    int dir_fd = open(dirname(dir_path), O_RDONLY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return 0;
 }
 
 /**
- * Retrieves the socket path for the specified socket name from the configuration.
- * This function is internally synchronized using a mutex to prevent race conditions.
- * @param socket_name The name of the socket whose path is to be retrieved.
- * @return The socket path as a string or NULL if not found or an error occurred.
+ * Writes settings changed at runtime back to the configuration file. Only the
+ * given keys are touched; the file is rewritten only if one of them differs.
+ * @param updates Settings to store.
+ * @param count Number of settings.
+ * @return 0 on success, -1 on failure.
  */
-char* config_get_socket_path(const char *socket_name) {
-    pthread_mutex_lock(&config_mutex);
-
-    // Get the audio configuration
-    cJSON *audio = get_audio_config();
-    if (!audio) {
-        pthread_mutex_unlock(&config_mutex);
-        return NULL;
+int config_save(const ConfigUpdate *updates, int count) {
+    if (!config_path[0]) {
+        return -1;
     }
 
-    // Get the network configuration within the audio configuration
-    cJSON *network = cJSON_GetObjectItemCaseSensitive(audio, "network");
-    if (!network) {
-        pthread_mutex_unlock(&config_mutex);
-        return NULL;
+    cJSON *root = config_read_json(config_path);
+    cJSON *audio = cJSON_GetObjectItemCaseSensitive(root, "audio");
+    if (!cJSON_IsObject(audio)) {
+        cJSON_Delete(root);
+        return -1;
     }
 
-    // Fetch the socket item based on the provided socket name
-    cJSON *socket_item = cJSON_GetObjectItemCaseSensitive(network, socket_name);
-    if (!socket_item || socket_item->type != cJSON_String) {
-        pthread_mutex_unlock(&config_mutex);
-        return NULL;
+    int changed = 0;
+    for (int i = 0; i < count; i++) {
+        cJSON *object = cJSON_GetObjectItemCaseSensitive(audio, updates[i].section);
+        if (object && updates[i].object) {
+            object = cJSON_GetObjectItemCaseSensitive(object, updates[i].object);
+        }
+        if (!cJSON_IsObject(object)) {
+            continue;
+        }
+        changed |= config_update_item(object, &updates[i]);
     }
 
-    char* result = strdup(socket_item->valuestring);
-    pthread_mutex_unlock(&config_mutex);
-
+    int result = 0;
+    if (changed) {
+        char *printed = cJSON_Print(root);
+        char *contents = printed ? config_format(printed) : NULL;
+        result = contents ? config_write_atomic(config_path, contents) : -1;
+        heap_free(contents);
+        cJSON_free(printed);
+    }
+    cJSON_Delete(root);
     return result;
 }
 
 /**
- * Retrieves the audio input socket path from the configuration.
- * @return The audio input socket path as a string or NULL if not found.
+ * Cleanup the loaded configuration. This function falls back to the built-in
+ * defaults and frees every snapshot loaded so far.
  */
-char* config_get_ai_socket() {
-    return config_get_socket_path("audio_input_socket_path");
+void config_cleanup(void) {
+    __atomic_store_n(&config_current, &config_defaults, __ATOMIC_RELEASE);
+    while (config_retired) {
+        ConfigSnapshot *next = config_retired->retired;
+        heap_free(config_retired);
+        config_retired = next;
+    }
 }
 
 /**
- * Retrieves the audio output socket path from the configuration.
- * @return The audio output socket path as a string or NULL if not found.
+ * Retrieve the current configuration snapshot.
+ * @return The published snapshot, or the built-in defaults if no file was loaded.
  */
-char* config_get_ao_socket() {
-    return config_get_socket_path("audio_output_socket_path");
+const AudioConfig *config_get(void) {
+    return __atomic_load_n(&config_current, __ATOMIC_ACQUIRE);
 }
 
 /**
- * Retrieves the audio control socket path from the configuration.
- * @return The audio control socket path as a string or NULL if not found.
+ * Check if AI (Audio Input) is enabled in the configuration.
+ * @return 1 if enabled, 0 otherwise.
  */
-char* config_get_ctrl_socket() {
-    return config_get_socket_path("audio_control_socket_path");
+int config_get_ai_enabled() {
+    return config_get()->ai.enabled;
 }
 
 /**
- * Fetches a specific audio attribute from the configuration.
- * @param type Specifies the type of audio (input or output).
- * @param attribute_name The name of the attribute to be fetched.
- * @return The cJSON object representing the requested attribute or NULL if not found.
+ * Check if AO (Audio Output) is enabled in the configuration.
+ * @return 1 if enabled, 0 otherwise.
  */
-cJSON* get_audio_attribute(AudioType type, const char* attribute_name) {
-    cJSON *audioConfigRoot = get_audio_config();
-    if (audioConfigRoot) {
-        const char* typeStr = (type == AUDIO_INPUT) ? "AI_attributes" : "AO_attributes";
-        cJSON *audioConfig = cJSON_GetObjectItemCaseSensitive(audioConfigRoot, typeStr);
-        if (audioConfig) {
-            return cJSON_GetObjectItemCaseSensitive(audioConfig, attribute_name);
-        }
-    }
-    return NULL;
+int config_get_ao_enabled() {
+    return config_get()->ao.enabled;
 }
 
 /**
  * Retrieves the audio output frame size from the configuration.
- * @return The audio output frame size as an integer. If not found or an error occurred, it returns the default frame size.
+ * @return The audio output frame size as an integer. If not found, it returns the default frame size.
  */
 int config_get_ao_frame_size() {
-    cJSON *audio = get_audio_config();
-    if (!audio) return DEFAULT_AO_MAX_FRAME_SIZE;
+    return config_get()->ao.frame_size;
+}
 
-    cJSON *AO_attributes = cJSON_GetObjectItemCaseSensitive(audio, "AO_attributes");
-    if (!AO_attributes) return DEFAULT_AO_MAX_FRAME_SIZE;
+/**
+ * Retrieves the audio output fade in/out ramp length from the configuration.
+ * @return The ramp length in milliseconds. If not found or out of range, it returns the default ramp length.
+ */
+int config_get_ao_fade_ms() {
+    return config_get()->ao.fade_ms;
+}
 
-    cJSON *frame_size = cJSON_GetObjectItemCaseSensitive(AO_attributes, "frame_size");
-    if (!frame_size || !cJSON_IsNumber(frame_size)) {
-        return DEFAULT_AO_MAX_FRAME_SIZE;
-    }
+/**
+ * Retrieves the depth of the internal AO frame queue from the configuration.
+ * @return The number of frame slots. If not found or out of range, it returns the default depth.
+ */
+int config_get_ao_queue_depth() {
+    return config_get()->ao.queue_depth;
+}
+
+/**
+ * Retrieves the number of frames a credit-based output client may have in flight.
+ * @return The credit window in frames. If not found or out of range, it returns the default window.
+ */
+int config_get_ao_credit_frames() {
+    return config_get()->ao.credit_frames;
+}
 
-    return frame_size->valueint;
+/**
+ * Retrieves how long an output client may wait for admission to the AO channel.
+ * @return The timeout in milliseconds, 0 meaning no limit. If not found or out of range, it returns the default timeout.
+ */
+int config_get_ao_admission_timeout_ms() {
+    return config_get()->ao.admission_timeout_ms;
+}
+
+/**
+ * Retrieves the peak amplitude of the comfort noise inserted on AO underruns.
+ * @return The amplitude in 16-bit sample units, 0 meaning silence. If not found or out of range, it returns the default level.
+ */
+int config_get_ao_comfort_noise_level() {
+    return config_get()->ao.comfort_noise_level;
 }
 
 /**
@@ -1,20 +1,178 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-#include <cJSON.h>
+#include "imp/imp_audio.h"  // for IMPAudioBitWidth, IMPAudioSoundMode
+
+// Longest socket name accepted from the configuration, including the terminator
+#define CONFIG_SOCKET_PATH_MAX 32
+
+// config_load_from_file() results
+#define CONFIG_OK 0
+#define CONFIG_ERROR -1     // The file could not be read or parsed; defaults are used
+#define CONFIG_INVALID -2   // The file was loaded but failed validation; defaults fill the gaps
+
+// -----------------------------
+// Configuration Snapshot
+// -----------------------------
+
+/**
+ * @brief Scheduling of an audio thread, from 'thread_policy', 'thread_priority'
+ * and 'cpu_affinity' in 'AI_attributes' or 'AO_attributes'.
+ */
+typedef struct {
+    int policy;         // SCHED_FIFO, SCHED_RR or SCHED_OTHER
+    int priority;       // Real-time priority, ignored for SCHED_OTHER
+    int cpu_affinity;   // Bit mask of the CPUs the thread may run on, 0 for any
+} ThreadConfig;
+
+/**
+ * @brief AI (Audio Input) settings, resolved from 'AI_attributes' when the file is loaded.
+ *
+ * Missing keys hold the built-in defaults, so readers never have to check.
+ */
+typedef struct {
+    int enabled;
+    int device_id;
+    int channel_id;
+    int sample_rate;
+    int frm_num;
+    IMPAudioBitWidth bitwidth;
+    IMPAudioSoundMode soundmode;
+    int chn_cnt;
+    int usr_frm_depth;
+    int volume;
+    int gain;
+    int alc_gain;
+    int ns_enabled;
+    int ns_level;
+    int hpf_enabled;
+    int aec_enabled;
+    int agc_enabled;
+    int agc_target_dbfs;
+    int agc_compression_db;
+    ThreadConfig thread;
+} AudioInputConfig;
+
+/**
+ * @brief AO (Audio Output) settings, resolved from 'AO_attributes' when the file is loaded.
+ *
+ * Missing or out of range optional keys hold the built-in defaults.
+ */
+typedef struct {
+    int enabled;
+    int device_id;
+    int channel_id;
+    int sample_rate;
+    int frm_num;
+    IMPAudioBitWidth bitwidth;
+    IMPAudioSoundMode soundmode;
+    int chn_cnt;
+    int volume;
+    int gain;
+    int frame_size;
+    int fade_ms;
+    int queue_depth;
+    int credit_frames;
+    int admission_timeout_ms;
+    int comfort_noise_level;
+    int agc_enabled;
+    int agc_target_dbfs;
+    int agc_compression_db;
+    int hpf_enabled;
+    int hpf_cofrequency;
+    ThreadConfig thread;
+} AudioOutputConfig;
+
+// Client limits, each backed by a pool allocated at startup
+#ifdef CONFIG_TINY_BUILD
+#define DEFAULT_MAX_INPUT_CLIENTS 2
+#define DEFAULT_MAX_CONTROL_CLIENTS 4
+#define DEFAULT_MAX_WAITING_CLIENTS 2
+#else
+#define DEFAULT_MAX_INPUT_CLIENTS 8
+#define DEFAULT_MAX_CONTROL_CLIENTS 16
+#define DEFAULT_MAX_WAITING_CLIENTS 8
+#endif
+
+/**
+ * @brief Socket names and client limits from 'network'. An empty name keeps the built-in one.
+ */
+typedef struct {
+    char ai_socket[CONFIG_SOCKET_PATH_MAX];
+    char ao_socket[CONFIG_SOCKET_PATH_MAX];
+    char ctrl_socket[CONFIG_SOCKET_PATH_MAX];
+    int max_input_clients;      // Connected input clients
+    int max_control_clients;    // Connected control clients
+    int max_waiting_clients;    // Output clients queued for the AO channel
+} NetworkConfig;
+
+/**
+ * @brief Process-wide settings from the optional 'daemon' object.
+ */
+typedef struct {
+    int lock_memory;        // mlockall() the daemon so audio threads never wait on a page fault
+    int thread_stack_kb;    // Stack size of the daemon's threads, 0 for the system default
+} DaemonConfig;
+
+/**
+ * @brief An immutable, typed copy of the whole configuration.
+ */
+typedef struct {
+    AudioInputConfig ai;
+    AudioOutputConfig ao;
+    NetworkConfig network;
+    DaemonConfig daemon;
+} AudioConfig;
 
 // -----------------------------
 // Configuration Handling Functions
 // -----------------------------
 
 /**
- * @brief Initialize the configuration system by loading the provided file.
+ * @brief Load, validate and compile the provided file into the configuration snapshot.
+ *
+ * The JSON is parsed once; its values are copied into a typed snapshot and
+ * the parse tree is freed. Anything missing keeps its default.
  *
  * @param config_file_path Path to the configuration file to load.
- * @return int 0 on success, -1 on error.
+ * @return int CONFIG_OK on success, CONFIG_ERROR or CONFIG_INVALID on error.
  */
 int config_load_from_file(const char *config_file_path);
 
+/**
+ * @brief Load the configuration file again and publish it if it is valid.
+ *
+ * A file that can't be loaded or fails validation is rejected as a whole;
+ * the running configuration stays in place.
+ *
+ * @param previous Receives the snapshot that was replaced. It stays valid until config_cleanup().
+ * @return int CONFIG_OK if the new configuration was published, CONFIG_ERROR or CONFIG_INVALID otherwise.
+ */
+int config_reload(const AudioConfig **previous);
+
+/**
+ * @brief A setting changed at runtime, to be written back to the configuration file.
+ */
+typedef struct {
+    const char *section;    // "AI_attributes" or "AO_attributes"
+    const char *object;     // Nested object such as "AGC_attributes", or NULL
+    const char *key;
+    int is_bool;
+    int value;
+} ConfigUpdate;
+
+/**
+ * @brief Write settings back to the configuration file.
+ *
+ * The file is replaced atomically (temporary file, fsync, rename) and only if
+ * one of the settings differs from it. The running snapshot is not changed.
+ *
+ * @param updates Settings to store.
+ * @param count Number of settings.
+ * @return int 0 on success, -1 on failure.
+ */
+int config_save(const ConfigUpdate *updates, int count);
+
 /**
  * @brief Cleanup and free resources associated with the configuration system.
  */
@@ -25,18 +183,14 @@ void config_cleanup(void);
 // -----------------------------
 
 /**
- * @brief Retrieve the 'audio' configuration object.
+ * @brief Retrieve the current configuration snapshot.
  *
- * @return cJSON* Pointer to the 'audio' cJSON object, or NULL if not found.
- */
-cJSON *get_audio_config(void);
-
-/**
- * @brief Retrieve the 'network' configuration object.
+ * Takes no lock and never fails: before a file is loaded it returns the
+ * built-in defaults. The snapshot stays valid until config_cleanup().
  *
- * @return cJSON* Pointer to the 'network' cJSON object, or NULL if not found.
+ * @return const AudioConfig* The current snapshot.
  */
-cJSON *get_network_config(void);
+const AudioConfig *config_get(void);
 
 /**
  * @brief Check if AI (Audio Input) is enabled in the configuration.
@@ -52,58 +206,47 @@ int config_get_ai_enabled(void);
  */
 int config_get_ao_enabled(void);
 
-// -----------------------------
-// Socket Path Retrieval Functions
-// -----------------------------
-
 /**
- * @brief Retrieve the AI (Audio Input) socket path from the configuration.
+ * @brief Retrieve the AO (Audio Output) frame size from the configuration.
  *
- * @return char* The AI socket path. Caller is responsible for freeing the returned string using free().
+ * @return int The AO frame size, or DEFAULT_AO_MAX_FRAME_SIZE if not found in the configuration.
  */
-char* config_get_ai_socket(void);
+int config_get_ao_frame_size(void);
 
 /**
- * @brief Retrieve the AO (Audio Output) socket path from the configuration.
+ * @brief Retrieve the AO (Audio Output) fade in/out ramp length from the configuration.
  *
- * @return char* The AO socket path. Caller is responsible for freeing the returned string using free().
+ * @return int The ramp length in milliseconds, or DEFAULT_AO_FADE_MS if not found in the configuration.
  */
-char* config_get_ao_socket(void);
+int config_get_ao_fade_ms(void);
 
 /**
- * @brief Retrieve the control socket path from the configuration.
+ * @brief Retrieve the depth of the internal AO (Audio Output) frame queue from the configuration.
  *
- * @return char* The control socket path. Caller is responsible for freeing the returned string using free().
+ * @return int The number of frame slots, or DEFAULT_AO_QUEUE_DEPTH if not found in the configuration.
  */
-char* config_get_ctrl_socket(void);
-
-// -----------------------------
-// Audio Attribute Retrieval Functions
-// -----------------------------
+int config_get_ao_queue_depth(void);
 
 /**
- * @brief Enum to differentiate between audio input and output.
+ * @brief Retrieve the credit window for flow-controlled AO (Audio Output) clients from the configuration.
+ *
+ * @return int The number of frames a client may have in flight, or DEFAULT_AO_CREDIT_FRAMES if not found in the configuration.
  */
-typedef enum {
-    AUDIO_INPUT,
-    AUDIO_OUTPUT
-} AudioType;
+int config_get_ao_credit_frames(void);
 
 /**
- * @brief Retrieve a specific attribute from the audio configuration.
+ * @brief Retrieve how long an AO (Audio Output) client may wait for admission from the configuration.
  *
- * @param type The type of audio (input or output).
- * @param attribute_name The name of the attribute to retrieve.
- * @return cJSON* Pointer to the attribute's cJSON object, or NULL if not found.
+ * @return int The timeout in milliseconds (0 for no limit), or DEFAULT_AO_ADMISSION_TIMEOUT_MS if not found in the configuration.
  */
-cJSON* get_audio_attribute(AudioType type, const char* attribute_name);
+int config_get_ao_admission_timeout_ms(void);
 
 /**
- * @brief Retrieve the AO (Audio Output) frame size from the configuration.
+ * @brief Retrieve the peak amplitude of the comfort noise inserted on AO (Audio Output) underruns from the configuration.
  *
- * @return int The AO frame size, or DEFAULT_AO_MAX_FRAME_SIZE if not found in the configuration.
+ * @return int The amplitude (0 for silence), or DEFAULT_AO_COMFORT_NOISE_LEVEL if not found in the configuration.
  */
-int config_get_ao_frame_size(void);
+int config_get_ao_comfort_noise_level(void);
 
 /**
  * Checks if the provided samplerate is valid.
@@ -112,12 +255,4 @@ int config_get_ao_frame_size(void);
  */
 int is_valid_samplerate(int samplerate);
 
-/**
- * @brief Validates the loaded configuration JSON for correct structure and keys.
- *
- * @param root The root cJSON object of the loaded configuration.
- * @return int 1 if the configuration is valid, 0 otherwise.
- */
-int validate_json(cJSON *root);
-
 #endif // CONFIG_H
@@ -0,0 +1,149 @@
+#define _GNU_SOURCE         // for pthread_getattr_np
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "footprint.h"
+#include "logging.h"
+
+#define TAG "FOOTPRINT"
+
+// Pages checked per mincore() call
+#define FOOTPRINT_MINCORE_PAGES 64
+
+typedef struct {
+    const char *name;
+    uintptr_t low;      // Lowest address of the stack
+    uintptr_t high;     // One past the highest address; stacks grow down from here
+} FootprintThread;
+
+static pthread_mutex_t footprint_lock = PTHREAD_MUTEX_INITIALIZER;
+static FootprintThread footprint_threads[FOOTPRINT_MAX_THREADS];
+static int footprint_thread_count = 0;
+
+void footprint_register_thread(const char *name) {
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+
+    if (pthread_getattr_np(pthread_self(), &attr)) {
+        handle_audio_error(TAG, "Failed to read the thread's stack");
+        return;
+    }
+    int ret = pthread_attr_getstack(&attr, &addr, &size);
+    pthread_attr_destroy(&attr);
+    if (ret) {
+        return;
+    }
+
+    pthread_mutex_lock(&footprint_lock);
+    if (footprint_thread_count < FOOTPRINT_MAX_THREADS) {
+        FootprintThread *thread = &footprint_threads[footprint_thread_count++];
+        thread->name = name;
+        thread->low = (uintptr_t)addr;
+        thread->high = (uintptr_t)addr + size;
+    }
+    pthread_mutex_unlock(&footprint_lock);
+}
+
+/**
+ * Counts the resident pages of a stack, walking down from its top. The main
+ * thread's stack is only mapped as far as it has grown, so the walk ends at
+ * the first page that isn't mapped.
+ */
+static size_t footprint_resident_pages(uintptr_t low, uintptr_t high) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t bottom = (low + page - 1) & ~(page - 1);
+    uintptr_t end = high & ~(page - 1);
+    unsigned char vec[FOOTPRINT_MINCORE_PAGES];
+    size_t resident = 0;
+
+    while (end > bottom) {
+        size_t pages = (end - bottom) / page;
+        if (pages > FOOTPRINT_MINCORE_PAGES) {
+            pages = FOOTPRINT_MINCORE_PAGES;
+        }
+        uintptr_t start = end - pages * page;
+
+        if (mincore((void *)start, pages * page, vec) == 0) {
+            for (size_t i = 0; i < pages; i++) {
+                resident += vec[i] & 1;
+            }
+            end = start;
+            continue;
+        }
+
+        // Part of the range isn't mapped; count page by page down to the gap
+        while (end > start && mincore((void *)(end - page), page, vec) == 0) {
+            resident += vec[0] & 1;
+            end -= page;
+        }
+        break;
+    }
+    return resident;
+}
+
+int footprint_stack(int index, const char **name, size_t *used_kb, size_t *size_kb) {
+    pthread_mutex_lock(&footprint_lock);
+    if (index < 0 || index >= footprint_thread_count) {
+        pthread_mutex_unlock(&footprint_lock);
+        return -1;
+    }
+    FootprintThread thread = footprint_threads[index];
+    pthread_mutex_unlock(&footprint_lock);
+
+    *name = thread.name;
+    *used_kb = footprint_resident_pages(thread.low, thread.high) * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+    *size_kb = (thread.high - thread.low) / 1024;
+    return 0;
+}
+
+// Returns the number following "<key>:" in a /proc status file, or -1.
+static long footprint_status_value(const char *status, const char *key) {
+    const char *line = strstr(status, key);
+    if (!line) {
+        return -1;
+    }
+    return strtol(line + strlen(key), NULL, 10);
+}
+
+int footprint_process(FootprintProcess *process) {
+    // Read with a stack buffer rather than stdio, which would allocate
+    char status[4096];
+    int fd = open("/proc/self/status", O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t len = read(fd, status, sizeof(status) - 1);
+    close(fd);
+    if (len <= 0) {
+        return -1;
+    }
+    status[len] = '\0';
+
+    process->rss_kb = footprint_status_value(status, "VmRSS:");
+    process->rss_peak_kb = footprint_status_value(status, "VmHWM:");
+    process->threads = (int)footprint_status_value(status, "Threads:");
+    return 0;
+}
+
+int footprint_report(char *buf, size_t size) {
+    FootprintProcess process;
+    if (footprint_process(&process)) {
+        return snprintf(buf, size, "RESPONSE_ERROR");
+    }
+
+    size_t len = snprintf(buf, size, "rss_kb=%ld rss_peak_kb=%ld threads=%d",
+                          process.rss_kb, process.rss_peak_kb, process.threads);
+
+    const char *name;
+    size_t used_kb, size_kb;
+    for (int i = 0; len < size && footprint_stack(i, &name, &used_kb, &size_kb) == 0; i++) {
+        len += snprintf(buf + len, size - len, " %s=%zu/%zu", name, used_kb, size_kb);
+    }
+    return len < size ? (int)len : (int)size - 1;
+}
@@ -0,0 +1,49 @@
+#ifndef FOOTPRINT_H
+#define FOOTPRINT_H
+
+#include <stddef.h>
+
+// Threads whose stacks are tracked, see footprint_register_thread()
+#define FOOTPRINT_MAX_THREADS 8
+
+/**
+ * @brief Memory and thread usage of the daemon, from /proc/self/status.
+ */
+typedef struct {
+    long rss_kb;        // Resident set size
+    long rss_peak_kb;   // Highest resident set size since startup
+    int threads;
+} FootprintProcess;
+
+/**
+ * Records the calling thread's stack so its high-water mark can be reported.
+ * Called once at the start of every thread of the daemon, including main().
+ * @param name Short name of the thread, e.g. "ai".
+ */
+void footprint_register_thread(const char *name);
+
+/**
+ * Reads the daemon's resident set size and thread count.
+ * @return 0 on success, -1 if /proc/self/status can't be read.
+ */
+int footprint_process(FootprintProcess *process);
+
+/**
+ * Reports a registered thread's stack. The high-water mark is the number of
+ * stack pages the thread has touched, since pages stay resident once faulted in.
+ * @param index Registration order of the thread, starting at 0.
+ * @param name Receives the thread's name.
+ * @param used_kb Receives the resident part of the stack.
+ * @param size_kb Receives the size of the stack.
+ * @return 0 on success, -1 if no thread has that index.
+ */
+int footprint_stack(int index, const char **name, size_t *used_kb, size_t *size_kb);
+
+/**
+ * Formats the process figures and every stack's high-water mark as one line,
+ * e.g. "rss_kb=812 rss_peak_kb=840 threads=4 main=16/8192 ai=36/64".
+ * @return Length of the line, truncated to fit size.
+ */
+int footprint_report(char *buf, size_t size);
+
+#endif // FOOTPRINT_H
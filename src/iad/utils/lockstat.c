@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "lockstat.h"
+
+// Powers of two from 1 ns to 2^31 ns; the last bucket takes the rest
+#define LOCKSTAT_BUCKET_COUNT 32
+
+#ifdef CONFIG_LOCK_PROFILE
+
+typedef struct {
+    unsigned int acquisitions;
+    unsigned int contended;         // Acquisitions that found the lock taken
+    unsigned long long wait_sum_ns;
+    unsigned long long hold_sum_ns;
+    unsigned long long wait_max_ns;
+    unsigned long long hold_max_ns;
+    unsigned int wait_buckets[LOCKSTAT_BUCKET_COUNT];
+    unsigned int hold_buckets[LOCKSTAT_BUCKET_COUNT];
+} LockSiteStats;
+
+static const char *lockstat_site_names[LOCK_SITE_COUNT] = {
+    "ai_fanout",
+    "ai_recovery",
+    "ao_play",
+    "ao_switch",
+    "ao_state",
+    "output_read",
+    "output_session",
+    "input_clients",
+    "metrics",
+    "shutdown",
+};
+
+/*
+ * All figures are updated with audio_buffer_lock held, waits included since
+ * they are recorded once the lock is taken, so they need no atomics. The
+ * reports take the lock directly to copy them, without being counted.
+ */
+static LockSiteStats lockstat_sites[LOCK_SITE_COUNT];
+static LockSite lockstat_holder;
+static struct timespec lockstat_acquired;
+
+static unsigned long long lockstat_elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    long long ns = (long long)(end->tv_sec - start->tv_sec) * 1000000000LL + (end->tv_nsec - start->tv_nsec);
+    return ns > 0 ? (unsigned long long)ns : 0;
+}
+
+// Bucket i holds times below 2^i ns
+static void lockstat_record(unsigned int *buckets, unsigned long long *sum, unsigned long long *max,
+                            unsigned long long ns) {
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    buckets[bucket < LOCKSTAT_BUCKET_COUNT ? bucket : LOCKSTAT_BUCKET_COUNT - 1]++;
+    *sum += ns;
+    if (ns > *max) {
+        *max = ns;
+    }
+}
+
+// Charges the time since the lock was taken to the site holding it
+static void lockstat_hold_end(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    LockSiteStats *stats = &lockstat_sites[lockstat_holder];
+    lockstat_record(stats->hold_buckets, &stats->hold_sum_ns, &stats->hold_max_ns,
+                    lockstat_elapsed_ns(&lockstat_acquired, &now));
+}
+
+void lockstat_lock(LockSite site) {
+    struct timespec start, now;
+
+    // Only a contended acquisition pays for a second clock read
+    int contended = pthread_mutex_trylock(&audio_buffer_lock) != 0;
+    if (contended) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&audio_buffer_lock);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    LockSiteStats *stats = &lockstat_sites[site];
+    stats->acquisitions++;
+    stats->contended += contended;
+    lockstat_record(stats->wait_buckets, &stats->wait_sum_ns, &stats->wait_max_ns,
+                    contended ? lockstat_elapsed_ns(&start, &now) : 0);
+    lockstat_holder = site;
+    lockstat_acquired = now;
+}
+
+void lockstat_unlock(void) {
+    lockstat_hold_end();
+    pthread_mutex_unlock(&audio_buffer_lock);
+}
+
+int lockstat_cond_wait(pthread_cond_t *cond, const struct timespec *abstime) {
+    LockSite site = lockstat_holder;
+    lockstat_hold_end();
+
+    // Retaking the lock on wake-up isn't counted as an acquisition
+    int ret = abstime ? pthread_cond_timedwait(cond, &audio_buffer_lock, abstime)
+                      : pthread_cond_wait(cond, &audio_buffer_lock);
+    lockstat_holder = site;
+    clock_gettime(CLOCK_MONOTONIC, &lockstat_acquired);
+    return ret;
+}
+
+// Upper bound of the bucket holding the given percentile, in nanoseconds
+static unsigned long long lockstat_percentile_ns(const unsigned int *buckets, unsigned int count, int percent) {
+    unsigned long long target = ((unsigned long long)count * percent + 99) / 100;
+    unsigned long long seen = 0;
+    for (int i = 0; i < LOCKSTAT_BUCKET_COUNT; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return 1ULL << i;
+        }
+    }
+    return 1ULL << (LOCKSTAT_BUCKET_COUNT - 1);
+}
+
+// Copies one site's figures, optionally clearing them
+static void lockstat_copy(int site, LockSiteStats *copy, int reset) {
+    pthread_mutex_lock(&audio_buffer_lock);
+    *copy = lockstat_sites[site];
+    if (reset) {
+        memset(&lockstat_sites[site], 0, sizeof(lockstat_sites[site]));
+    }
+    pthread_mutex_unlock(&audio_buffer_lock);
+}
+
+int lockstat_report(char *buf, size_t size, int reset) {
+    size_t len = 0;
+    buf[0] = '\0';
+
+    for (int i = 0; i < LOCK_SITE_COUNT && len < size; i++) {
+        LockSiteStats stats;
+        lockstat_copy(i, &stats, reset);
+        if (stats.acquisitions == 0) {
+            continue;
+        }
+
+        len += snprintf(buf + len, size - len, "%s%s=%u,%u,%llu,%llu,%llu,%llu,%llu,%llu", len ? " " : "",
+                        lockstat_site_names[i], stats.acquisitions, stats.contended,
+                        stats.wait_sum_ns / stats.acquisitions,
+                        lockstat_percentile_ns(stats.wait_buckets, stats.acquisitions, 99), stats.wait_max_ns,
+                        stats.hold_sum_ns / stats.acquisitions,
+                        lockstat_percentile_ns(stats.hold_buckets, stats.acquisitions, 99), stats.hold_max_ns);
+    }
+    return len < size ? (int)len : (int)size - 1;
+}
+
+// Appends the non-empty buckets of a histogram
+static size_t lockstat_format_buckets(char *buf, size_t size, size_t len, const char *name,
+                                      const unsigned int *buckets) {
+    if (len >= size) {
+        return len;
+    }
+    len += snprintf(buf + len, size - len, "%s%s", len ? " " : "", name);
+    for (int i = 0; i < LOCKSTAT_BUCKET_COUNT && len < size; i++) {
+        if (buckets[i]) {
+            len += snprintf(buf + len, size - len, " %llu:%u", 1ULL << i, buckets[i]);
+        }
+    }
+    return len;
+}
+
+int lockstat_site_report(const char *site, char *buf, size_t size) {
+    for (int i = 0; i < LOCK_SITE_COUNT; i++) {
+        if (strcmp(site, lockstat_site_names[i]) == 0) {
+            LockSiteStats stats;
+            lockstat_copy(i, &stats, 0);
+
+            size_t len = lockstat_format_buckets(buf, size, 0, "wait", stats.wait_buckets);
+            len = lockstat_format_buckets(buf, size, len, "hold", stats.hold_buckets);
+            return len < size ? (int)len : (int)size - 1;
+        }
+    }
+    return -1;
+}
+
+#else
+
+int lockstat_report(char *buf, size_t size, int reset) {
+    return -1;
+}
+
+int lockstat_site_report(const char *site, char *buf, size_t size) {
+    return -1;
+}
+
+#endif // CONFIG_LOCK_PROFILE
@@ -0,0 +1,87 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+#include "utils.h"          // For audio_buffer_lock
+
+/*
+ * Contention profiling for audio_buffer_lock. Every place that takes the lock
+ * names its call site; with CONFIG_LOCK_PROFILE the acquisitions, the time
+ * spent waiting for the lock and the time it was held are counted per site,
+ * otherwise these are plain pthread calls.
+ */
+
+// Call sites of audio_buffer_lock, reported by LOCKSTAT in this order
+typedef enum {
+    LOCK_SITE_AI_FANOUT,        // Record thread sending a frame to the input clients
+    LOCK_SITE_AI_RECOVERY,      // Record thread handling capture faults and gaps
+    LOCK_SITE_AO_PLAY,          // Play thread taking frames from the queue
+    LOCK_SITE_AO_SWITCH,        // Network thread handing the AO channel to the next client
+    LOCK_SITE_AO_STATE,         // AO counters, drain state and re-initialization requests
+    LOCK_SITE_OUTPUT_READ,      // Network thread queueing client audio for the play thread
+    LOCK_SITE_OUTPUT_SESSION,   // Output client admission, credits and end of stream
+    LOCK_SITE_INPUT_CLIENTS,    // Input clients connecting, leaving or being handed over
+    LOCK_SITE_METRICS,          // METRICS reading queue depths and client totals
+    LOCK_SITE_SHUTDOWN,         // Waking the audio threads to stop
+    LOCK_SITE_COUNT
+} LockSite;
+
+#ifdef CONFIG_LOCK_PROFILE
+void lockstat_lock(LockSite site);
+void lockstat_unlock(void);
+int lockstat_cond_wait(pthread_cond_t *cond, const struct timespec *abstime);
+#endif
+
+// Takes audio_buffer_lock on behalf of a call site.
+static inline void audio_lock(LockSite site) {
+#ifdef CONFIG_LOCK_PROFILE
+    lockstat_lock(site);
+#else
+    pthread_mutex_lock(&audio_buffer_lock);
+#endif
+}
+
+// Releases audio_buffer_lock; the hold time goes to the site that took it.
+static inline void audio_unlock(void) {
+#ifdef CONFIG_LOCK_PROFILE
+    lockstat_unlock();
+#else
+    pthread_mutex_unlock(&audio_buffer_lock);
+#endif
+}
+
+/**
+ * Waits on a condition with audio_buffer_lock held, until the given realtime
+ * deadline if abstime isn't NULL. The time spent waiting doesn't count as
+ * holding the lock.
+ * @return The result of pthread_cond_wait() or pthread_cond_timedwait().
+ */
+static inline int audio_cond_wait(pthread_cond_t *cond, const struct timespec *abstime) {
+#ifdef CONFIG_LOCK_PROFILE
+    return lockstat_cond_wait(cond, abstime);
+#else
+    return abstime ? pthread_cond_timedwait(cond, &audio_buffer_lock, abstime)
+                   : pthread_cond_wait(cond, &audio_buffer_lock);
+#endif
+}
+
+/**
+ * Formats every site that took the lock as one line of
+ * "<site>=<acquisitions>,<contended>,<wait_avg>,<wait_p99>,<wait_max>,<hold_avg>,<hold_p99>,<hold_max>"
+ * fields, times in nanoseconds. Percentiles are power-of-two bucket bounds.
+ * @param reset Clears the figures once they are copied.
+ * @return Length of the line, or -1 if the daemon was built without CONFIG_LOCK_PROFILE.
+ */
+int lockstat_report(char *buf, size_t size, int reset);
+
+/**
+ * Formats one site's wait and hold histograms as
+ * "wait <bound_ns>:<count> ... hold <bound_ns>:<count> ...", listing only
+ * non-empty buckets. A bucket holds the times below its bound.
+ * @return Length of the line, or -1 if the site is unknown or profiling isn't built in.
+ */
+int lockstat_site_report(const char *site, char *buf, size_t size);
+
+#endif // LOCKSTAT_H
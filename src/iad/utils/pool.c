@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+// Slots are aligned for any of the structs kept in them
+#define POOL_ALIGN (sizeof(long long) > sizeof(void *) ? sizeof(long long) : sizeof(void *))
+
+static unsigned long heap_allocations = 0;
+
+int pool_init(Pool *pool, const char *name, size_t slot_size, int capacity) {
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    pool->slot_size = (slot_size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+    pool->capacity = capacity;
+
+    pool->slots = heap_alloc(pool->slot_size * capacity);
+    if (!pool->slots) {
+        return -1;
+    }
+
+    for (int i = capacity - 1; i >= 0; i--) {
+        void *slot = pool->slots + pool->slot_size * i;
+        *(void **)slot = pool->free_list;
+        pool->free_list = slot;
+    }
+    printf("[INFO] [POOL] %d %s of %zu bytes\n", capacity, name, pool->slot_size);
+    return 0;
+}
+
+void *pool_get(Pool *pool) {
+    void *slot = pool->free_list;
+    if (!slot) {
+        pool->exhausted++;
+        return NULL;
+    }
+
+    pool->free_list = *(void **)slot;
+    memset(slot, 0, pool->slot_size);
+    if (++pool->in_use > pool->peak) {
+        pool->peak = pool->in_use;
+    }
+    return slot;
+}
+
+void pool_put(Pool *pool, void *slot) {
+    if (!slot) {
+        return;
+    }
+    *(void **)slot = pool->free_list;
+    pool->free_list = slot;
+    pool->in_use--;
+}
+
+void pool_destroy(Pool *pool) {
+    heap_free(pool->slots);
+    pool->slots = NULL;
+    pool->free_list = NULL;
+    pool->capacity = 0;
+}
+
+void *heap_alloc(size_t size) {
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+void *heap_calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return calloc(count, size);
+}
+
+void *heap_realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return realloc(ptr, size);
+}
+
+void heap_free(void *ptr) {
+    free(ptr);
+}
+
+unsigned long heap_allocation_count() {
+    return __atomic_load_n(&heap_allocations, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,52 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/**
+ * @brief A fixed number of equally sized slots carved from one allocation.
+ *
+ * Pools are sized from the configuration at startup, so taking and returning
+ * slots while clients come and go never touches the heap. A pool is not
+ * thread-safe; callers that share one serialize access themselves.
+ */
+typedef struct {
+    const char *name;           // Used in log lines
+    unsigned char *slots;
+    size_t slot_size;
+    int capacity;
+    void *free_list;            // Free slots, linked through their first bytes
+    int in_use;
+    int peak;                   // Highest in_use since startup
+    unsigned int exhausted;     // Requests that found no free slot
+} Pool;
+
+/**
+ * Allocates a pool's slots.
+ * @param pool The pool to set up.
+ * @param name Name used in log lines, e.g. "input clients".
+ * @param slot_size Size of each slot in bytes.
+ * @param capacity Number of slots.
+ * @return 0 on success, -1 if memory ran out.
+ */
+int pool_init(Pool *pool, const char *name, size_t slot_size, int capacity);
+
+// Takes a zeroed slot. Returns NULL when all slots are in use.
+void *pool_get(Pool *pool);
+
+// Returns a slot taken with pool_get().
+void pool_put(Pool *pool, void *slot);
+
+// Releases a pool's slots. All of them must have been returned.
+void pool_destroy(Pool *pool);
+
+// Heap allocations of the daemon go through these, so they can be counted.
+void *heap_alloc(size_t size);
+void *heap_calloc(size_t count, size_t size);
+void *heap_realloc(void *ptr, size_t size);
+void heap_free(void *ptr);
+
+// Returns the number of heap allocations since startup, including reallocations.
+unsigned long heap_allocation_count(void);
+
+#endif // POOL_H
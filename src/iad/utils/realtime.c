@@ -0,0 +1,86 @@
+#define _GNU_SOURCE         // for cpu_set_t, sched_setaffinity
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "config.h"
+#include "logging.h"
+#include "realtime.h"
+
+#define TAG "RT"
+
+void realtime_lock_memory() {
+    const DaemonConfig *daemon = &config_get()->daemon;
+    if (!daemon->lock_memory) {
+        return;
+    }
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        handle_audio_error(TAG, "mlockall failed, memory stays pageable");
+        return;
+    }
+    printf("[INFO] [RT] Memory locked, thread stacks %d KiB\n", daemon->thread_stack_kb);
+}
+
+/**
+ * Touches the top of the calling thread's stack so later frames don't page fault.
+ * With memory locked the pages then stay resident.
+ */
+static void __attribute__((noinline)) realtime_prefault_stack(void) {
+    volatile unsigned char stack[REALTIME_STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 256) {
+        stack[i] = 0;
+    }
+}
+
+static void realtime_set_affinity(const char *tag, int mask) {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < 16 && cpu < cpus; cpu++) {
+        if (mask & (1 << cpu)) {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    if (CPU_COUNT(&set) == 0) {
+        printf("[INFO] [%s] cpu_affinity 0x%x names no CPU of this SoC, not pinning\n", tag, mask);
+        return;
+    }
+    // pid 0 is the calling thread
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        handle_audio_error(TAG, "sched_setaffinity");
+        return;
+    }
+    printf("[INFO] [%s] Thread pinned to CPU mask 0x%x\n", tag, mask);
+}
+
+void realtime_setup_thread(const char *tag, const ThreadConfig *config) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+
+    if (config->policy != SCHED_OTHER) {
+        int min = sched_get_priority_min(config->policy);
+        int max = sched_get_priority_max(config->policy);
+        param.sched_priority = config->priority < min ? min : config->priority > max ? max : config->priority;
+    }
+
+    int ret = pthread_setschedparam(pthread_self(), config->policy, &param);
+    if (ret) {
+        errno = ret;
+        handle_audio_error(TAG, "pthread_setschedparam");
+    } else {
+        printf("[INFO] [%s] Thread policy %s, priority %d\n", tag,
+               config->policy == SCHED_FIFO ? "SCHED_FIFO" : config->policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER",
+               param.sched_priority);
+    }
+
+    if (config->cpu_affinity) {
+        realtime_set_affinity(tag, config->cpu_affinity);
+    }
+
+    realtime_prefault_stack();
+}
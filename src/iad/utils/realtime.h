@@ -0,0 +1,38 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include "config.h"
+
+// Thread stack size used when memory is locked and no size is configured
+#define DEFAULT_LOCKED_THREAD_STACK_KB 256
+
+// Thread stack size without a 'thread_stack_kb' setting; 0 keeps the C library's default
+#ifdef CONFIG_TINY_BUILD
+#define DEFAULT_THREAD_STACK_KB 64
+#else
+#define DEFAULT_THREAD_STACK_KB 0
+#endif
+
+// Stack touched by an audio thread at startup so it never faults while streaming
+#define REALTIME_STACK_PREFAULT (32 * 1024)
+
+/**
+ * @brief Locks the daemon's current and future memory if 'lock_memory' is set.
+ *
+ * Call once after loading the configuration and before starting threads, so
+ * their stacks are created with the configured size and locked as they are mapped.
+ */
+void realtime_lock_memory(void);
+
+/**
+ * @brief Applies an audio thread's scheduling policy, priority and CPU affinity
+ * to the calling thread, then pre-faults its stack.
+ *
+ * Failures are logged and the thread keeps running with what could be applied.
+ *
+ * @param tag Log tag of the thread, e.g. "AI".
+ * @param config The thread's configured scheduling.
+ */
+void realtime_setup_thread(const char *tag, const ThreadConfig *config);
+
+#endif // REALTIME_H
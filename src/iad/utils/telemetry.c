@@ -0,0 +1,102 @@
+#include <string.h>
+#include "telemetry.h"
+
+/**
+ * A histogram guarded by a sequence counter. Writers make it odd while they
+ * update the buckets, readers retry until they see the same even value before
+ * and after copying, so 64-bit totals are never torn on 32-bit targets.
+ */
+typedef struct {
+    unsigned int seq;
+    TelemetryHistogramSnapshot data;
+} Histogram;
+
+static unsigned int counters[TELEMETRY_COUNTER_COUNT];
+static int peaks[TELEMETRY_LEVEL_COUNT];
+static Histogram histograms[TELEMETRY_HISTOGRAM_COUNT];
+static const long bucket_bounds_us[TELEMETRY_BUCKET_COUNT - 1] = TELEMETRY_BUCKET_BOUNDS_US;
+
+void telemetry_count(TelemetryCounter counter) {
+    __atomic_fetch_add(&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+void telemetry_add(TelemetryCounter counter, unsigned int count) {
+    __atomic_fetch_add(&counters[counter], count, __ATOMIC_RELAXED);
+}
+
+void telemetry_level(TelemetryLevel level, const int16_t *samples, int count) {
+    int peak = 0;
+    for (int i = 0; i < count; i++) {
+        int magnitude = samples[i] < 0 ? -samples[i] : samples[i];
+        if (magnitude > peak) {
+            peak = magnitude;
+        }
+    }
+
+    // Only the reader resets the meter, so a failed exchange means a higher peak or a reset
+    int current = __atomic_load_n(&peaks[level], __ATOMIC_RELAXED);
+    while (peak > current &&
+           !__atomic_compare_exchange_n(&peaks[level], &current, peak, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+unsigned int telemetry_counter(TelemetryCounter counter) {
+    return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+int telemetry_take_peak(TelemetryLevel level) {
+    return __atomic_exchange_n(&peaks[level], 0, __ATOMIC_RELAXED);
+}
+
+void telemetry_observe_us(TelemetryHistogram histogram, long us) {
+    Histogram *h = &histograms[histogram];
+
+    int bucket = 0;
+    while (bucket < TELEMETRY_BUCKET_COUNT - 1 && us > bucket_bounds_us[bucket]) {
+        bucket++;
+    }
+
+    unsigned int seq = __atomic_load_n(&h->seq, __ATOMIC_RELAXED);
+    while ((seq & 1) || !__atomic_compare_exchange_n(&h->seq, &seq, seq + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        seq = __atomic_load_n(&h->seq, __ATOMIC_RELAXED);
+    }
+    h->data.buckets[bucket]++;
+    h->data.count++;
+    h->data.sum_us += us > 0 ? us : 0;
+    __atomic_store_n(&h->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void telemetry_histogram(TelemetryHistogram histogram, TelemetryHistogramSnapshot *snapshot) {
+    Histogram *h = &histograms[histogram];
+    unsigned int before, after;
+
+    do {
+        before = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        memcpy(snapshot, &h->data, sizeof(*snapshot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&h->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+long telemetry_percentile_us(const TelemetryHistogramSnapshot *snapshot, int percent) {
+    if (snapshot->count == 0) {
+        return 0;
+    }
+
+    // Rank of the observation, rounded up so p100 is the largest one
+    unsigned long long rank = (snapshot->count * percent + 99) / 100;
+    unsigned long long cumulative = 0;
+    for (int i = 0; i < TELEMETRY_BUCKET_COUNT - 1; i++) {
+        cumulative += snapshot->buckets[i];
+        if (cumulative >= rank) {
+            return bucket_bounds_us[i];
+        }
+    }
+    return -1;
+}
+
+long telemetry_elapsed_us(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
@@ -0,0 +1,93 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Events counted for control socket subscribers
+typedef enum {
+    TELEMETRY_STREAM_START,     // An output client was admitted
+    TELEMETRY_STREAM_STOP,      // An output client finished playing
+    TELEMETRY_UNDERRUN,         // The AO channel ran out of client data
+    TELEMETRY_DEVICE_ERROR,     // An IMP call failed on the audio path
+    TELEMETRY_AI_FRAMES,        // Frames read from the AI channel
+    TELEMETRY_AO_FRAMES,        // Client frames sent to the AO channel
+    TELEMETRY_AO_FRAMES_DROPPED,// Queued client frames discarded by a stream switch
+    TELEMETRY_AI_CONNECTS,      // Input clients accepted
+    TELEMETRY_AO_CONNECTS,      // Output clients accepted
+    TELEMETRY_AI_POLL_FAULTS,   // IMP_AI_PollingFrame failed or timed out
+    TELEMETRY_AI_GET_FAULTS,    // IMP_AI_GetFrame failed
+    TELEMETRY_AI_REINITS,       // AI channel re-initialized to recover from faults
+    TELEMETRY_AI_RECOVERIES,    // Capture resumed after faults
+    TELEMETRY_AI_GAP_FRAMES,    // Silence frames sent to input clients for a capture gap
+    TELEMETRY_COUNTER_COUNT
+} TelemetryCounter;
+
+// Peak level meters
+typedef enum {
+    TELEMETRY_LEVEL_AI,
+    TELEMETRY_LEVEL_AO,
+    TELEMETRY_LEVEL_COUNT
+} TelemetryLevel;
+
+// Latency histograms, each in microseconds
+typedef enum {
+    TELEMETRY_AO_LOCK_WAIT,     // Play thread waiting for audio_buffer_lock
+    TELEMETRY_AI_LOCK_WAIT,     // Record thread waiting for audio_buffer_lock
+    TELEMETRY_AO_FRAME_TIME,    // Play thread preparing a frame before sending it
+    TELEMETRY_AI_FRAME_TIME,    // Record thread delivering a frame to the clients
+    TELEMETRY_AI_RECOVERY_TIME, // From the first capture fault to the next captured frame
+
+    // Stages of the audio paths, see LATENCY on the control socket
+    TELEMETRY_AO_QUEUE_WAIT,    // From reading client audio to the play thread taking it from the queue
+    TELEMETRY_AO_SEND_TIME,     // Inside IMP_AO_SendFrame
+    TELEMETRY_AO_PATH_TIME,     // From reading client audio to IMP_AO_SendFrame returning
+    TELEMETRY_AI_GET_TIME,      // Inside IMP_AI_GetFrame
+    TELEMETRY_AI_WRITE_DELAY,   // From IMP_AI_GetFrame returning to a client's send() returning
+    TELEMETRY_HISTOGRAM_COUNT
+} TelemetryHistogram;
+
+// Upper bounds of the histogram buckets in microseconds; a final bucket takes the rest
+#define TELEMETRY_BUCKET_BOUNDS_US {10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000, 250000, 500000}
+#define TELEMETRY_BUCKET_COUNT 12
+
+/**
+ * @brief A consistent copy of a histogram.
+ */
+typedef struct {
+    unsigned long long buckets[TELEMETRY_BUCKET_COUNT];  // Per bucket, not cumulative
+    unsigned long long count;
+    unsigned long long sum_us;
+} TelemetryHistogramSnapshot;
+
+// Publishing is lock-free and never blocks, so the audio threads can call these per frame.
+
+// Counts one occurrence of an event.
+void telemetry_count(TelemetryCounter counter);
+
+// Counts several occurrences of an event.
+void telemetry_add(TelemetryCounter counter, unsigned int count);
+
+// Raises the peak meter to the loudest of the given 16-bit samples.
+void telemetry_level(TelemetryLevel level, const int16_t *samples, int count);
+
+// Records one observation. Never blocks for long; writers of the same histogram only spin against each other.
+void telemetry_observe_us(TelemetryHistogram histogram, long us);
+
+// Returns the number of occurrences of an event since startup. Wraps around.
+unsigned int telemetry_counter(TelemetryCounter counter);
+
+// Returns the peak (0 - 32768) since the previous call and resets the meter.
+int telemetry_take_peak(TelemetryLevel level);
+
+// Copies a histogram without blocking its writers.
+void telemetry_histogram(TelemetryHistogram histogram, TelemetryHistogramSnapshot *snapshot);
+
+// Returns the upper bound in microseconds of the bucket holding the given percentile
+// of a histogram's observations, 0 if there are none, or -1 if it lies beyond the last bound.
+long telemetry_percentile_us(const TelemetryHistogramSnapshot *snapshot, int percent);
+
+// Returns the microseconds elapsed since start on the monotonic clock.
+long telemetry_elapsed_us(const struct timespec *start);
+
+#endif // TELEMETRY_H
@@ -0,0 +1,153 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "logging.h"
+#include "trace.h"
+
+#define TAG "TRACE"
+
+// Slots copied per write by trace_dump, a divisor of TRACE_RING_EVENTS
+#define TRACE_DUMP_CHUNK 64
+
+static TraceRecord trace_ring[TRACE_RING_EVENTS];
+static uint32_t trace_next_seq = 0;
+static int trace_event_fd = -1;
+
+// Signals that end the daemon with a dump of the ring
+static const int trace_crash_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+
+void trace_event(TraceEventType type, unsigned int id, unsigned int value) {
+    uint32_t seq = __atomic_fetch_add(&trace_next_seq, 1, __ATOMIC_RELAXED);
+    TraceRecord *record = &trace_ring[seq % TRACE_RING_EVENTS];
+    struct timespec now;
+
+    // Mark the slot as being written before touching its fields; seq + 1
+    // doesn't belong to this slot, so the dump drops it until seq is stored
+    __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record->sec = (uint32_t)now.tv_sec;
+    record->nsec = (uint32_t)now.tv_nsec;
+    record->type = (uint16_t)type;
+    record->id = (uint16_t)id;
+    record->value = value;
+    __atomic_store_n(&record->seq, seq, __ATOMIC_RELEASE);
+}
+
+// Writes the whole buffer, retrying short writes. Async-signal-safe.
+static int trace_write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written <= 0) {
+            return -1;
+        }
+        p += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/**
+ * Copies the ring slots from first to first + count - 1, seqlock-style: a slot
+ * whose seq changed while it was copied, or that is being written, is cleared
+ * so the decoder skips it. Async-signal-safe.
+ */
+static void trace_copy_slots(TraceRecord *out, size_t first, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const TraceRecord *record = &trace_ring[first + i];
+        uint32_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+        out[i] = *record;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) != seq || seq % TRACE_RING_EVENTS != first + i) {
+            memset(&out[i], 0, sizeof(out[i]));
+        }
+    }
+}
+
+int trace_dump(TraceDumpReason reason, int sig) {
+    trace_event(TRACE_DUMP, sig, reason);
+
+    TraceFileHeader header;
+    struct timespec mono, real;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    header.capacity = TRACE_RING_EVENTS;
+    header.next_seq = __atomic_load_n(&trace_next_seq, __ATOMIC_ACQUIRE);
+    header.reason = reason;
+    header.pid = (uint32_t)getpid();
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    header.mono_sec = (uint32_t)mono.tv_sec;
+    header.mono_nsec = (uint32_t)mono.tv_nsec;
+    header.real_sec = (uint32_t)real.tv_sec;
+    header.real_nsec = (uint32_t)real.tv_nsec;
+
+    int fd = open(TRACE_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    int ret = trace_write_all(fd, &header, sizeof(header));
+    // Copied in chunks on the stack; the crash handler can't allocate
+    TraceRecord chunk[TRACE_DUMP_CHUNK];
+    for (size_t first = 0; ret == 0 && first < TRACE_RING_EVENTS; first += TRACE_DUMP_CHUNK) {
+        trace_copy_slots(chunk, first, TRACE_DUMP_CHUNK);
+        ret = trace_write_all(fd, chunk, sizeof(chunk));
+    }
+    close(fd);
+    return ret;
+}
+
+// Only async-signal-safe calls here; the network thread writes the dump
+static void handle_sigusr1(int sig) {
+    uint64_t one = 1;
+    ssize_t written = write(trace_event_fd, &one, sizeof(one));
+    (void)written;
+}
+
+/**
+ * Dumps the ring and lets the signal take its default action, so the daemon
+ * still dies and leaves a core file where enabled.
+ */
+static void handle_crash(int sig) {
+    trace_dump(TRACE_DUMP_CRASH, sig);
+    raise(sig);
+}
+
+int trace_init(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+
+    // SA_RESETHAND restores the default action before the handler runs
+    sa.sa_handler = handle_crash;
+    sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+    for (size_t i = 0; i < sizeof(trace_crash_signals) / sizeof(trace_crash_signals[0]); i++) {
+        sigaction(trace_crash_signals[i], &sa, NULL);
+    }
+
+    trace_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (trace_event_fd < 0) {
+        handle_audio_error(TAG, "eventfd");
+        return -1;
+    }
+
+    sa.sa_handler = handle_sigusr1;
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
+        handle_audio_error(TAG, "sigaction");
+        return -1;
+    }
+    return 0;
+}
+
+int trace_signal_fd(void) {
+    return trace_event_fd;
+}
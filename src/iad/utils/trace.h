@@ -0,0 +1,114 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary event trace. The audio and network threads record events into a
+ * fixed ring without locking; the ring is written to TRACE_FILE on the TRACE
+ * control command, on SIGUSR1 and when the daemon crashes. iad_trace decodes
+ * the file. The records and the file header below are the file format.
+ */
+
+#ifndef TRACE_FILE
+#define TRACE_FILE "/tmp/iad.trace"
+#endif
+
+// Events kept in the ring, a power of two
+#ifdef CONFIG_TINY_BUILD
+#define TRACE_RING_EVENTS 1024
+#else
+#define TRACE_RING_EVENTS 4096
+#endif
+
+#define TRACE_MAGIC "IADT"
+#define TRACE_VERSION 1
+
+// Event types and the meaning of their id and value fields
+typedef enum {
+    TRACE_AI_FRAME = 1,         // Frame captured; id: bytes, value: driver sequence number
+    TRACE_AO_FRAME,             // Frame sent to the AO channel; id: bytes, value: us in IMP_AO_SendFrame
+    TRACE_AO_UNDERRUN,          // Playback ran out of client data; value: underruns so far
+    TRACE_CLIENT_CONNECT,       // id: client number, output ticket or socket; value: TraceClientKind
+    TRACE_CLIENT_DISCONNECT,    // Same fields as TRACE_CLIENT_CONNECT
+    TRACE_QUEUE_FULL,           // A client's frame was dropped, or the AO queue was full; id and value as above
+    TRACE_ERROR,                // id: TraceErrorSource, value: errno
+    TRACE_DUMP,                 // The ring was written out; id: signal number, value: TraceDumpReason
+    TRACE_EVENT_COUNT
+} TraceEventType;
+
+typedef enum {
+    TRACE_CLIENT_INPUT,
+    TRACE_CLIENT_OUTPUT,
+    TRACE_CLIENT_CONTROL
+} TraceClientKind;
+
+typedef enum {
+    TRACE_ERROR_AI_POLL,        // IMP_AI_PollingFrame failed or timed out
+    TRACE_ERROR_AI_GET,         // IMP_AI_GetFrame failed
+    TRACE_ERROR_AI_REINIT,      // Re-initializing the AI channel failed
+    TRACE_ERROR_AO_DEVICE,      // An AO call failed and the channel is re-initialized
+    TRACE_ERROR_CLIENT_WRITE    // Sending audio to an input client failed
+} TraceErrorSource;
+
+typedef enum {
+    TRACE_DUMP_COMMAND,
+    TRACE_DUMP_SIGNAL,
+    TRACE_DUMP_CRASH
+} TraceDumpReason;
+
+/**
+ * @brief One event. Written by the thread that claimed its sequence number;
+ * seq is stored last, so a record whose seq doesn't belong to its slot's
+ * current lap is stale. The dump clears slots that were being written.
+ */
+typedef struct {
+    uint32_t seq;               // Position in the event stream; the slot is seq % capacity
+    uint32_t sec;               // CLOCK_MONOTONIC time of the event
+    uint32_t nsec;
+    uint16_t type;              // TraceEventType, 0 for a slot never written
+    uint16_t id;
+    uint32_t value;
+} TraceRecord;
+
+/**
+ * @brief Start of a trace file, followed by capacity records in slot order.
+ * Fields are in the byte order of the device that wrote the file.
+ */
+typedef struct {
+    char magic[4];              // TRACE_MAGIC
+    uint16_t version;           // TRACE_VERSION
+    uint16_t record_size;       // sizeof(TraceRecord)
+    uint32_t capacity;          // Slots in the ring
+    uint32_t next_seq;          // Sequence number of the next event
+    uint32_t reason;            // TraceDumpReason
+    uint32_t pid;
+    uint32_t mono_sec;          // Both clocks at the time of the dump, to place events in wall-clock time
+    uint32_t mono_nsec;
+    uint32_t real_sec;
+    uint32_t real_nsec;
+} TraceFileHeader;
+
+/**
+ * Installs the SIGUSR1 and crash handlers.
+ * @return 0 on success, -1 if the SIGUSR1 eventfd can't be created.
+ */
+int trace_init(void);
+
+// Returns an eventfd that becomes readable when SIGUSR1 was received.
+int trace_signal_fd(void);
+
+/**
+ * Records an event. Lock-free and async-signal-safe, so any thread may call
+ * it on the audio paths.
+ */
+void trace_event(TraceEventType type, unsigned int id, unsigned int value);
+
+/**
+ * Writes the ring to TRACE_FILE. Async-signal-safe, for the crash handler.
+ * @param sig Signal that caused the dump, 0 for none.
+ * @return 0 on success, -1 if the file can't be written.
+ */
+int trace_dump(TraceDumpReason reason, int sig);
+
+#endif // TRACE_H
@@ -4,39 +4,80 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "utils.h"
 #include "config.h"
+#include "footprint.h"
+#include "lockstat.h"
 #include "output.h"
 #include "input.h"
 
+#ifndef PID_FILE
 #define PID_FILE "/var/run/iad.pid"
+#endif
 
 ClientNode *client_list_head = NULL;
 pthread_mutex_t audio_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t audio_data_cond = PTHREAD_COND_INITIALIZER;
-unsigned char *audio_buffer = NULL;
-ssize_t audio_buffer_size = 0;
-int active_client_sock = -1;
 
 volatile int g_stop_thread = 0;
 pthread_mutex_t g_stop_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Becomes readable once a termination signal was received
+static int stop_event_fd = -1;
+
+// Start routines of the daemon's threads, kept until the threads are gone
+typedef struct {
+    const char *name;
+    void *(*start_routine)(void *);
+    void *arg;
+} ThreadStart;
+
+static ThreadStart thread_starts[FOOTPRINT_MAX_THREADS];
+static int thread_start_count = 0;
+
+// Registers the new thread's stack for FOOTPRINT before running its start routine
+static void *thread_main(void *arg) {
+    ThreadStart *start = (ThreadStart *)arg;
+    footprint_register_thread(start->name);
+    return start->start_routine(start->arg);
+}
+
 /**
  * @brief Create a new thread.
  *
- * This function creates a new thread and starts it.
+ * This function creates a new thread and starts it, with the stack size
+ * configured by 'thread_stack_kb' if one is set.
  *
  * @param thread_id Pointer to the thread identifier.
+ * @param name Short name of the thread, reported by FOOTPRINT.
  * @param start_routine Pointer to the function to be executed by the thread.
  * @param arg Arguments to be passed to the start_routine.
  * @return int Returns 0 on success, error code on failure.
  */
-int create_thread(pthread_t *thread_id, void *(*start_routine)(void *), void *arg) {
-    int ret = pthread_create(thread_id, NULL, start_routine, arg);
+int create_thread(pthread_t *thread_id, const char *name, void *(*start_routine)(void *), void *arg) {
+    if (thread_start_count >= FOOTPRINT_MAX_THREADS) {
+        fprintf(stderr, "[ERROR] Too many threads, can't start %s\n", name);
+        return EAGAIN;
+    }
+    ThreadStart *start = &thread_starts[thread_start_count++];
+    *start = (ThreadStart){name, start_routine, arg};
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    int stack_kb = config_get()->daemon.thread_stack_kb;
+    if (stack_kb > 0 && pthread_attr_setstacksize(&attr, (size_t)stack_kb * 1024)) {
+        fprintf(stderr, "[WARNING] Invalid thread stack size %d KiB, using the default\n", stack_kb);
+    }
+
+    int ret = pthread_create(thread_id, &attr, thread_main, start);
+    pthread_attr_destroy(&attr);
     if (ret) {
         fprintf(stderr, "[ERROR] pthread_create for thread failed with error code: %d\n", ret);
     }
@@ -91,21 +132,28 @@ IMPAudioSoundMode string_to_soundmode(const char* str) {
  * @brief Clean up resources.
  *
  * This function cleans up allocated resources and restores the system to its initial state.
+ * It must only be called once the audio threads have stopped.
  */
 void perform_cleanup() {
-    pthread_mutex_destroy(&audio_buffer_lock);
-    pthread_cond_destroy(&audio_data_cond);
+    disable_audio_input();
+    disable_audio_output();
 
+    config_cleanup();
+}
+
+/**
+ * @brief Stop the audio threads.
+ *
+ * Sets the stop flag and wakes threads waiting for audio data so they can observe it.
+ */
+void stop_audio_threads() {
     pthread_mutex_lock(&g_stop_thread_mutex);
     g_stop_thread = 1;
     pthread_mutex_unlock(&g_stop_thread_mutex);
 
-    pthread_cond_signal(&audio_data_cond);
-
-    disable_audio_input();
-    disable_audio_output();
-
-    config_cleanup();
+    audio_lock(LOCK_SITE_SHUTDOWN);
+    pthread_cond_broadcast(&audio_data_cond);
+    audio_unlock();
 }
 
 /**
@@ -118,20 +166,19 @@ void remove_pid_file() {
 }
 
 /**
- * @brief Signal handler for SIGINT.
+ * @brief Signal handler for SIGINT and SIGTERM.
  *
  * This function handles the SIGINT signal (typically sent from the
- * command line via CTRL+C). It ensures that the daemon exits gracefully.
+ * command line via CTRL+C) and SIGTERM. Only async-signal-safe calls are
+ * made here: the network thread wakes up on the stop eventfd and main()
+ * shuts the daemon down. A second signal terminates right away.
  *
- * @param sig Signal number (expected to be SIGINT).
+ * @param sig Signal number.
  */
 void handle_sigint(int sig) {
-    printf("Caught signal %d. Exiting gracefully...\n", sig);
-    perform_cleanup();
-    remove_pid_file();
-    signal(sig, SIG_DFL);
-    raise(sig);
-    exit(0);
+    uint64_t one = 1;
+    ssize_t written = write(stop_event_fd, &one, sizeof(one));
+    (void)written;
 }
 
 /**
@@ -140,15 +187,25 @@ void handle_sigint(int sig) {
  * This function sets up signal handlers for various signals the program might receive.
  */
 void setup_signal_handling() {
+    stop_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stop_event_fd < 0) {
+        perror("eventfd");
+    }
+
     struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
     sa.sa_handler = handle_sigint;
-    sa.sa_flags = 0;
+    sa.sa_flags = SA_RESETHAND;
     sigemptyset(&sa.sa_mask);
 
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
 }
 
+int stop_signal_fd() {
+    return stop_event_fd;
+}
+
 /**
  * @brief Daemonize the process.
  *
@@ -7,48 +7,48 @@
 
 // Audio headers for handling audio data and configurations
 #include "imp/imp_audio.h"  // For IMPAudioBitWidth, IMPAudioSoundMode
+#include "event_loop.h"     // For EventHandler
 
 // Constants for program tagging and frame duration
 #define PROG_TAG "AO_T31"
 #define FRAME_DURATION 0.040
 
 /**
- * @brief Represents a connected client with its socket descriptor.
+ * @brief Represents a connected input client with its socket descriptor.
  *
- * This struct is used to manage connected clients in a linked list.
+ * This struct is used to manage connected clients in a linked list. The
+ * network thread adds and removes clients; the record thread sends to them.
  */
 typedef struct ClientNode {
-    int sockfd;  // Socket descriptor for the client
+    EventHandler handler;  // Socket descriptor for the client, watched for hang-ups
+    unsigned int id;  // Connection number, used to label per-client metrics
+    unsigned long long bytes_sent;  // Audio bytes delivered to the client
+    unsigned int drops;  // Frames that could not be delivered in full
+    unsigned char *pending;  // Unsent rest of a frame that only partly fit in the socket
+    size_t pending_len;  // Bytes in pending
+    size_t pending_size;  // Allocated size of pending
     struct ClientNode *next;  // Pointer to the next client node
 } ClientNode;
 
 // Head of the linked list that contains all connected clients
 extern ClientNode *client_list_head;
 
-// Mutex lock for audio buffer synchronization
+// Mutex lock for the AO frame queue and client list synchronization
 extern pthread_mutex_t audio_buffer_lock;
 
 // Condition variable for signaling availability of audio data
 extern pthread_cond_t audio_data_cond;
 
-// Global buffer to store audio data
-extern unsigned char *audio_buffer;
-
-// Size of the current audio data in the buffer
-extern ssize_t audio_buffer_size;
-
-// Socket descriptor of the currently active client
-extern int active_client_sock;
-
 /**
  * @brief Creates a new thread.
  *
  * @param thread_id Pointer to the thread ID.
+ * @param name Short name of the thread, e.g. "ai".
  * @param start_routine Pointer to the function to run in the new thread.
  * @param arg Argument to pass to the start_routine.
  * @return 0 on success, error code on failure.
  */
-int create_thread(pthread_t *thread_id, void *(*start_routine) (void *), void *arg);
+int create_thread(pthread_t *thread_id, const char *name, void *(*start_routine) (void *), void *arg);
 
 /**
  * @brief Computes the number of samples per frame based on sample rate.
@@ -77,7 +77,10 @@ IMPAudioSoundMode string_to_soundmode(const char* str);
 // Cleans up all resources and prepares for program termination.
 void perform_cleanup(void);
 
-// Handles the SIGINT signal to allow the program to exit gracefully.
+// Asks the audio threads to exit and wakes them up.
+void stop_audio_threads(void);
+
+// Handles SIGINT and SIGTERM to allow the program to exit gracefully.
 void handle_sigint(int sig);
 
 // Transforms the program into a daemon process.
@@ -86,6 +89,9 @@ void daemonize(void);
 // Sets up signal handling for the program.
 void setup_signal_handling(void);
 
+// Returns an eventfd that becomes readable when a termination signal was received.
+int stop_signal_fd(void);
+
 /**
  * @brief Checks if another instance of the program is already running.
  *
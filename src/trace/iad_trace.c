@@ -0,0 +1,137 @@
+/*
+ * IAD TRACE DECODER
+ *
+ * Prints the events of a trace file written by iad (TRACE on the control
+ * socket, SIGUSR1 or a crash) in the order they happened, one per line:
+ * seconds before the dump, milliseconds since the previous event, the event
+ * and its fields.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+static const char *event_names[TRACE_EVENT_COUNT] = {
+    [TRACE_AI_FRAME] = "ai_frame",
+    [TRACE_AO_FRAME] = "ao_frame",
+    [TRACE_AO_UNDERRUN] = "ao_underrun",
+    [TRACE_CLIENT_CONNECT] = "connect",
+    [TRACE_CLIENT_DISCONNECT] = "disconnect",
+    [TRACE_QUEUE_FULL] = "queue_full",
+    [TRACE_ERROR] = "error",
+    [TRACE_DUMP] = "dump",
+};
+
+static const char *client_kinds[] = {"input", "output", "control"};
+static const char *error_sources[] = {"ai_poll", "ai_get", "ai_reinit", "ao_device", "client_write"};
+static const char *dump_reasons[] = {"command", "signal", "crash"};
+
+#define NAME(table, index) ((index) < sizeof(table) / sizeof(table[0]) ? table[index] : "unknown")
+
+static int compare_seq(const void *a, const void *b) {
+    // Sequence numbers wrap; within one ring they are less than half the range apart
+    int32_t diff = (int32_t)(((const TraceRecord *)a)->seq - ((const TraceRecord *)b)->seq);
+    return (diff > 0) - (diff < 0);
+}
+
+static void print_fields(const TraceRecord *record) {
+    switch (record->type) {
+        case TRACE_AI_FRAME:
+            printf("bytes=%u seq=%u", record->id, record->value);
+            break;
+        case TRACE_AO_FRAME:
+            printf("bytes=%u send_us=%u", record->id, record->value);
+            break;
+        case TRACE_AO_UNDERRUN:
+            printf("count=%u", record->value);
+            break;
+        case TRACE_CLIENT_CONNECT:
+        case TRACE_CLIENT_DISCONNECT:
+        case TRACE_QUEUE_FULL:
+            printf("%s=%u", NAME(client_kinds, record->value), record->id);
+            break;
+        case TRACE_ERROR:
+            // IMP calls fail without setting errno
+            printf("source=%s", NAME(error_sources, record->id));
+            if (record->value) {
+                printf(" errno=%u (%s)", record->value, strerror(record->value));
+            }
+            break;
+        case TRACE_DUMP:
+            printf("reason=%s signal=%u", NAME(dump_reasons, record->value), record->id);
+            break;
+        default:
+            printf("id=%u value=%u", record->id, record->value);
+            break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = TRACE_FILE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h")) != -1) {
+        printf("Usage: %s [trace_file]\nDefault file: %s\n", argv[0], TRACE_FILE);
+        return opt == 'h' ? 0 : 1;
+    }
+    if (optind < argc) {
+        path = argv[optind];
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not an iad trace\n", path);
+        return 1;
+    }
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord) || header.capacity == 0) {
+        fprintf(stderr, "%s has trace format %u with %u byte records; this decoder reads format %u with %zu\n",
+                path, header.version, header.record_size, TRACE_VERSION, sizeof(TraceRecord));
+        return 1;
+    }
+
+    TraceRecord *records = calloc(header.capacity, sizeof(TraceRecord));
+    size_t slots = fread(records, sizeof(TraceRecord), header.capacity, f);
+    fclose(f);
+
+    // Keep the records of the last lap; others were never written, stale or cleared by the dump
+    size_t count = 0;
+    for (size_t i = 0; i < slots; i++) {
+        uint32_t age = header.next_seq - records[i].seq;
+        if (records[i].type != 0 && age > 0 && age <= header.capacity && records[i].seq % header.capacity == i) {
+            records[count++] = records[i];
+        }
+    }
+    qsort(records, count, sizeof(TraceRecord), compare_seq);
+
+    time_t dumped = header.real_sec;
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&dumped));
+    printf("# %zu events, dumped by pid %u on %s at %s.%06u\n", count, header.pid,
+           NAME(dump_reasons, header.reason), date, header.real_nsec / 1000);
+    if (header.next_seq > header.capacity) {
+        printf("# %u earlier events were overwritten\n", header.next_seq - header.capacity);
+    }
+
+    double dump_time = header.mono_sec + header.mono_nsec / 1e9;
+    double previous = 0;
+    for (size_t i = 0; i < count; i++) {
+        double t = records[i].sec + records[i].nsec / 1e9;
+        printf("%12.6f %10.3f  %-11s ", t - dump_time, i ? (t - previous) * 1e3 : 0.0,
+               NAME(event_names, records[i].type) ? NAME(event_names, records[i].type) : "unknown");
+        print_fields(&records[i]);
+        printf("\n");
+        previous = t;
+    }
+
+    free(records);
+    return 0;
+}
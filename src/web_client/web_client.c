@@ -107,8 +107,9 @@ static int http_callback(struct lws *wsi, enum lws_callback_reasons reason, void
 
         case LWS_CALLBACK_HTTP_BODY_COMPLETION:
             lws_return_http_status(wsi, HTTP_STATUS_OK, NULL);
-            usleep(1000000); // Temporary solution: wait before closing socket to prevent audio cutoff
             if (daemon_sockfd != -1) {
+                // Wait for the daemon to play out the tail of the stream before closing
+                wait_for_drain(daemon_sockfd, AUDIO_DRAIN_TIMEOUT_MS);
                 close_client_connection(daemon_sockfd);
                 daemon_sockfd = -1;
             }
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <stdio.h>
@@ -69,3 +70,63 @@ void close_client_connection(int sockfd) {
     }
     was_connected_successfully = 0; // Reset the flag
 }
+
+// Lines received on the output socket but not handled yet
+static char reply[64];
+static size_t reply_len = 0;
+
+// Takes the next line the daemon sent into line, without its newline. Garbage
+// that never ends in a newline is discarded. Each read waits at most
+// timeout_ms, or indefinitely if it is negative. Returns 0, or -1 on timeout,
+// error or end of file.
+static int read_reply_line(int sockfd, char *line, size_t size, int timeout_ms) {
+    for (;;) {
+        char *newline = memchr(reply, '\n', reply_len);
+        if (newline) {
+            size_t len = newline - reply;
+            size_t copy = len < size - 1 ? len : size - 1;
+            memcpy(line, reply, copy);
+            line[copy] = '\0';
+            reply_len -= len + 1;
+            memmove(reply, newline + 1, reply_len);
+            return 0;
+        }
+
+        if (reply_len == sizeof(reply)) {
+            reply_len = 0;
+        }
+        if (timeout_ms >= 0) {
+            struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+            if (poll(&pfd, 1, timeout_ms) <= 0) {
+                return -1;
+            }
+        }
+        ssize_t n = read(sockfd, reply + reply_len, sizeof(reply) - reply_len);
+        if (n <= 0) {
+            return -1;
+        }
+        reply_len += n;
+    }
+}
+
+// Half-closes the output socket to signal end of stream, then waits until the
+// daemon reports that the last sample has actually played.
+int wait_for_drain(int sockfd, int timeout_ms) {
+    if (shutdown(sockfd, SHUT_WR) == -1) {
+        perror("shutdown");
+        return -1;
+    }
+
+    // ticket, queued, admitted and credit lines may still come first
+    char line[64];
+    while (read_reply_line(sockfd, line, sizeof(line), timeout_ms) == 0) {
+        if (strcmp(line, AUDIO_DRAIN_ACK) == 0) {
+            return 0;
+        }
+        if (strcmp(line, "timeout") == 0) {
+            break;
+        }
+    }
+
+    return -1;
+}
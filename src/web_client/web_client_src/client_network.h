@@ -6,9 +6,14 @@
 
 #define AUDIO_OUTPUT_REQUEST 2
 
+// Sent by the daemon on the output socket once the last sample has been played
+#define AUDIO_DRAIN_ACK "drained"
+#define AUDIO_DRAIN_TIMEOUT_MS 5000
+
 // Function declarations
 int setup_client_connection(int request_type);
 int setup_control_client_connection();
+int wait_for_drain(int sockfd, int timeout_ms);
 void close_client_connection(int sockfd);
 
 #endif // CLIENT_NETWORK_H